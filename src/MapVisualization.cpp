@@ -862,9 +862,9 @@ void MapVisualization::renderDebugImage(cv::Mat& rgb_cv, const Tracker* tracker,
         case 3: color = cv::Vec3b(255, 0, 255); break;
         }
 
-        for (unsigned int j = 0; j < lev.vMaxCorners.size(); j++) {
-            int x = lev.vMaxCorners[j].x*(scale);
-            int y = lev.vMaxCorners[j].y*(scale);
+        for (unsigned int j = 0; j < lev.vCorners.size(); j++) {
+            int x = lev.vCorners[j].x*(scale);
+            int y = lev.vCorners[j].y*(scale);
             rectangle(rgb_cv, cv::Point2f(x-1, y-1), cv::Point2f(x+1, y+1),
                       (cv::Scalar) color/*cv::Vec3b(0, 0, 0)*/, CV_FILLED);
         }
@@ -915,9 +915,9 @@ void MapVisualization::renderDebugImageSec(cv::Mat& rgb_cv, const Tracker* track
         case 3: color = cv::Vec3b(255, 0, 255); break;
         }
 
-        for (unsigned int j = 0; j < lev.vMaxCorners.size(); j++) {
-            int x = lev.vMaxCorners[j].x*(scale);
-            int y = lev.vMaxCorners[j].y*(scale);
+        for (unsigned int j = 0; j < lev.vCorners.size(); j++) {
+            int x = lev.vCorners[j].x*(scale);
+            int y = lev.vCorners[j].y*(scale);
             rectangle(rgb_cv, cv::Point2f(x-1, y-1), cv::Point2f(x+1, y+1),
                       (cv::Scalar) color/*cv::Vec3b(0, 0, 0)*/, CV_FILLED);
         }
@@ -976,16 +976,16 @@ void MapVisualization::renderRefImage(cv::Mat& rgb_cv, const Tracker* tracker) {
         CVD::convert_image(frameRefbw,frameRef);
         cv::Mat img(frameRef.size().y, frameRef.size().x, CV_8UC3, frameRef.data());
 
-        for (unsigned int j = 0; j < lev.vMaxCorners.size(); j++) {
-            int x = lev.vMaxCorners[j].x*(scale);
-            int y = lev.vMaxCorners[j].y*(scale);
+        for (unsigned int j = 0; j < lev.vCorners.size(); j++) {
+            int x = lev.vCorners[j].x*(scale);
+            int y = lev.vCorners[j].y*(scale);
             rectangle(rgb_cv, cv::Point2f(x-1, y-1), cv::Point2f(x+1, y+1),
                       (cv::Scalar) color/*cv::Vec3b(0, 0, 0)*/, CV_FILLED);
         }
 
-        for (unsigned int j = 0; j < lev.vMaxCorners.size(); j++) {
-            int x = lev.vMaxCorners[j].x;
-            int y = lev.vMaxCorners[j].y;
+        for (unsigned int j = 0; j < lev.vCorners.size(); j++) {
+            int x = lev.vCorners[j].x;
+            int y = lev.vCorners[j].y;
             rectangle(img, cv::Point2f(x-1, y-1), cv::Point2f(x+1, y+1),
                       (cv::Scalar) color/*cv::Vec3b(0, 0, 0)*/, CV_FILLED);
         }
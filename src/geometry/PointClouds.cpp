@@ -44,6 +44,12 @@ PointCloud<PointXYZRGB>::Ptr PointClouds::rgbdToPointCloud(const ptam::CameraMod
 //    FileStorage fs("depthpc.txt", FileStorage::WRITE);
 //    fs << "depth" << depth;
 
+    // Every pixel's ray comes out of the camera's shared unprojection table,
+    // unless it has none for this size: then each is unprojected on its own
+    boost::shared_ptr<const ptam::CameraModel::UnProjectionTable> unProj = cam.GetUnProjectionTable();
+    if (unProj && unProj->size() != CVD::ImageRef(depth.cols, depth.rows))
+        unProj.reset();
+
     PointCloud<PointXYZRGB>::iterator pc_iter = res->begin();
     for (unsigned int y = 0; y < depth.rows; y += step) {
         const uint16_t* depthPtr = depth.ptr<uint16_t>(y);
@@ -52,8 +58,8 @@ PointCloud<PointXYZRGB>::Ptr PointClouds::rgbdToPointCloud(const ptam::CameraMod
             const uint16_t& d = depthPtr[x];
             PointXYZRGB& pt = *pc_iter++;
             if ((d > 0) && (d < 5000)) {
-                TooN::Vector<2> pixel = TooN::makeVector(x,y);
-                TooN::Vector<3> p3d = TooN::unproject(cam.UnProjectSafe(pixel))*(d*1e-3);
+                TooN::Vector<2> v2Cam = unProj ? (*unProj)[y][x] : cam.UnProjectSafe(CVD::vec(CVD::ImageRef(x, y)));
+                TooN::Vector<3> p3d = TooN::unproject(v2Cam)*(d*1e-3);
                 TooN::Vector<3> p = se3*p3d; // (cam.unprojectPixelTo3D(Eigen::Vector2d(x,y))*(d*1e-3));
                 pt.x = p[0]; pt.y = p[1]; pt.z = p[2];
 
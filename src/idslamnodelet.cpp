@@ -44,6 +44,7 @@
 
 #include <idSLAM/Edges.h>
 #include <idSLAM/Keyframe.h>
+#include <idSLAM/KeyframeUpdate.h>
 #include <idSLAM/Level.h>
 #include <idSLAM/Mappoint.h>
 
@@ -57,6 +58,8 @@
 #include "ptam/Tracker.h"
 #include "ptam/MapPoint.h"
 #include "ptam/CameraModel.h"
+#include "ptam/KeyFrameStream.h"
+#include "ptam/ImageCodec.h"
 
 using namespace CVD;
 using namespace std;
@@ -67,7 +70,7 @@ namespace idSLAM{
 
 class idslamnodelet : public BaseSLAMNode{
 public:
-    idslamnodelet() : BaseSLAMNode(){}
+    idslamnodelet() : BaseSLAMNode(), keyframe_update_pending_(false){}
 
     virtual void onInit(){
         BaseSLAMNode::onInit();
@@ -81,6 +84,10 @@ public:
         cam_posewithcov_pub_ = nh_.advertise<geometry_msgs::PoseWithCovarianceStamped>("/ptam_world_cov",1);
         quad_pose_pub_ = nh_.advertise<geometry_msgs::TransformStamped>(pose_,1);
         cam_marker_pub_sec = nh_.advertise<visualization_msgs::Marker>("/ptam/camerasec", 1);
+        if (map_maker_->GetKeyFrameStream()) {
+            keyframe_update_pub_ = nh_.advertise<idSLAM::KeyframeUpdate>("/ptam/keyframe_updates", 10);
+            keyframe_update_thread_ = boost::thread(boost::bind(&idslamnodelet::runKeyFrameUpdates, this));
+        }
 
         rgbSubscriber_   = it.subscribe("rgb", 1, boost::bind(&idslamnodelet::rgbCallback, this, _1));
         depthSubscriber_ = it.subscribe("depth", 1, boost::bind(&idslamnodelet::depthCallback, this, _1));
@@ -98,6 +105,10 @@ public:
 
     ~idslamnodelet()
     {
+        if (keyframe_update_thread_.joinable()) {
+            keyframe_update_thread_.interrupt();
+            keyframe_update_thread_.join();
+        }
         if (pos_log_.is_open())
             pos_log_.close();
         if (debugloop.is_open())
@@ -118,6 +129,11 @@ public:
             use_ekf_pose = true;
         if(!nh_private_.getParam("sendvisual", sendvisual))
             sendvisual = false;
+        string keyframe_encoding;
+        if(!nh_private_.getParam("keyframe_encoding", keyframe_encoding))
+            keyframe_encoding = "deflate";
+        keyframe_compression_ = (keyframe_encoding == "raw") ? ptam::ImageCodec::COMPRESSION_RAW
+                                                             : ptam::ImageCodec::COMPRESSION_DEFLATE;
 
         if (!nh_private_.getParam("use_artificial_ini", use_circle_ini_))
             use_circle_ini_ = false;
@@ -650,6 +666,7 @@ public:
         cout << camPosethis.get_translation() << endl << camPosethis.get_rotation().get_matrix() << endl;
 
         logPose(img_msg->header.stamp, SE3<>());
+        notifyKeyFrameUpdates(img_msg->header.stamp);
 
         if (sendvisual){// && !isPTAMshouldstop){
             if (cam_marker_pub_.getNumSubscribers() > 0 || point_marker_pub_.getNumSubscribers() > 0)
@@ -752,6 +769,122 @@ private:
         }
     }
 
+    // Wakes the keyframe update thread after a frame; never blocks tracking.
+    void notifyKeyFrameUpdates(ros::Time stamp)
+    {
+        if (!keyframe_update_thread_.joinable())
+            return;
+        {
+            boost::mutex::scoped_lock lock(keyframe_update_lock_);
+            keyframe_update_stamp_ = stamp;
+            keyframe_update_pending_ = true;
+        }
+        keyframe_update_cond_.notify_one();
+    }
+
+    // Own thread: encoding a new keyframe deflates all its levels plus depth
+    // and RGB, which is far too slow for the image callback.
+    void runKeyFrameUpdates()
+    {
+        try {
+            while (true) {
+                ros::Time stamp;
+                {
+                    boost::mutex::scoped_lock lock(keyframe_update_lock_);
+                    while (!keyframe_update_pending_)
+                        keyframe_update_cond_.wait(lock);   // An interruption point
+                    stamp = keyframe_update_stamp_;
+                    keyframe_update_pending_ = false;
+                }
+                publishKeyFrameUpdates(stamp);
+                boost::this_thread::interruption_point();
+            }
+        }
+        catch (boost::thread_interrupted &) {
+        }
+    }
+
+    // The local map's changes since the last frame, see ptam/KeyFrameStream.h.
+    // Nothing is fetched while nobody listens: the stream then overflows,
+    // and whoever subscribes later starts with a reset holding the whole map.
+    // Messages go out by pointer, so a nodelet in this process gets them
+    // without any copy or serialisation.
+    // Runs on the keyframe update thread only; stamp is that of the latest
+    // frame tracked when it woke up.
+    void publishKeyFrameUpdates(ros::Time stamp)
+    {
+        ptam::KeyFrameStream *stream = map_maker_->GetKeyFrameStream();
+        if (!stream || keyframe_update_pub_.getNumSubscribers() == 0)
+            return;
+        boost::shared_ptr<const ptam::KeyFrameStream::Update> update;
+        while (stream->Fetch(update)) {
+            idSLAM::KeyframeUpdatePtr msg(new idSLAM::KeyframeUpdate);
+            msg->header.stamp = stamp;
+            msg->header.frame_id = world_frame_;
+            msg->sequence = update->nSequence;
+            msg->reset = update->bReset;
+
+            msg->added.resize(update->vAdded.size());
+            for (unsigned int i = 0; i < update->vAdded.size(); i++)
+                toKeyframeContent(update->vAdded[i], msg->added[i]);
+
+            msg->poses.resize(update->vPoses.size());
+            for (unsigned int i = 0; i < update->vPoses.size(); i++) {
+                msg->poses[i].id = update->vPoses[i].nId;
+                msg->poses[i].pose = toGeomMsgPose(update->vPoses[i].se3CfromW.inverse());
+            }
+
+            msg->points.resize(update->vPoints.size());
+            for (unsigned int i = 0; i < update->vPoints.size(); i++) {
+                const ptam::KeyFrameStream::Point &p = update->vPoints[i];
+                idSLAM::MappointUpdate &mp = msg->points[i];
+                mp.id = p.nId;
+                mp.keyframe = p.nKeyFrameId;
+                mp.px = p.v3PosInKF[0];
+                mp.py = p.v3PosInKF[1];
+                mp.pz = p.v3PosInKF[2];
+                mp.level = p.nLevel;
+                mp.ix = p.v2RootPos[0];
+                mp.iy = p.v2RootPos[1];
+            }
+
+            msg->removedPoints = update->vnRemovedPoints;
+            msg->retiredKeyframes.assign(update->vnRetiredKeyFrames.begin(), update->vnRetiredKeyFrames.end());
+            keyframe_update_pub_.publish(msg);
+        }
+    }
+
+    template<class T>
+    void toCompressedImage(const CVD::BasicImage<T> &im, idSLAM::CompressedImage &msg)
+    {
+        msg.height = im.size().y;
+        msg.width = im.size().x;
+        msg.bytesPerPixel = sizeof(T);
+        msg.compression = ptam::ImageCodec::Encode(im, keyframe_compression_, msg.data);
+    }
+
+    void toKeyframeContent(const ptam::KeyFrameStream::KeyFrameContent &content, idSLAM::KeyframeContent &msg)
+    {
+        const ptam::KeyFrame &kf = *content.pKF;
+        msg.id = content.nId;
+        msg.kftime = ros::Time(kf.time.sec, kf.time.nsec);
+        msg.nSourceCamera = kf.nSourceCamera;
+        msg.pose = toGeomMsgPose(content.se3CfromW.inverse());
+
+        msg.levels.resize(LEVELS);
+        for (int l = 0; l < LEVELS; l++) {
+            const ptam::Level &level = kf.aLevels[l];
+            toCompressedImage(level.im, msg.levels[l].image);
+            msg.levels[l].corners.resize(level.vCorners.size());
+            for (unsigned int i = 0; i < level.vCorners.size(); i++) {
+                msg.levels[l].corners[i].ix = level.vCorners[i].x;
+                msg.levels[l].corners[i].iy = level.vCorners[i].y;
+            }
+        }
+        toCompressedImage(kf.depthImage, msg.depth);
+        toCompressedImage(kf.rgbImage, msg.rgb);
+    }
+
     // change to log quadrotor pose, not camera pose
     void logPose(ros::Time msgtime, SE3<> roboPose)
     {
@@ -862,6 +995,13 @@ private:
     ros::Publisher landingpad_inipose_pub_;// two different headers used in setpoint node
     ros::Publisher landingpad_finalpose_pub_;
     ros::Publisher cam_marker_pub_sec;// for dual camera image
+    ros::Publisher keyframe_update_pub_;// with MapMaker.KeyFrameStream
+    ptam::ImageCodec::Compression keyframe_compression_;
+    boost::mutex keyframe_update_lock_;
+    boost::condition_variable keyframe_update_cond_;// A frame was tracked
+    ros::Time keyframe_update_stamp_;
+    bool keyframe_update_pending_;
+    boost::thread keyframe_update_thread_;// Fetches, encodes and publishes keyframe updates
 
     geometry_msgs::TransformStamped vicon_state;
     geometry_msgs::PoseWithCovarianceStamped pose_predicted_ekf_state_;
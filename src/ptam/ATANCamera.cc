@@ -14,6 +14,7 @@ ATANCamera::ATANCamera(string sName)
   // The camera name is used to find the camera's parameters in a GVar.
   msName = sName;
   GV2.Register(mgvvCameraParams, sName+".Parameters", mvDefaultParams, HIDDEN | FATAL_IF_NOT_DEFINED);
+  mvTableParams = *mgvvCameraParams;
   SetImageSize(CVD::ImageRef(640, 480));
 }
 
@@ -101,6 +102,15 @@ void ATANCamera::RefreshParams()
     mvUFBLinearCenter[1] = -1.0 * v2Min[1] * mvUFBLinearFocal[1];
   }*/
   
+  // The unprojection tables hold the calibration they were built with
+  bool bChanged = false;
+  for(int i=0; i<NUMTRACKERCAMPARAMETERS; i++)
+    bChanged = bChanged || mvTableParams[i] != (*mgvvCameraParams)[i];
+  if(bChanged)
+    {
+      mvTableParams = *mgvvCameraParams;
+      InvalidateUnProjectionTables();
+    }
 }
 
 // Project from the camera z=1 plane to image pixels,
@@ -119,6 +129,14 @@ Vector<2> ATANCamera::Project(const Vector<2>& vCam){
   return mvLastIm;
 }
 
+// Same as Project(), but without touching the member variables
+Vector<2> ATANCamera::ProjectSafe(const Vector<2>& vCam) const {
+  double dR = sqrt(vCam * vCam);
+  Vector<2> v2DistCam = rtrans_factor(dR) * vCam;
+  return makeVector(mvCenter[0] + mvFocal[0] * v2DistCam[0],
+                    mvCenter[1] + mvFocal[1] * v2DistCam[1]);
+}
+
 Vector<2> ATANCamera::Project_ud(const Vector<2>& vCam){
   mvLastCam = vCam;
   mdLastR = sqrt(vCam * vCam);
@@ -167,9 +185,18 @@ Vector<2> ATANCamera::UnProject_ud(const Vector<2>& v2Im)
   mvLastCam = dFactor * mvLastDistCam;
   return mvLastCam;
 }
+// Same as UnProject(), but without touching the member variables
 Vector<2> ATANCamera::UnProjectSafe(const Vector<2>& v2Im) const {
-
-    return Vector<2>();
+  Vector<2> v2DistCam;
+  v2DistCam[0] = (v2Im[0] - mvCenter[0]) * mvInvFocal[0];
+  v2DistCam[1] = (v2Im[1] - mvCenter[1]) * mvInvFocal[1];
+  double dDistR = sqrt(v2DistCam * v2DistCam);
+  double dFactor;
+  if(dDistR > 0.01)
+    dFactor = invrtrans(dDistR) / dDistR;
+  else
+    dFactor = 1.0;
+  return dFactor * v2DistCam;
 }
 
 // Utility function for easy drawing with OpenGL
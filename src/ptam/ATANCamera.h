@@ -16,7 +16,8 @@
 // Best bet is to give each thread its own version of the camera!
 //
 // Camera parameters are stored in a GVar, but changing the gvar has no effect
-// until the next call to RefreshParams() or SetImageSize().
+// until the next call to RefreshParams() or SetImageSize(), which also
+// rebuild the unprojection tables if the parameters changed.
 //
 // Pixel conventions are as follows:
 // For Project() and Unproject(),
@@ -79,6 +80,7 @@ class ATANCamera: public CameraModel {
   // Various projection functions
   virtual Vector<2> Project(const Vector<2>& camframe); // Projects from camera z=1 plane to pixel coordinates, with radial distortion
   virtual Vector<2> Project_ud(const Vector<2>& camframe); // Projects from camera z=1 plane to pixel coordinates, without radial distortion
+  virtual Vector<2> ProjectSafe(const Vector<2>& camframe) const; // Same as Project, without changing the cached state
   //inline Vector<2> Project(CVD::ImageRef ir) { return Project(vec(ir)); }
   virtual Vector<2> UnProject(const Vector<2>& imframe); // Inverse operation
   //inline Vector<2> UnProject(CVD::ImageRef ir)  { return UnProject(vec(ir)); }
@@ -137,6 +139,7 @@ class ATANCamera: public CameraModel {
   double mdWinv;          // distortion model coeff
   double mdDistortionEnabled; // One or zero depending on if distortion is on or off.
   Vector<2> mvCenter;     // Pixel projection center
+  Vector<NUMTRACKERCAMPARAMETERS> mvTableParams; // Those of the unprojection tables
   Vector<2> mvFocal;      // Pixel focal length
   Vector<2> mvInvFocal;   // Inverse pixel focal length
   //Vector<2> mvImageSize;
@@ -147,7 +150,7 @@ class ATANCamera: public CameraModel {
   //Vector<2> mvImplaneBR;
   
   // Radial distortion transformation factor: returns ration of distorted / undistorted radius.
-  inline double rtrans_factor(double r)
+  inline double rtrans_factor(double r) const
   {
     if(r < 0.001 || mdW == 0.0)
       return 1.0;
@@ -156,7 +159,7 @@ class ATANCamera: public CameraModel {
   };
 
   // Inverse radial distortion: returns un-distorted radius from distorted.
-  inline double invrtrans(double r)
+  inline double invrtrans(double r) const
   {
     if(mdW == 0.0)
       return r;
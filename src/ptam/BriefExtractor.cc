@@ -0,0 +1,253 @@
+#include "BriefExtractor.h"
+#include "LevelHelpers.h"
+#include <cmath>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace TooN;
+using namespace CVD;
+using namespace std;
+using namespace ptam;
+
+void BriefFeatures::clear()
+{
+  vv2RootPos.clear();
+  vnLevel.clear();
+  vfDepth.clear();
+  vnSource.clear();
+  vnWords.clear();
+}
+
+void BriefFeatures::reserve(unsigned int n)
+{
+  vv2RootPos.reserve(n);
+  vnLevel.reserve(n);
+  vfDepth.reserve(n);
+  vnSource.reserve(n);
+  vnWords.reserve(n * BriefExtractor::Words);
+}
+
+void BriefFeatures::swap(BriefFeatures &other)
+{
+  vv2RootPos.swap(other.vv2RootPos);
+  vnLevel.swap(other.vnLevel);
+  vfDepth.swap(other.vfDepth);
+  vnSource.swap(other.vnSource);
+  vnWords.swap(other.vnWords);
+}
+
+void BriefFeatures::Add(const Vector<2> &v2RootPos, int nLevel, float fDepth, int nSource)
+{
+  vv2RootPos.push_back(v2RootPos);
+  vnLevel.push_back(nLevel);
+  vfDepth.push_back(fDepth);
+  vnSource.push_back(nSource);
+}
+
+const uint64_t *BriefFeatures::Descriptor(int i) const
+{
+  return &vnWords[i * BriefExtractor::Words];
+}
+
+BriefExtractor::BriefExtractor()
+{
+  Pattern();  // Make it now, not in the middle of the first Describe()
+}
+
+const vector<BriefExtractor::Test> &BriefExtractor::Pattern()
+{
+  static const vector<Test> vPattern = MakePattern();
+  return vPattern;
+}
+
+vector<BriefExtractor::Test> BriefExtractor::MakePattern()
+{
+  // xorshift32 and Box-Muller: the same pattern everywhere
+  uint32_t nState = 2463534242u;
+  const double dSigma = (2 * PatchRadius + 1) / 5.0;
+  vector<Test> vPattern;
+  vector<int> vnCoords;
+  while(vnCoords.size() < 4 * Bits)
+  {
+    double u[2];
+    for(int i=0; i<2; i++)
+    {
+      nState ^= nState << 13;
+      nState ^= nState >> 17;
+      nState ^= nState << 5;
+      u[i] = (nState + 1.0) / 4294967297.0;
+    }
+    double g[2] = {sqrt(-2.0 * log(u[0])) * cos(2 * M_PI * u[1]),
+                   sqrt(-2.0 * log(u[0])) * sin(2 * M_PI * u[1])};
+    for(int i=0; i<2; i++)
+    {
+      int n = (int) floor(dSigma * g[i] + 0.5);
+      vnCoords.push_back(max(-(int)PatchRadius, min((int)PatchRadius, n)));
+    }
+  }
+  for(int i=0; i<Bits; i++)
+  {
+    Test t;
+    t.nX1 = vnCoords[4*i];
+    t.nY1 = vnCoords[4*i+1];
+    t.nX2 = vnCoords[4*i+2];
+    t.nY2 = vnCoords[4*i+3];
+    if(t.nX1 == t.nX2 && t.nY1 == t.nY2)
+      t.nX2 = (t.nX1 < PatchRadius) ? t.nX1 + 1 : t.nX1 - 1;
+    vPattern.push_back(t);
+  }
+  return vPattern;
+}
+
+// 5x5 box filter (SmoothRadius 2), as two passes of plain sums the
+// compiler can vectorise. The border is copied as it is.
+void BriefExtractor::Smooth(const BasicImage<byte> &im, int nLevel)
+{
+  const int R = SmoothRadius;
+  const int nW = im.size().x;
+  const int nH = im.size().y;
+  Image<byte> &imOut = mvimSmoothed[nLevel];
+  if(imOut.size() != im.size())
+    imOut.resize(im.size());
+
+  for(int y=0; y<nH; y++)
+  {
+    const byte *pIn = im[y];
+    byte *pOut = imOut[y];
+    if(y < R || y >= nH - R)
+    {
+      for(int x=0; x<nW; x++)
+        pOut[x] = pIn[x];
+      continue;
+    }
+    for(int x=0; x<R && x<nW; x++)
+      pOut[x] = pIn[x];
+    for(int x=max(nW-R, R); x<nW; x++)
+      pOut[x] = pIn[x];
+  }
+  if(nW <= 2*R || nH <= 2*R)
+    return;
+
+  mvnRowSums.resize(nW * nH);
+  for(int y=0; y<nH; y++)
+  {
+    const byte *p = im[y];
+    uint16_t *pnSum = &mvnRowSums[y * nW];
+    for(int x=R; x<nW-R; x++)
+      pnSum[x] = p[x-2] + p[x-1] + p[x] + p[x+1] + p[x+2];
+  }
+  for(int y=R; y<nH-R; y++)
+  {
+    const uint16_t *pn0 = &mvnRowSums[(y-2) * nW];
+    const uint16_t *pn1 = pn0 + nW;
+    const uint16_t *pn2 = pn1 + nW;
+    const uint16_t *pn3 = pn2 + nW;
+    const uint16_t *pn4 = pn3 + nW;
+    byte *pOut = imOut[y];
+    for(int x=R; x<nW-R; x++)
+    {
+      uint32_t n = pn0[x] + pn1[x] + pn2[x] + pn3[x] + pn4[x];
+      pOut[x] = (byte) ((n + 12u) / 25u);   // n / 25, rounded; the compiler makes it a multiply
+    }
+  }
+}
+
+void BriefExtractor::MakeOffsets(int nStride, int nLevel)
+{
+  if(mvnOffsetsStride[nLevel] == nStride)
+    return;
+  const vector<Test> &vPattern = Pattern();
+  mvvnOffsets1[nLevel].resize(Bits);
+  mvvnOffsets2[nLevel].resize(Bits);
+  for(int i=0; i<Bits; i++)
+  {
+    mvvnOffsets1[nLevel][i] = vPattern[i].nY1 * nStride + vPattern[i].nX1;
+    mvvnOffsets2[nLevel][i] = vPattern[i].nY2 * nStride + vPattern[i].nX2;
+  }
+  mvnOffsetsStride[nLevel] = nStride;
+}
+
+void BriefExtractor::Describe(const BasicImage<byte> *const *apimLevels, int nLevels, BriefFeatures &features)
+{
+  if((int) mvimSmoothed.size() < nLevels)
+  {
+    mvimSmoothed.resize(nLevels);
+    mvvnOffsets1.resize(nLevels);
+    mvvnOffsets2.resize(nLevels);
+    mvnOffsetsStride.resize(nLevels, 0);
+  }
+
+  // Smooth the levels which have features, once
+  vector<bool> vbNeeded(nLevels, false);
+  for(unsigned int i=0; i<features.size(); i++)
+    if(features.vnLevel[i] >= 0 && features.vnLevel[i] < nLevels)
+      vbNeeded[features.vnLevel[i]] = true;
+  for(int l=0; l<nLevels; l++)
+    if(vbNeeded[l])
+    {
+      Smooth(*apimLevels[l], l);
+      MakeOffsets(mvimSmoothed[l].row_stride(), l);
+    }
+
+  const int nBorder = PatchRadius + SmoothRadius;
+  features.vnWords.resize(features.size() * Words);
+  unsigned int nKept = 0;
+  for(unsigned int i=0; i<features.size(); i++)
+  {
+    const int l = features.vnLevel[i];
+    if(l < 0 || l >= nLevels)
+      continue;
+    const Image<byte> &im = mvimSmoothed[l];
+    Vector<2> v2LevelPos = LevelNPos(features.vv2RootPos[i], l);
+    int x = (int) floor(v2LevelPos[0] + 0.5);
+    int y = (int) floor(v2LevelPos[1] + 0.5);
+    if(x < nBorder || y < nBorder || x >= im.size().x - nBorder || y >= im.size().y - nBorder)
+      continue;
+
+    const byte *pCenter = &im[y][x];
+    const int *pnOffsets1 = &mvvnOffsets1[l][0];
+    const int *pnOffsets2 = &mvvnOffsets2[l][0];
+    uint64_t *pnWords = &features.vnWords[nKept * Words];
+#ifdef __SSE2__
+    // Sixteen tests at once: gather, compare as signed bytes, take the sign bits
+    const __m128i vBias = _mm_set1_epi8((char) 0x80);
+    for(int w=0; w<Words; w++)
+    {
+      uint64_t nWord = 0;
+      for(int g=0; g<4; g++)
+      {
+        union { __m128i v; byte b[16]; } u1, u2;
+        const int nFirst = w * 64 + g * 16;
+        for(int k=0; k<16; k++)
+        {
+          u1.b[k] = pCenter[pnOffsets1[nFirst + k]];
+          u2.b[k] = pCenter[pnOffsets2[nFirst + k]];
+        }
+        __m128i vLess = _mm_cmplt_epi8(_mm_xor_si128(u1.v, vBias), _mm_xor_si128(u2.v, vBias));
+        nWord |= (uint64_t) (unsigned int) _mm_movemask_epi8(vLess) << (g * 16);
+      }
+      pnWords[w] = nWord;
+    }
+#else
+    for(int w=0; w<Words; w++)
+    {
+      uint64_t nWord = 0;
+      for(int b=0; b<64; b++)
+        nWord |= (uint64_t) (pCenter[pnOffsets1[w*64 + b]] < pCenter[pnOffsets2[w*64 + b]]) << b;
+      pnWords[w] = nWord;
+    }
+#endif
+
+    features.vv2RootPos[nKept] = features.vv2RootPos[i];
+    features.vnLevel[nKept] = l;
+    features.vfDepth[nKept] = features.vfDepth[i];
+    features.vnSource[nKept] = features.vnSource[i];
+    nKept++;
+  }
+  features.vv2RootPos.resize(nKept);
+  features.vnLevel.resize(nKept);
+  features.vfDepth.resize(nKept);
+  features.vnSource.resize(nKept);
+  features.vnWords.resize(nKept * Words);
+}
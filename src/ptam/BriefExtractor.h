@@ -0,0 +1,76 @@
+// -*- c++ -*-
+//
+// BriefExtractor - BRIEF descriptors for features on an image pyramid.
+//
+// A descriptor is 256 intensity comparisons between pixel pairs of the
+// smoothed patch around a feature, packed into four 64-bit words so that
+// matching is a popcount away. The pairs are drawn once from an isotropic
+// Gaussian (Calonder et al.) with a fixed generator, so descriptors don't
+// depend on the platform or the OpenCV version.
+//
+// Describe() takes a whole batch of features, on any levels, in one go:
+// every level needed is smoothed once into a buffer which is kept for the
+// next call, and the comparisons run off a table of pixel offsets made for
+// that level's row stride, sixteen at a time with SSE2. An extractor is
+// not thread-safe; each thread keeps its own.
+//
+// Features are kept in BriefFeatures, a structure of arrays.
+
+#ifndef __BRIEFEXTRACTOR_H
+#define __BRIEFEXTRACTOR_H
+#include <TooN/TooN.h>
+#include <cvd/image.h>
+#include <cvd/byte.h>
+#include <vector>
+#include <stdint.h>
+
+namespace ptam{
+
+struct BriefFeatures
+{
+  std::vector<TooN::Vector<2> > vv2RootPos;  // Level zero coordinates
+  std::vector<int> vnLevel;                  // Which level to describe it on
+  std::vector<float> vfDepth;                // [m], or 0 if not available
+  std::vector<int> vnSource;                 // The caller's index, e.g. of a corner
+  std::vector<uint64_t> vnWords;             // BriefExtractor::Words per feature, once described
+
+  unsigned int size() const { return vnLevel.size(); }
+  void clear();
+  void reserve(unsigned int n);
+  void swap(BriefFeatures &other);
+  void Add(const TooN::Vector<2> &v2RootPos, int nLevel, float fDepth, int nSource);
+  const uint64_t *Descriptor(int i) const;
+};
+
+class BriefExtractor
+{
+public:
+  enum { Words = 4, Bits = 64 * Words, PatchRadius = 15, SmoothRadius = 2 };
+
+  BriefExtractor();
+
+  // Describes all features; those too close to the border of their level
+  // are dropped, the others keep their order. *apimLevels[l] is level l.
+  void Describe(const CVD::BasicImage<CVD::byte> *const *apimLevels, int nLevels, BriefFeatures &features);
+
+protected:
+  void Smooth(const CVD::BasicImage<CVD::byte> &im, int nLevel);
+  void MakeOffsets(int nStride, int nLevel);
+
+  struct Test
+  {
+    int nX1, nY1, nX2, nY2;
+  };
+  static const std::vector<Test> &Pattern();
+  static std::vector<Test> MakePattern();
+
+  std::vector<CVD::Image<CVD::byte> > mvimSmoothed;  // Per level, reused
+  std::vector<uint16_t> mvnRowSums;                  // Scratch for Smooth()
+  std::vector<std::vector<int> > mvvnOffsets1;       // Of the pattern, per level
+  std::vector<std::vector<int> > mvvnOffsets2;
+  std::vector<int> mvnOffsetsStride;                 // Row stride the offsets were made for
+};
+
+} // namespace
+
+#endif
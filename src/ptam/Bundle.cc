@@ -4,6 +4,7 @@
 #include <TooN/helpers.h>
 #include <TooN/Cholesky.h>
 #include <fstream>
+#include <iterator>
 #include <iomanip>
 #include <gvars3/instances.h>
 
@@ -156,23 +157,34 @@ void Bundle::ClearAccumulators()
 }
 
 // Perform bundle adjustment. The parameter points to a signal bool 
-// which mapmaker will set to high if another keyframe is incoming
-// and bundle adjustment needs to be aborted.
+// which mapmaker will set to high if bundle adjustment needs to be
+// aborted. The optional yield signal is set when another keyframe is
+// incoming: the step in progress gets no more tries with a larger lambda
+// once one has failed, and then Compute() returns.
 // Returns number of accepted iterations if all good, negative 
 // value for big error.
 // TODO: add rigid connection between dual keyframes, otherwise, could be used for dual camera calibration
-int Bundle::Compute(bool *pbAbortSignal)
+int Bundle::Compute(bool *pbAbortSignal, bool *pbYieldSignal)
 {
     cout << "in compute..." << endl;
     mpbAbortSignal = pbAbortSignal;
 
     // Some speedup data structures
-    GenerateMeasLUTs();
-    GenerateOffDiagScripts();
+    GenerateObservations();
+    GenerateOffDiagScripts();   // Also sets up the sparse structure of S
 
-    // Initially behave like gauss-newton
-    mdLambda = 0.1; //0.0001;
-    mdLambdaFactor = 2.0;
+    // Initially behave like gauss-newton, unless carrying on where an
+    // interrupted run left off
+    if(mWarmStart.bValid)
+    {
+        mdLambda = mWarmStart.dLambda;
+        mdLambdaFactor = mWarmStart.dLambdaFactor;
+    }
+    else
+    {
+        mdLambda = 0.1; //0.0001;
+        mdLambdaFactor = 2.0;
+    }
     mbConverged = false;
     mbHitMaxIterations = false;
     mnCounter = 0;
@@ -186,23 +198,29 @@ int Bundle::Compute(bool *pbAbortSignal)
     {
         bool bNoError;
         if(*gvsMEstimator == "Cauchy")
-            bNoError = Do_LM_Step<Cauchy>(pbAbortSignal);
+            bNoError = Do_LM_Step<Cauchy>(pbAbortSignal, pbYieldSignal);
         else if(*gvsMEstimator == "Tukey")
-            bNoError = Do_LM_Step<Tukey>(pbAbortSignal);
+            bNoError = Do_LM_Step<Tukey>(pbAbortSignal, pbYieldSignal);
         else if(*gvsMEstimator == "Huber")
-            bNoError = Do_LM_Step<Huber>(pbAbortSignal);
+            bNoError = Do_LM_Step<Huber>(pbAbortSignal, pbYieldSignal);
         else if (*gvsMEstimator == "LeastSquares")
-            bNoError = Do_LM_Step<LeastSquares>(pbAbortSignal);
+            bNoError = Do_LM_Step<LeastSquares>(pbAbortSignal, pbYieldSignal);
         else
         {
             cout << "Invalid BundleMEstimator selected !! " << endl;
             cout << "Defaulting to Tukey." << endl;
             *gvsMEstimator = "Tukey";
-            bNoError = Do_LM_Step<Tukey>(pbAbortSignal);
+            bNoError = Do_LM_Step<Tukey>(pbAbortSignal, pbYieldSignal);
         };
 
         if(!bNoError)
             return -1;
+
+        if(pbYieldSignal && *pbYieldSignal)
+        {
+            cout << "  Yielding to incoming keyframe." << endl;
+            break;
+        }
     }
 
     if(mbHitMaxIterations)
@@ -213,7 +231,7 @@ int Bundle::Compute(bool *pbAbortSignal)
 
 
 template<class MEstimator>
-bool Bundle::Do_LM_Step(bool *pbAbortSignal)
+bool Bundle::Do_LM_Step(bool *pbAbortSignal, bool *pbYieldSignal)
 {
 //    cout << "in LBA..." << endl;
     // Reset all accumulators to zero
@@ -354,13 +372,36 @@ bool Bundle::Do_LM_Step(bool *pbAbortSignal)
 
     }
 
+    // Sum up the W's of each point's measurements per camera, for the off-diagonal
+    // blocks of S (e.g. an image and a depth measurement of the same point)
+    for(vector<Point>::iterator itr = mvPoints.begin(); itr!=mvPoints.end(); itr++)
+        for(unsigned int n=0; n<itr->vObservations.size(); n++)
+        {
+            itr->vObservations[n].bUsed = false;
+            itr->vObservations[n].m63W = Zeros;
+        }
+    for(list<Meas*>::iterator itr = mMeasList.begin(); itr!=mMeasList.end(); itr++)
+    {
+        Meas* meas = *itr;
+        if(meas->bBad)
+            continue;
+        PointObservation &obs = mvPoints[meas->p].vObservations[meas->nObservation];
+        obs.bUsed = true;
+        obs.m63W += meas->m63W;
+    }
+
 //    cout << "BA iterating..." << endl;
     // OK, done (i) and most of (ii) except calcing Yij; this depends on Vi, which should
     // be finished now. So we can find V*i (by adding lambda) and then invert.
     // The next bits depend on mdLambda! So loop this next bit until error goes down.
+    // A yield gives up on the retries after the first try: nothing is
+    // accepted then, but the grown lambda is kept for the warm start.
     double dNewError = dCurrentError + 9999;
-    while(dNewError > dCurrentError && !mbConverged && !mbHitMaxIterations && !*pbAbortSignal)
+    bool bRetry = false;
+    while(dNewError > dCurrentError && !mbConverged && !mbHitMaxIterations && !*pbAbortSignal &&
+          !(bRetry && pbYieldSignal && *pbYieldSignal))
     {
+        bRetry = true;
         // Rest of part (ii) : find V*i inverse
         for(vector<Point>::iterator itr = mvPoints.begin(); itr!=mvPoints.end(); itr++)
         {
@@ -386,22 +427,18 @@ bool Bundle::Do_LM_Step(bool *pbAbortSignal)
         // But we can do this inline when we calculate S in part (iii).
 
         // Part (iii): Construct the the big block-matrix S which will be inverted.
-        Matrix<> mS(mnCamsToUpdate * 6, mnCamsToUpdate * 6);
-        mS = Zeros;
+        // S is block-sparse: cameras j and k only share a block if they see a common point.
+        mS.Clear();
         Vector<> vE(mnCamsToUpdate * 6);
         vE = Zeros;
 
-        Matrix<6> m6; // Temp working space
-        Vector<6> v6; // Temp working space
-
-        // Calculate on-diagonal blocks of S (i.e. only one camera at a time:)
+        // Start the on-diagonal blocks of S (i.e. only one camera at a time:)
         for(unsigned int j=0; j<mvCameras.size(); j++)
         {
             Camera &cam_j = mvCameras[j];
             if(cam_j.bFixed) continue;
-            int nCamJStartRow = cam_j.nStartRow;
+            Matrix<6> &m6 = *mS.DiagonalBlock(cam_j.nStartRow / 6);
 
-            // First, do the diagonal elements.
             //m6= cam_j.m6U;     // can't do this anymore because cam_j.m6U is LL!!
             for(int r=0; r<6; r++)
             {
@@ -413,73 +450,64 @@ bool Bundle::Do_LM_Step(bool *pbAbortSignal)
             for(int nn = 0; nn< 6; nn++)
                 m6[nn][nn] *= (1.0 + mdLambda);
 
-            v6 = cam_j.v6EpsilonA;
-
-            vector<Meas*> &vMeasLUTj = mvMeasLUTs[j];
-            // Sum over measurements (points):
-            for(unsigned int i=0; i<mvPoints.size(); i++)
-            {
-                Meas* pMeas = vMeasLUTj[i];
-                if(pMeas == NULL || pMeas->bBad)
-                    continue;
-                m6 -= pMeas->m63W * mvPoints[i].m3VStarInv * pMeas->m63W.T();  // SLOW SLOW should by 6x6sy
-                v6 -= pMeas->m63W * (mvPoints[i].m3VStarInv * mvPoints[i].v3EpsilonB);
-            }
-            mS.slice(nCamJStartRow, nCamJStartRow, 6, 6) = m6;
-            vE.slice(nCamJStartRow,6) = v6;
+            vE.slice(cam_j.nStartRow,6) = cam_j.v6EpsilonA;
         }
 
-        // Now find off-diag elements of S. These are camera-point-camera combinations, of which there are lots.
-        // New code which doesn't waste as much time finding i-jk pairs; these are pre-stored in a per-i list.
+        // Now subtract the camera-point-camera combinations, of which there are lots.
+        // They are pre-stored in a per-point list, together with their block of S.
         for(unsigned int i=0; i<mvPoints.size(); i++)
         {
             Point &p = mvPoints[i];
+            // On-diagonal: the measurements (cameras) of this point
+            for(unsigned int n=0; n<p.vObservations.size(); n++)
+            {
+                PointObservation &obs = p.vObservations[n];
+                Camera &cam = mvCameras[obs.c];
+                if(!obs.bUsed || cam.bFixed)
+                    continue;
+                Matrix<6,3> m63_W_times_m3VStarInv = obs.m63W * p.m3VStarInv;
+                *mS.DiagonalBlock(cam.nStartRow / 6) -= m63_W_times_m3VStarInv * obs.m63W.T();  // SLOW SLOW should by 6x6sy
+                vE.slice(cam.nStartRow,6) -= m63_W_times_m3VStarInv * p.v3EpsilonB;
+            }
+
+            // Off-diagonal
             int nCurrentJ = -1;
-            int nJRow = -1;
-            Meas* pMeas_ij;
-            Meas* pMeas_ik;
             Matrix<6,3> m63_MIJW_times_m3VStarInv;
-
             for(vector<OffDiagScriptEntry>::iterator it=p.vOffDiagonalScript.begin();
                 it!=p.vOffDiagonalScript.end();
                 it++)
             {
                 OffDiagScriptEntry &e = *it;
-                pMeas_ik = mvMeasLUTs[e.k][i];
-                if(pMeas_ik == NULL || pMeas_ik->bBad)
+                PointObservation &obs_k = p.vObservations[e.k];
+                if(!obs_k.bUsed)
                     continue;
                 if(e.j != nCurrentJ)
                 {
-                    pMeas_ij = mvMeasLUTs[e.j][i];
-                    if(pMeas_ij == NULL || pMeas_ij->bBad)
+                    PointObservation &obs_j = p.vObservations[e.j];
+                    if(!obs_j.bUsed)
                         continue;
                     nCurrentJ = e.j;
-                    nJRow = mvCameras[e.j].nStartRow;
-                    m63_MIJW_times_m3VStarInv = pMeas_ij->m63W * p.m3VStarInv;
+                    m63_MIJW_times_m3VStarInv = obs_j.m63W * p.m3VStarInv;
                 }
-                int nKRow = mvCameras[pMeas_ik->c].nStartRow;
-#ifndef WIN32
-                mS.slice(nJRow, nKRow, 6, 6) -= m63_MIJW_times_m3VStarInv * pMeas_ik->m63W.T();
-#else
-                Matrix<6> m = mS.slice(nJRow, nKRow, 6, 6);
-                m -= m63_MIJW_times_m3VStarInv * pMeas_ik->m63W.T();
-                mS.slice(nJRow, nKRow, 6, 6) = m;
-#endif
-                assert(nKRow < nJRow);
+                if(e.bTransposed)
+                    *e.pm6S -= obs_k.m63W * m63_MIJW_times_m3VStarInv.T();
+                else
+                    *e.pm6S -= m63_MIJW_times_m3VStarInv * obs_k.m63W.T();
             }
         }
 
-        // Did this purely LL triangle - now update the TR bit as well!
-        // (This is actually unneccessary since the lapack cholesky solver
-        // uses only one triangle, but I'm leaving it in here anyway.)
-        for(int i=0; i<mS.num_rows(); i++)
-            for(int j=0; j<i; j++)
-                mS[j][i] = mS[i][j];
-
-        // Got fat matrix S and vector E from part(iii). Now Cholesky-decompose
+        // Got sparse matrix S and vector E from part(iii). Now Cholesky-decompose
         // the matrix, and find the camera update vector.
-        Vector<> vCamerasUpdate(mS.num_rows());
-        vCamerasUpdate = Cholesky<>(mS).backsub(vE);
+        if(!mS.Factorise())
+        {
+            cout << " S NOT POSITIVE DEFINITE " << endl;
+            ModifyLambda_BadStep();
+            mnCounter++;
+            if(mnCounter >= *mgvnMaxIterations)
+                mbHitMaxIterations = true;
+            continue;
+        }
+        Vector<> vCamerasUpdate = mS.Solve(vE);
 
         // Part (iv): Compute the map updates
         Vector<> vMapUpdates(mvPoints.size() * 3);
@@ -488,15 +516,13 @@ bool Bundle::Do_LM_Step(bool *pbAbortSignal)
         {
             Vector<3> v3Sum;
             v3Sum = Zeros;
-            for(unsigned int j=0; j<mvCameras.size(); j++)
+            for(unsigned int n=0; n<mvPoints[i].vObservations.size(); n++)
             {
-                Camera &cam = mvCameras[j];
-                if(cam.bFixed)
+                PointObservation &obs = mvPoints[i].vObservations[n];
+                Camera &cam = mvCameras[obs.c];
+                if(!obs.bUsed || cam.bFixed)
                     continue;
-                Meas *pMeas = mvMeasLUTs[j][i];
-                if(pMeas == NULL || pMeas->bBad)
-                    continue;
-                v3Sum+=pMeas->m63W.T() * vCamerasUpdate.slice(cam.nStartRow,6);
+                v3Sum+=obs.m63W.T() * vCamerasUpdate.slice(cam.nStartRow,6);
             }
             Vector<3> v3 = mvPoints[i].v3EpsilonB - v3Sum;
             vMapUpdates.slice(i * 3, 3) = mvPoints[i].m3VStarInv * v3;
@@ -573,7 +599,6 @@ bool Bundle::Do_LM_Step(bool *pbAbortSignal)
             vit.push_back(itr);
             mvOutlierMeasurementIdx.push_back(make_pair(meas->p, meas->c));
             mvPoints[meas->p].nOutliers++;
-            mvMeasLUTs[meas->c][meas->p] = NULL;
         }
     }
 
@@ -619,56 +644,86 @@ double Bundle::FindNewError()
     return dNewError;
 }
 
-// Optimisation: make a bunch of tables, one per camera
-// which point to measurements (if any) for each point
-// This is faster than a std::map lookup.
-void Bundle::GenerateMeasLUTs()
+// Optimisation: give each point a list of the cameras which measure
+// it, and each measurement its place in that list. Unlike a
+// camera-by-point table this stays small for big maps.
+void Bundle::GenerateObservations()
 {
-    mvMeasLUTs.clear();
-    for(unsigned int nCam = 0; nCam < mvCameras.size(); nCam++)
+    for(unsigned int i=0; i<mvPoints.size(); i++)
     {
-        mvMeasLUTs.push_back(vector<Meas*>());
-        mvMeasLUTs.back().resize(mvPoints.size(), NULL);
-    };
+        Point &p = mvPoints[i];
+        p.vObservations.clear();
+        for(set<int>::iterator it = p.sCameras.begin(); it!=p.sCameras.end(); it++)
+        {
+            PointObservation obs;
+            obs.c = *it;
+            obs.bUsed = false;
+            obs.m63W = Zeros;
+            p.vObservations.push_back(obs);
+        }
+    }
     for(list<Meas*>::iterator it = mMeasList.begin(); it!=mMeasList.end(); it++) {
         Meas* meas = *it;
-        mvMeasLUTs[meas->c][meas->p] = meas;
+        meas->nObservation = distance(mvPoints[meas->p].sCameras.begin(), mvPoints[meas->p].sCameras.find(meas->c));
     }
 }
 
 // Optimisation: make a per-point list of all
 // observation camera-camera pairs; this is then
-// scanned to make the off-diagonal elements of matrix S
+// scanned to make the off-diagonal elements of matrix S.
+// The pairs also give the sparsity pattern of S, so S is set up here.
 void Bundle::GenerateOffDiagScripts()
 {
+    vector<pair<int, int> > vOffDiagonal;
     for(unsigned int i=0; i<mvPoints.size(); i++)
     {
         Point &p = mvPoints[i];
         p.vOffDiagonalScript.clear();
-        for(set<int>::iterator it_j = p.sCameras.begin(); it_j!=p.sCameras.end(); it_j++)
+        for(unsigned int j=0; j<p.vObservations.size(); j++)
         {
-            int j = *it_j;
-            if(mvCameras[j].bFixed)
+            const Camera &cam_j = mvCameras[p.vObservations[j].c];
+            if(cam_j.bFixed)
                 continue;
-            Meas *pMeas_j = mvMeasLUTs[j][i];
-            assert(pMeas_j != NULL);
 
-            for(set<int>::iterator it_k = p.sCameras.begin(); it_k!=it_j; it_k++)
+            for(unsigned int k=0; k<j; k++)
             {
-                int k = *it_k;
-                if(mvCameras[k].bFixed)
+                const Camera &cam_k = mvCameras[p.vObservations[k].c];
+                if(cam_k.bFixed)
                     continue;
 
-                Meas *pMeas_k = mvMeasLUTs[k][i];
-                assert(pMeas_k != NULL);
-
                 OffDiagScriptEntry e;
                 e.j = j;
                 e.k = k;
+                e.pm6S = NULL;
+                e.bTransposed = false;
                 p.vOffDiagonalScript.push_back(e);
+                vOffDiagonal.push_back(make_pair(cam_j.nStartRow / 6, cam_k.nStartRow / 6));
             }
         }
     }
+
+    mS.Analyse(mnCamsToUpdate, vOffDiagonal);
+    for(unsigned int i=0; i<mvPoints.size(); i++)
+    {
+        Point &p = mvPoints[i];
+        for(unsigned int n=0; n<p.vOffDiagonalScript.size(); n++)
+        {
+            OffDiagScriptEntry &e = p.vOffDiagonalScript[n];
+            e.pm6S = mS.Block(mvCameras[p.vObservations[e.j].c].nStartRow / 6,
+                              mvCameras[p.vObservations[e.k].c].nStartRow / 6, e.bTransposed);
+        }
+    }
+}
+
+BundleWarmStart Bundle::GetWarmStart() const
+{
+    // Not after running out of iterations: lambda has then mostly blown up
+    // on bad steps, and would only slow the next run down
+    BundleWarmStart ws;
+    ws.bValid = !mbConverged && !mbHitMaxIterations;
+    ws.dLambda = mdLambda;
+    ws.dLambdaFactor = mdLambdaFactor;
+    return ws;
 }
 
 void Bundle::ModifyLambda_GoodStep()
@@ -23,6 +23,7 @@
 // then reads results back to update the map.
 
 #include "CameraModel.h"
+#include "SparseBlockCholesky.h"
 #include <TooN/TooN.h>
 #include <TooN/se3.h>
 #include <gvars3/gvars3.h>
@@ -50,11 +51,22 @@ struct Camera
   SE3<>se3C2fC1;
 };
 
-// Camera-camera pair index
+// Camera-camera pair observing a point
 struct OffDiagScriptEntry
 {
-  int j;
-  int k;
+  int j;  // Index into the point's vObservations
+  int k;  // Ditto, with camera k < camera j
+  Matrix<6> *pm6S;    // Block (j,k) of the reduced camera system
+  bool bTransposed;   // pm6S holds block (k,j) instead
+};
+
+// All measurements of a point by one camera. Their W's are summed up here
+// for building the reduced camera system.
+struct PointObservation
+{
+  int c;
+  bool bUsed;     // Any good measurements this step?
+  Matrix<6,3> m63W;
 };
 
 // A map point, plus computation intermediates.
@@ -72,6 +84,7 @@ struct Point
   int nMeasurements;
   int nOutliers;
   std::set<int> sCameras; // Which cameras observe this point?
+  std::vector<PointObservation> vObservations; // One per camera in sCameras, same order
   std::vector<OffDiagScriptEntry> vOffDiagonalScript; // A record of all camera-camera pairs observing this point
 };
 
@@ -79,9 +92,9 @@ struct Point
 // computation intermediates.
 struct Meas
 {
-  inline Meas() : bBad(false){nSourceCamera = 0; mAssociated = false;
+  inline Meas() : nObservation(-1), bBad(false){nSourceCamera = 0; mAssociated = false;
                              bdepth = false;}
-  inline Meas(int nPoint, int nCam) : p(nPoint), c(nCam), bBad(false)  {nSourceCamera = 0;};
+  inline Meas(int nPoint, int nCam) : p(nPoint), c(nCam), nObservation(-1), bBad(false)  {nSourceCamera = 0;};
   virtual void ProjectAndFindSquaredError(const std::vector<Point>& points, std::vector<Camera>& cameras,
                                                  CameraModel* calib) = 0;
   virtual double EstimateNewSquaredError(const Vector<3>& v3Cam, CameraModel* calib) = 0;
@@ -99,6 +112,7 @@ struct Meas
   // Which camera/point did this measurement come from?
   int p; // The point  - called i in MVG
   int c; // The camera - called j in MVG
+  int nObservation; // Index into the point's vObservations
 
   inline bool operator<(const Meas &rhs) const
   {  return(c<rhs.c ||(c==rhs.c && p < rhs.p)); }
@@ -483,6 +497,18 @@ struct MeasDepth: public Meas
 };
 
 
+// Levenberg-Marquardt state carried from a bundle adjustment that was
+// interrupted to the next one, so it doesn't start again from scratch.
+// (The linearization point itself is carried by the map: whatever steps
+// were accepted before the interruption have been written back.)
+struct BundleWarmStart
+{
+  inline BundleWarmStart() : bValid(false), dLambda(0.1), dLambdaFactor(2.0) {}
+  bool bValid;
+  double dLambda;
+  double dLambdaFactor;
+};
+
 // Core bundle adjustment class
 class Bundle
 {
@@ -495,7 +521,11 @@ public:
   void AddMeas(int nCam, int nPoint, Vector<2> v2Pos, double dSigmaSquared, int nCamnum = 0, bool mAssociated = false); // Add a 2D measurement
   void AddMeas(int nCam, int nPoint, Vector<3> v3Pos, double dSigmaSquared, int nCamnum = 0); // Add a 3D measurement
   void AddMeas(int nCam, int nPoint, double dDepth, double dSigmaSquared, int nCamnum = 0, bool mAssociated = false); // Add a depth measurement
-  int Compute(bool *pbAbortSignal);    // Perform bundle adjustment. Aborts if *pbAbortSignal gets set to true. Returns number of accepted update iterations, or negative on error.
+  int Compute(bool *pbAbortSignal, bool *pbYieldSignal = NULL);    // Perform bundle adjustment. Aborts if *pbAbortSignal gets set to true,
+                                                                    // stops after the step in progress (and at least one try) if *pbYieldSignal does.
+                                                                    // Returns number of accepted update iterations, or negative on error.
+  void SetWarmStart(const BundleWarmStart &ws) { mWarmStart = ws; }  // Call before Compute()
+  BundleWarmStart GetWarmStart() const;                             // LM state to continue from after Compute()
   inline bool Converged() { return mbConverged;}  // Has bundle adjustment converged?
   Vector<3> GetPoint(int n);       // Point coords after adjustment
   SE3<> GetCamera(int n);            // Camera pose after adjustment
@@ -508,9 +538,9 @@ public:
 protected:
 
   inline void ProjectAndFindSquaredError(Meas &meas); // Project a single point in a single view, compare to measurement
-  template<class MEstimator> bool Do_LM_Step(bool *pbAbortSignal);
+  template<class MEstimator> bool Do_LM_Step(bool *pbAbortSignal, bool *pbYieldSignal);
   template<class MEstimator> double FindNewError();
-  void GenerateMeasLUTs();
+  void GenerateObservations();
   void GenerateOffDiagScripts();
   void ClearAccumulators(); // Zero temporary quantities stored in cameras and points
   void ModifyLambda_GoodStep();
@@ -520,7 +550,7 @@ protected:
   std::vector<Camera> mvCameras;
   std::list<Meas*> mMeasList;
   std::vector<std::pair<int,int> > mvOutlierMeasurementIdx;  // p-c pair
-  std::vector<std::vector<Meas*> > mvMeasLUTs;  //Each camera gets a per-point table of pointers to valid measurements
+  SparseBlockCholesky mS;  // The reduced camera system, one 6x6 block row per adjusted camera
   
   std::auto_ptr<CameraModel> mCamera;
   std::auto_ptr<CameraModel> mCameraSec[AddCamNumber];// the second camera model.
@@ -540,6 +570,7 @@ protected:
   GVars3::gvar3<int> mgvnBundleCout;
   
   bool *mpbAbortSignal;
+  BundleWarmStart mWarmStart;
 
   // DUAL camera BA
   SE3<> mse3Cam2FromCam1[AddCamNumber];
@@ -17,10 +17,32 @@ bool CameraModel::polynomialsec = false;
 auto_ptr<CameraModel> CameraModel::cameraPrototype;
 auto_ptr<CameraModel> CameraModel::cameraPrototypesec[AddCamNumber];
 
-CameraModel::CameraModel() {
+CameraModel::CameraModel() : mpUnProjTables(new UnProjectionTables()) {
     mvImageSize[0] = mvImageSize[1] = 0;
 }
 
+boost::shared_ptr<const CameraModel::UnProjectionTable> CameraModel::UnProjectionTables::Get(const CameraModel& camera) {
+    CVD::ImageRef irSize = CVD::ir(camera.GetImageSize());
+    if(irSize.x <= 0 || irSize.y <= 0)
+        return boost::shared_ptr<const UnProjectionTable>();
+
+    boost::mutex::scoped_lock lock(mutex);
+    boost::shared_ptr<const UnProjectionTable> &table = tables[std::make_pair(irSize.x, irSize.y)];
+    if(!table) {
+        UnProjectionTable *newTable = new UnProjectionTable(irSize);
+        CVD::ImageRef ir;
+        do (*newTable)[ir] = camera.UnProjectSafe(vec(ir));
+        while(ir.next(irSize));
+        table.reset(newTable);
+    }
+    return table;
+}
+
+void CameraModel::InvalidateUnProjectionTables() {
+    mpUnProjTables.reset(new UnProjectionTables());
+    mpUnProjTable = mpUnProjTables->Get(*this);
+}
+
 CameraModel* CameraModel::CreateCamera(int camnum) {
     if((firstCreate && !camnum) || (firstCreatesec && camnum)) {
         // This method might be called a lot, so we only check
@@ -3,8 +3,12 @@
 
 #include <TooN/TooN.h>
 #include <cvd/vector_image_ref.h>
+#include <cvd/image.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 #include <string>
 #include <memory>
+#include <map>
 
 #define AddCamNumber 1 // additional camera number, besides the main camera
 
@@ -14,10 +18,14 @@ class CameraModel {
 public:
 	CameraModel();
 
+	// z=1-plane position of every pixel, see GetUnProjectionTable()
+	typedef CVD::Image<TooN::Vector<2> > UnProjectionTable;
+
 	void SetImageSize(TooN::Vector<2> v2ImageSize) {
 		if(mvImageSize[0] != v2ImageSize[0] || mvImageSize[1] != v2ImageSize[1]) {
 			mvImageSize = v2ImageSize;
 			RefreshParams();
+			mpUnProjTable = mpUnProjTables->Get(*this);
 		}
 	}
 	void SetImageSize(CVD::ImageRef irImageSize) {SetImageSize(vec(irImageSize));};
@@ -29,6 +37,8 @@ public:
 	// Projects from camera z=1 plane to pixel coordinates, with radial distortion
 	virtual TooN::Vector<2> Project(const TooN::Vector<2>& camframe) = 0;
 	TooN::Vector<2> Project(CVD::ImageRef ir) { return Project(vec(ir)); }
+    // Same as Project(), without modifing anything in the model
+    virtual TooN::Vector<2> ProjectSafe(const TooN::Vector<2>& camframe) const = 0;
     // Projects from camera z=1 plane to pixel coordinates, without radial distortion
     virtual TooN::Vector<2> Project_ud(const TooN::Vector<2>& camframe) = 0;
     TooN::Vector<2> Project_ud(CVD::ImageRef ir) { return Project_ud(vec(ir)); }
@@ -41,6 +51,18 @@ public:
     virtual TooN::Vector<2> UnProject_ud(const TooN::Vector<2>& imframe) = 0;
     TooN::Vector<2> UnProject_ud(CVD::ImageRef ir)  { return UnProject_ud(vec(ir)); }
 
+    // UnProjectSafe() of a whole pixel, looked up in the unprojection table
+    TooN::Vector<2> UnProjectPixel(CVD::ImageRef ir) const {
+        if(mpUnProjTable && mpUnProjTable->in_image(ir))
+            return (*mpUnProjTable)[ir];
+        return UnProjectSafe(vec(ir));
+    }
+    // UnProjectSafe() of every pixel at the current image size, or NULL while
+    // that is unset. The table is built once per calibration and image size
+    // and shared by all copies of this camera; it never changes, so any
+    // thread may read it.
+    boost::shared_ptr<const UnProjectionTable> GetUnProjectionTable() const { return mpUnProjTable; }
+
 	// Projection jacobian
 	virtual TooN::Matrix<2,2> GetProjectionDerivs() = 0;
 	
@@ -50,6 +72,12 @@ public:
 	
 	// Creates a camera that matches the current configuration
     static CameraModel* CreateCamera(int camnum = 0);
+
+protected:
+	// For RefreshParams() when the calibration changed: the tables built so
+	// far are not this camera's any more. Copies made before keep them, with
+	// the calibration they were made with.
+	void InvalidateUnProjectionTables();
 	
 private:
     static bool firstCreate, firstCreatesec;
@@ -59,6 +87,17 @@ private:
 	static bool polynomial;
     static bool polynomialsec;
 	TooN::Vector<2> mvImageSize;
+
+	// The unprojection tables of one calibration, for all image sizes asked for
+	class UnProjectionTables {
+	public:
+		boost::shared_ptr<const UnProjectionTable> Get(const CameraModel& camera);
+	private:
+		boost::mutex mutex;
+		std::map<std::pair<int, int>, boost::shared_ptr<const UnProjectionTable> > tables;
+	};
+	boost::shared_ptr<UnProjectionTables> mpUnProjTables; // Shared between copies
+	boost::shared_ptr<const UnProjectionTable> mpUnProjTable; // The one for mvImageSize
 };
 } // namespace
 
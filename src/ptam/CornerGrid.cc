@@ -0,0 +1,146 @@
+#include "CornerGrid.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace TooN;
+using namespace std;
+using namespace ptam;
+
+// Don't let a few far-out corners (e.g. from a wide-angle camera) make for a huge grid.
+static const int MAX_GRID_DIM = 512;
+
+CornerGrid::CornerGrid()
+  : mdCellSize(1.0), mnCols(0), mnRows(0)
+{
+  mv2Origin = Zeros;
+}
+
+void CornerGrid::Clear()
+{
+  mnCols = mnRows = 0;
+  mvCellStart.clear();
+  mvPointIndices.clear();
+}
+
+int CornerGrid::Col(double x) const
+{
+  return (int) floor((x - mv2Origin[0]) / mdCellSize);
+}
+
+int CornerGrid::Row(double y) const
+{
+  return (int) floor((y - mv2Origin[1]) / mdCellSize);
+}
+
+void CornerGrid::Build(const vector<Vector<2> > &vPoints, double dCellSize)
+{
+  Clear();
+  if(vPoints.empty())
+    return;
+
+  Vector<2> v2Min = vPoints[0];
+  Vector<2> v2Max = vPoints[0];
+  for(unsigned int i=1; i<vPoints.size(); i++)
+    for(int d=0; d<2; d++)
+    {
+      v2Min[d] = min(v2Min[d], vPoints[i][d]);
+      v2Max[d] = max(v2Max[d], vPoints[i][d]);
+    }
+
+  double dExtent = max(v2Max[0] - v2Min[0], v2Max[1] - v2Min[1]);
+  mdCellSize = max(dCellSize, dExtent / (MAX_GRID_DIM - 1));
+  mv2Origin = v2Min;
+  mnCols = Col(v2Max[0]) + 1;
+  mnRows = Row(v2Max[1]) + 1;
+
+  // Counting sort of the point indices by cell; this keeps the indices
+  // of each cell in ascending order.
+  vector<int> vCell(vPoints.size());
+  mvCellStart.assign(mnCols * mnRows + 1, 0);
+  for(unsigned int i=0; i<vPoints.size(); i++)
+  {
+    int nCol = min(Col(vPoints[i][0]), mnCols - 1);
+    int nRow = min(Row(vPoints[i][1]), mnRows - 1);
+    vCell[i] = nRow * mnCols + nCol;
+    mvCellStart[vCell[i] + 1]++;
+  }
+  for(unsigned int c=1; c<mvCellStart.size(); c++)
+    mvCellStart[c] += mvCellStart[c-1];
+
+  mvPointIndices.resize(vPoints.size());
+  vector<int> vFill(mvCellStart.begin(), mvCellStart.end() - 1);
+  for(unsigned int i=0; i<vPoints.size(); i++)
+    mvPointIndices[vFill[vCell[i]]++] = i;
+}
+
+void CornerGrid::FindInBand(const Vector<2> &v2Dirn, const Vector<2> &v2Normal,
+                            double dNormDist, double dMinLen, double dMaxLen, double dMaxDist,
+                            vector<int> &vFound) const
+{
+  if(Empty())
+    return;
+
+  // The band is a rectangle; walk around its corners.
+  Vector<2> av2Rect[4];
+  av2Rect[0] = v2Dirn * dMinLen + v2Normal * (dNormDist - dMaxDist);
+  av2Rect[1] = v2Dirn * dMaxLen + v2Normal * (dNormDist - dMaxDist);
+  av2Rect[2] = v2Dirn * dMaxLen + v2Normal * (dNormDist + dMaxDist);
+  av2Rect[3] = v2Dirn * dMinLen + v2Normal * (dNormDist + dMaxDist);
+
+  double dYMin = av2Rect[0][1], dYMax = av2Rect[0][1];
+  for(int i=1; i<4; i++)
+  {
+    dYMin = min(dYMin, av2Rect[i][1]);
+    dYMax = max(dYMax, av2Rect[i][1]);
+  }
+  int nRowMin = max(Row(dYMin), 0);
+  int nRowMax = min(Row(dYMax), mnRows - 1);
+
+  unsigned int nFirstFound = vFound.size();
+  for(int nRow = nRowMin; nRow <= nRowMax; nRow++)
+  {
+    // x-extent of the rectangle within this row's strip: clip each edge to the strip.
+    double dY0 = mv2Origin[1] + nRow * mdCellSize;
+    double dY1 = dY0 + mdCellSize;
+    double dXMin = 1e10, dXMax = -1e10;
+    for(int i=0; i<4; i++)
+    {
+      const Vector<2> &v2P = av2Rect[i];
+      const Vector<2> &v2Q = av2Rect[(i+1)%4];
+      double dDY = v2Q[1] - v2P[1];
+      double dT0 = 0.0, dT1 = 1.0;
+      if(fabs(dDY) < 1e-12)
+      {
+        if(v2P[1] < dY0 || v2P[1] > dY1)
+          continue;
+      }
+      else
+      {
+        double dTa = (dY0 - v2P[1]) / dDY;
+        double dTb = (dY1 - v2P[1]) / dDY;
+        dT0 = max(dT0, min(dTa, dTb));
+        dT1 = min(dT1, max(dTa, dTb));
+        if(dT0 > dT1)
+          continue;
+      }
+      double dXa = v2P[0] + dT0 * (v2Q[0] - v2P[0]);
+      double dXb = v2P[0] + dT1 * (v2Q[0] - v2P[0]);
+      dXMin = min(dXMin, min(dXa, dXb));
+      dXMax = max(dXMax, max(dXa, dXb));
+    }
+    if(dXMin > dXMax)
+      continue;
+
+    int nColMin = max(Col(dXMin), 0);
+    int nColMax = min(Col(dXMax), mnCols - 1);
+    for(int nCol = nColMin; nCol <= nColMax; nCol++)
+    {
+      int nCell = nRow * mnCols + nCol;
+      for(int j = mvCellStart[nCell]; j < mvCellStart[nCell + 1]; j++)
+        vFound.push_back(mvPointIndices[j]);
+    }
+  }
+
+  // Callers pick the first of equally good matches, so keep the corners in their original order.
+  sort(vFound.begin() + nFirstFound, vFound.end());
+}
@@ -0,0 +1,54 @@
+// -*- c++ -*-
+//
+// CornerGrid - a uniform bucket grid over the z=1-plane positions of a
+// level's FAST corners (Level::vImplaneCorners).
+//
+// The epipolar search in MapMaker::AddPointEpipolar only wants the corners
+// inside a narrow band around a segment of the epipolar line. Instead of
+// testing every corner of the target level for every candidate, the grid
+// returns the corners of those cells which touch the band. The result is a
+// superset of the corners inside the band, so the caller still applies its
+// exact tests. The grid is built once per target level and then only read,
+// so many epipolar searches may query it concurrently.
+
+#ifndef __CORNERGRID_H
+#define __CORNERGRID_H
+#include <TooN/TooN.h>
+#include <vector>
+
+namespace ptam{
+
+class CornerGrid
+{
+public:
+  CornerGrid();
+
+  // Buckets the points into square cells of side dCellSize. Point indices
+  // returned by the queries refer to vPoints.
+  void Build(const std::vector<TooN::Vector<2> > &vPoints, double dCellSize);
+  void Clear();
+  bool Empty() const { return mvCellStart.empty(); }
+
+  // Finds the points which may lie within dMaxDist of the line
+  // { x : x*v2Normal == dNormDist } while dMinLen <= x*v2Dirn <= dMaxLen.
+  // v2Dirn and v2Normal have to be orthonormal. Indices are appended to
+  // vFound in ascending order.
+  void FindInBand(const TooN::Vector<2> &v2Dirn, const TooN::Vector<2> &v2Normal,
+                  double dNormDist, double dMinLen, double dMaxLen, double dMaxDist,
+                  std::vector<int> &vFound) const;
+
+protected:
+  int Col(double x) const;
+  int Row(double y) const;
+
+  TooN::Vector<2> mv2Origin;  // z=1-plane position of the top-left corner of cell (0,0)
+  double mdCellSize;
+  int mnCols;
+  int mnRows;
+  std::vector<int> mvCellStart;    // Cell c holds mvPointIndices[mvCellStart[c]] .. mvPointIndices[mvCellStart[c+1]-1]
+  std::vector<int> mvPointIndices; // Point indices sorted by cell (and ascending within each cell)
+};
+
+} // namespace
+
+#endif
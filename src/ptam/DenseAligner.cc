@@ -0,0 +1,173 @@
+#include "DenseAligner.h"
+#include "CameraModel.h"
+#include "LevelHelpers.h"
+#include "MEstimator.h"
+
+#include <TooN/wls.h>
+#include <cmath>
+
+using namespace CVD;
+using namespace TooN;
+using namespace ptam;
+
+DenseAligner::Params::Params()
+  : nFinestLevel(2), nIterations(4), dMinGradient(6.0), dDepthWeight(20.0),
+    nMinPoints(300), dMaxError(20.0)
+{
+}
+
+DenseAligner::DenseAligner(CameraModel &camera)
+  : mCamera(camera), mbHasReference(false), mdLastError(0.0)
+{
+}
+
+void DenseAligner::SetReference(const KeyFrame &kf, const DepthPyramid &depth, const Params &params)
+{
+  for(int l=0; l<LEVELS; l++)
+    mvRefPoints[l].clear();
+  for(int l=params.nFinestLevel; l<LEVELS; l++)
+  {
+    const BasicImage<byte> &im = kf.aLevels[l].im;
+    const BasicImage<uint16_t> &imDepth = depth.Level(l);
+    const int nMinGradient2 = (int) (2.0 * params.dMinGradient);   // Central differences are two pixels wide
+    std::vector<RefPoint> &vPoints = mvRefPoints[l];
+    for(int y=1; y<im.size().y-1; y++)
+    {
+      const byte *pRow = im[y];
+      const uint16_t *pDepthRow = imDepth[y];
+      for(int x=1; x<im.size().x-1; x++)
+      {
+        if(!pDepthRow[x])
+          continue;
+        int nGx = pRow[x+1] - pRow[x-1];
+        int nGy = im[y+1][x] - im[y-1][x];
+        if(std::abs(nGx) < nMinGradient2 && std::abs(nGy) < nMinGradient2)
+          continue;
+        double dDepth = pDepthRow[x] * 0.001;
+        Vector<2> v2ImPlane = mCamera.UnProjectPixel(LevelZeroPosIR(ImageRef(x, y), l));
+        RefPoint p;
+        p.v3Pos = makeVector(v2ImPlane[0] * dDepth, v2ImPlane[1] * dDepth, dDepth);
+        p.dIntensity = pRow[x];
+        vPoints.push_back(p);
+      }
+    }
+  }
+  mbHasReference = true;
+}
+
+bool DenseAligner::Align(const KeyFrame &kf, const DepthPyramid &depth, const Params &params, SE3<> &se3CurFromRef)
+{
+  if(!mbHasReference)
+    return false;
+
+  SE3<> se3 = se3CurFromRef;
+  double dMeanError = 0.0;
+  int nPoints = 0;
+  for(int l=LEVELS-1; l>=params.nFinestLevel; l--)
+    for(int i=0; i<params.nIterations; i++)
+    {
+      nPoints = Iterate(l, kf, depth, params, se3, dMeanError);
+      if(nPoints < 20)   // Too few for six unknowns, let alone for the robust scale
+        return false;
+    }
+
+  mdLastError = dMeanError;
+  if(nPoints < params.nMinPoints || dMeanError > params.dMaxError)
+    return false;
+  se3CurFromRef = se3;
+  return true;
+}
+
+int DenseAligner::Iterate(int nLevel, const KeyFrame &kf, const DepthPyramid &depth, const Params &params,
+                          SE3<> &se3CurFromRef, double &dMeanError)
+{
+  const BasicImage<byte> &im = kf.aLevels[nLevel].im;
+  const BasicImage<uint16_t> &imDepth = depth.Level(nLevel);
+  const double dLevelScale = 1.0 / LevelScale(nLevel);
+  const double dMaxX = im.size().x - 2;
+  const double dMaxY = im.size().y - 2;
+  const std::vector<RefPoint> &vPoints = mvRefPoints[nLevel];
+
+  mvPhotoTerms.clear();
+  mvDepthTerms.clear();
+  for(unsigned int i=0; i<vPoints.size(); i++)
+  {
+    Vector<3> v3Cam = se3CurFromRef * vPoints[i].v3Pos;
+    if(v3Cam[2] < 0.05)
+      continue;
+    const double dOneOverZ = 1.0 / v3Cam[2];
+    Vector<2> v2Level = LevelNPos(mCamera.Project(v3Cam.slice<0,2>() * dOneOverZ), nLevel);
+    if(!(v2Level[0] >= 0.0 && v2Level[1] >= 0.0 && v2Level[0] < dMaxX && v2Level[1] < dMaxY))
+      continue;
+    Matrix<2> m2CamDerivs = mCamera.GetProjectionDerivs() * dLevelScale;
+
+    // Intensity and its gradient, both of the bilinear interpolant
+    const int x = (int) v2Level[0];
+    const int y = (int) v2Level[1];
+    const double dx = v2Level[0] - x;
+    const double dy = v2Level[1] - y;
+    const byte *p0 = &im[y][x];
+    const byte *p1 = &im[y+1][x];
+    const double dIntensity = (1.0 - dy) * ((1.0 - dx) * p0[0] + dx * p0[1]) + dy * ((1.0 - dx) * p1[0] + dx * p1[1]);
+    Vector<2> v2Gradient = makeVector((1.0 - dy) * (p0[1] - p0[0]) + dy * (p1[1] - p1[0]),
+                                      (1.0 - dx) * (p1[0] - p0[0]) + dx * (p1[1] - p0[1]));
+
+    // d(z=1 plane)/d(camera frame)
+    Matrix<2,3> m23ImPlane;
+    m23ImPlane[0] = makeVector(dOneOverZ, 0.0, -v3Cam[0] * dOneOverZ * dOneOverZ);
+    m23ImPlane[1] = makeVector(0.0, dOneOverZ, -v3Cam[1] * dOneOverZ * dOneOverZ);
+
+    // d(intensity)/d(camera frame); the rotational part of the SE3
+    // derivative of a point q is q x (that), the translational part itself.
+    Vector<3> v3Photo = (v2Gradient * m2CamDerivs) * m23ImPlane;
+    Term photo;
+    photo.v6Jacobian.slice<0,3>() = v3Photo;
+    photo.v6Jacobian.slice<3,3>() = v3Cam ^ v3Photo;
+    photo.dError = vPoints[i].dIntensity - dIntensity;
+    mvPhotoTerms.push_back(photo);
+
+    const uint16_t nDepth = imDepth[(int) (v2Level[1] + 0.5)][(int) (v2Level[0] + 0.5)];
+    if(nDepth && params.dDepthWeight > 0.0)
+    {
+      // Only the warped point's depth moves; the depth image's slope is
+      // too noisy on these levels to be worth a term.
+      Term depthTerm;
+      depthTerm.v6Jacobian = makeVector(0.0, 0.0, 1.0, v3Cam[1], -v3Cam[0], 0.0) * params.dDepthWeight;
+      depthTerm.dError = (nDepth * 0.001 - v3Cam[2]) * params.dDepthWeight;
+      mvDepthTerms.push_back(depthTerm);
+    }
+  }
+  if(mvPhotoTerms.size() < 20)
+    return mvPhotoTerms.size();
+
+  // Separate robust scales for the two kinds of error
+  mvdErrorSquared.resize(mvPhotoTerms.size());
+  double dSumError = 0.0;
+  for(unsigned int i=0; i<mvPhotoTerms.size(); i++)
+  {
+    mvdErrorSquared[i] = mvPhotoTerms[i].dError * mvPhotoTerms[i].dError;
+    dSumError += std::fabs(mvPhotoTerms[i].dError);
+  }
+  dMeanError = dSumError / mvPhotoTerms.size();
+  const double dPhotoSigmaSquared = std::max(Huber::FindSigmaSquared(mvdErrorSquared), 1.0);
+  double dDepthSigmaSquared = 1.0;
+  if(mvDepthTerms.size() > 10)
+  {
+    mvdErrorSquared.resize(mvDepthTerms.size());
+    for(unsigned int i=0; i<mvDepthTerms.size(); i++)
+      mvdErrorSquared[i] = mvDepthTerms[i].dError * mvDepthTerms[i].dError;
+    dDepthSigmaSquared = std::max(Huber::FindSigmaSquared(mvdErrorSquared), 1e-4);
+  }
+
+  WLS<6> wls;
+  wls.add_prior(100.0); // Stabilising prior, as for the tracker's pose updates
+  for(unsigned int i=0; i<mvPhotoTerms.size(); i++)
+    wls.add_mJ(mvPhotoTerms[i].dError, mvPhotoTerms[i].v6Jacobian,
+               Huber::Weight(mvPhotoTerms[i].dError * mvPhotoTerms[i].dError, dPhotoSigmaSquared));
+  for(unsigned int i=0; i<mvDepthTerms.size(); i++)
+    wls.add_mJ(mvDepthTerms[i].dError, mvDepthTerms[i].v6Jacobian,
+               Huber::Weight(mvDepthTerms[i].dError * mvDepthTerms[i].dError, dDepthSigmaSquared));
+  wls.compute();
+  se3CurFromRef = SE3<>::exp(wls.get_mu()) * se3CurFromRef;
+  return mvPhotoTerms.size();
+}
@@ -0,0 +1,91 @@
+// -*- c++ -*-
+//
+// DenseAligner - frame to frame RGB-D odometry on the coarse pyramid
+// levels of one camera, as a pose prior for the tracker.
+//
+// The reference is the last frame: every pixel of its coarse levels
+// with a valid depth and some texture becomes a 3D point. Align() then
+// finds the motion which best warps these points into the current frame,
+// level by level from the top, by Gauss-Newton on two residuals per
+// point: the intensity at the warped position against the reference
+// intensity, and the current depth there against the warped point's
+// depth. Both are Huber-weighted. The motion model's guess is the
+// starting point; with a good prior the tracker's patch search can stay
+// small, instead of falling back to the coarse stage on fast rotations.
+//
+// One aligner per camera, each with its own CameraModel; aligners of
+// different cameras may run in parallel.
+
+#ifndef __DENSEALIGNER_H
+#define __DENSEALIGNER_H
+#include <vector>
+#include <TooN/TooN.h>
+#include <TooN/se3.h>
+#include <cvd/image.h>
+#include <cvd/byte.h>
+
+#include "KeyFrame.h"
+#include "DepthPyramid.h"
+
+namespace ptam{
+
+class CameraModel;
+
+class DenseAligner
+{
+public:
+  struct Params
+  {
+    Params();
+    int nFinestLevel;      // Levels LEVELS-1 down to this one are used
+    int nIterations;       // Gauss-Newton iterations per level
+    double dMinGradient;   // Reference pixels with less texture are left out [grey levels/pixel]
+    double dDepthWeight;   // Grey levels a metre of depth error is worth
+    int nMinPoints;        // Fewer points than this on the finest level is a failure
+    double dMaxError;      // So is a mean intensity error above this at the end [grey levels]
+  };
+
+  DenseAligner(CameraModel &camera);
+
+  // The frame to align the next one against
+  void SetReference(const KeyFrame &kf, const DepthPyramid &depth, const Params &params);
+  bool HasReference() const { return mbHasReference; }
+  void ClearReference() { mbHasReference = false; }
+
+  // se3CurFromRef holds the guess on the way in and the result on the way
+  // out; it is only changed if the alignment succeeded.
+  bool Align(const KeyFrame &kf, const DepthPyramid &depth, const Params &params, TooN::SE3<> &se3CurFromRef);
+
+  double LastError() const { return mdLastError; }   // Mean intensity error of the last Align()
+
+protected:
+  struct RefPoint
+  {
+    TooN::Vector<3> v3Pos;   // In the reference camera frame [m]
+    double dIntensity;
+  };
+
+  struct Term
+  {
+    TooN::Vector<6> v6Jacobian;
+    double dError;
+  };
+
+  // One Gauss-Newton step on one level; returns how many points landed in the image
+  int Iterate(int nLevel, const KeyFrame &kf, const DepthPyramid &depth, const Params &params,
+              TooN::SE3<> &se3CurFromRef, double &dMeanError);
+
+  CameraModel &mCamera;
+  bool mbHasReference;
+  std::vector<RefPoint> mvRefPoints[LEVELS];
+  double mdLastError;
+
+  // Scratch, kept to save allocations
+  std::vector<Term> mvPhotoTerms;
+  std::vector<Term> mvDepthTerms;
+  std::vector<double> mvdErrorSquared;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,95 @@
+#include "DepthPyramid.h"
+#include <algorithm>
+#include <gvars3/instances.h>
+
+using namespace CVD;
+using namespace GVars3;
+using namespace ptam;
+
+namespace {
+// The nearest of two depths, valid ones first: 0 wraps round to the largest
+// value, so min() never picks it unless both are 0. Branch free, so that the
+// halving loop vectorises.
+inline uint16_t Nearest(uint16_t a, uint16_t b)
+{
+  return (uint16_t) (std::min((uint16_t) (a - 1), (uint16_t) (b - 1)) + 1);
+}
+}
+
+DepthPyramid::DepthPyramid()
+  : mnFillRadius(0)
+{
+}
+
+int DepthPyramid::FillRadius()
+{
+  static gvar3<int> gvnFillRadius("Tracker.DepthFillRadius", 1, SILENT);
+  return *gvnFillRadius;
+}
+
+void DepthPyramid::Make(const BasicImage<uint16_t> &depth, int nLevels, int nFillRadius)
+{
+  mnFillRadius = nFillRadius;
+  mvimHalved.resize(nLevels - 1);
+  mvpLevels.resize(nLevels);
+  mvpLevels[0] = &depth;
+  for(int l=1; l<nLevels; l++)
+  {
+    const BasicImage<uint16_t> &imIn = *mvpLevels[l-1];
+    Image<uint16_t> &imOut = mvimHalved[l-1];
+    imOut.resize(imIn.size() / 2);
+    for(int y=0; y<imOut.size().y; y++)
+    {
+      const uint16_t *pTop = imIn[2*y];
+      const uint16_t *pBottom = imIn[2*y+1];
+      uint16_t *pOut = imOut[y];
+      for(int x=0; x<imOut.size().x; x++)
+        pOut[x] = Nearest(Nearest(pTop[2*x], pTop[2*x+1]), Nearest(pBottom[2*x], pBottom[2*x+1]));
+    }
+    mvpLevels[l] = &imOut;
+  }
+}
+
+void DepthPyramid::Sample(int nLevel, const std::vector<ImageRef> &virPos, std::vector<double> &vdDepth) const
+{
+  const BasicImage<uint16_t> &im = Level(nLevel);
+  const uint16_t *pData = im.data();
+  const int nStride = im.row_stride();
+  const unsigned int n = virPos.size();
+  vdDepth.resize(n);
+
+  // Gather first, without looking at the values..
+  for(unsigned int i=0; i<n; i++)
+    vdDepth[i] = pData[virPos[i].y * nStride + virPos[i].x];
+
+  // .. then go back for the holes only.
+  for(unsigned int i=0; i<n; i++)
+  {
+    if(vdDepth[i] == 0.0 && mnFillRadius > 0)
+      vdDepth[i] = FillHole(im, virPos[i]);
+    vdDepth[i] *= 0.001;
+  }
+}
+
+// The nearest valid depth on the smallest ring round ir which has any
+uint16_t DepthPyramid::FillHole(const BasicImage<uint16_t> &im, ImageRef ir) const
+{
+  for(int r=1; r<=mnFillRadius; r++)
+  {
+    uint16_t nBest = 0;
+    int y0 = std::max(ir.y - r, 0), y1 = std::min(ir.y + r, im.size().y - 1);
+    int x0 = std::max(ir.x - r, 0), x1 = std::min(ir.x + r, im.size().x - 1);
+    for(int y=y0; y<=y1; y++)
+    {
+      const uint16_t *pRow = im[y];
+      // Whole rows at the top and bottom of the ring, just its ends otherwise
+      int nStep = (y == ir.y - r || y == ir.y + r) ? 1 : 2 * r;
+      for(int x = ir.x - r; x <= ir.x + r; x += nStep)
+        if(x >= x0 && x <= x1)
+          nBest = Nearest(nBest, pRow[x]);
+    }
+    if(nBest)
+      return nBest;
+  }
+  return 0;
+}
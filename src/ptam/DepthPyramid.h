@@ -0,0 +1,53 @@
+// -*- c++ -*-
+//
+// DepthPyramid - a depth image halved level by level alongside a
+// keyframe's image pyramid, so that corners on any level can look up
+// their depth on their own level.
+//
+// Depths are kept as the sensor gives them: millimetres, with 0 where
+// the sensor has none; that zero is the validity mask. A pixel on level
+// l covers 2x2 pixels of level l-1 and takes the nearest valid depth of
+// those, i.e. the front surface where the block straddles an edge, and
+// 0 only if none of them is valid. Level sizes follow halfSample(), as
+// for KeyFrame::aLevels.
+//
+// Sample() looks up a whole list of corners of one level at once. Holes
+// can be filled from the nearest valid depth within a small window, so
+// that corners just off a Kinect hole still get a depth.
+
+#ifndef __DEPTHPYRAMID_H
+#define __DEPTHPYRAMID_H
+#include <vector>
+#include <stdint.h>
+#include <cvd/image.h>
+
+namespace ptam{
+
+class DepthPyramid
+{
+public:
+  DepthPyramid();
+
+  // Level zero is depth itself, which must outlive the pyramid's use.
+  // Holes are filled from up to nFillRadius pixels away; 0 leaves them.
+  void Make(const CVD::BasicImage<uint16_t> &depth, int nLevels, int nFillRadius);
+
+  int Levels() const { return mvpLevels.size(); }
+  const CVD::BasicImage<uint16_t> &Level(int nLevel) const { return *mvpLevels[nLevel]; }
+
+  // Depth [m] at positions on level nLevel, 0 where there is none.
+  void Sample(int nLevel, const std::vector<CVD::ImageRef> &virPos, std::vector<double> &vdDepth) const;
+
+  static int FillRadius();   // Tracker.DepthFillRadius; read it on the thread feeding the workers
+
+protected:
+  uint16_t FillHole(const CVD::BasicImage<uint16_t> &im, CVD::ImageRef ir) const;
+
+  std::vector<const CVD::BasicImage<uint16_t>*> mvpLevels;
+  std::vector<CVD::Image<uint16_t> > mvimHalved;   // Levels one and up, reused
+  int mnFillRadius;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,62 @@
+#include "FeatureBudget.h"
+
+#include <algorithm>
+
+using namespace TooN;
+using namespace ptam;
+
+FeatureBudget::FeatureBudget(int nBucketsX, int nBucketsY)
+  : mnBucketsX(nBucketsX), mnBucketsY(nBucketsY), mdBucketsPerPixelX(0), mdBucketsPerPixelY(0)
+{
+}
+
+void FeatureBudget::Clear(CVD::ImageRef irImageSize)
+{
+  mvCandidates.clear();
+  mdBucketsPerPixelX = (double) mnBucketsX / std::max(irImageSize.x, 1);
+  mdBucketsPerPixelY = (double) mnBucketsY / std::max(irImageSize.y, 1);
+}
+
+void FeatureBudget::Add(const Vector<2> &v2Image, double dPriority)
+{
+  int nX = std::min(std::max((int) (v2Image[0] * mdBucketsPerPixelX), 0), mnBucketsX - 1);
+  int nY = std::min(std::max((int) (v2Image[1] * mdBucketsPerPixelY), 0), mnBucketsY - 1);
+  Candidate c;
+  c.nBucket = nY * mnBucketsX + nX;
+  c.nRound = 0;
+  c.dPriority = dPriority;
+  c.nIndex = mvCandidates.size();
+  mvCandidates.push_back(c);
+}
+
+// Ties go by index, so that the order doesn't depend on the sort
+bool FeatureBudget::ByBucket(const Candidate &a, const Candidate &b)
+{
+  if(a.nBucket != b.nBucket)
+    return a.nBucket < b.nBucket;
+  if(a.dPriority != b.dPriority)
+    return a.dPriority > b.dPriority;
+  return a.nIndex < b.nIndex;
+}
+
+bool FeatureBudget::ByRound(const Candidate &a, const Candidate &b)
+{
+  if(a.nRound != b.nRound)
+    return a.nRound < b.nRound;
+  if(a.dPriority != b.dPriority)
+    return a.dPriority > b.dPriority;
+  return a.nIndex < b.nIndex;
+}
+
+void FeatureBudget::Select(unsigned int nBudget, std::vector<int> &vnSelected)
+{
+  std::sort(mvCandidates.begin(), mvCandidates.end(), ByBucket);
+  for(unsigned int i=0; i<mvCandidates.size(); i++)
+    mvCandidates[i].nRound = (i > 0 && mvCandidates[i].nBucket == mvCandidates[i-1].nBucket) ? mvCandidates[i-1].nRound + 1 : 0;
+
+  // Only the first nBudget need to be in order
+  unsigned int nSelected = std::min(nBudget, (unsigned int) mvCandidates.size());
+  std::partial_sort(mvCandidates.begin(), mvCandidates.begin() + nSelected, mvCandidates.end(), ByRound);
+  for(unsigned int i=0; i<nSelected; i++)
+    vnSelected.push_back(mvCandidates[i].nIndex);
+}
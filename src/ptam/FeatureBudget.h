@@ -0,0 +1,53 @@
+// -*- c++ -*-
+//
+// FeatureBudget - picks which of the potentially visible map points the
+// tracker searches for in a frame, when it can't afford all of them.
+//
+// The image is divided into buckets. The candidates are taken in rounds:
+// each round takes the best candidate left in every bucket, best first. So
+// the points chosen are spread over the image as far as the map allows,
+// rather than crowding into its most textured part. Within a bucket, and
+// within a round, higher priority goes first. The order in which Select()
+// returns the candidates is also the order to search them in, so that a
+// search cut short loses the least useful ones.
+
+#ifndef __FEATUREBUDGET_H
+#define __FEATUREBUDGET_H
+#include <vector>
+#include <TooN/TooN.h>
+#include <cvd/image_ref.h>
+
+namespace ptam{
+
+class FeatureBudget
+{
+public:
+  FeatureBudget(int nBucketsX = 8, int nBucketsY = 6);
+
+  void Clear(CVD::ImageRef irImageSize);   // Starts a new set of candidates, for an image of this size
+  void Add(const TooN::Vector<2> &v2Image, double dPriority);   // Level zero pixels; the nth Add() is candidate n
+  unsigned int Size() const { return mvCandidates.size(); }
+
+  // Appends the indices of at most nBudget candidates to vnSelected, in
+  // the order to search them in. Once per Clear().
+  void Select(unsigned int nBudget, std::vector<int> &vnSelected);
+
+protected:
+  struct Candidate
+  {
+    int nBucket;
+    int nRound;               // Rank within its bucket
+    double dPriority;
+    int nIndex;
+  };
+  static bool ByBucket(const Candidate &a, const Candidate &b);
+  static bool ByRound(const Candidate &a, const Candidate &b);
+
+  const int mnBucketsX, mnBucketsY;
+  double mdBucketsPerPixelX, mdBucketsPerPixelY;
+  std::vector<Candidate> mvCandidates;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,54 @@
+#include "FramePool.h"
+#include "KeyFrame.h"
+
+using namespace ptam;
+
+FramePool::FramePool(unsigned int nMaxFree)
+  : mpStore(new Store)
+{
+  mpStore->nMaxFree = nMaxFree;
+}
+
+boost::shared_ptr<KeyFrame> FramePool::Get()
+{
+  KeyFrame *pKF = NULL;
+  {
+    boost::mutex::scoped_lock lock(mpStore->mutex);
+    if(!mpStore->vpFree.empty())
+    {
+      pKF = mpStore->vpFree.back();
+      mpStore->vpFree.pop_back();
+    }
+  }
+  if(!pKF)
+    pKF = new KeyFrame();
+  Recycle recycle;
+  recycle.pStore = mpStore;
+  return boost::shared_ptr<KeyFrame>(pKF, recycle);
+}
+
+unsigned int FramePool::Free() const
+{
+  boost::mutex::scoped_lock lock(mpStore->mutex);
+  return mpStore->vpFree.size();
+}
+
+FramePool::Store::~Store()
+{
+  for(unsigned int i=0; i<vpFree.size(); i++)
+    delete vpFree[i];
+}
+
+void FramePool::Recycle::operator()(KeyFrame *pKF) const
+{
+  // Outside the lock: this lets go of map points, which may take a while
+  pKF->Recycle();
+  boost::mutex::scoped_lock lock(pStore->mutex);
+  if(pStore->vpFree.size() < pStore->nMaxFree)
+  {
+    pStore->vpFree.push_back(pKF);
+    return;
+  }
+  lock.unlock();
+  delete pKF;
+}
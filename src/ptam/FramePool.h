@@ -0,0 +1,55 @@
+// -*- c++ -*-
+//
+// FramePool - recycles the tracker's frame structs.
+//
+// The tracker hands a frame which becomes a keyframe over to the mapmaker
+// as it is, by pointer, and carries on with another one from the pool.
+// Frames handed out by Get() come back by themselves once the last
+// shared_ptr to them goes, be it because the mapmaker dropped them or
+// because they were erased from the map; their pyramid, corner vectors
+// and RGB-D images keep their memory, so that tracking the next frames
+// in them allocates nothing.
+//
+// Frames may come back on any thread; Get() is for the tracker.
+
+#ifndef __FRAMEPOOL_H
+#define __FRAMEPOOL_H
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace ptam{
+
+struct KeyFrame;
+
+class FramePool
+{
+public:
+  FramePool(unsigned int nMaxFree);
+
+  boost::shared_ptr<KeyFrame> Get();   // A recycled frame if there is one, else a new one
+  unsigned int Free() const;           // Waiting to be handed out again
+
+protected:
+  struct Store
+  {
+    ~Store();
+    mutable boost::mutex mutex;
+    std::vector<KeyFrame*> vpFree;
+    unsigned int nMaxFree;             // Any more than these are deleted
+  };
+
+  // The shared_ptr deleter: hands the frame back to the store, which it
+  // keeps alive, so that frames may outlive the pool.
+  struct Recycle
+  {
+    boost::shared_ptr<Store> pStore;
+    void operator()(KeyFrame *pKF) const;
+  };
+
+  boost::shared_ptr<Store> mpStore;
+};
+
+} // namespace
+
+#endif
@@ -12,25 +12,18 @@ using namespace std;
 using namespace TooN;
 using namespace ptam;
 
-bool HomographyInit::IsHomographyInlier(Matrix<3> m3Homography, HomographyMatch match)
+HomographyInit::HomographyInit(WorkerPool *pWorkers)
+  : mpWorkers(pWorkers)
 {
-  Vector<2> v2Projected = project(m3Homography * unproject(match.v2CamPlaneFirst));
-  Vector<2> v2Error = match.v2CamPlaneSecond - v2Projected;
-  Vector<2> v2PixelError = match.m2PixelProjectionJac * v2Error;
-  double dSquaredError = v2PixelError * v2PixelError;
-  return (dSquaredError < mdMaxPixelErrorSquared);
 }
 
-double HomographyInit::MLESACScore(Matrix<3> m3Homography, HomographyMatch match)
+bool HomographyInit::IsHomographyInlier(Matrix<3> m3Homography, HomographyMatch match)
 {
   Vector<2> v2Projected = project(m3Homography * unproject(match.v2CamPlaneFirst));
   Vector<2> v2Error = match.v2CamPlaneSecond - v2Projected;
   Vector<2> v2PixelError = match.m2PixelProjectionJac * v2Error;
   double dSquaredError = v2PixelError * v2PixelError;
-  if(dSquaredError > mdMaxPixelErrorSquared)
-    return mdMaxPixelErrorSquared;
-  else 
-    return dSquaredError;
+  return (dSquaredError < mdMaxPixelErrorSquared);
 }
 
 bool HomographyInit::Compute(vector<HomographyMatch> vMatches, double dMaxPixelError, SE3<> &se3SecondFromFirst)
@@ -204,48 +197,18 @@ void HomographyInit::BestHomographyFromMatches_MLESAC()
       return;
     }
   
-  // Enough matches? Run MLESAC.
-  int anIndices[4];
-  
+  // Enough matches? Run MLESAC, stopping once 99.9% sure of having
+  // drawn four inliers, and at 300 trials
+  mRansac.Clear();
+  for(unsigned int i=0; i<mvMatches.size(); i++)
+    mRansac.Add(mvMatches[i].v2CamPlaneFirst, mvMatches[i].v2CamPlaneSecond, mvMatches[i].m2PixelProjectionJac);
+  HomographyRansac::Params params;
+  params.cost = HomographyRansac::COST_MLESAC;
+  params.dMaxError = sqrt(mdMaxPixelErrorSquared);
+  params.nMaxIterations = 300;
+  params.dConfidence = 0.999;
   mm3BestHomography = Identity;
-  double dBestError = 999999999999999999.9;
-  
-  // Do 300 MLESAC trials.
-  for(int nR = 0; nR < 300 ; nR++)
-    { 
-      // Find set of four unique matches
-      for(int i=0; i<4; i++)
-	{
-	  bool isUnique = false;
-	  int n;
-	  while(!isUnique)
-	    {
-	      n = rand() % mvMatches.size();
-	      isUnique =true;
-	      for(int j=0; j<i && isUnique; j++)
-		if(anIndices[j] == n)
-		  isUnique = false;
-	    };
-	  anIndices[i] = n;
-	}
-      vector<HomographyMatch> vMinimalMatches;
-      for(int i=0; i<4; i++)
-	vMinimalMatches.push_back(mvMatches[anIndices[i]]);
-      
-      // Find a homography from the minimal set..
-      Matrix<3> m3Homography = HomographyFromMatches(vMinimalMatches);
-      
-      //..and sum resulting MLESAC score
-      double dError = 0.0;
-      for(unsigned int i=0; i<mvMatches.size(); i++)
- 	dError += MLESACScore(m3Homography, mvMatches[i]);
-      
-      if(dError < dBestError)
-	{
-	  mm3BestHomography = m3Homography;
-	  dBestError = dError;
-	}
-    };
+  mRansac.Find(params, mpWorkers, rand(), mm3BestHomography);
 }
 
 void HomographyInit::DecomposeHomography()
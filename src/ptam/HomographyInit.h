@@ -15,6 +15,7 @@
 #include <TooN/TooN.h>
 #include <TooN/se3.h>
 #include <vector>
+#include "HomographyRansac.h"
 
 // Homography matches are 2D-2D matches in a stereo pair, unprojected
 // to the Z=1 plane.
@@ -42,6 +43,10 @@ struct HomographyDecomposition
 class HomographyInit
 {
 public:
+  // With pWorkers, the MLESAC hypotheses are scored in parallel; the
+  // caller's thread must be the only one feeding the pool.
+  HomographyInit(ptam::WorkerPool *pWorkers = NULL);
+
   bool Compute(std::vector<HomographyMatch> vMatches, double dMaxPixelError, TooN::SE3<> &se3SecondCameraPose);
 
   //use circle pattern for initialization
@@ -55,13 +60,14 @@ protected:
   void RefineHomographyWithInliers();
   
   bool IsHomographyInlier(TooN::Matrix<3> m3Homography, HomographyMatch match);
-  double MLESACScore(TooN::Matrix<3> m3Homography, HomographyMatch match);
   
   double mdMaxPixelErrorSquared;
   TooN::Matrix<3> mm3BestHomography;
   std::vector<HomographyMatch> mvMatches;
   std::vector<HomographyMatch> mvHomographyInliers;
   std::vector<HomographyDecomposition> mvDecompositions;
+  ptam::WorkerPool *mpWorkers;
+  ptam::HomographyRansac mRansac;
 };
 
 
@@ -0,0 +1,363 @@
+#include "HomographyRansac.h"
+#include "WorkerPool.h"
+
+#include <TooN/LU.h>
+#include <TooN/SVD.h>
+#include <TooN/helpers.h>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace TooN;
+using namespace ptam;
+
+namespace {
+// Matches scored between checks against the bound
+const int BlockSize = 64;
+// Hypotheses per round, per worker
+const int HypothesesPerWorker = 8;
+// Fewer match scorings than this in a round aren't worth the workers
+const int MinParallelWork = 65536;
+
+inline bool InLine(const Vector<2> &v2A, const Vector<2> &v2B, const Vector<2> &v2C)
+{
+  Vector<2> v2AB = v2B - v2A;
+  Vector<2> v2AC = v2C - v2A;
+  double dCross = v2AB[0] * v2AC[1] - v2AB[1] * v2AC[0];
+  return std::fabs(dCross) <= 1e-3 * std::sqrt((v2AB * v2AB) * (v2AC * v2AC));
+}
+
+#ifdef __SSE2__
+inline float HorizontalSum(__m128 v)
+{
+  v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+  return _mm_cvtss_f32(v);
+}
+
+inline int HorizontalSum(__m128i v)
+{
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(v);
+}
+#endif
+}
+
+HomographyRansac::Params::Params()
+  : cost(COST_MLESAC), dMaxError(5.0), nMaxIterations(300), dConfidence(0.999), bCheirality(false)
+{
+}
+
+HomographyRansac::HomographyRansac()
+  : mnJobsPerRound(1), mdBound(0.0)
+{
+  mStatistics.nHypotheses = 0;
+  mStatistics.nDegenerate = 0;
+  mStatistics.nPreempted = 0;
+  mStatistics.nBestInliers = 0;
+}
+
+void HomographyRansac::Clear()
+{
+  mvv2First.clear();
+  mvv2Second.clear();
+  mvfX1.clear();
+  mvfY1.clear();
+  mvfX2.clear();
+  mvfY2.clear();
+  mvfS00.clear();
+  mvfS01.clear();
+  mvfS10.clear();
+  mvfS11.clear();
+}
+
+void HomographyRansac::Add(const Vector<2> &v2First, const Vector<2> &v2Second, const Matrix<2> &m2Scale)
+{
+  mvv2First.push_back(v2First);
+  mvv2Second.push_back(v2Second);
+  mvfX1.push_back(v2First[0]);
+  mvfY1.push_back(v2First[1]);
+  mvfX2.push_back(v2Second[0]);
+  mvfY2.push_back(v2Second[1]);
+  mvfS00.push_back(m2Scale[0][0]);
+  mvfS01.push_back(m2Scale[0][1]);
+  mvfS10.push_back(m2Scale[1][0]);
+  mvfS11.push_back(m2Scale[1][1]);
+}
+
+void HomographyRansac::Add(const Vector<2> &v2First, const Vector<2> &v2Second, double dScale)
+{
+  Add(v2First, v2Second, dScale * Matrix<2>(Identity));
+}
+
+bool HomographyRansac::Find(const Params &params, WorkerPool *pWorkers, unsigned int nSeed, Matrix<3> &m3Best)
+{
+  mStatistics.nHypotheses = 0;
+  mStatistics.nDegenerate = 0;
+  mStatistics.nPreempted = 0;
+  mStatistics.nBestInliers = 0;
+  const int nMatches = size();
+  if(nMatches < 4)
+    return false;
+  mParams = params;
+
+  const int nWorkers = pWorkers ? pWorkers->Size() : 1;
+  const int nPerRound = HypothesesPerWorker * nWorkers;
+  const bool bParallel = nWorkers > 1 && nPerRound * nMatches >= MinParallelWork;
+  double dBestCost = HUGE_VAL;
+  bool bFound = false;
+  int nNeeded = params.nMaxIterations;
+  while(mStatistics.nHypotheses < nNeeded)
+  {
+    // Draw the samples of this round here, so that they don't depend on the workers
+    mvRound.resize(std::min(nPerRound, nNeeded - mStatistics.nHypotheses));
+    for(unsigned int h=0; h<mvRound.size(); h++)
+    {
+      int *anSample = mvRound[h].anSample;
+      for(int i=0; i<4; i++)
+      {
+        bool bUnique;
+        do
+        {
+          anSample[i] = rand_r(&nSeed) % nMatches;
+          bUnique = true;
+          for(int j=0; j<i; j++)
+            if(anSample[j] == anSample[i])
+              bUnique = false;
+        } while(!bUnique);
+      }
+    }
+
+    mdBound = dBestCost;
+    if(bParallel)
+    {
+      mnJobsPerRound = nWorkers;
+      pWorkers->ParallelFor(nWorkers, boost::bind(&HomographyRansac::MakeHypotheses, this, _1, _2));
+    }
+    else
+    {
+      mnJobsPerRound = 1;
+      MakeHypotheses(0, 0);
+    }
+
+    // In the order drawn, so that ties go as they would one at a time
+    for(unsigned int h=0; h<mvRound.size(); h++)
+    {
+      const Hypothesis &hyp = mvRound[h];
+      mStatistics.nHypotheses++;
+      if(hyp.bDegenerate)
+        mStatistics.nDegenerate++;
+      else if(hyp.bPreempted)
+        mStatistics.nPreempted++;
+      else if(hyp.dCost < dBestCost)
+      {
+        dBestCost = hyp.dCost;
+        m3Best = hyp.m3Homography;
+        mStatistics.nBestInliers = hyp.nInliers;
+        bFound = true;
+      }
+    }
+
+    // Hypotheses needed to have drawn four inliers with the confidence asked for
+    if(params.dConfidence > 0.0 && mStatistics.nBestInliers > 0)
+    {
+      double dInlierRatio = (double) mStatistics.nBestInliers / nMatches;
+      double dAllInliers = dInlierRatio * dInlierRatio * dInlierRatio * dInlierRatio;
+      if(dAllInliers > 1.0 - 1e-9)
+        nNeeded = 0;
+      else
+      {
+        double dNeeded = std::ceil(std::log(1.0 - params.dConfidence) / std::log(1.0 - dAllInliers));
+        nNeeded = (int) std::min(dNeeded, (double) params.nMaxIterations);
+      }
+    }
+  }
+  return bFound;
+}
+
+void HomographyRansac::MakeHypotheses(int nJob, int nWorker)
+{
+  for(unsigned int h=nJob; h<mvRound.size(); h+=mnJobsPerRound)
+  {
+    Hypothesis &hyp = mvRound[h];
+    hyp.bPreempted = false;
+    hyp.bDegenerate = IsDegenerate(hyp.anSample);
+    if(hyp.bDegenerate)
+      continue;
+    std::vector<int> vnSample(hyp.anSample, hyp.anSample + 4);
+    hyp.m3Homography = Fit(vnSample);
+    hyp.dCost = Score(hyp.m3Homography, mdBound, hyp.nInliers, hyp.bPreempted);
+  }
+}
+
+// Three points in a line, in either view, make the system singular
+bool HomographyRansac::IsDegenerate(const int *anSample) const
+{
+  static const int anTriples[4][3] = {{0, 1, 2}, {0, 1, 3}, {0, 2, 3}, {1, 2, 3}};
+  for(int t=0; t<4; t++)
+  {
+    const int *an = anTriples[t];
+    if(InLine(mvv2First[anSample[an[0]]], mvv2First[anSample[an[1]]], mvv2First[anSample[an[2]]]) ||
+       InLine(mvv2Second[anSample[an[0]]], mvv2Second[anSample[an[1]]], mvv2Second[anSample[an[2]]]))
+      return true;
+  }
+  return false;
+}
+
+// The NaNs of a singular fit count as outliers everywhere below, and so do
+// matches mapped to w <= 0 with Params::bCheirality
+double HomographyRansac::Score(const Matrix<3> &m3, double dBound, int &nInliers, bool &bPreempted) const
+{
+  const int nMatches = size();
+  const bool bMLESAC = (mParams.cost == COST_MLESAC);
+  const float fMaxErrorSquared = mParams.dMaxError * mParams.dMaxError;
+  double dCost = 0.0;
+  nInliers = 0;
+  bPreempted = false;
+  int i = 0;
+
+#ifdef __SSE2__
+  const __m128 vH00 = _mm_set1_ps(m3[0][0]), vH01 = _mm_set1_ps(m3[0][1]), vH02 = _mm_set1_ps(m3[0][2]);
+  const __m128 vH10 = _mm_set1_ps(m3[1][0]), vH11 = _mm_set1_ps(m3[1][1]), vH12 = _mm_set1_ps(m3[1][2]);
+  const __m128 vH20 = _mm_set1_ps(m3[2][0]), vH21 = _mm_set1_ps(m3[2][1]), vH22 = _mm_set1_ps(m3[2][2]);
+  const __m128 vMax = _mm_set1_ps(fMaxErrorSquared);
+  const __m128 vOne = _mm_set1_ps(1.0f);
+  const __m128 vZero = _mm_setzero_ps();
+  // All set without the cheirality test, so that every match counts as in front
+  const __m128 vAllInFront = mParams.bCheirality ? vZero : _mm_castsi128_ps(_mm_set1_epi32(-1));
+  const int nQuads = nMatches & ~3;
+  while(i < nQuads)
+  {
+    const int nEnd = std::min(i + BlockSize, nQuads);
+    __m128 vCost = _mm_setzero_ps();
+    __m128i vInliers = _mm_setzero_si128();
+    for(; i<nEnd; i+=4)
+    {
+      __m128 vX = _mm_loadu_ps(&mvfX1[i]);
+      __m128 vY = _mm_loadu_ps(&mvfY1[i]);
+      __m128 vU = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vH00, vX), _mm_mul_ps(vH01, vY)), vH02);
+      __m128 vV = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vH10, vX), _mm_mul_ps(vH11, vY)), vH12);
+      __m128 vW = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vH20, vX), _mm_mul_ps(vH21, vY)), vH22);
+      __m128 vOneOverW = _mm_div_ps(vOne, vW);
+      __m128 vDX = _mm_sub_ps(_mm_loadu_ps(&mvfX2[i]), _mm_mul_ps(vU, vOneOverW));
+      __m128 vDY = _mm_sub_ps(_mm_loadu_ps(&mvfY2[i]), _mm_mul_ps(vV, vOneOverW));
+      __m128 vEX = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&mvfS00[i]), vDX), _mm_mul_ps(_mm_loadu_ps(&mvfS01[i]), vDY));
+      __m128 vEY = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&mvfS10[i]), vDX), _mm_mul_ps(_mm_loadu_ps(&mvfS11[i]), vDY));
+      __m128 vErrorSquared = _mm_add_ps(_mm_mul_ps(vEX, vEX), _mm_mul_ps(vEY, vEY));
+      __m128 vInFront = _mm_or_ps(_mm_cmpgt_ps(vW, vZero), vAllInFront);
+      vErrorSquared = _mm_or_ps(_mm_and_ps(vInFront, vErrorSquared), _mm_andnot_ps(vInFront, vMax));
+      __m128 vInlier = _mm_cmplt_ps(vErrorSquared, vMax);   // False for NaN
+      vInliers = _mm_sub_epi32(vInliers, _mm_castps_si128(vInlier));
+      if(bMLESAC)
+        vCost = _mm_add_ps(vCost, _mm_min_ps(vErrorSquared, vMax));   // vMax for NaN
+      else
+        vCost = _mm_add_ps(vCost, _mm_andnot_ps(vInlier, vOne));
+    }
+    dCost += HorizontalSum(vCost);
+    nInliers += HorizontalSum(vInliers);
+    if(dCost > dBound && i < nMatches)
+    {
+      bPreempted = true;
+      return dCost;
+    }
+  }
+#endif
+
+  for(; i<nMatches; i++)
+  {
+    float fU = m3[0][0] * mvfX1[i] + m3[0][1] * mvfY1[i] + m3[0][2];
+    float fV = m3[1][0] * mvfX1[i] + m3[1][1] * mvfY1[i] + m3[1][2];
+    float fW = m3[2][0] * mvfX1[i] + m3[2][1] * mvfY1[i] + m3[2][2];
+    float fDX = mvfX2[i] - fU / fW;
+    float fDY = mvfY2[i] - fV / fW;
+    float fEX = mvfS00[i] * fDX + mvfS01[i] * fDY;
+    float fEY = mvfS10[i] * fDX + mvfS11[i] * fDY;
+    float fErrorSquared = fEX * fEX + fEY * fEY;
+    if(fErrorSquared < fMaxErrorSquared && (fW > 0.0f || !mParams.bCheirality))
+    {
+      nInliers++;
+      if(bMLESAC)
+        dCost += fErrorSquared;
+    }
+    else
+      dCost += bMLESAC ? fMaxErrorSquared : 1.0;
+    if(((i + 1) % BlockSize) == 0 && dCost > dBound && i + 1 < nMatches)
+    {
+      bPreempted = true;
+      return dCost;
+    }
+  }
+  return dCost;
+}
+
+int HomographyRansac::FindInliers(const Matrix<3> &m3Homography, double dMaxError, std::vector<int> &vnInliers,
+                                  bool bCheirality) const
+{
+  vnInliers.clear();
+  const double dMaxErrorSquared = dMaxError * dMaxError;
+  for(unsigned int i=0; i<size(); i++)
+  {
+    Vector<3> v3Second = m3Homography * unproject(mvv2First[i]);
+    if(bCheirality && !(v3Second[2] > 0.0))
+      continue;
+    Vector<2> v2Error = mvv2Second[i] - project(v3Second);
+    Matrix<2> m2Scale;
+    m2Scale[0] = makeVector(mvfS00[i], mvfS01[i]);
+    m2Scale[1] = makeVector(mvfS10[i], mvfS11[i]);
+    Vector<2> v2Scaled = m2Scale * v2Error;
+    if(v2Scaled * v2Scaled < dMaxErrorSquared)
+      vnInliers.push_back(i);
+  }
+  return vnInliers.size();
+}
+
+Matrix<3> HomographyRansac::Fit(const std::vector<int> &vnIndices) const
+{
+  if(vnIndices.size() == 4)
+  {
+    Matrix<8> m8;
+    Vector<8> v8;
+    for(int n=0; n<4; n++)
+    {
+      const Vector<2> &v2First = mvv2First[vnIndices[n]];
+      const Vector<2> &v2Second = mvv2Second[vnIndices[n]];
+      double x = v2First[0], y = v2First[1];
+      double u = v2Second[0], v = v2Second[1];
+      m8[n*2+0] = makeVector(x, y, 1, 0, 0, 0, -x*u, -y*u);
+      m8[n*2+1] = makeVector(0, 0, 0, x, y, 1, -x*v, -y*v);
+      v8[n*2+0] = u;
+      v8[n*2+1] = v;
+    }
+    Vector<8> v8H = LU<8>(m8).backsub(v8);
+    Matrix<3> m3;
+    m3[0] = v8H.slice<0,3>();
+    m3[1] = v8H.slice<3,3>();
+    m3[2] = makeVector(v8H[6], v8H[7], 1.0);
+    return m3;
+  }
+
+  // The right null-space, as in HomographyInit
+  Matrix<> m2Nx9(2 * vnIndices.size(), 9);
+  for(unsigned int n=0; n<vnIndices.size(); n++)
+  {
+    const Vector<2> &v2First = mvv2First[vnIndices[n]];
+    const Vector<2> &v2Second = mvv2Second[vnIndices[n]];
+    double x = v2First[0], y = v2First[1];
+    double u = v2Second[0], v = v2Second[1];
+    m2Nx9[n*2+0] = makeVector(x, y, 1, 0, 0, 0, -x*u, -y*u, -u);
+    m2Nx9[n*2+1] = makeVector(0, 0, 0, x, y, 1, -x*v, -y*v, -v);
+  }
+  SVD<> svd(m2Nx9);
+  Vector<9> v9H = svd.get_VT()[8];
+  Matrix<3> m3;
+  m3[0] = v9H.slice<0,3>();
+  m3[1] = v9H.slice<3,3>();
+  m3[2] = v9H.slice<6,3>();
+  return m3;
+}
@@ -0,0 +1,111 @@
+// -*- c++ -*-
+//
+// HomographyRansac - robust homography estimation, shared by the stereo
+// initialiser (HomographyInit) and the landing pad detector.
+//
+// Matches are kept as a structure of arrays in floats, so that a
+// hypothesis is scored against four matches at a time with SSE2. The
+// residual of a match is its 2x2 scale (e.g. the camera's projection
+// derivatives, to get pixels) times the second view's error; the cost is
+// either the MLESAC one, the squared residual truncated at the threshold,
+// or the number of outliers.
+//
+// Both costs only grow as matches are added, so a hypothesis is given up
+// as soon as its partial cost is above that of the best one so far: this
+// never changes which hypothesis wins. Hypotheses are drawn in rounds;
+// after each round the number still needed for the given confidence is
+// worked out from the best inlier ratio, and the search stops there.
+// With a WorkerPool, the hypotheses of a round are made and scored in
+// parallel; the samples are all drawn beforehand on the calling thread,
+// so the result does not depend on the number of workers.
+
+#ifndef __HOMOGRAPHYRANSAC_H
+#define __HOMOGRAPHYRANSAC_H
+#include <vector>
+#include <TooN/TooN.h>
+
+namespace ptam{
+
+class WorkerPool;
+
+class HomographyRansac
+{
+public:
+  enum Cost { COST_MLESAC, COST_OUTLIERS };
+
+  struct Params
+  {
+    Params();
+    Cost cost;
+    double dMaxError;       // Inlier threshold, on the scaled residual
+    int nMaxIterations;     // Hypotheses at most
+    double dConfidence;     // Of having drawn an all-inlier sample, to stop early; 0 never stops early
+    bool bCheirality;       // Matches mapped to w <= 0 are outliers, see FindInliers()
+  };
+
+  struct Statistics
+  {
+    int nHypotheses;        // Drawn
+    int nDegenerate;        // Of those, left out as three of the points were in a line
+    int nPreempted;         // Given up before all matches were scored
+    int nBestInliers;
+  };
+
+  HomographyRansac();
+
+  void Clear();
+  // A match, v2Second ~ H v2First; the residual is m2Scale * (v2Second - H(v2First))
+  void Add(const TooN::Vector<2> &v2First, const TooN::Vector<2> &v2Second, const TooN::Matrix<2> &m2Scale);
+  void Add(const TooN::Vector<2> &v2First, const TooN::Vector<2> &v2Second, double dScale);
+  unsigned int size() const { return mvv2First.size(); }
+
+  // The best homography of the hypotheses drawn; false if there are fewer
+  // than four matches. pWorkers may be null; nSeed picks the samples.
+  bool Find(const Params &params, WorkerPool *pWorkers, unsigned int nSeed, TooN::Matrix<3> &m3Best);
+  const Statistics &LastStatistics() const { return mStatistics; }
+
+  // The matches with a residual below dMaxError. With bCheirality, also
+  // only those which H maps to w > 0: as Fit() makes h33 = 1, those on the
+  // same side of the second view's horizon as the first view's origin.
+  // For a plane seen by a camera, those in front of it.
+  int FindInliers(const TooN::Matrix<3> &m3Homography, double dMaxError, std::vector<int> &vnInliers,
+                  bool bCheirality = false) const;
+
+  // Direct linear transform from the matches given: four are solved for
+  // exactly with h33 = 1, more in the least squares sense.
+  TooN::Matrix<3> Fit(const std::vector<int> &vnIndices) const;
+
+protected:
+  struct Hypothesis
+  {
+    int anSample[4];
+    TooN::Matrix<3> m3Homography;
+    double dCost;
+    int nInliers;
+    bool bDegenerate;
+    bool bPreempted;
+  };
+
+  // Cost of the hypothesis, given up once above dBound
+  double Score(const TooN::Matrix<3> &m3Homography, double dBound, int &nInliers, bool &bPreempted) const;
+  void MakeHypotheses(int nJob, int nWorker);
+  bool IsDegenerate(const int *anSample) const;
+
+  std::vector<TooN::Vector<2> > mvv2First;
+  std::vector<TooN::Vector<2> > mvv2Second;
+  // Structure of arrays, for Score()
+  std::vector<float> mvfX1, mvfY1, mvfX2, mvfY2;
+  std::vector<float> mvfS00, mvfS01, mvfS10, mvfS11;
+
+  // Of the current Find(), for the workers
+  Params mParams;
+  std::vector<Hypothesis> mvRound;
+  int mnJobsPerRound;
+  double mdBound;
+
+  Statistics mStatistics;
+};
+
+} // namespace
+
+#endif
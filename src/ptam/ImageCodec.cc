@@ -0,0 +1,111 @@
+#include "ImageCodec.h"
+
+#include <cstring>
+#include <zlib.h>
+
+using namespace CVD;
+using namespace ptam;
+
+namespace {
+ImageCodec::Compression EncodeRows(const unsigned char *pRows, int nStride, int nRowBytes, int nHeight, int nPixelBytes,
+                                   ImageCodec::Compression compression, std::vector<unsigned char> &vData)
+{
+  const int nBytes = nRowBytes * nHeight;
+  if(compression == ImageCodec::COMPRESSION_RAW || nBytes == 0)
+  {
+    vData.resize(nBytes);
+    for(int y=0; y<nHeight; y++)
+      memcpy(&vData[0] + y * nRowBytes, pRows + y * nStride, nRowBytes);
+    return compression;
+  }
+
+  std::vector<unsigned char> vFiltered(nBytes);
+  for(int y=0; y<nHeight; y++)
+  {
+    const unsigned char *pIn = pRows + y * nStride;
+    unsigned char *pOut = &vFiltered[0] + y * nRowBytes;
+    memcpy(pOut, pIn, nPixelBytes);
+    for(int x=nPixelBytes; x<nRowBytes; x++)
+      pOut[x] = pIn[x] - pIn[x - nPixelBytes];
+  }
+  uLongf nCompressed = compressBound(nBytes);
+  vData.resize(nCompressed);
+  if(compress2(&vData[0], &nCompressed, &vFiltered[0], nBytes, Z_BEST_SPEED) != Z_OK)
+    return EncodeRows(pRows, nStride, nRowBytes, nHeight, nPixelBytes, ImageCodec::COMPRESSION_RAW, vData);
+  vData.resize(nCompressed);
+  return compression;
+}
+
+bool DecodeRows(const std::vector<unsigned char> &vData, ImageCodec::Compression compression,
+                unsigned char *pRows, int nStride, int nRowBytes, int nHeight, int nPixelBytes)
+{
+  const int nBytes = nRowBytes * nHeight;
+  if(compression == ImageCodec::COMPRESSION_RAW || nBytes == 0)
+  {
+    if((int) vData.size() != nBytes)
+      return false;
+    for(int y=0; y<nHeight; y++)
+      memcpy(pRows + y * nStride, &vData[0] + y * nRowBytes, nRowBytes);
+    return true;
+  }
+
+  std::vector<unsigned char> vFiltered(nBytes);
+  uLongf nUncompressed = nBytes;
+  if(vData.empty() || uncompress(&vFiltered[0], &nUncompressed, &vData[0], vData.size()) != Z_OK ||
+     (int) nUncompressed != nBytes)
+    return false;
+  for(int y=0; y<nHeight; y++)
+  {
+    const unsigned char *pIn = &vFiltered[0] + y * nRowBytes;
+    unsigned char *pOut = pRows + y * nStride;
+    memcpy(pOut, pIn, nPixelBytes);
+    for(int x=nPixelBytes; x<nRowBytes; x++)
+      pOut[x] = pIn[x] + pOut[x - nPixelBytes];
+  }
+  return true;
+}
+
+template<class T>
+ImageCodec::Compression EncodeImage(const BasicImage<T> &im, ImageCodec::Compression compression, std::vector<unsigned char> &vData)
+{
+  return EncodeRows(reinterpret_cast<const unsigned char *>(im.data()), im.row_stride() * sizeof(T),
+             im.size().x * sizeof(T), im.size().y, sizeof(T), compression, vData);
+}
+
+template<class T>
+bool DecodeImage(const std::vector<unsigned char> &vData, ImageCodec::Compression compression, BasicImage<T> &im)
+{
+  return DecodeRows(vData, compression, reinterpret_cast<unsigned char *>(im.data()), im.row_stride() * sizeof(T),
+                    im.size().x * sizeof(T), im.size().y, sizeof(T));
+}
+}
+
+ImageCodec::Compression ImageCodec::Encode(const BasicImage<byte> &im, Compression compression, std::vector<unsigned char> &vData)
+{
+  return EncodeImage(im, compression, vData);
+}
+
+ImageCodec::Compression ImageCodec::Encode(const BasicImage<uint16_t> &im, Compression compression, std::vector<unsigned char> &vData)
+{
+  return EncodeImage(im, compression, vData);
+}
+
+ImageCodec::Compression ImageCodec::Encode(const BasicImage<Rgb<byte> > &im, Compression compression, std::vector<unsigned char> &vData)
+{
+  return EncodeImage(im, compression, vData);
+}
+
+bool ImageCodec::Decode(const std::vector<unsigned char> &vData, Compression compression, BasicImage<byte> &im)
+{
+  return DecodeImage(vData, compression, im);
+}
+
+bool ImageCodec::Decode(const std::vector<unsigned char> &vData, Compression compression, BasicImage<uint16_t> &im)
+{
+  return DecodeImage(vData, compression, im);
+}
+
+bool ImageCodec::Decode(const std::vector<unsigned char> &vData, Compression compression, BasicImage<Rgb<byte> > &im)
+{
+  return DecodeImage(vData, compression, im);
+}
@@ -0,0 +1,39 @@
+// -*- c++ -*-
+//
+// ImageCodec - lossless packing of keyframe images for the wire.
+//
+// Rows are packed without padding. COMPRESSION_DEFLATE first replaces each
+// byte by its difference from the same byte of the pixel to its left, as
+// PNG's Sub filter does, and then deflates the lot with zlib at its
+// fastest level: smooth images then compress well, for little CPU.
+// Pixels of more than one byte are packed in the machine's byte order.
+
+#ifndef __IMAGECODEC_H
+#define __IMAGECODEC_H
+#include <vector>
+#include <stdint.h>
+#include <cvd/image.h>
+#include <cvd/byte.h>
+#include <cvd/rgb.h>
+
+namespace ptam{
+
+namespace ImageCodec{
+
+enum Compression { COMPRESSION_RAW = 0, COMPRESSION_DEFLATE = 1 };
+
+// Returns the compression used, which is COMPRESSION_RAW if zlib fails
+Compression Encode(const CVD::BasicImage<CVD::byte> &im, Compression compression, std::vector<unsigned char> &vData);
+Compression Encode(const CVD::BasicImage<uint16_t> &im, Compression compression, std::vector<unsigned char> &vData);
+Compression Encode(const CVD::BasicImage<CVD::Rgb<CVD::byte> > &im, Compression compression, std::vector<unsigned char> &vData);
+
+// The image has to be of the size encoded; false if the data doesn't fit it
+bool Decode(const std::vector<unsigned char> &vData, Compression compression, CVD::BasicImage<CVD::byte> &im);
+bool Decode(const std::vector<unsigned char> &vData, Compression compression, CVD::BasicImage<uint16_t> &im);
+bool Decode(const std::vector<unsigned char> &vData, Compression compression, CVD::BasicImage<CVD::Rgb<CVD::byte> > &im);
+
+} // namespace ImageCodec
+
+} // namespace
+
+#endif
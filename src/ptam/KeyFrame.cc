@@ -32,7 +32,6 @@ void KeyFrame::MakeKeyFrame_Lite(BasicImage<byte> &im, int nCam)
 
   copy(im, aLevels[0].im);
 
-  static int imnum = 1;
   // Then, for each level...
   for(int i=0; i<LEVELS; i++)
     {
@@ -57,30 +56,17 @@ void KeyFrame::MakeKeyFrame_Lite(BasicImage<byte> &im, int nCam)
       lev.vCorners.clear();
       lev.vCandidates.clear();
       lev.vMaxCorners.clear();
+      lev.vMaxCornersDepth.clear();
 
       if (!nCam){
-          if (imnum == 0)// for landing pad ref img
-          {
-              if(i == 0)
-                  fast_corner_detect_10(lev.im, lev.vCorners, 20);
-              if(i == 1)
-                  fast_corner_detect_10(lev.im, lev.vCorners, 20);
-              if(i == 2)
-                  fast_corner_detect_10(lev.im, lev.vCorners, 14);
-              if(i == 3)
-                  fast_corner_detect_10(lev.im, lev.vCorners, 12);
-          }
-          else
-          {
-              if(i == 0)
-                  fast_corner_detect_10(lev.im, lev.vCorners, 20);//16
-              if(i == 1)
-                  fast_corner_detect_10(lev.im, lev.vCorners, 18);//14
-              if(i == 2)
-                  fast_corner_detect_10(lev.im, lev.vCorners, 14);//12
-              if(i == 3)
-                  fast_corner_detect_10(lev.im, lev.vCorners, 14);
-          }
+          if(i == 0)
+              fast_corner_detect_10(lev.im, lev.vCorners, 20);//16
+          if(i == 1)
+              fast_corner_detect_10(lev.im, lev.vCorners, 18);//14
+          if(i == 2)
+              fast_corner_detect_10(lev.im, lev.vCorners, 14);//12
+          if(i == 3)
+              fast_corner_detect_10(lev.im, lev.vCorners, 14);
       }
       else
       {
@@ -107,11 +93,10 @@ void KeyFrame::MakeKeyFrame_Lite(BasicImage<byte> &im, int nCam)
 //      std::cout << "lev size: " << lev.vCorners.size() << std::endl;
 
 
-      lev.vCornersDepth.resize(lev.vCorners.size(),0.);
+      lev.vCornersDepth.assign(lev.vCorners.size(),0.);
       
       createRowLookupTable(i);
     };
-  imnum = 1;
 }
 
 void KeyFrame::MakeKeyFrame_Rest()
@@ -119,110 +104,110 @@ void KeyFrame::MakeKeyFrame_Rest()
   // Fills the rest of the keyframe structure needed by the mapmaker:
   // FAST nonmax suppression, generation of the list of candidates for further map points,
   // creation of the relocaliser's SmallBlurryImage.
-  static gvar3<double> gvdCandidateMinSTScore("MapMaker.CandidateMinShiTomasiScore", 70, SILENT);
-  
-  // For each level...
+  double dMinSTScore = CandidateMinSTScore();
   for(int l=0; l<LEVELS; l++)
+    MakeLevel_Rest(l, NULL, dMinSTScore);
+  MakeKeyFrame_Finish();
+}
+
+// Read from the thread which feeds the levels to MakeLevel_Rest(): gvars
+// must not be first registered in a worker thread.
+double KeyFrame::CandidateMinSTScore()
+{
+  static gvar3<double> gvdCandidateMinSTScore("MapMaker.CandidateMinShiTomasiScore", 70, SILENT);
+  return *gvdCandidateMinSTScore;
+}
+
+// The per-level part of MakeKeyFrame_Rest(): levels are independent of each
+// other, so KeyFrameBuilder runs them in parallel. With a depth pyramid, the
+// maximal corners and candidates get their depth from its level l.
+void KeyFrame::MakeLevel_Rest(int l, const DepthPyramid *pDepth, double dMinSTScore)
+{
+  Level &lev = aLevels[l];
+  lev.vCandidates.clear();
+  // .. find those FAST corners which are maximal..
+  fast_nonmax(lev.im, lev.vCorners, 10, lev.vMaxCorners);
+  if(pDepth)
+    pDepth->Sample(l, lev.vMaxCorners, lev.vMaxCornersDepth);
+  else
+    lev.vMaxCornersDepth.assign(lev.vMaxCorners.size(), 0.0);
+
+  // .. and then calculate the Shi-Tomasi scores of those, and keep the ones with
+  // a suitably high score as Candidates, i.e. points which the mapmaker will attempt
+  // to make new map points out of.
+  std::vector<ImageRef> virScored;
+  std::vector<int> vnScored;
+  std::vector<double> vdScores;
+  virScored.reserve(lev.vMaxCorners.size());
+  vnScored.reserve(lev.vMaxCorners.size());
+  for(unsigned int i=0; i<lev.vMaxCorners.size(); i++)
+    if(lev.im.in_image_with_border(lev.vMaxCorners[i], 10))
     {
-      Level &lev = aLevels[l];
-      // .. find those FAST corners which are maximal..
-      fast_nonmax(lev.im, lev.vCorners, 10, lev.vMaxCorners);
-      lev.vMaxCornersDepth.resize(lev.vMaxCorners.size(),0.0);
-      // .. and then calculate the Shi-Tomasi scores of those, and keep the ones with
-      // a suitably high score as Candidates, i.e. points which the mapmaker will attempt
-      // to make new map points out of.
-      unsigned int ind = 0;
-      for(vector<ImageRef>::iterator i=lev.vMaxCorners.begin(); i!=lev.vMaxCorners.end(); i++, ind++)
-	{
-	  if(!lev.im.in_image_with_border(*i, 10))
-	    continue;
-	  double dSTScore = FindShiTomasiScoreAtPoint(lev.im, 3, *i);
-	  if(dSTScore > *gvdCandidateMinSTScore)
-	    {
-	      Candidate c;
-	      c.irLevelPos = *i;
-              c.dSTScore = dSTScore;
-              c.dDepth = 0.0;
-              lev.vCandidates.push_back(c);
-	    }
-	}
+      virScored.push_back(lev.vMaxCorners[i]);
+      vnScored.push_back(i);
     }
-  
+  FindShiTomasiScores(lev.im, 3, virScored, vdScores);
+
+  for(unsigned int i=0; i<virScored.size(); i++)
+    if(vdScores[i] > dMinSTScore)
+    {
+      Candidate c;
+      c.irLevelPos = virScored[i];
+      c.dSTScore = vdScores[i];
+      c.dDepth = lev.vMaxCornersDepth[vnScored[i]];
+      lev.vCandidates.push_back(c);
+    }
+}
+
+// Depth of all FAST corners, [m]; 0 where there is none
+void KeyFrame::MakeCornerDepths(const DepthPyramid &depth)
+{
+  for (int l = 0; l < LEVELS; l++)
+    depth.Sample(l, aLevels[l].vCorners, aLevels[l].vCornersDepth);
+}
+
+// The maximal corners of level l, with the depths MakeCornerDepths() gave
+// its FAST corners, for a frame which MakeLevel_Rest() has not been run on
+void KeyFrame::MakeMaxCorners(int l)
+{
+  Level &lev = aLevels[l];
+  fast_nonmax(lev.im, lev.vCorners, 10, lev.vMaxCorners);
+  lev.vMaxCornersDepth.assign(lev.vMaxCorners.size(), 0.0);
+  for(unsigned int i=0; i<lev.vMaxCorners.size(); i++)
+  {
+    const ImageRef &ir = lev.vMaxCorners[i];
+    for(unsigned int j=lev.vCornerRowLUT[ir.y]; j<lev.vCorners.size() && lev.vCorners[j].y == ir.y; j++)
+      if(lev.vCorners[j] == ir)
+      {
+        lev.vMaxCornersDepth[i] = lev.vCornersDepth[j];
+        break;
+      }
+  }
+}
+
+void KeyFrame::MakeKeyFrame_Finish()
+{
   // Also, make a SmallBlurryImage of the keyframe: The relocaliser uses these.
-  SBI = SmallBlurryImage(*this);  
+  SBI = SmallBlurryImage(*this);
   // Relocaliser also wants the jacobians..
   SBI.MakeJacs();
   bComplete = true;
-
-  // for landing pad detection
-  islandingpadDetected = false;
-  mPadCorners.clear();
-  mMapPointsInPad.clear();
 }
 
 void KeyFrame::MakeKeyFrame(BasicImage<byte> &im,CVD::BasicImage<uint16_t> &depth, CameraModel* cam)
 {
     MakeKeyFrame_Lite(im);
-
-    for (int l = 0; l < LEVELS; l++) {
-        Level& lev = aLevels[l];
-        lev.vCornersDepth.resize(lev.vCorners.size());
-        for (unsigned int i = 0; i < lev.vCorners.size(); i++) {
-            ImageRef irLev = lev.vCorners[i];
-            ImageRef irL0 = LevelZeroPosIR(irLev,l);
-            double d = depth[irL0]/1000.0;
-//            if (d = isnan(d) || d > mMaxDepth)
-//                d = 0.0;
-            d = isnan(d) ? 0.0 : d;
-            lev.vCornersDepth[i] = d;
-        }
-    }
+    DepthPyramid pyramid;
+    pyramid.Make(depth, LEVELS, DepthPyramid::FillRadius());
+    MakeCornerDepths(pyramid);
 
     // Fills the rest of the keyframe structure needed by the mapmaker:
     // FAST nonmax suppression, generation of the list of candidates for further map points,
     // creation of the relocaliser's SmallBlurryImage.
-    static gvar3<double> gvdCandidateMinSTScore("MapMaker.CandidateMinShiTomasiScore", 70, SILENT);
-
-    // For each level...
+    double dMinSTScore = CandidateMinSTScore();
     for(int l=0; l<LEVELS; l++)
-      {
-        Level &lev = aLevels[l];
-        // .. find those FAST corners which are maximal..
-        fast_nonmax(lev.im, lev.vCorners, 10, lev.vMaxCorners);
-        // .. and then calculate the Shi-Tomasi scores of those, and keep the ones with
-        // a suitably high score as Candidates, i.e. points which the mapmaker will attempt
-        // to make new map points out of.
-        unsigned int ind = 0;
-        lev.vMaxCornersDepth.resize(lev.vMaxCorners.size());
-        for(vector<ImageRef>::iterator i=lev.vMaxCorners.begin(); i!=lev.vMaxCorners.end(); i++, ind++)
-          {
-
-              ImageRef irL0 = LevelZeroPosIR(*i,l);
-              double d = depth[irL0]/1000.0;
-              d = isnan(d) ? 0.0 : d;
-              lev.vMaxCornersDepth[ind] = d;
-
-              if(!lev.im.in_image_with_border(*i, 10))
-                  continue;
-              double dSTScore = FindShiTomasiScoreAtPoint(lev.im, 3, *i);
-              if(dSTScore > *gvdCandidateMinSTScore)
-              {
-                  Candidate c;
-                  c.irLevelPos = *i;
-                  c.dSTScore = dSTScore;
-                  c.dDepth = d;
-                  lev.vCandidates.push_back(c);
-              }
-          }
-
-//        std::cout << __PRETTY_FUNCTION__ << " level: " << l << ", candidates: " << lev.vCandidates.size() << std::endl;
-      };
-
-    // Also, make a SmallBlurryImage of the keyframe: The relocaliser uses these.
-    SBI = SmallBlurryImage(*this);
-    // Relocaliser also wants the jacobians..
-    SBI.MakeJacs();
-    bComplete = true;
+        MakeLevel_Rest(l, &pyramid, dMinSTScore);
+    MakeKeyFrame_Finish();
 }
 
 // Initializes a keyframe with data from sparse stereo matching
@@ -318,11 +303,28 @@ void KeyFrame::createRowLookupTable(int level) {
 	}
 }
 
-void KeyFrame::finalizeKeyframeBackend()
+namespace {
+void LevelImages(const Level *aLevels, const BasicImage<byte> **apim)
+{
+    for (int l = 0; l < LEVELS; l++)
+        apim[l] = &aLevels[l].im;
+}
+
+// The maximal corners of the first nLevels levels, with their depth
+void AddMaxCorners(const Level *aLevels, int nLevels, BriefFeatures &features)
+{
+    for (int l = 0; l < nLevels; l++) {
+        const Level &lev = aLevels[l];
+        for (unsigned int k = 0; k < lev.vMaxCorners.size(); k++)
+            features.Add(LevelZeroPos(lev.vMaxCorners[k], l), l, lev.vMaxCornersDepth[k], k);
+    }
+}
+}
+
+void KeyFrame::finalizeKeyframeBackend(BriefExtractor &extractor)
 {
     if(finalized || !mMeasurements.size())
         return;
-    /// TODO: descript points on the correct level!
 
     mapPoints.clear();
     for(const_meas_it it = mMeasurements.begin(); it != mMeasurements.end(); it++) {
@@ -343,223 +345,86 @@ void KeyFrame::finalizeKeyframeBackend()
     }
     cout << "mapPoints: " << mapPoints.size() << endl;
 
-    boost::scoped_ptr<cv::DescriptorExtractor> extractor(new cv::BriefDescriptorExtractor(32));
-
-    std::vector<std::vector<cv::KeyPoint> >mpKpts(LEVELS);
-    for (uint i = 0; i < mapPoints.size(); i++) {
-        int l = mapPoints[i]->nSourceLevel;
-        cv::KeyPoint kp(cv::Point2f(mapPoints[i]->irCenterZero[0], mapPoints[i]->irCenterZero[1]),
-                        (1 << l)*10, // TODO: feature size to be adjusted
-                        -1, 0,
-                        l);
-
-        kp.class_id = i; // store index of original map point
-        mpKpts[l].push_back(kp);
-    }
-
-    // compute descriptors of map points and all corners(for loop detection)
-    Level &lev = aLevels[0];
-    ImageRef irsize = lev.im.size();
-
-    // Make sure image is actually copied:
-    cv::Mat cv_im = cv::Mat(irsize[1], irsize[0], CV_8UC1,
-                        (void*) lev.im.data(), lev.im.row_stride()).clone();
-    cvImgDebug = cv_im;
-    std::vector<boost::shared_ptr<MapPoint> > mpNew;
-    mpKeypoints.clear();
-    keypoints.clear();
-    mpDescriptors.release();
-    kpDescriptors.release();
-    for (uint l = 0; l < 2; l++) {
-        if (!mpKpts[l].size())
-            continue;
-
-        cv::Mat levDesc;
-        // Warning: this modifies kpts (deletes keypoints for which it cannot compute a descriptor)
-        extractor->compute(cv_im, mpKpts[l], levDesc);
-
-        assert(mpKpts[l].size() == levDesc.rows);
+    // map points on their source level, and all corners (for loop detection),
+    // both on the first two levels only
+    const BasicImage<byte> *apim[LEVELS];
+    LevelImages(aLevels, apim);
 
-        mpDescriptors.push_back(levDesc);
+    mpFeatures.clear();
+    mpFeatures.reserve(mapPoints.size());
+    for (unsigned int i = 0; i < mapPoints.size(); i++)
+        mpFeatures.Add(LevelZeroPos(mapPoints[i]->irCenter, mapPoints[i]->nSourceLevel),
+                       mapPoints[i]->nSourceLevel, 0.0f, i);
+    extractor.Describe(apim, 2, mpFeatures);
 
-        // Keep only map points with descriptors:
-        for (int i = 0; i < mpKpts[l].size(); i++) {
-            mpKeypoints.push_back(mpKpts[l][i]);
-            mpNew.push_back(mapPoints[mpKpts[l][i].class_id]);
-        }
-        assert(mpDescriptors.rows == mpKeypoints.size());
-
-        // for all corners
-        Level &lev1 = aLevels[l];
-        int scaleFactor = (1 << l);
-        std::vector<cv::KeyPoint> kpts;
-        kpts.resize(lev1.vMaxCorners.size());
-
-        for (uint k = 0; k < kpts.size(); k++) {
-            kpts[k].pt.x = lev1.vMaxCorners[k].x*scaleFactor;
-            kpts[k].pt.y = lev1.vMaxCorners[k].y*scaleFactor;
-            kpts[k].octave = l;
-            kpts[k].angle = -1;
-            kpts[k].size = (1 << l)*10; // setting this is required for DescriptorExtractors to work.
-
-            // Abuse response field, but we have to keep this keypoint's depth somewhere
-            kpts[k].response = lev1.vMaxCornersDepth[k];
-        }
-        cout << "IN the current kf, mpKpts, keypoints: "<<
-                mpKpts[l].size() << ", " << kpts.size() << endl;
-
-        cv::Mat levkpDesc;
-        // Warning: this modifies kpts (deletes keypoints for which it cannot compute a descriptor)
-        extractor->compute(cv_im, kpts, levkpDesc);
-
-        assert(levkpDesc.rows == kpts.size());
+    // Keep only map points with descriptors:
+    std::vector<boost::shared_ptr<MapPoint> > mpNew(mpFeatures.size());
+    for (unsigned int i = 0; i < mpFeatures.size(); i++)
+        mpNew[i] = mapPoints[mpFeatures.vnSource[i]];
+    mapPoints.swap(mpNew);
 
-        // concatenate all levels
-        kpDescriptors.push_back(levkpDesc);
-        keypoints.insert( keypoints.end(), kpts.begin(), kpts.end() );
-    }
-    mapPoints = mpNew;
+    kpFeatures.clear();
+    AddMaxCorners(aLevels, 2, kpFeatures);
+    extractor.Describe(apim, 2, kpFeatures);
 
     cout << "mapPoints: " << mapPoints.size() << endl;
-    cout << "IN the current kf, all describ. all keypoints: "
-         << kpDescriptors.rows << ", " << keypoints.size() << endl;
-
-    // extract depth again
-    kpDepth.resize(keypoints.size());
-    for (unsigned int i = 0; i < keypoints.size(); i++) {
-        kpDepth[i] = keypoints[i].response;
-    }
+    cout << "IN the current kf, all describ. all keypoints: " << kpFeatures.size() << endl;
 
     finalized = true;
 }
 
-void KeyFrame::finalizeKeyframeGoodkf()
+void KeyFrame::describeGoodkf(BriefExtractor &extractor, std::vector<boost::shared_ptr<MapPoint> > &vpPoints,
+                              BriefFeatures &features) const
 {
-    if(finalizGoodkf || !mMeasurements.size())
-        return;
-
-    mapPointsFirstLevel.clear();
+    vpPoints.clear();
+    features.clear();
     for(const_meas_it it = mMeasurements.begin(); it != mMeasurements.end(); it++) {
-        boost::shared_ptr<MapPoint> point = it->first;
-        if (point->pPatchSourceKF.lock() //&& source kf not removed
-                )
-        {
-            // relative pose of the map points to this kf! (not neccecerrily the source kf!):
-//            if (point->pPatchSourceKF.lock()->id != id)
-            if (!point->nSourceLevel) // only points on level 0
-                continue;
-            point->v3RelativePos = se3CfromW*point->v3WorldPos;
-            point->irCenterZero = LevelZeroPosIR(point->irCenter,point->nSourceLevel);
-
-            mapPointsFirstLevel.push_back(point);
-        }
-    }
-    cout << "mapPoints for relocalization: " << mapPointsFirstLevel.size() << endl;
-
-    boost::scoped_ptr<cv::DescriptorExtractor> extractor(new cv::BriefDescriptorExtractor(32));
-
-    std::vector<cv::KeyPoint> mpKpts;
-    for (uint i = 0; i < mapPointsFirstLevel.size(); i++) {
-        int l = 0;
-        cv::KeyPoint kp(cv::Point2f(mapPointsFirstLevel[i]->irCenterZero[0], mapPointsFirstLevel[i]->irCenterZero[1]),
-                        (1 << l)*10, // TODO: feature size to be adjusted
-                        -1, 0,
-                        l);
-
-        kp.class_id = i; // store index of original map point
-        mpKpts.push_back(kp);
+        // only points measured on level 0, whose source kf has not been removed
+        if (it->second.nLevel != 0 || !it->first->pPatchSourceKF.lock())
+            continue;
+        // The descriptors are computed on this kf's image, so at the positions
+        // the points were measured here, not at their source kf corners
+        features.Add(it->second.v2RootPos, 0, it->second.dDepth, vpPoints.size());
+        vpPoints.push_back(it->first);
     }
-
-    // compute descriptors of map points and all corners(for loop detection)
-    Level &lev = aLevels[0];
-    ImageRef irsize = lev.im.size();
-
-    // Make sure image is actually copied:
-    cv::Mat cv_im = cv::Mat(irsize[1], irsize[0], CV_8UC1,
-                        (void*) lev.im.data(), lev.im.row_stride()).clone();
-    cvImgDebug = cv_im;
-    std::vector<boost::shared_ptr<MapPoint> > mpNew;
-    mpFirstKeypoints.clear();
-    mpFDescriptors.release();
-
-    if (!mpKpts.size())
+    if (!features.size())
         return;
 
-    cv::Mat levDesc;
-    // Warning: this modifies kpts (deletes keypoints for which it cannot compute a descriptor)
-    extractor->compute(cv_im, mpKpts, levDesc);
-
-    assert(mpKpts.size() == levDesc.rows);
-
-    mpFDescriptors.push_back(levDesc);
+    const BasicImage<byte> *apim[LEVELS];
+    LevelImages(aLevels, apim);
+    extractor.Describe(apim, 1, features);
 
     // Keep only map points with descriptors:
-    for (int i = 0; i < mpKpts.size(); i++) {
-        mpFirstKeypoints.push_back(mpKpts[i]);
-        mpNew.push_back(mapPointsFirstLevel[mpKpts[i].class_id]);
+    std::vector<boost::shared_ptr<MapPoint> > vpDescribed(features.size());
+    for (unsigned int i = 0; i < features.size(); i++) {
+        vpDescribed[i] = vpPoints[features.vnSource[i]];
+        features.vnSource[i] = i;
     }
-    assert(mpFDescriptors.rows == mpFirstKeypoints.size());
-
-    mapPointsFirstLevel = mpNew;
-
-    cout << "mapPoints: " << mapPointsFirstLevel.size() << endl;
+    vpPoints.swap(vpDescribed);
+}
 
+void KeyFrame::finalizeKeyframeGoodkf(std::vector<boost::shared_ptr<MapPoint> > &vpPoints, BriefFeatures &features)
+{
+    if (finalizGoodkf || !vpPoints.size())
+        return;
+    mapPointsFirstLevel.swap(vpPoints);
+    mpFirstFeatures.swap(features);
+    cout << "mapPoints for relocalization: " << mapPointsFirstLevel.size() << endl;
     finalizGoodkf = true;
 }
 
-void KeyFrame::finalizeKeyframekpts()
+void KeyFrame::finalizeKeyframekpts(BriefExtractor &extractor)
 {
-    static boost::scoped_ptr<cv::DescriptorExtractor> extractor(new cv::BriefDescriptorExtractor(32));
-
-    // compute descriptors of all corners
-    // Make sure image is actually copied:
-    Level &lev = aLevels[0];
-    ImageRef irsize = lev.im.size();
-    cv::Mat cv_im = cv::Mat(irsize[1], irsize[0], CV_8UC1,
-                        (void*) lev.im.data(), lev.im.row_stride()).clone();
-    cvImgDebug = cv_im;
-    keypoints.clear();
-    kpDescriptors.release();
-    for (uint l = 0; l < 1; l++) {
-        Level &lev1 = aLevels[l];
-
-        // for all corners
-        int scaleFactor = (1 << l);
-        std::vector<cv::KeyPoint> kpts;
-        kpts.resize(lev1.vMaxCorners.size());
-
-        for (uint k = 0; k < kpts.size(); k++) {
-            kpts[k].pt.x = lev1.vMaxCorners[k].x*scaleFactor;
-            kpts[k].pt.y = lev1.vMaxCorners[k].y*scaleFactor;
-            kpts[k].octave = l;
-            kpts[k].angle = -1;
-            kpts[k].size = (1 << l)*10; // setting this is required for DescriptorExtractors to work.
-
-            // Abuse response field, but we have to keep this keypoint's depth somewhere
-            kpts[k].response = lev1.vMaxCornersDepth[k];
-        }
-        if (!kpts.size())
-            continue;
-
-        cout << "in the current kf, keypoints: "<< kpts.size() << endl;
-
-        cv::Mat levkpDesc;
-        // Warning: this modifies kpts (deletes keypoints for which it cannot compute a descriptor)
-        extractor->compute(cv_im, kpts, levkpDesc);
-
-        assert(levkpDesc.rows == kpts.size());
-
-        // concatenate all levels
-        kpDescriptors.push_back(levkpDesc);
-        keypoints.insert( keypoints.end(), kpts.begin(), kpts.end() );
-    }
-    cout << "in the current kf for reloc., all kpdesc. keypoints: " << kpDescriptors.rows << ", " << keypoints.size() << endl;
-
-    // extract depth again
-    kpDepth.resize(keypoints.size());
-    for (unsigned int i = 0; i < keypoints.size(); i++) {
-        kpDepth[i] = keypoints[i].response;
-    }
+    // compute descriptors of all corners on level 0; a tracked frame is
+    // made lite (KeyFrameBuilder::AddLite()), and has no maximal corners yet
+    if (!bComplete)
+        MakeMaxCorners(0);
+    const BasicImage<byte> *apim[LEVELS];
+    LevelImages(aLevels, apim);
+    kpFeatures.clear();
+    AddMaxCorners(aLevels, 1, kpFeatures);
+    extractor.Describe(apim, 1, kpFeatures);
+    cout << "in the current kf for reloc., all kpdesc. keypoints: " << kpFeatures.size() << endl;
 }
 
 //void KeyFrame::createRowLookupTable_sec(int level) {
@@ -575,6 +440,48 @@ void KeyFrame::finalizeKeyframekpts()
 //    }
 //}
 
+void KeyFrame::Recycle()
+{
+  nSourceCamera = 0;
+  mAssociateKeyframe = false;
+  mAssociatedinFinalQueue = false;
+  id = -1;
+  updatedByGMap = false;
+  SentToGMap = false;
+  pointSent = false;
+  rgbIsBgr_ = false;
+  finalized = false;
+  finalizGoodkf = false;
+  mbKFlocked = false;
+  bComplete = false;
+  bFixed = false;
+  bNewsec = false;
+  islandingpadDetected = false;
+
+  // Whatever ties the frame to the map goes; the images stay
+  mMeasurements.clear();
+  mapPoints.clear();
+  mapPointsFirstLevel.clear();
+  mMapPointsInPad.clear();
+  mPadCorners.clear();
+  mPadCornersWorld.clear();
+  mpFeatures.clear();
+  kpFeatures.clear();
+  mpFirstFeatures.clear();
+  edges.clear();
+  neighbor_ids_ordered_by_distance.clear();
+  for(int l=0; l<LEVELS; l++)
+  {
+    aLevels[l].bImplaneCornersCached = false;
+    aLevels[l].vImplaneCorners.clear();
+    aLevels[l].vCandidates.clear();
+    aLevels[l].vMaxCorners.clear();
+    aLevels[l].vMaxCornersDepth.clear();
+  }
+  SBI = SmallBlurryImage();
+  SBIsec = SmallBlurryImage();
+}
+
 // The keyframe struct is quite happy with default operator=, but Level needs its own
 // to override CVD's reference-counting behaviour.
 Level& Level::operator=(const Level &rhs)
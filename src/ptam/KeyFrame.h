@@ -35,6 +35,9 @@
 
 #include "CameraModel.h"
 #include "SmallBlurryImage.h"
+#include "CornerGrid.h"
+#include "BriefExtractor.h"
+#include "DepthPyramid.h"
 
 #define mMaxDepth 4.0 // maximal depth allowed for using the depth measurement
 
@@ -84,6 +87,7 @@ struct Level
   
   bool bImplaneCornersCached;           // Also keep image-plane (z=1) positions of FAST corners to speed up epipolar search
   std::vector<TooN::Vector<2> > vImplaneCorners; // Corner points un-projected into z=1-plane coordinates
+  CornerGrid ImplaneGrid;                // Bucket grid over vImplaneCorners for the epipolar search
 };
 
 struct TimeStamp
@@ -138,6 +142,7 @@ struct KeyFrame
       mbKFlocked = false;
   }
   virtual ~KeyFrame() {};
+  void Recycle();   // Back to the state of a new keyframe, but the buffers keep their memory; see FramePool
   int id; // for a mappoint, it is the id of its source keyframe, it has to be updated whenever its current
           // source kf is removed from the local map, to a oldest existing kf in the local map
   bool updatedByGMap; // has been updated according to gmap?
@@ -153,6 +158,11 @@ struct KeyFrame
   void MakeKeyFrame_Lite(CVD::BasicImage<CVD::byte> &im, int nCam = 0);   // This takes an image and calculates pyramid levels etc to fill the
                                                             // keyframe data structures with everything that's needed by the tracker..
   void MakeKeyFrame_Rest();                                 // ... while this calculates the rest of the data which the mapmaker needs.
+  void MakeLevel_Rest(int nLevel, const DepthPyramid *pDepth, double dMinSTScore); // One level's part of that; levels may run in parallel
+  static double CandidateMinSTScore();                      // The usual dMinSTScore
+  void MakeCornerDepths(const DepthPyramid &depth);         // vCornersDepth of all levels from a depth pyramid
+  void MakeMaxCorners(int nLevel);                          // Just the maximal corners of a level, for a frame made lite
+  void MakeKeyFrame_Finish();                               // The SmallBlurryImage, once all levels are done
   void MakeKeyFrame(CVD::BasicImage<CVD::byte> &im, CVD::BasicImage<uint16_t> &depth,CameraModel* cam); // Try & extract 3d positions for all non max FAST corners
   // Version for sparse stereo data
   void MakeKeyFrame(CVD::BasicImage<CVD::byte> &im, const sensor_msgs::PointCloud& points, CameraModel* cam);
@@ -196,28 +206,24 @@ struct KeyFrame
   TooN::SE3<> se3Cam2fromCam1; // store each transformation, when assuming dual cameras
 
   /// only for the back-end processes ///////////////
-  void finalizeKeyframeBackend(); /// further process (compute descriptors of) the keyframe for the loop cloure detection
-  void finalizeKeyframekpts(); /// further process (compute descriptors of the corners of) the keyframe for relocalization
+  void finalizeKeyframeBackend(BriefExtractor &extractor); /// further process (compute descriptors of) the keyframe for the loop cloure detection
+  void finalizeKeyframekpts(BriefExtractor &extractor); /// further process (compute descriptors of the corners of) the keyframe for relocalization
   bool finalized; /// finalized for the loop closing
   std::vector<boost::shared_ptr<MapPoint> > mapPoints;  /// measured map points in this keyframe
-  std::vector<cv::KeyPoint> mpKeypoints;
-  cv::Mat mpDescriptors; /// descriptors for map points
-  cv::Mat kpDescriptors; /// for all corners
-  std::vector<cv::KeyPoint> keypoints; /// all corners
-  std::vector<float> kpDepth; /// Depth values at keypoint locations or 0 if unavailable.
-
-  /// for relocalization
-  void finalizeKeyframeGoodkf(); /// we only care about the zero-level features for relocalization
-  bool finalizGoodkf;
+  BriefFeatures mpFeatures; /// descriptors for map points, in the order of mapPoints
+  BriefFeatures kpFeatures; /// for all corners; vnSource is the index into the level's vMaxCorners
+
+  /// for relocalization: we only care about the zero-level features.
+  /// Describing only reads the keyframe, so it can run without write access
+  /// to the map; the result is then swapped in by finalizeKeyframeGoodkf().
+  void describeGoodkf(BriefExtractor &extractor, std::vector<boost::shared_ptr<MapPoint> > &vpPoints,
+                      BriefFeatures &features) const;
+  void finalizeKeyframeGoodkf(std::vector<boost::shared_ptr<MapPoint> > &vpPoints, BriefFeatures &features);
+  bool finalizGoodkf; /// read under an upgrade lock of the map, set under a unique one
   std::vector<boost::shared_ptr<MapPoint> > mapPointsFirstLevel;
-  std::vector<cv::KeyPoint> mpFirstKeypoints;
-  cv::Mat mpFDescriptors;
+  BriefFeatures mpFirstFeatures; /// in the order of mapPointsFirstLevel
   bool mbKFlocked; /// kf locked after failure
 
-  /// for debug only////
-  cv::Mat cvImgDebug;
-  //////////////////////
-
   typedef std::map<int, boost::shared_ptr<Edge> > EdgeMap;
   EdgeMap edges; // Outgoing edges to other keyframes
   std::multimap<double, int> neighbor_ids_ordered_by_distance;
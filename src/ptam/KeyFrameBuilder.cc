@@ -0,0 +1,102 @@
+#include "KeyFrameBuilder.h"
+#include "KeyFrame.h"
+
+#include <boost/bind.hpp>
+
+using namespace CVD;
+using namespace ptam;
+
+KeyFrameBuilder::KeyFrameBuilder(WorkerPool &pool)
+  : mPool(pool), mdMinSTScore(0.0), mnFillRadius(0)
+{
+}
+
+void KeyFrameBuilder::Add(KeyFrame &kf, BasicImage<byte> &im, const BasicImage<uint16_t> *pDepth)
+{
+  Item item;
+  item.pKF = &kf;
+  item.pim = &im;
+  item.pDepth = pDepth;
+  item.bRest = true;
+  item.bFinish = true;
+  mvItems.push_back(item);
+}
+
+void KeyFrameBuilder::AddLite(KeyFrame &kf, BasicImage<byte> &im, const BasicImage<uint16_t> *pDepth)
+{
+  Item item;
+  item.pKF = &kf;
+  item.pim = &im;
+  item.pDepth = pDepth;
+  item.bRest = false;
+  item.bFinish = false;
+  mvItems.push_back(item);
+}
+
+void KeyFrameBuilder::AddMade(KeyFrame &kf)
+{
+  Item item;
+  item.pKF = &kf;
+  item.pim = NULL;
+  item.bRest = !kf.bComplete;
+  item.pDepth = (item.bRest && kf.depthImage.totalsize()) ? &kf.depthImage : NULL;
+  item.bFinish = true;
+  mvItems.push_back(item);
+}
+
+void KeyFrameBuilder::Run()
+{
+  if(mvDepths.size() < mvItems.size())
+    mvDepths.resize(mvItems.size());
+  mnFillRadius = DepthPyramid::FillRadius();
+  mPool.ParallelFor(mvItems.size(), boost::bind(&KeyFrameBuilder::MakeLite, this, _1, _2));
+
+  // Level by level, so that the big levels of all keyframes go first
+  mvLevelJobs.clear();
+  for(int l=0; l<LEVELS; l++)
+    for(unsigned int i=0; i<mvItems.size(); i++)
+      if(mvItems[i].bRest)
+        mvLevelJobs.push_back(std::make_pair(i, l));
+  mdMinSTScore = KeyFrame::CandidateMinSTScore();
+  mPool.ParallelFor(mvLevelJobs.size(), boost::bind(&KeyFrameBuilder::MakeLevel, this, _1, _2));
+
+  mPool.ParallelFor(mvItems.size(), boost::bind(&KeyFrameBuilder::Finish, this, _1, _2));
+  mvbDepthMade.resize(mvItems.size());
+  for(unsigned int i=0; i<mvItems.size(); i++)
+    mvbDepthMade[i] = mvItems[i].pDepth != NULL;
+  mvItems.clear();
+}
+
+const DepthPyramid *KeyFrameBuilder::LastDepth(unsigned int nItem) const
+{
+  if(nItem >= mvbDepthMade.size() || !mvbDepthMade[nItem])
+    return NULL;
+  return &mvDepths[nItem];
+}
+
+void KeyFrameBuilder::MakeLite(int nJob, int nWorker)
+{
+  Item &item = mvItems[nJob];
+  if(item.pDepth)
+    mvDepths[nJob].Make(*item.pDepth, LEVELS, mnFillRadius);
+  if(!item.pim)
+    return;
+  item.pKF->MakeKeyFrame_Lite(*item.pim);
+  if(item.pDepth)
+    item.pKF->MakeCornerDepths(mvDepths[nJob]);
+}
+
+void KeyFrameBuilder::MakeLevel(int nJob, int nWorker)
+{
+  int nItem = mvLevelJobs[nJob].first;
+  const Item &item = mvItems[nItem];
+  item.pKF->MakeLevel_Rest(mvLevelJobs[nJob].second, item.pDepth ? &mvDepths[nItem] : NULL, mdMinSTScore);
+}
+
+void KeyFrameBuilder::Finish(int nJob, int nWorker)
+{
+  Item &item = mvItems[nJob];
+  if(!item.bFinish)
+    return;
+  item.pKF->MakeKeyFrame_Finish();
+}
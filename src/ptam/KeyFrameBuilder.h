@@ -0,0 +1,86 @@
+// -*- c++ -*-
+//
+// KeyFrameBuilder - makes several keyframes at once on a WorkerPool.
+//
+// Both the tracker, with the frames of all cameras of the rig, and the
+// mapmaker, with the keyframes of one bundle, have a handful of keyframes
+// to finish at the same time. Done one after another, the time taken
+// grows with the size of the rig. The builder cuts the work into jobs
+// which don't depend on each other and runs them in three rounds:
+//   1. per keyframe: pyramid and FAST corners (MakeKeyFrame_Lite), and
+//      with depth, a DepthPyramid and the corners' depth from it;
+//   2. per keyframe and level: FAST nonmax suppression, Shi-Tomasi scores
+//      and mapping candidates (KeyFrame::MakeLevel_Rest); the large
+//      levels are handed out first;
+//   3. per keyframe: the SmallBlurryImage.
+// The keyframes come out just as KeyFrame::MakeKeyFrame() and
+// MakeKeyFrame_Rest() would make them. Frames added with AddLite() only
+// go through the first round.
+//
+// Like the pool, a builder is fed from one thread only. Keep it around:
+// the depth pyramids are reused from one Run() to the next.
+
+#ifndef __KEYFRAMEBUILDER_H
+#define __KEYFRAMEBUILDER_H
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include <cvd/image.h>
+#include <cvd/byte.h>
+
+#include "WorkerPool.h"
+#include "DepthPyramid.h"
+
+namespace ptam{
+
+struct KeyFrame;
+
+class KeyFrameBuilder
+{
+public:
+  KeyFrameBuilder(WorkerPool &pool);
+
+  // A keyframe to make from an image, as MakeKeyFrame(im, depth) does;
+  // without depth (pDepth null) as MakeKeyFrame_Lite() and _Rest() do.
+  // The images must stay valid until Run() returns.
+  void Add(KeyFrame &kf, CVD::BasicImage<CVD::byte> &im, const CVD::BasicImage<uint16_t> *pDepth);
+  // A frame for the tracker only: MakeKeyFrame_Lite() and the corners'
+  // depth. The rest waits until the frame becomes a keyframe, see AddMade().
+  void AddLite(KeyFrame &kf, CVD::BasicImage<CVD::byte> &im, const CVD::BasicImage<uint16_t> *pDepth);
+  // A keyframe handed to the mapmaker: MakeKeyFrame_Rest() if it is
+  // not complete yet, with the depth of its depthImage if it has one,
+  // and a fresh SmallBlurryImage either way.
+  void AddMade(KeyFrame &kf);
+
+  void Run();   // Makes all that were added, and forgets them
+
+  // The depth pyramid made for the nItem-th frame added before the last
+  // Run(), or NULL if it came without depth. Valid until the next Run().
+  const DepthPyramid *LastDepth(unsigned int nItem) const;
+
+protected:
+  struct Item
+  {
+    KeyFrame *pKF;
+    CVD::BasicImage<CVD::byte> *pim;              // Null if the Lite part is done
+    const CVD::BasicImage<uint16_t> *pDepth;
+    bool bRest;                                   // Levels still to be done?
+    bool bFinish;                                 // SmallBlurryImage to be done?
+  };
+
+  void MakeLite(int nJob, int nWorker);
+  void MakeLevel(int nJob, int nWorker);
+  void Finish(int nJob, int nWorker);
+
+  WorkerPool &mPool;
+  std::vector<Item> mvItems;
+  std::vector<DepthPyramid> mvDepths;              // One per item; those without depth stay unused
+  std::vector<bool> mvbDepthMade;                  // Which of them the last Run() made
+  std::vector<std::pair<int, int> > mvLevelJobs;   // (item, level)
+  double mdMinSTScore;                             // Read by Run(), for the workers
+  int mnFillRadius;                                // Likewise
+};
+
+} // namespace
+
+#endif
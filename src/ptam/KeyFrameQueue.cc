@@ -0,0 +1,91 @@
+#include "KeyFrameQueue.h"
+#include <cvd/timer.h>
+
+using namespace ptam;
+
+bool KeyFrameBundle::HasAllCameras() const
+{
+  for(int i=0; i<AddCamNumber; i++)
+    if(!apKFSec[i])
+      return false;
+  return true;
+}
+
+KeyFrameQueue::KeyFrameQueue()
+  : mnPushed(0), mnPopped(0), mnRejected(0), mnMaxQueued(0), mdMeanWait(0.0),
+    mbWoken(false), mnPushedSeen(0)
+{
+}
+
+bool KeyFrameQueue::Push(KeyFrameBundle &bundle)
+{
+  bundle.dQueuedTime = CVD::timer.get_time();
+  if(!mqBundles.push(bundle))
+  {
+    mnRejected++;
+    return false;
+  }
+  mnPushed++;
+  unsigned int nQueued = Size();
+  if(nQueued > mnMaxQueued)
+    mnMaxQueued = nQueued;
+
+  {
+    boost::mutex::scoped_lock lock(mWakeMutex);
+  }
+  mWakeCond.notify_one();
+  return true;
+}
+
+bool KeyFrameQueue::Pop(KeyFrameBundle &bundle)
+{
+  if(!mqBundles.pop(bundle))
+    return false;
+  mnPopped++;
+  double dWait = CVD::timer.get_time() - bundle.dQueuedTime;
+  mdMeanWait = 0.8 * mdMeanWait + 0.2 * dWait;
+  return true;
+}
+
+bool KeyFrameQueue::Wait(double dSeconds)
+{
+  boost::mutex::scoped_lock lock(mWakeMutex);
+  if(mnPushed == mnPushedSeen && !mbWoken)
+    mWakeCond.timed_wait(lock, boost::posix_time::microseconds((long) (dSeconds * 1e6)));
+  mbWoken = false;
+  mnPushedSeen = mnPushed;
+  return mqBundles.read_available() > 0;
+}
+
+void KeyFrameQueue::Clear()
+{
+  KeyFrameBundle bundle;
+  while(mqBundles.pop(bundle))
+    mnPopped++;
+}
+
+unsigned int KeyFrameQueue::Size() const
+{
+  // Popped first: a bundle can be popped before its push was counted
+  unsigned int nPopped = mnPopped;
+  unsigned int nPushed = mnPushed;
+  return nPushed > nPopped ? nPushed - nPopped : 0;
+}
+
+KeyFrameQueue::Statistics KeyFrameQueue::GetStatistics() const
+{
+  Statistics stats;
+  stats.nQueued = Size();
+  stats.nMaxQueued = mnMaxQueued;
+  stats.nPushed = mnPushed;
+  stats.nRejected = mnRejected;
+  stats.dMeanWait = mdMeanWait;
+  return stats;
+}
+
+void KeyFrameQueue::Wake()
+{
+  boost::mutex::scoped_lock lock(mWakeMutex);
+  mbWoken = true;
+  mWakeCond.notify_one();
+}
@@ -0,0 +1,84 @@
+// -*- c++ -*-
+//
+// KeyFrameQueue - keyframes on their way from the tracker to the mapmaker.
+//
+// The tracker hands over one bundle per instant: the main camera's
+// keyframe together with those the additional cameras took at the same
+// time, so the mapmaker never has to pair up keyframes from separate
+// queues. The queue is a bounded lock-free single-producer/single-consumer
+// ring; a push never waits, and fails when the mapmaker is that far behind.
+//
+// The mapmaker can sleep on the queue until the next bundle arrives; the
+// mutex involved is only for that, never for the bundles themselves. The
+// statistics tell the tracker how far behind the mapmaker is, so that it
+// can hold back keyframes rather than have them rejected.
+
+#ifndef __KEYFRAMEQUEUE_H
+#define __KEYFRAMEQUEUE_H
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+
+#include "CameraModel.h"
+
+namespace ptam{
+
+class KeyFrame;
+
+struct KeyFrameBundle
+{
+  boost::shared_ptr<KeyFrame> pKF;                    // Main camera
+  boost::shared_ptr<KeyFrame> apKFSec[AddCamNumber];  // Additional cameras; null if one took none
+  double dQueuedTime;                                 // Set by Push()
+
+  bool HasAllCameras() const;
+};
+
+class KeyFrameQueue
+{
+public:
+  enum { Capacity = 8 };
+
+  struct Statistics
+  {
+    unsigned int nQueued;       // Waiting right now
+    unsigned int nMaxQueued;    // The most that were ever waiting at once
+    unsigned int nPushed;
+    unsigned int nRejected;     // Pushed while the queue was full
+    double dMeanWait;           // Seconds between push and pop, moving average
+  };
+
+  KeyFrameQueue();
+
+  // Tracker thread
+  bool Push(KeyFrameBundle &bundle);  // False if full
+
+  // Mapmaker thread
+  bool Pop(KeyFrameBundle &bundle);   // False if empty
+  bool Wait(double dSeconds);         // Until a bundle arrives, Wake() or time out; true if any is waiting
+  void Clear();
+
+  // Any thread
+  unsigned int Size() const;
+  Statistics GetStatistics() const;
+  void Wake();
+
+protected:
+  boost::lockfree::spsc_queue<KeyFrameBundle, boost::lockfree::capacity<Capacity> > mqBundles;
+
+  boost::atomic<unsigned int> mnPushed;
+  boost::atomic<unsigned int> mnPopped;
+  boost::atomic<unsigned int> mnRejected;
+  boost::atomic<unsigned int> mnMaxQueued;
+  boost::atomic<double> mdMeanWait;
+
+  boost::mutex mWakeMutex;
+  boost::condition_variable mWakeCond;
+  bool mbWoken;                  // By Wake(); under mWakeMutex
+  unsigned int mnPushedSeen;     // By Wait(), mapmaker side
+};
+
+} // namespace
+
+#endif
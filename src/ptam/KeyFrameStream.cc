@@ -0,0 +1,190 @@
+#include "KeyFrameStream.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "LevelHelpers.h"
+
+using namespace TooN;
+using namespace ptam;
+
+KeyFrameStream::Params::Params()
+  : dMinTranslation(1e-4), dMinRotation(1e-4), dMinPointMove(1e-4), nMaxQueued(32)
+{
+}
+
+KeyFrameStream::KeyFrameStream(const Params &params)
+  : mParams(params), mnNextPointId(0), mnCollection(0), mbResetPending(true), mnSequence(0)
+{
+  mStatistics.nUpdates = 0;
+  mStatistics.nResets = 0;
+  mStatistics.nKeyFrames = 0;
+  mStatistics.nPoses = 0;
+  mStatistics.nPoints = 0;
+}
+
+void KeyFrameStream::Reset()
+{
+  mmSentKeyFrames.clear();
+  mmSentPoints.clear();
+  mbResetPending = true;
+  boost::mutex::scoped_lock lock(mMutex);
+  mqUpdates.clear();
+}
+
+bool KeyFrameStream::PoseMoved(const SE3<> &se3Sent, const SE3<> &se3Now) const
+{
+  Vector<6> v6Moved = (se3Now * se3Sent.inverse()).ln();
+  Vector<3> v3Translation = v6Moved.slice<0,3>();
+  Vector<3> v3Rotation = v6Moved.slice<3,3>();
+  return v3Translation * v3Translation > mParams.dMinTranslation * mParams.dMinTranslation ||
+         v3Rotation * v3Rotation > mParams.dMinRotation * mParams.dMinRotation;
+}
+
+void KeyFrameStream::Collect(const std::vector<boost::shared_ptr<KeyFrame> > &vpKeyFrames,
+                             const std::vector<boost::shared_ptr<MapPoint> > &vpPoints)
+{
+  // A consumer too far behind starts again from scratch
+  {
+    boost::mutex::scoped_lock lock(mMutex);
+    if(mqUpdates.size() >= mParams.nMaxQueued)
+    {
+      mqUpdates.clear();
+      mbResetPending = true;
+    }
+  }
+  if(mbResetPending)
+  {
+    mmSentKeyFrames.clear();
+    mmSentPoints.clear();
+  }
+
+  boost::shared_ptr<Update> pUpdate(new Update);
+  pUpdate->bReset = mbResetPending;
+  mnCollection++;
+
+  for(unsigned int i=0; i<vpKeyFrames.size(); i++)
+  {
+    const boost::shared_ptr<KeyFrame> &pKF = vpKeyFrames[i];
+    if(pKF->id < 0)
+      continue;
+    std::map<int, SentKeyFrame>::iterator it = mmSentKeyFrames.find(pKF->id);
+    if(it == mmSentKeyFrames.end())
+    {
+      KeyFrameContent content;
+      content.pKF = pKF;
+      content.nId = pKF->id;
+      content.se3CfromW = pKF->se3CfromW;
+      pUpdate->vAdded.push_back(content);
+      it = mmSentKeyFrames.insert(std::make_pair(pKF->id, SentKeyFrame())).first;
+      it->second.se3CfromW = pKF->se3CfromW;
+    }
+    else if(PoseMoved(it->second.se3CfromW, pKF->se3CfromW))
+    {
+      Pose pose;
+      pose.nId = pKF->id;
+      pose.se3CfromW = pKF->se3CfromW;
+      pUpdate->vPoses.push_back(pose);
+      it->second.se3CfromW = pKF->se3CfromW;
+    }
+    it->second.nSeen = mnCollection;
+  }
+  for(std::map<int, SentKeyFrame>::iterator it = mmSentKeyFrames.begin(); it != mmSentKeyFrames.end(); )
+  {
+    if(it->second.nSeen == mnCollection)
+      ++it;
+    else
+    {
+      pUpdate->vnRetiredKeyFrames.push_back(it->first);
+      mmSentKeyFrames.erase(it++);
+    }
+  }
+
+  const double dMinPointMoveSquared = mParams.dMinPointMove * mParams.dMinPointMove;
+  for(unsigned int i=0; i<vpPoints.size(); i++)
+  {
+    const boost::shared_ptr<MapPoint> &pPoint = vpPoints[i];
+    if(pPoint->bBad)
+      continue;
+    boost::shared_ptr<KeyFrame> pKF = pPoint->pPatchSourceKF.lock();
+    if(!pKF || pKF->id < 0 || !mmSentKeyFrames.count(pKF->id))
+      continue;
+    Vector<3> v3PosInKF = pKF->se3CfromW * pPoint->v3WorldPos;
+
+    std::map<const MapPoint*, SentPoint>::iterator it = mmSentPoints.find(pPoint.get());
+    if(it != mmSentPoints.end() && it->second.wpPoint.lock() != pPoint)
+    {
+      // The old point went, and this one took its address
+      pUpdate->vnRemovedPoints.push_back(it->second.nId);
+      mmSentPoints.erase(it);
+      it = mmSentPoints.end();
+    }
+    bool bSend = true;
+    if(it == mmSentPoints.end())
+    {
+      it = mmSentPoints.insert(std::make_pair(pPoint.get(), SentPoint())).first;
+      it->second.wpPoint = pPoint;
+      it->second.nId = mnNextPointId++;
+    }
+    else
+    {
+      Vector<3> v3Moved = v3PosInKF - it->second.v3PosInKF;
+      bSend = it->second.nKeyFrameId != pKF->id || v3Moved * v3Moved > dMinPointMoveSquared;
+    }
+    it->second.nSeen = mnCollection;
+    if(!bSend)
+      continue;
+    it->second.nKeyFrameId = pKF->id;
+    it->second.v3PosInKF = v3PosInKF;
+
+    Point point;
+    point.nId = it->second.nId;
+    point.nKeyFrameId = pKF->id;
+    point.v3PosInKF = v3PosInKF;
+    point.nLevel = pPoint->nSourceLevel;
+    std::map<boost::shared_ptr<MapPoint>, Measurement>::const_iterator itMeas = pKF->mMeasurements.find(pPoint);
+    if(itMeas != pKF->mMeasurements.end())
+      point.v2RootPos = itMeas->second.v2RootPos;
+    else
+      point.v2RootPos = LevelZeroPos(pPoint->irCenter, pPoint->nSourceLevel);
+    pUpdate->vPoints.push_back(point);
+  }
+  for(std::map<const MapPoint*, SentPoint>::iterator it = mmSentPoints.begin(); it != mmSentPoints.end(); )
+  {
+    if(it->second.nSeen == mnCollection)
+      ++it;
+    else
+    {
+      pUpdate->vnRemovedPoints.push_back(it->second.nId);
+      mmSentPoints.erase(it++);
+    }
+  }
+
+  if(!pUpdate->bReset && pUpdate->vAdded.empty() && pUpdate->vPoses.empty() && pUpdate->vPoints.empty() &&
+     pUpdate->vnRemovedPoints.empty() && pUpdate->vnRetiredKeyFrames.empty())
+    return;
+  mbResetPending = false;
+
+  boost::mutex::scoped_lock lock(mMutex);
+  pUpdate->nSequence = ++mnSequence;
+  mqUpdates.push_back(pUpdate);
+  mStatistics.nUpdates++;
+  mStatistics.nResets += pUpdate->bReset;
+  mStatistics.nKeyFrames += pUpdate->vAdded.size();
+  mStatistics.nPoses += pUpdate->vPoses.size();
+  mStatistics.nPoints += pUpdate->vPoints.size();
+}
+
+bool KeyFrameStream::Fetch(boost::shared_ptr<const Update> &pUpdate)
+{
+  boost::mutex::scoped_lock lock(mMutex);
+  if(mqUpdates.empty())
+    return false;
+  pUpdate = mqUpdates.front();
+  mqUpdates.pop_front();
+  return true;
+}
+
+KeyFrameStream::Statistics KeyFrameStream::GetStatistics() const
+{
+  boost::mutex::scoped_lock lock(mMutex);
+  return mStatistics;
+}
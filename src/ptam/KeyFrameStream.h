@@ -0,0 +1,141 @@
+// -*- c++ -*-
+//
+// KeyFrameStream - the local map as a stream of changes, for back-ends
+// outside the MapMaker.
+//
+// Each keyframe is sent once, with its pyramid, corners and RGB-D images.
+// After that only what changed goes out: a pose the bundle adjuster moved,
+// a map point which is new, moved relative to its source keyframe, or
+// was handed to another source keyframe, and the points and keyframes
+// which left the local map. Points are given relative to their source
+// keyframe, so that a keyframe which moves takes its points along without
+// any of them being sent again.
+//
+// The MapMaker calls Collect() on its own thread, whenever it has changed
+// the map; any other thread picks the updates up with Fetch(), in order.
+// Updates are handed over by shared pointer, and an added keyframe's
+// images by a pointer to the keyframe itself, which holds them unchanged
+// for as long as it lives: nothing is copied on the way, and a consumer in
+// the same process can read the images as they are. Packing them for the
+// wire (see ImageCodec) is up to the consumer, on its own thread.
+//
+// A consumer which falls more than Params::nMaxQueued updates behind
+// loses those, and gets the whole local map again, flagged as a reset.
+
+#ifndef __KEYFRAMESTREAM_H
+#define __KEYFRAMESTREAM_H
+#include <vector>
+#include <deque>
+#include <map>
+#include <TooN/TooN.h>
+#include <TooN/se3.h>
+#include <boost/smart_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace ptam{
+
+struct KeyFrame;
+struct MapPoint;
+
+class KeyFrameStream
+{
+public:
+  struct Params
+  {
+    Params();
+    double dMinTranslation;   // A pose is sent again once moved this much [m] ..
+    double dMinRotation;      // .. or turned this much [rad]
+    double dMinPointMove;     // A point relative to its keyframe [m]
+    unsigned int nMaxQueued;
+  };
+
+  struct KeyFrameContent
+  {
+    boost::shared_ptr<const KeyFrame> pKF;   // Only its images, corners and time may be read
+    int nId;
+    TooN::SE3<> se3CfromW;
+  };
+
+  struct Pose
+  {
+    int nId;
+    TooN::SE3<> se3CfromW;
+  };
+
+  struct Point
+  {
+    unsigned int nId;         // The stream's own, as map points have none
+    int nKeyFrameId;          // Source keyframe
+    TooN::Vector<3> v3PosInKF;
+    int nLevel;               // Source level
+    TooN::Vector<2> v2RootPos;   // In the source keyframe, level zero pixels
+  };
+
+  struct Update
+  {
+    unsigned int nSequence;   // From 1
+    bool bReset;              // Forget all earlier updates: this one has everything
+    std::vector<KeyFrameContent> vAdded;
+    std::vector<Pose> vPoses;
+    std::vector<Point> vPoints;
+    std::vector<unsigned int> vnRemovedPoints;
+    std::vector<int> vnRetiredKeyFrames;   // No longer in the local map; nothing more comes for them
+  };
+
+  struct Statistics
+  {
+    unsigned int nUpdates;
+    unsigned int nResets;     // Of those, full resends
+    unsigned int nKeyFrames;  // Contents sent
+    unsigned int nPoses;
+    unsigned int nPoints;
+  };
+
+  KeyFrameStream(const Params &params);
+
+  // MapMaker thread. Keyframes with a negative id are left out, as are
+  // points whose source keyframe is.
+  void Collect(const std::vector<boost::shared_ptr<KeyFrame> > &vpKeyFrames,
+               const std::vector<boost::shared_ptr<MapPoint> > &vpPoints);
+  void Reset();   // The map was reset; the next update is a reset
+
+  // Any thread. The oldest update not yet fetched, if there is one.
+  bool Fetch(boost::shared_ptr<const Update> &pUpdate);
+  Statistics GetStatistics() const;
+
+protected:
+  struct SentKeyFrame
+  {
+    TooN::SE3<> se3CfromW;
+    unsigned int nSeen;
+  };
+
+  struct SentPoint
+  {
+    boost::weak_ptr<MapPoint> wpPoint;   // The key may be a new point's, once this one has gone
+    unsigned int nId;
+    int nKeyFrameId;
+    TooN::Vector<3> v3PosInKF;
+    unsigned int nSeen;
+  };
+
+  bool PoseMoved(const TooN::SE3<> &se3Sent, const TooN::SE3<> &se3Now) const;
+
+  const Params mParams;
+
+  // MapMaker thread's
+  std::map<int, SentKeyFrame> mmSentKeyFrames;
+  std::map<const MapPoint*, SentPoint> mmSentPoints;
+  unsigned int mnNextPointId;
+  unsigned int mnCollection;
+  bool mbResetPending;
+
+  mutable boost::mutex mMutex;
+  std::deque<boost::shared_ptr<const Update> > mqUpdates;
+  unsigned int mnSequence;
+  Statistics mStatistics;
+};
+
+} // namespace
+
+#endif
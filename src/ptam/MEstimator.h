@@ -15,6 +15,16 @@
 #include <cassert>
 
 namespace ptam{
+// Median of the squared errors, found by selection (linear time) rather than
+// by sorting. Only the median element ends up in its sorted position.
+inline double FindMedianSquared(std::vector<double> &vdErrorSquared)
+{
+  assert(vdErrorSquared.size() > 0);
+  std::vector<double>::iterator itMedian = vdErrorSquared.begin() + vdErrorSquared.size() / 2;
+  std::nth_element(vdErrorSquared.begin(), itMedian, vdErrorSquared.end());
+  return *itMedian;
+}
+
 struct Tukey
 {
   inline static double FindSigmaSquared(std::vector<double> &vdErrorSquared);
@@ -76,9 +86,7 @@ inline double Tukey::ObjectiveScore(double dErrorSquared, const double dSigmaSqu
 inline double Tukey::FindSigmaSquared(std::vector<double> &vdErrorSquared)
 {
   double dSigmaSquared;
-  assert(vdErrorSquared.size() > 0);
-  std::sort(vdErrorSquared.begin(), vdErrorSquared.end());
-  double dMedianSquared = vdErrorSquared[vdErrorSquared.size() / 2];
+  double dMedianSquared = FindMedianSquared(vdErrorSquared);
   double dSigma = 1.4826 * (1 + 5.0 / (vdErrorSquared.size() * 2 - 6)) * sqrt(dMedianSquared);
   dSigma =  4.6851 * dSigma;
   dSigmaSquared = dSigma * dSigma;
@@ -110,9 +118,7 @@ inline double Cauchy::ObjectiveScore(double dErrorSquared, const double dSigmaSq
 inline double Cauchy::FindSigmaSquared(std::vector<double> &vdErrorSquared)
 {
   double dSigmaSquared;
-  assert(vdErrorSquared.size() > 0);
-  std::sort(vdErrorSquared.begin(), vdErrorSquared.end());
-  double dMedianSquared = vdErrorSquared[vdErrorSquared.size() / 2];
+  double dMedianSquared = FindMedianSquared(vdErrorSquared);
   double dSigma = 1.4826 * (1 + 5.0 / (vdErrorSquared.size() * 2 - 6)) * sqrt(dMedianSquared);
   dSigma =  4.6851 * dSigma;
   dSigmaSquared = dSigma * dSigma;
@@ -154,9 +160,7 @@ inline double Huber::ObjectiveScore(double dErrorSquared, const double dSigmaSqu
 inline double Huber::FindSigmaSquared(std::vector<double> &vdErrorSquared)
 {
   double dSigmaSquared;
-  assert(vdErrorSquared.size() > 0);
-  std::sort(vdErrorSquared.begin(), vdErrorSquared.end());
-  double dMedianSquared = vdErrorSquared[vdErrorSquared.size() / 2];
+  double dMedianSquared = FindMedianSquared(vdErrorSquared);
   double dSigma = 1.4826 * (1 + 5.0 / (vdErrorSquared.size() * 2 - 6)) * sqrt(dMedianSquared);
   dSigma =  1.345 * dSigma;
   dSigmaSquared = dSigma * dSigma;
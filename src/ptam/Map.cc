@@ -12,6 +12,7 @@ using namespace GVars3;
 using namespace ptam;
 
 Map::Map()
+    : mnGeneration(0)
 {
     Reset();
 }
@@ -27,6 +28,7 @@ void Map::Reset()
     erasedAllCallback = &emptyErasedAllCb;
 //    erasedKfCallback = &emptyErasedKfCb;
 
+    PublishSnapshot();
     lock.unlock();
 }
 
@@ -194,11 +196,24 @@ void Map::EraseAll() {
     vpKeyFrames.clear();
     vpPoints.clear();
 
+    PublishSnapshot();
     lock.unlock();
 
     erasedAllCallback(erased);
 }
 
+void Map::PublishSnapshot()
+{
+    boost::shared_ptr<const MapSnapshot> pSnapshot = MapSnapshot::Make(*this, ++mnGeneration);
+    // The generation this replaces lives on while the tracker has it pinned
+    boost::atomic_store(&mpSnapshot, pSnapshot);
+}
+
+boost::shared_ptr<const MapSnapshot> Map::PinSnapshot() const
+{
+    return boost::atomic_load(&mpSnapshot);
+}
+
 bool Map::SaveMap(const std::string sPath)
 {
     boost::filesystem::path path(sPath);
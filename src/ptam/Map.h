@@ -20,6 +20,7 @@
 #include <boost/thread.hpp>
 #include <boost/smart_ptr.hpp>
 #include "CameraModel.h"
+#include "MapSnapshot.h"
 
 namespace ptam{
 struct MapPoint;
@@ -43,6 +44,11 @@ struct Map
   ErasedKfCbFunction erasedKfCallback;
   BaDoneCbFunction baDoneCallback;
 
+  // Copy-on-write view for the tracker, see MapSnapshot.h. Publish with
+  // the write lock held, after changing the map; pinning needs no lock.
+  void PublishSnapshot();
+  boost::shared_ptr<const MapSnapshot> PinSnapshot() const;
+
   bool SaveMap(const std::string sPath);
   bool LoadMap(const std::string sPath);
   
@@ -51,8 +57,11 @@ struct Map
   std::vector<boost::shared_ptr<KeyFrame> > vpKeyFramessec[AddCamNumber];
 
   bool bGood;
+  MapSnapshot::Rebase rebase;   // Changed with the write lock held; reaches the tracker with the next snapshot
 
   mutable boost::shared_mutex mutex;
+  boost::shared_ptr<const MapSnapshot> mpSnapshot;   // Only through boost::atomic_load/atomic_store
+  unsigned int mnGeneration;
 
   static void emptyErasedAllCb(std::vector<boost::shared_ptr<KeyFrame> >) {}
   static void emptyErasedKfCb(boost::shared_ptr<KeyFrame>) {}
@@ -22,6 +22,7 @@
 #include <gvars3/instances.h>
 #include <fstream>
 #include <algorithm>
+#include <boost/bind.hpp>
 
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -49,6 +50,35 @@ MapMaker::MapMaker(Map& m, bool bOffline)
         std::auto_ptr<CameraModel> camera_temp (CameraModel::CreateCamera(i + 1));
         mCameraSec[i] = camera_temp;
     }
+
+    // Point creation workers, each with its own set of cameras
+    // Settings read by the workers are registered here, not on first use in a worker thread.
+    static gvar3<int> gvnWorkers("MapMaker.Workers", 4, SILENT);
+    GV3::Register(mgvnAddPoints3D, "MapMaker.AddPoints3D", 1, SILENT);
+    GV3::Register(mgvnAddPointsEpipolar, "MapMaker.AddPointsEpipolar", 1, SILENT);
+    GV3::Register(mgvdUseMaxDepth, "MapMaker.UseMaxDepth", 5.0, SILENT);
+    GV3::Register(mgvdSceneDepthMaxSecCam, "MapMaker.SceneDepthMaxSecCam", 5.0, SILENT);
+    GV3::Register(mgvdSceneDepthMinSecCam, "MapMaker.SceneDepthMinSecCam", 2.0, SILENT);
+    GV3::Register(mgvdMinViewAngleDiff, "MapMaker.minViewAngleDiff", 3.0, SILENT);
+    mpWorkers.reset(new WorkerPool(*gvnWorkers));
+    mpBuilder.reset(new KeyFrameBuilder(*mpWorkers));
+    for (int w = 0; w < mpWorkers->Size(); w ++)
+        for (int c = 0; c <= AddCamNumber; c ++)
+            mvWorkerCameras[c].push_back(boost::shared_ptr<CameraModel>(CameraModel::CreateCamera(c)));
+
+    // The back-end: a pose graph over all keyframes ever made
+    static gvar3<int> gvnFullSLAM("MapMaker.fullSLAM", 0, SILENT);
+    if (*gvnFullSLAM)
+        mpPoseGraph.reset(new PoseGraph);
+
+    // The local map as a stream of changes, for a back-end outside this process (or thread)
+    static gvar3<int> gvnKeyFrameStream("MapMaker.KeyFrameStream", 0, SILENT);
+    if (*gvnKeyFrameStream){
+        KeyFrameStream::Params params;
+        params.nMaxQueued = GV3::get<int>("MapMaker.KeyFrameStreamMaxQueued", params.nMaxQueued, SILENT);
+        mpKeyFrameStream.reset(new KeyFrameStream(params));
+    }
+
     mbResetRequested = false;
     Reset();
     if (!bOffline)
@@ -60,7 +90,6 @@ MapMaker::MapMaker(Map& m, bool bOffline)
     isLandingPoseGetCurrent = false;
     isFinishPadDetection = false;
 
-    needMotionModelUpdate = false;
     debugmarkLoopDetected = false;
 
     bInputStopped = false;
@@ -82,18 +111,21 @@ void MapMaker::Reset()
     mvFailureQueue.clear();
     while(!mqNewQueue.empty()) mqNewQueue.pop();
     mMap.vpKeyFrames.clear(); // TODO: actually erase old keyframes
-    mvpKeyFrameQueue.clear(); // TODO: actually erase old keyframes
+    mKeyFrameQueue.Clear(); // TODO: actually erase old keyframes
     for (int i = 0; i < AddCamNumber; i ++)
-    {
-        mvpKeyFrameQueueSec[i].clear(); // TODO: actually erase old keyframes
         secKFid[i] = 0;
-    }
     mbBundleRunning = false;
     mbBundleConverged_Full = true;
     mbBundleConverged_Recent = true;
     mbResetDone = true;
     mbResetRequested = false;
     mbBundleAbortRequested = false;
+    mbBundleYieldRequested = false;
+    mRecentBundleWarmStart = BundleWarmStart();
+    if (mpPoseGraph)
+        mpPoseGraph->Reset();
+    if (mpKeyFrameStream)
+        mpKeyFrameStream->Reset();
 
     nullObject_keyframe = true;
     nullTracking_frame = true;
@@ -164,7 +196,7 @@ void MapMaker::run()
             MappingEnabledCond.wait(lock);
         }
         CHECK_RESET;
-        sleep(5); // Sleep not really necessary, especially if mapmaker is busy
+        mKeyFrameQueue.Wait(0.005); // Not really necessary, especially if mapmaker is busy; a new keyframe cuts it short
         CHECK_RESET;
 
         // Handle any GUI commands encountered..
@@ -185,30 +217,15 @@ void MapMaker::run()
 
         ros::Time timemapbegin = ros::Time::now();
         bool didba = false;
-        // if the global map in the backend is updated, update the local map also
+        // if the pose graph moved keyframes, update the local map also;
         // motion model of the tracker has to be updated correspondingly
-        // read access
-//        boost::unique_lock< boost::mutex > lock(mSLAM.syncMutex);
-//        if (*doingfullSLAM && mSLAM.IsGMapUpdated()){
-//            // write the reference kf pose, for motion model update in tracker
-//            // use the second last kf as reference, since the relative pose to the last kf could be too small
-//            mse3LatestKFpose = mMap.vpKeyFrames[mMap.vpKeyFrames.size()-2]->se3CfromW;
-//            lastKFid = mMap.vpKeyFrames[mMap.vpKeyFrames.size()-2]->id;
-
-//            // write access
-//            boost::unique_lock< boost::shared_mutex > lockl(mMap.mutex);
-
-//            UpdateLMapByGMap(); // TODO adjust this when using different camera for backend
-//            needMotionModelUpdate = true;
-//            if (mSLAM.debugLoopDetected()) debugmarkLoopDetected = true;
-
-//            lockl.unlock();
-//            mSLAM.setGMapUpdated(false);
-//        }
-
-//        lock.unlock(); // end back-end lock
+        PoseGraph::Corrections corrections;
+        if (mpPoseGraph && mpPoseGraph->FetchCorrections(corrections))
+            ApplyPoseGraphCorrections(corrections);
 
-        // Should we run local bundle adjustment?
+        // Should we run local bundle adjustment? If keyframes keep queueing up,
+        // it is still forced every few of them, but then yields after one
+        // iteration (see BundleAdjust()) and the next run continues from there.
         // yang, also Do landing object detect here, when LBA not performan this frame, or after a certatin time gap.
         static gvar3<double> gvnPadDetectMinHeight("MapMaker.PadDetectMinHeight", 0.6, SILENT);
         if(!mbBundleConverged_Recent && (QueueSize() == 0 || nAddedKfNoBA >= *maxKeyFrames-2) && newRecentKF){
@@ -223,6 +240,9 @@ void MapMaker::run()
             didba = true;
             bFullBAfinished = false;
             cout<< "BA Done!"<<endl;
+            SendToPoseGraph();
+            if (mpKeyFrameStream)
+                mpKeyFrameStream->Collect(mMap.vpKeyFrames, mMap.vpPoints);
 
             // if the waiting list is not empty(might happen when very slow pgo), update the waitinglist
             // according to the current local map, for both kfs and edges
@@ -331,6 +351,11 @@ void MapMaker::run()
             WriteFrames("frames-ba.txt");
         }
 
+        CHECK_RESET;
+        // Descriptors of the latest keyframes, once local BA has seen them
+        if(QueueSize() == 0 && !newRecentKF)
+            DescribeNewKeyFrames();
+
         CHECK_RESET;
         // Very low priorty: re-find measurements marked as outliers
         if(mbBundleConverged_Recent && mbBundleConverged_Full && rand()%20 == 0 && QueueSize() == 0)
@@ -449,6 +474,7 @@ void MapMaker::HandleBadPoints()
     // Move bad points to the trash list.
     mMap.EraseBadPoints(false);
 
+    PublishMap();
     lock.unlock();
 }
 
@@ -618,12 +644,85 @@ MapMaker::~MapMaker()
 ////        mbackend_.addEdges(edges);
 //}
 
-bool MapMaker::relocaliseRegister(const boost::shared_ptr<KeyFrame> goodkf, const boost::shared_ptr<KeyFrame> kf, Sophus::SE3d &result, double minInliers)
+// kf needs its corner descriptors (finalizeKeyframekpts()). The good
+// keyframe has normally been described in the background already (see
+// DescribeNewKeyFrames()); it is condensed into a relocalisation target the
+// first time it is asked for.
+bool MapMaker::relocaliseRegister(const boost::shared_ptr<KeyFrame> goodkf, const boost::shared_ptr<KeyFrame> kf, SE3<> &result, double minInliers)
 {
-//    if ( mbackend_.relocaliseRegister(goodkf, kf, result, minInliers))
-//        return true;
-//    else
-        return false;
+    boost::shared_ptr<const PnPRelocaliser::Target> pTarget = mPnPRelocaliser.CachedTarget(goodkf);
+    if (!pTarget) {
+        boost::upgrade_lock< boost::shared_mutex > lock(mMap.mutex);
+        std::vector<boost::shared_ptr<MapPoint> > vpPoints;
+        BriefFeatures features;
+        if (!goodkf->finalizGoodkf)
+            goodkf->describeGoodkf(mRelocaliseExtractor, vpPoints, features);
+        // write access for handing over the descriptors
+        boost::upgrade_to_unique_lock< boost::shared_mutex > uniqueLock(lock);
+        goodkf->finalizeKeyframeGoodkf(vpPoints, features);
+        pTarget = mPnPRelocaliser.MakeTarget(goodkf);
+    }
+
+    CameraModel &camera = kf->nSourceCamera ? *mCameraSec[kf->nSourceCamera - 1] : *mCamera;
+    PnPRelocaliser::Frame frame = PnPRelocaliser::MakeFrame(*kf, camera, camera.OnePixelDist());
+    return mPnPRelocaliser.Register(*pTarget, frame, minInliers, result);
+}
+
+// Describes the keyframes which the tracker would relocalise against, so
+// that relocaliseRegister() rarely has to. That may describe the same
+// keyframe from the tracker's thread, so this follows the same protocol: the
+// flag is tested under an upgrade lock, which lets the tracker read the map
+// but keeps relocaliseRegister() out until the result is handed over.
+void MapMaker::DescribeNewKeyFrames()
+{
+    std::vector<boost::shared_ptr<KeyFrame> > vpKFs;
+    if (mMap.vpKeyFrames.size())
+        vpKFs.push_back(mMap.vpKeyFrames.back());
+    for (int cn = 0; cn < AddCamNumber; cn++)
+        if (mMap.vpKeyFramessec[cn].size())
+            vpKFs.push_back(mMap.vpKeyFramessec[cn].back());
+
+    std::vector<boost::shared_ptr<MapPoint> > vpPoints;
+    BriefFeatures features;
+    for (unsigned int i = 0; i < vpKFs.size(); i++) {
+        boost::upgrade_lock< boost::shared_mutex > lock(mMap.mutex);
+        if (vpKFs[i]->finalizGoodkf)
+            continue;
+        vpKFs[i]->describeGoodkf(mExtractor, vpPoints, features);
+        boost::upgrade_to_unique_lock< boost::shared_mutex > uniqueLock(lock);
+        vpKFs[i]->finalizeKeyframeGoodkf(vpPoints, features);
+    }
+}
+
+// Makes the map as changed so far visible to the tracker, see MapSnapshot.h.
+// Points whose source keyframe was handed over by Map::EraseOldKeyFrames()
+// get their patch vectors redone first; the tracker used to do that while
+// building its PVS. Call with the map locked for writing.
+void MapMaker::PublishMap()
+{
+    for (unsigned int i = 0; i < mMap.vpPoints.size(); i++) {
+        boost::shared_ptr<MapPoint> p = mMap.vpPoints[i];
+        if (!p->sourceKfIDtransfered || p->refreshed)
+            continue;
+        boost::shared_ptr<KeyFrame> pSourceKF = p->pPatchSourceKF.lock();
+        if (!pSourceKF)
+            continue;
+        meas_it it = pSourceKF->mMeasurements.find(p);
+        if (it == pSourceKF->mMeasurements.end())
+            continue;
+        const Measurement &m = it->second;
+        CameraModel &camera = p->nSourceCamera ? *mCameraSec[p->nSourceCamera - 1] : *mCamera;
+        p->v3Center_NC = unproject(camera.UnProjectSafe(m.v2RootPos));
+        p->v3OneRightFromCenter_NC = unproject(camera.UnProjectSafe(m.v2RootPos + vec(ImageRef(m.nLevel,0))));
+        p->v3OneDownFromCenter_NC  = unproject(camera.UnProjectSafe(m.v2RootPos + vec(ImageRef(0,m.nLevel))));
+        normalize(p->v3Center_NC);
+        normalize(p->v3OneDownFromCenter_NC);
+        normalize(p->v3OneRightFromCenter_NC);
+        p->RefreshPixelVectors();
+
+        p->refreshed = true;
+    }
+    mMap.PublishSnapshot();
 }
 
 // Finds 3d coords of point in reference frame B from two z=1 plane projections
@@ -697,9 +796,9 @@ bool MapMaker::InitFromRGBD(KeyFrame &kf, const TooN::SE3<> &worldPos)
             p->v3Normal_NC = makeVector( 0,0,-1);
             p->irCenter = lev.vMaxCorners[i];
             ImageRef irCenterl0 = LevelZeroPosIR(p->irCenter,l);
-            p->v3Center_NC = unproject(mCamera->UnProject(irCenterl0));
-            p->v3OneDownFromCenter_NC = unproject(mCamera->UnProject(irCenterl0 + ImageRef(0,nLevelScale)));
-            p->v3OneRightFromCenter_NC = unproject(mCamera->UnProject(irCenterl0 + ImageRef(nLevelScale,0)));
+            p->v3Center_NC = unproject(mCamera->UnProjectPixel(irCenterl0));
+            p->v3OneDownFromCenter_NC = unproject(mCamera->UnProjectPixel(irCenterl0 + ImageRef(0,nLevelScale)));
+            p->v3OneRightFromCenter_NC = unproject(mCamera->UnProjectPixel(irCenterl0 + ImageRef(nLevelScale,0)));
 
             Vector<3> v3CamPos = p->v3Center_NC*depth;// Xc
             p->v3RelativePos = v3CamPos;// Xc
@@ -748,6 +847,7 @@ bool MapMaker::InitFromRGBD(KeyFrame &kf, const TooN::SE3<> &worldPos)
     mMap.vpKeyFrames.push_back(pkFirst);
     mMap.bGood = true;
 
+    PublishMap();
     lock.unlock();
 
     cout << "  MapMaker: made initial map from RGBD frame with " << mMap.vpPoints.size() << " points." << endl;
@@ -803,9 +903,9 @@ bool MapMaker::InitFromRGBD(KeyFrame &kf, boost::shared_ptr<KeyFrame>* adkfs, co
             p->v3Normal_NC = makeVector( 0,0,-1);
             p->irCenter = lev.vMaxCorners[i];
             ImageRef irCenterl0 = LevelZeroPosIR(p->irCenter,l);
-            p->v3Center_NC = unproject(mCamera->UnProject(irCenterl0));
-            p->v3OneDownFromCenter_NC = unproject(mCamera->UnProject(irCenterl0 + ImageRef(0,nLevelScale)));
-            p->v3OneRightFromCenter_NC = unproject(mCamera->UnProject(irCenterl0 + ImageRef(nLevelScale,0)));
+            p->v3Center_NC = unproject(mCamera->UnProjectPixel(irCenterl0));
+            p->v3OneDownFromCenter_NC = unproject(mCamera->UnProjectPixel(irCenterl0 + ImageRef(0,nLevelScale)));
+            p->v3OneRightFromCenter_NC = unproject(mCamera->UnProjectPixel(irCenterl0 + ImageRef(nLevelScale,0)));
 
             Vector<3> v3CamPos = p->v3Center_NC*depth;// Xc
             p->v3RelativePos = v3CamPos;// Xc
@@ -888,9 +988,9 @@ bool MapMaker::InitFromRGBD(KeyFrame &kf, boost::shared_ptr<KeyFrame>* adkfs, co
                 p->v3Normal_NC = makeVector( 0,0,-1);
                 p->irCenter = lev.vMaxCorners[i];
                 ImageRef irCenterl0 = LevelZeroPosIR(p->irCenter,l);
-                p->v3Center_NC = unproject(mCameraSec[cn]->UnProject(irCenterl0));
-                p->v3OneDownFromCenter_NC = unproject(mCameraSec[cn]->UnProject(irCenterl0 + ImageRef(0,nLevelScale)));
-                p->v3OneRightFromCenter_NC = unproject(mCameraSec[cn]->UnProject(irCenterl0 + ImageRef(nLevelScale,0)));
+                p->v3Center_NC = unproject(mCameraSec[cn]->UnProjectPixel(irCenterl0));
+                p->v3OneDownFromCenter_NC = unproject(mCameraSec[cn]->UnProjectPixel(irCenterl0 + ImageRef(0,nLevelScale)));
+                p->v3OneRightFromCenter_NC = unproject(mCameraSec[cn]->UnProjectPixel(irCenterl0 + ImageRef(nLevelScale,0)));
 
                 Vector<3> v3CamPos = p->v3Center_NC*depth;// Xc
                 p->v3RelativePos = v3CamPos;
@@ -942,6 +1042,7 @@ bool MapMaker::InitFromRGBD(KeyFrame &kf, boost::shared_ptr<KeyFrame>* adkfs, co
 
     mMap.bGood = true;
 
+    PublishMap();
     lock.unlock();
 
     cout << "  MapMaker: made initial map from RGBD frame with " << mMap.vpPoints.size() << " points." << endl;
@@ -1007,9 +1108,9 @@ bool MapMaker::ReInitFromRGBD(KeyFrame &kf, boost::shared_ptr<KeyFrame>* adkfs,
             p->v3Normal_NC = makeVector( 0,0,-1);
             p->irCenter = lev.vMaxCorners[i];
             ImageRef irCenterl0 = LevelZeroPosIR(p->irCenter,l);
-            p->v3Center_NC = unproject(mCamera->UnProject(irCenterl0));
-            p->v3OneDownFromCenter_NC = unproject(mCamera->UnProject(irCenterl0 + ImageRef(0,nLevelScale)));
-            p->v3OneRightFromCenter_NC = unproject(mCamera->UnProject(irCenterl0 + ImageRef(nLevelScale,0)));
+            p->v3Center_NC = unproject(mCamera->UnProjectPixel(irCenterl0));
+            p->v3OneDownFromCenter_NC = unproject(mCamera->UnProjectPixel(irCenterl0 + ImageRef(0,nLevelScale)));
+            p->v3OneRightFromCenter_NC = unproject(mCamera->UnProjectPixel(irCenterl0 + ImageRef(nLevelScale,0)));
 
             Vector<3> v3CamPos = p->v3Center_NC*depth;// Xc
             p->v3RelativePos = v3CamPos;// Xc
@@ -1091,9 +1192,9 @@ bool MapMaker::ReInitFromRGBD(KeyFrame &kf, boost::shared_ptr<KeyFrame>* adkfs,
                 p->v3Normal_NC = makeVector( 0,0,-1);
                 p->irCenter = lev.vMaxCorners[i];
                 ImageRef irCenterl0 = LevelZeroPosIR(p->irCenter,l);
-                p->v3Center_NC = unproject(mCameraSec[cn]->UnProject(irCenterl0));
-                p->v3OneDownFromCenter_NC = unproject(mCameraSec[cn]->UnProject(irCenterl0 + ImageRef(0,nLevelScale)));
-                p->v3OneRightFromCenter_NC = unproject(mCameraSec[cn]->UnProject(irCenterl0 + ImageRef(nLevelScale,0)));
+                p->v3Center_NC = unproject(mCameraSec[cn]->UnProjectPixel(irCenterl0));
+                p->v3OneDownFromCenter_NC = unproject(mCameraSec[cn]->UnProjectPixel(irCenterl0 + ImageRef(0,nLevelScale)));
+                p->v3OneRightFromCenter_NC = unproject(mCameraSec[cn]->UnProjectPixel(irCenterl0 + ImageRef(nLevelScale,0)));
 
                 Vector<3> v3CamPos = p->v3Center_NC*depth;// Xc
                 p->v3RelativePos = v3CamPos;
@@ -1142,6 +1243,7 @@ bool MapMaker::ReInitFromRGBD(KeyFrame &kf, boost::shared_ptr<KeyFrame>* adkfs,
         mMap.vpKeyFramessec[cn].push_back(pkSec);
     }
 
+    PublishMap();
     lock.unlock();
 
     cout << "  MapMaker: made RE-initial map from RGBD frame with " << mMap.vpPoints.size() - mpcountold << " points." << endl;
@@ -1159,7 +1261,8 @@ bool MapMaker::InitFromStereo(KeyFrame &kF,
                               KeyFrame &kS,
                               vector<pair<ImageRef, ImageRef> > &vTrailMatches,
                               SE3<> &se3TrackerPose,
-                              bool use_circle_ini, int ini_thresh, int ini_times)
+                              bool use_circle_ini, int ini_thresh, int ini_times,
+                              WorkerPool *pWorkers)
 {
 
     // write access: unique lock
@@ -1173,8 +1276,10 @@ bool MapMaker::InitFromStereo(KeyFrame &kF,
     for(unsigned int i=0; i<vTrailMatches.size(); i++)
     {
         HomographyMatch m;
-        m.v2CamPlaneFirst = mCamera->UnProject(vTrailMatches[i].first);
-        m.v2CamPlaneSecond = mCamera->UnProject(vTrailMatches[i].second);
+        m.v2CamPlaneFirst = mCamera->UnProjectPixel(vTrailMatches[i].first);
+        m.v2CamPlaneSecond = mCamera->UnProjectPixel(vTrailMatches[i].second);
+        // UnProjectPixel() is a const lookup: project again, so that the derivatives are at this match
+        mCamera->Project(m.v2CamPlaneSecond);
         m.m2PixelProjectionJac = mCamera->GetProjectionDerivs();
         vMatches.push_back(m);
     }
@@ -1182,7 +1287,7 @@ bool MapMaker::InitFromStereo(KeyFrame &kF,
     SE3<> se3;
     bool bGood;
 
-    HomographyInit HomographyInit;
+    HomographyInit HomographyInit(pWorkers);   // The caller's pool: this runs on its thread
     bGood = HomographyInit.Compute(vMatches, 5.0, se3);//R21
     if(!bGood)
     {
@@ -1240,9 +1345,9 @@ bool MapMaker::InitFromStereo(KeyFrame &kF,
         p->nSourceLevel = 0;
         p->v3Normal_NC = makeVector( 0,0,-1);
         p->irCenter = vTrailMatches[i].first;
-        p->v3Center_NC = unproject(mCamera->UnProject(p->irCenter));
-        p->v3OneDownFromCenter_NC = unproject(mCamera->UnProject(p->irCenter + ImageRef(0,1)));
-        p->v3OneRightFromCenter_NC = unproject(mCamera->UnProject(p->irCenter + ImageRef(1,0)));
+        p->v3Center_NC = unproject(mCamera->UnProjectPixel(p->irCenter));
+        p->v3OneDownFromCenter_NC = unproject(mCamera->UnProjectPixel(p->irCenter + ImageRef(0,1)));
+        p->v3OneRightFromCenter_NC = unproject(mCamera->UnProjectPixel(p->irCenter + ImageRef(1,0)));
         normalize(p->v3Center_NC);
         normalize(p->v3OneDownFromCenter_NC);
         normalize(p->v3OneRightFromCenter_NC);
@@ -1302,10 +1407,7 @@ bool MapMaker::InitFromStereo(KeyFrame &kF,
     mdWiggleScaleDepthNormalized = mdWiggleScale / pkFirst->dSceneDepthMean;
 
 
-    AddSomeMapPoints(0);
-    AddSomeMapPoints(3);
-    AddSomeMapPoints(1);
-    AddSomeMapPoints(2);
+    AddNewMapPoints();
 
     mbBundleConverged_Full = false;
     mbBundleConverged_Recent = false;
@@ -1337,6 +1439,7 @@ bool MapMaker::InitFromStereo(KeyFrame &kF,
     else
         se3TrackerPose = pkSecond->se3CfromW;// * se3worldfromfirst.inverse();//RT2W = RT21 * RT1W
 
+    PublishMap();
     lock.unlock();
 
     cout << "  MapMaker: made initial map with " << mMap.vpPoints.size() << " points." << endl;
@@ -1427,9 +1530,9 @@ bool MapMaker::InitFromOneCircle(KeyFrame &kf,
                     continue;
             }
 
-            p->v3Center_NC = unproject(mCamera->UnProject(irCenterl0));// (x, y, 1)
-            p->v3OneDownFromCenter_NC = unproject(mCamera->UnProject(irCenterl0 + ImageRef(0,nLevelScale)));
-            p->v3OneRightFromCenter_NC = unproject(mCamera->UnProject(irCenterl0 + ImageRef(nLevelScale,0)));
+            p->v3Center_NC = unproject(mCamera->UnProjectPixel(irCenterl0));// (x, y, 1)
+            p->v3OneDownFromCenter_NC = unproject(mCamera->UnProjectPixel(irCenterl0 + ImageRef(0,nLevelScale)));
+            p->v3OneRightFromCenter_NC = unproject(mCamera->UnProjectPixel(irCenterl0 + ImageRef(nLevelScale,0)));
 
             //calculate the 3D point info in world frame. xp--(xd--)xn(--xc)--xw
             //Xw = Rwc*Xc + twc = d*Rwc*Xn + twc
@@ -1495,6 +1598,7 @@ bool MapMaker::InitFromOneCircle(KeyFrame &kf,
     mMap.vpKeyFrames.push_back(pkFirst);
     mMap.bGood = true;
 
+    PublishMap();
     lock.unlock();
 
     cout << "  MapMaker: made initial map from " << mMap.vpPoints.size() << " points." << endl;
@@ -1569,9 +1673,9 @@ bool MapMaker::InitFromOneCircleDual(KeyFrame &kf, KeyFrame &kss,
                     continue;
             }
 
-            p->v3Center_NC = unproject(mCamera->UnProject(irCenterl0));// (x, y, 1)
-            p->v3OneDownFromCenter_NC = unproject(mCamera->UnProject(irCenterl0 + ImageRef(0,nLevelScale)));
-            p->v3OneRightFromCenter_NC = unproject(mCamera->UnProject(irCenterl0 + ImageRef(nLevelScale,0)));
+            p->v3Center_NC = unproject(mCamera->UnProjectPixel(irCenterl0));// (x, y, 1)
+            p->v3OneDownFromCenter_NC = unproject(mCamera->UnProjectPixel(irCenterl0 + ImageRef(0,nLevelScale)));
+            p->v3OneRightFromCenter_NC = unproject(mCamera->UnProjectPixel(irCenterl0 + ImageRef(nLevelScale,0)));
 
             //calculate the 3D point info in world frame. xp--(xd--)xn(--xc)--xw
             //Xw = Rwc*Xc + twc = d*Rwc*Xn + twc
@@ -1634,6 +1738,7 @@ bool MapMaker::InitFromOneCircleDual(KeyFrame &kf, KeyFrame &kss,
     mMap.vpKeyFrames.push_back(pkFirst);
     mMap.bGood = true;
 
+    PublishMap();
     lock.unlock();
 
     cout << "  MapMaker: made initial map from " << mMap.vpPoints.size() << " points." << endl;
@@ -1664,6 +1769,7 @@ bool MapMaker::InitFromOneCircleDual(KeyFrame &kf, KeyFrame &kss,
 //        it->second.Source = Measurement::SRC_TRACKER;
 //    }
 
+    PublishMap();
     locksec.unlock();
 
     return true;
@@ -1709,10 +1815,29 @@ void MapMaker::ThinCandidates(KeyFrame &k, int nLevel)
     vCSrc = vCGood;
 }
 
-// Adds map points by epipolar search to the last-added key-frame, at a single
-// specified pyramid level. Does epipolar search in the target keyframe as closest by
+// Adds map points to the last-added key-frame of camera nCam, on all pyramid levels.
+// ThinCandidates() on level L looks at measurements on levels L and L+1, so level 2
+// has to wait until the points made on level 3 are in; the other levels are independent
+// and are searched in one batch.
+void MapMaker::AddNewMapPoints(int nCam)
+{
+    vector<int> vLevels;
+    vLevels.push_back(3);
+    vLevels.push_back(0);
+    vLevels.push_back(1);
+    AddSomeMapPoints(vLevels, nCam);
+
+    vLevels.assign(1, 2);
+    AddSomeMapPoints(vLevels, nCam);
+}
+
+// Adds map points by epipolar search to the last-added key-frame, at the
+// specified pyramid levels. Does epipolar search in the target keyframe as closest by
 // the ClosestKeyFrame function.
-void MapMaker::AddSomeMapPoints(int nLevel, int nCam)
+// The candidates of all levels are searched in parallel by the worker pool; the new
+// points are then committed to the map in candidate order by this thread, which
+// (like the serial version) has to hold the map's write lock.
+void MapMaker::AddSomeMapPoints(const vector<int> &vLevels, int nCam)
 {
     boost::shared_ptr<KeyFrame> kSrc;
     boost::shared_ptr<KeyFrame> kTarget;
@@ -1731,30 +1856,71 @@ void MapMaker::AddSomeMapPoints(int nLevel, int nCam)
     double distxy = sqrt(c12.get_translation()[0]*c12.get_translation()[0]+c12.get_translation()[1]*c12.get_translation()[1]);
     if (nCam && distxy < *gvnmindistxy)
         return;
-    Level &l = kSrc->aLevels[nLevel];
 
-    ThinCandidates(*kSrc, nLevel);
+    // Everything the workers share has to be ready before they start.
+    vector<pair<int, int> > vJobs;
+    for (unsigned int i = 0; i < vLevels.size(); i++)
+    {
+        int nLevel = vLevels[i];
+        ThinCandidates(*kSrc, nLevel);
+        CacheImplaneCorners(*kTarget, nLevel);
+        for (unsigned int j = 0; j < kSrc->aLevels[nLevel].vCandidates.size(); j++)
+            vJobs.push_back(make_pair(nLevel, (int)j));
+    }
 
-    static gvar3<int> gvnAddPoints3D("MapMaker.AddPoints3D", 1, SILENT);
-    static gvar3<int> gvnAddPointsEpipolar("MapMaker.AddPointsEpipolar", 1, SILENT);
+    vector<NewMapPoint> vNew(vJobs.size());
+    mpWorkers->ParallelFor(vJobs.size(), boost::bind(&MapMaker::AddPointFromCandidate, this, kSrc, kTarget,
+                                                     boost::cref(vJobs), boost::ref(vNew), _1, _2));
 
-    //  static int add = 0;
-    for(unsigned int i = 0; i<l.vCandidates.size(); i++) {
-        if (l.vCandidates[i].dDepth > 0.0 && *gvnAddPoints3D == 1){
-            AddPointDepth(kSrc, kTarget, nLevel, i);
-            //          if (add == 0)
-            //              cout << "ADD MAP POINTS BY DEPTH. " << endl;
-            //          add = 1;
-        }
-        else if (*gvnAddPointsEpipolar == 1){
-            AddPointEpipolar(kSrc, kTarget, nLevel, i);
-            //          if (add == 0)
-            //            cout << "ADD MAP POINTS BY EPIPOLAR SEARCH. " << endl;
-            //          add = 1;
-        }
+    for (unsigned int i = 0; i < vNew.size(); i++)
+        if (vNew[i].pPoint)
+            CommitNewMapPoint(kSrc, kTarget, vNew[i]);
+}
+
+// Worker pool job: tries to make a map point out of candidate vJobs[nJob].
+// Must not touch the map or the keyframes' measurements, the result goes to vNew[nJob].
+void MapMaker::AddPointFromCandidate(boost::shared_ptr<KeyFrame> kSrc, boost::shared_ptr<KeyFrame> kTarget,
+                                     const vector<pair<int, int> > &vJobs, vector<NewMapPoint> &vNew,
+                                     int nJob, int nWorker)
+{
+    int nLevel = vJobs[nJob].first;
+    int nCandidate = vJobs[nJob].second;
+    if (kSrc->aLevels[nLevel].vCandidates[nCandidate].dDepth > 0.0 && *mgvnAddPoints3D == 1)
+        AddPointDepth(kSrc, kTarget, nLevel, nCandidate, nWorker, vNew[nJob]);
+    else if (*mgvnAddPointsEpipolar == 1)
+        AddPointEpipolar(kSrc, kTarget, nLevel, nCandidate, nWorker, vNew[nJob]);
+}
+
+// Puts a point made by AddPointDepth/AddPointEpipolar into the map.
+void MapMaker::CommitNewMapPoint(boost::shared_ptr<KeyFrame> kSrc, boost::shared_ptr<KeyFrame> kTarget, NewMapPoint &np)
+{
+    mMap.vpPoints.push_back(np.pPoint);
+    mqNewQueue.push(np.pPoint);
+    kSrc->mMeasurements[np.pPoint] = np.mSrc;
+    np.pPoint->MMData.sMeasurementKFs.insert(kSrc);
+    if (np.bFoundInTarget)
+    {
+        kTarget->mMeasurements[np.pPoint] = np.mTarget;
+        np.pPoint->MMData.sMeasurementKFs.insert(kTarget);
     }
-    //  add = 0;
-};
+}
+
+void MapMaker::CacheImplaneCorners(KeyFrame &k, int nLevel)
+{
+    Level &l = k.aLevels[nLevel];
+    if (l.bImplaneCornersCached)
+        return;
+    const CameraModel *cam = WorkerCamera(0, k.nSourceCamera);
+    l.vImplaneCorners.clear();
+    l.vImplaneCorners.reserve(l.vCorners.size());
+    for (unsigned int i = 0; i < l.vCorners.size(); i++)   // over all corners in target img..
+        l.vImplaneCorners.push_back(cam->UnProjectPixel(ir(LevelZeroPos(l.vCorners[i], nLevel))));
+
+    // Cells about as wide as the epipolar band searched by AddPointEpipolar
+    double dBandWidth = 2.0 * WorkerCamera(0, k.nSourceCamera)->OnePixelDist() * (4.0 + 1.0 * LevelScale(nLevel));
+    l.ImplaneGrid.Build(l.vImplaneCorners, dBandWidth);
+    l.bImplaneCornersCached = true;
+}
 
 // Rotates/translates the whole map and all keyframes
 void MapMaker::ApplyGlobalTransformationToMap(SE3<> se3NewFromOld)
@@ -1789,73 +1955,58 @@ void MapMaker::ApplyGlobalScaleToMap(double dScale)
 // the tracker thread doesn't want to hang about, so 
 // just dumps it on the top of the mapmaker's queue to 
 // be dealt with later, and return.
-bool MapMaker::AddKeyFrame(KeyFrame &k)
+bool MapMaker::AddKeyFrame(const boost::shared_ptr<KeyFrame> &pK)
 {
-    boost::mutex::scoped_lock lock(MappingEnabledMut);
-    if (mbMappingEnabled) {
-        boost::shared_ptr<KeyFrame> pK(new KeyFrame);
-        *pK = k;
-        if (!k.nSourceCamera)
-        {
-            mvpKeyFrameQueue.push_back(pK);
-        }
-        else
-        {
-            mvpKeyFrameQueueSec[0].push_back(pK);
-        }
-        return true;
-    } else {
-        return false;
-    }
-//    lock.unlock();
+    boost::shared_ptr<KeyFrame> apKSec[AddCamNumber];
+    return AddKeyFrame(pK, apKSec);
 }
-bool MapMaker::AddKeyFrameDual(KeyFrame &k, KeyFrame &ksec)
+
+bool MapMaker::AddKeyFrame(const boost::shared_ptr<KeyFrame> &pK, const boost::shared_ptr<KeyFrame> apKSec[AddCamNumber])
 {
     boost::mutex::scoped_lock lock(MappingEnabledMut);
-    if (mbMappingEnabled) {
-        if (k.nSourceCamera || !ksec.nSourceCamera)
-        {
-            cerr << "Keyframes identity error!!!" << endl;
-            return false;
-        }
+    bool bEnabled = mbMappingEnabled;
+    lock.unlock();
+    if (!bEnabled)
+        return false;
 
-        boost::shared_ptr<KeyFrame> pK(new KeyFrame);
-        boost::shared_ptr<KeyFrame> pKsec(new KeyFrame);
-        *pK = k;
-        *pKsec = ksec;
-        pK->mAssociateKeyframe = true;
-        pKsec->mAssociateKeyframe = true;
-        mvpKeyFrameQueue.push_back(pK);
-        mvpKeyFrameQueueSec[0].push_back(pKsec);
-        // label its associated kf from the master camera with associated.
-        // which is the lated kf added to the mvpKeyFrameQueue
-        mvpKeyFrameQueue[mvpKeyFrameQueue.size()-1]->nAssociatedKf = mvpKeyFrameQueueSec[0].size()-1;
-        mvpKeyFrameQueueSec[0][mvpKeyFrameQueueSec[0].size()-1]->nAssociatedKf = mvpKeyFrameQueue.size()-1;
-        return true;
-    } else {
+    if (pK->nSourceCamera)
+    {
+        cerr << "Keyframes identity error!!!" << endl;
+        return false;
+    }
+    // No copies: the tracker hands its frames over
+    KeyFrameBundle bundle;
+    bundle.pKF = pK;
+    bool abAssociated[AddCamNumber];
+    for (int i = 0; i < AddCamNumber; i ++)
+    {
+        if (!apKSec[i])
+            continue;
+        assert(apKSec[i]->nSourceCamera == i + 1);
+        bundle.apKFSec[i] = apKSec[i];
+        abAssociated[i] = apKSec[i]->mAssociateKeyframe;
+        apKSec[i]->mAssociateKeyframe = true;
+    }
+    if (!mKeyFrameQueue.Push(bundle))
+    {
+        // Still the tracker's
+        for (int i = 0; i < AddCamNumber; i ++)
+            if (apKSec[i])
+                apKSec[i]->mAssociateKeyframe = abAssociated[i];
         return false;
     }
-//    lock.unlock();
+    RequestBundleYield();
+    return true;
 }
 
-bool MapMaker::AddKeyFrameSec(KeyFrame &ksec)
+// Called by the Add*KeyFrame* entry points (tracker thread): a local
+// bundle adjustment in progress stops at its next iteration boundary,
+// keeps what it has got so far, and the keyframe gets integrated. The
+// next local BA then carries on from there.
+void MapMaker::RequestBundleYield()
 {
-    assert(ksec.nSourceCamera > 0);
-
-    boost::mutex::scoped_lock lock(MappingEnabledMut);
-    if (!mbMappingEnabled)
-        return false;
-
-    boost::shared_ptr<KeyFrame> pKsec(new KeyFrame);
-    *pKsec = ksec;
-    int adcamIndex = ksec.nSourceCamera - 1;
-    pKsec->mAssociateKeyframe = true;
-    mvpKeyFrameQueueSec[adcamIndex].push_back(pKsec);
-    // label its associated kf from the master camera with associated.
-    // which is the lated kf added to the mvpKeyFrameQueue
-    mvpKeyFrameQueueSec[adcamIndex][mvpKeyFrameQueueSec[adcamIndex].size()-1]->nAssociatedKf = mvpKeyFrameQueue.size()-1;
-
-    return true;
+    if(mbBundleRunning && mbBundleRunningIsRecent)
+        mbBundleYieldRequested = true;
 }
 
 // Mapmaker's code to handle incoming key-frames.
@@ -1863,52 +2014,34 @@ bool MapMaker::AddKeyFrameSec(KeyFrame &ksec)
 // but those keyframes from the two cameras should be paired, except the initialised one
 void MapMaker::AddKeyFrameFromTopOfQueue()
 {
-    cout << "Adding " << mvpKeyFrameQueue.size()<< " Keyframes to the local map..." << endl;
-    boost::mutex::scoped_lock lockqueue(MappingEnabledMut);
-    if(mvpKeyFrameQueue.size() == 0)
-        return;
+    cout << "Adding " << mKeyFrameQueue.Size() << " Keyframes to the local map..." << endl;
 
     static gvar3<int> gvnFixedFrameSize("MapMaker.FixedFrameSize", 3, SILENT);
     static gvar3<int> gvnVOonly("MapMaker.VOonly", 0, SILENT);
 
-//    for (int i = 0; i < mMap.vpKeyFrames.size(); i ++){
-//        if (mMap.vpKeyFrames[i]->mAssociateKeyframe)
-//            cout << i <<": " << mMap.vpKeyFrames[i]->nAssociatedKf << ", " << mMap.vpKeyFrames[i]->mAssociatedinFinalQueue <<endl;
-//    }
     // yang, original PTAM problem: when mapping thread is busy, it may not be able to add
     // a keyframe in time. Then tracking thread may add too many very close keyframes to the
     // waiting list, if the quadrotor flys fast. So we need to check those kf in the waiting
     // list again.
-    bool neednewkf = true;
-    bool neednewkfsec = true;
-    bool usingDualimg = true;
-    bool needanykf = true;
+    bool neednewkf = false;
+    bool neednewkfsec = false;
+    bool usingDualimg = false;
+    bool needanykf = false;
     boost::shared_ptr<KeyFrame> pK, pK2[AddCamNumber];
 
-    // force directly add kfs from the two cams together if there's association! <= check based on both kfs
-    // then the association number would match each kf's own number
+    // kfs from all cams of one instant come as a bundle, and are added together.
     /// TODO: allow individual additional kfs to be added, as I tried and abondoned before. This can improve the robustness of the system when kfs are lost commonly occures in a multi-cam system
-    int nKfmin = mvpKeyFrameQueue.size();
-    for (int i = 0; i < AddCamNumber; i ++){
-        if (mvpKeyFrameQueueSec[i].size()== 0)
-            usingDualimg = false;
-        else if (mvpKeyFrameQueueSec[i].size() < nKfmin)
-            nKfmin = mvpKeyFrameQueueSec[i].size();
-    }
-
-    for (int i = 0; i < nKfmin; i ++){
-        pK = mvpKeyFrameQueue[0];
-        mvpKeyFrameQueue.erase(mvpKeyFrameQueue.begin());
-//        if (i != 0) /// in this case, not likely to add it
-            neednewkf = NeedNewKeyFrame(pK);
+    KeyFrameBundle bundle;
+    while (mKeyFrameQueue.Pop(bundle)){
+        pK = bundle.pKF;
+        neednewkf = NeedNewKeyFrame(pK);
         cout << "need new kf from first cam?: " << neednewkf << endl;
 
         /// Add kfs whenever one of the kfs should be added
+        usingDualimg = bundle.HasAllCameras();
         if (usingDualimg){
             for (int cn = 0; cn < AddCamNumber; cn ++){
-                pK2[cn] = mvpKeyFrameQueueSec[cn][0];
-                mvpKeyFrameQueueSec[cn].erase(mvpKeyFrameQueueSec[cn].begin());
-//                if (i != 0 && mMap.vpKeyFramessec[cn].size()>0)
+                pK2[cn] = bundle.apKFSec[cn];
                 if ( mMap.vpKeyFramessec[cn].size()>0)
                     neednewkfsec = NeedNewKeyFrame(pK2[cn]);
                 else
@@ -1920,40 +2053,16 @@ void MapMaker::AddKeyFrameFromTopOfQueue()
         needanykf = neednewkf || neednewkfsec;
         cout << "need new kf from secon cam?: " << neednewkfsec << endl;
 
-//        // and every kf with a association in queuesec should correct its association number
-//        for (int j = 0; j < mvpKeyFrameQueueSec.size(); j++){
-//            if (mvpKeyFrameQueueSec[j]->mAssociateKeyframe && !mvpKeyFrameQueueSec[j]->mAssociatedinFinalQueue)
-//                mvpKeyFrameQueueSec[j]->nAssociatedKf --;
-//        }
-
         if (needanykf){// add this kf!
             // in dcslam system, the association number is useless
             if (usingDualimg){
-//                assert(mMap.vpKeyFrames.size() == mMap.vpKeyFramessec.size());
                 pK->nAssociatedKf = mMap.vpKeyFramessec[0].size();
                 for (int cn = 0; cn < AddCamNumber; cn ++)
                     pK2[cn]->nAssociatedKf = mMap.vpKeyFrames.size();
             }
-//            if (pK->mAssociateKeyframe){
-//                if (!pK->mAssociatedinFinalQueue){
-//                    mvpKeyFrameQueueSec[pK->nAssociatedKf]->nAssociatedKf = mMap.vpKeyFrames.size();
-//                    mvpKeyFrameQueueSec[pK->nAssociatedKf]->mAssociatedinFinalQueue = true;
-//                }
-//                else{
-//                    mMap.vpKeyFramessec[pK->nAssociatedKf]->nAssociatedKf = mMap.vpKeyFrames.size();
-//                    mMap.vpKeyFramessec[pK->nAssociatedKf]->mAssociatedinFinalQueue = true;
-//                }
-//            }
             break;
         }
-//        else if (pK->mAssociateKeyframe){ // label the association relationship of its associated kf
-//            if (!pK->mAssociatedinFinalQueue)
-//                mvpKeyFrameQueueSec[pK->nAssociatedKf]->mAssociateKeyframe = false;
-//            else
-//                mMap.vpKeyFramessec[pK->nAssociatedKf]->mAssociateKeyframe = false;
-//        }
     }
-    lockqueue.unlock();
     cout << "Adding Keyframes preparation done..." << endl;
 
     if (!needanykf)
@@ -1961,10 +2070,12 @@ void MapMaker::AddKeyFrameFromTopOfQueue()
 
     //    pK = mvpKeyFrameQueue[0];
     //    mvpKeyFrameQueue.erase(mvpKeyFrameQueue.begin());
-    pK->SBI = SmallBlurryImage(*pK); // Regenerate Small Blurry Image
-    pK->SBI.MakeJacs();
-    if (!pK->bComplete)
-        pK->MakeKeyFrame_Rest();
+    // Regenerate Small Blurry Images, and the rest where missing, for the kfs of all cameras at once
+    mpBuilder->AddMade(*pK);
+    if (usingDualimg)
+        for (int cn = 0; cn < AddCamNumber; cn ++)
+            mpBuilder->AddMade(*pK2[cn]);
+    mpBuilder->Run();
 
     if (mMap.vpKeyFrames.size() < *gvnFixedFrameSize)
         pK->bFixed = true;
@@ -1993,10 +2104,7 @@ void MapMaker::AddKeyFrameFromTopOfQueue()
     ReFindInSingleKeyFrame(pK);
 
     if (neednewkf){
-        AddSomeMapPoints(3);       // .. and add more map points by epipolar search.
-        AddSomeMapPoints(0);
-        AddSomeMapPoints(1);
-        AddSomeMapPoints(2);
+        AddNewMapPoints();       // .. and add more map points by epipolar search.
         cout << "Added map points from First cam keyframe..."<< mMap.vpKeyFrames.size() << endl;
     }
 
@@ -2054,21 +2162,17 @@ void MapMaker::AddKeyFrameFromTopOfQueue()
 //    }
 
     if (!usingDualimg){
+        if (*gvnVOonly!=0)// Remove old keyframes
+            mMap.EraseOldKeyFrames(false);
+        PublishMap();
         lock.unlock();
         mbBundleConverged_Full = false;
         mbBundleConverged_Recent = false;
         newRecentKF= true;
-        if (*gvnVOonly!=0)// Remove old keyframes
-            mMap.EraseOldKeyFrames(false);
         return;
     }
 
     for (int cn = 0; cn < AddCamNumber; cn ++){
-        pK2[cn]->SBI = SmallBlurryImage(*pK2[cn]); // Regenerate Small Blurry Image
-        pK2[cn]->SBI.MakeJacs();
-        if (!pK2[cn]->bComplete)
-            pK2[cn]->MakeKeyFrame_Rest();
-
         // try also fix the second kf, since the ini map is always accurate till now
         if (mMap.vpKeyFramessec[cn].size() < *gvnFixedFrameSize)
             pK2[cn]->bFixed = true;
@@ -2087,17 +2191,16 @@ void MapMaker::AddKeyFrameFromTopOfQueue()
         }
         // different camera model for the second camera keyframes,
         // mappoints should only be triangulated among those kfs from the same camera
-        if(mMap.vpKeyFramessec[cn].size() < 2)
+        if(mMap.vpKeyFramessec[cn].size() < 2){
+            PublishMap();
             return;
+        }
         // And maybe we missed some - this now adds to the map itself, too.
         ReFindInSingleKeyFrame(pK2[cn]);//
 
 //        if (neednewkfsec)
         {
-            AddSomeMapPoints(3, cn+1);       // .. and add more map points by epipolar search.
-            AddSomeMapPoints(0, cn+1);
-            AddSomeMapPoints(1, cn+1);
-            AddSomeMapPoints(2, cn+1);
+            AddNewMapPoints(cn+1);       // .. and add more map points by epipolar search.
             cout << "Added map points from sec cam keyframe..."<< mMap.vpKeyFramessec[cn].size() << endl;
         }
     }
@@ -2108,10 +2211,11 @@ void MapMaker::AddKeyFrameFromTopOfQueue()
 //        BundleAdjustAllsec();
 
     nAddedKfNoBA ++;
+    if (*gvnVOonly!=0)// Remove old keyframes
+        mMap.EraseOldKeyFrames(false);
+    PublishMap();
     lock.unlock();
     newRecentKF= true;
-    if (*gvnVOonly!=0)// Remove old keyframes
-        mMap.EraseOldKeyFrames(true);
 
 //    std::cout<<"associations: " << "\n";
 //    for (int i = 0; i < mMap.vpKeyFramessec.size(); i ++)
@@ -2122,38 +2226,35 @@ void MapMaker::AddKeyFrameFromTopOfQueue()
 //    std::cout << std::endl;
 }
 
+// Makes a new map point straight from a candidate with a depth measurement,
+// and tries to find it in the target keyframe as well.
+// Runs in a worker thread: the point only goes into result, see CommitNewMapPoint().
 bool MapMaker::AddPointDepth(boost::shared_ptr<KeyFrame> kSrc,
                              boost::shared_ptr<KeyFrame> kTarget,
                              int nLevel,
-                             int nCandidate
+                             int nCandidate,
+                             int nWorker,
+                             NewMapPoint &result
                              )
 {
     int nCam = kSrc->nSourceCamera;
+    CameraModel *cam = WorkerCamera(nWorker, nCam);
     int nLevelScale = LevelScale(nLevel);
-    Candidate &candidate = kSrc->aLevels[nLevel].vCandidates[nCandidate];
-    static gvar3<double> gvnUseMaxDepth("MapMaker.UseMaxDepth", 5.0, SILENT);
+    const Candidate &candidate = kSrc->aLevels[nLevel].vCandidates[nCandidate];
 
     const ImageRef& irLevelPos = candidate.irLevelPos;
     Vector<2> v2RootPos = LevelZeroPos(irLevelPos, nLevel);
 
     // project candidate into target frame
-    Vector<3> v3Unprojected;
-    if (!nCam)
-        v3Unprojected = unproject(mCamera->UnProject(v2RootPos));
-    else
-        v3Unprojected = unproject(mCameraSec[nCam - 1]->UnProject(v2RootPos));
+    Vector<3> v3Unprojected = unproject(cam->UnProject(v2RootPos));
 
     Vector<3> v3PoseCam = candidate.dDepth*v3Unprojected;
-    if (sqrt(v3PoseCam*v3PoseCam) > *gvnUseMaxDepth)
+    if (sqrt(v3PoseCam*v3PoseCam) > *mgvdUseMaxDepth)
         return false;
 
     Vector<3> v3PosWorld = kSrc->se3CfromW.inverse()*v3PoseCam;
     Vector<3> v3PosTarget = kTarget->se3CfromW*v3PosWorld;
-    ImageRef irTarget;
-    if (!nCam)
-        irTarget = ir(mCamera->Project(project(v3PosTarget)));
-    else
-        irTarget = ir(mCameraSec[nCam - 1]->Project(project(v3PosTarget)));
+    ImageRef irTarget = ir(cam->Project(project(v3PosTarget)));
 
     // Find current-frame corners which might match this
     PatchFinder Finder;
@@ -2172,16 +2273,9 @@ bool MapMaker::AddPointDepth(boost::shared_ptr<KeyFrame> kSrc,
     pNew->v3Normal_NC = makeVector( 0,0,-1);
     pNew->irCenter = irLevelPos;
 
-    if (!nCam){
-        pNew->v3Center_NC = unproject(mCamera->UnProject(v2RootPos));
-        pNew->v3OneRightFromCenter_NC = unproject(mCamera->UnProject(v2RootPos + vec(ImageRef(nLevelScale,0))));
-        pNew->v3OneDownFromCenter_NC  = unproject(mCamera->UnProject(v2RootPos + vec(ImageRef(0,nLevelScale))));
-    }
-    else{
-        pNew->v3Center_NC = unproject(mCameraSec[nCam - 1]->UnProject(v2RootPos));
-        pNew->v3OneRightFromCenter_NC = unproject(mCameraSec[nCam - 1]->UnProject(v2RootPos + vec(ImageRef(nLevelScale,0))));
-        pNew->v3OneDownFromCenter_NC  = unproject(mCameraSec[nCam - 1]->UnProject(v2RootPos + vec(ImageRef(0,nLevelScale))));
-    }
+    pNew->v3Center_NC = unproject(cam->UnProject(v2RootPos));
+    pNew->v3OneRightFromCenter_NC = unproject(cam->UnProject(v2RootPos + vec(ImageRef(nLevelScale,0))));
+    pNew->v3OneDownFromCenter_NC  = unproject(cam->UnProject(v2RootPos + vec(ImageRef(0,nLevelScale))));
 
     normalize(pNew->v3Center_NC);
     normalize(pNew->v3OneDownFromCenter_NC);
@@ -2192,28 +2286,25 @@ bool MapMaker::AddPointDepth(boost::shared_ptr<KeyFrame> kSrc,
 
     pNew->RefreshPixelVectors();
 
-    mMap.vpPoints.push_back(pNew);
-    mqNewQueue.push(pNew);
-    Measurement m;
+    result.pPoint = pNew;
+    Measurement &m = result.mSrc;
     m.Source = Measurement::SRC_ROOT;
     m.v2RootPos = v2RootPos;
     m.dDepth = candidate.dDepth;
     m.nLevel = nLevel;
     m.bSubPix = true;
-    kSrc->mMeasurements[pNew] = m;
-    pNew->MMData.sMeasurementKFs.insert(kSrc);
 
+    result.bFoundInTarget = false;
     if (Finder.FindPatchCoarse(irTarget,*kTarget,10)) {
         Finder.MakeSubPixTemplate();
         Finder.SetSubPixPos(Finder.GetCoarsePosAsVector());
         if (Finder.IterateSubPixToConvergence(*kTarget,10)) {
-            m.Source = Measurement::SRC_EPIPOLAR;
-            m.v2RootPos = Finder.GetSubPixPos();
-            m.dDepth = Finder.GetCoarseDepth();
-            m.nLevel = Finder.GetLevel();
-            //m.bSubPix = true;
-            kTarget->mMeasurements[pNew] = m;
-            pNew->MMData.sMeasurementKFs.insert(kTarget);
+            result.mTarget = m;
+            result.mTarget.Source = Measurement::SRC_EPIPOLAR;
+            result.mTarget.v2RootPos = Finder.GetSubPixPos();
+            result.mTarget.dDepth = Finder.GetCoarseDepth();
+            result.mTarget.nLevel = Finder.GetLevel();
+            result.bFoundInTarget = true;
         }
     }
 
@@ -2223,46 +2314,24 @@ bool MapMaker::AddPointDepth(boost::shared_ptr<KeyFrame> kSrc,
 // Tries to make a new map point out of a single candidate point
 // by searching for that point in another keyframe, and triangulating
 // if a match is found.
+// Runs in a worker thread: the point only goes into result, see CommitNewMapPoint().
+// Relies on the target's vImplaneCorners being ready.
 bool MapMaker::AddPointEpipolar(boost::shared_ptr<KeyFrame> kSrc, 
                                 boost::shared_ptr<KeyFrame> kTarget,
                                 int nLevel,
-                                int nCandidate)
+                                int nCandidate,
+                                int nWorker,
+                                NewMapPoint &result)
 {
     int nCam = kSrc->nSourceCamera;
-    static Image<Vector<2> > imUnProj;
-    static Image<Vector<2> > imUnProjsec;// look out this static member!!
-    static bool bMadeCache = false;
-    static bool bMadeCachesec = false;
-    if(!bMadeCache && !nCam)
-    {
-        ImageRef ir;
-        imUnProj.resize(kSrc->aLevels[0].im.size());
-        do imUnProj[ir] = mCamera->UnProject(ir);
-        while(ir.next(imUnProj.size()));
-        bMadeCache = true;
-    }
-    else if(!bMadeCachesec && nCam)
-    {
-        ImageRef ir;
-        imUnProjsec.resize(kSrc->aLevels[0].im.size());
-        do imUnProjsec[ir] = mCameraSec[nCam - 1]->UnProject(ir);
-        while(ir.next(imUnProjsec.size()));
-        bMadeCachesec = true;
-    }
+    CameraModel *cam = WorkerCamera(nWorker, nCam);
 
     int nLevelScale = LevelScale(nLevel);
-    Candidate &candidate = kSrc->aLevels[nLevel].vCandidates[nCandidate];
+    const Candidate &candidate = kSrc->aLevels[nLevel].vCandidates[nCandidate];
     ImageRef irLevelPos = candidate.irLevelPos;
     Vector<2> v2RootPos = LevelZeroPos(irLevelPos, nLevel);
 
-    Vector<3> v3Ray_SC;
-    if (!nCam){
-        v3Ray_SC = unproject(mCamera->UnProject(v2RootPos));
-    }
-    else
-    {
-        v3Ray_SC = unproject(mCameraSec[nCam - 1]->UnProject(v2RootPos));
-    }
+    Vector<3> v3Ray_SC = unproject(cam->UnProject(v2RootPos));
     normalize(v3Ray_SC);
     assert(v3Ray_SC[2] >= 0);
     Vector<3> v3LineDirn_TC = kTarget->se3CfromW.get_rotation() * (kSrc->se3CfromW.get_rotation().inverse() * v3Ray_SC);
@@ -2274,12 +2343,10 @@ bool MapMaker::AddPointEpipolar(boost::shared_ptr<KeyFrame> kSrc,
     double dSigma = kSrc->dSceneDepthSigma;
     double dStartDepth;
     double dEndDepth;
-    static gvar3<double> gvndSceneDepthMaxSecCam("MapMaker.SceneDepthMaxSecCam", 5.0, SILENT);
-    static gvar3<double> gvndSceneDepthMinSecCam("MapMaker.SceneDepthMinSecCam", 2.0, SILENT);
     if ((kSrc->dSceneDepthMean==1.0) && (kSrc->dSceneDepthSigma==1.0))// weak constrain for initial case
     {
-        dStartDepth = *gvndSceneDepthMinSecCam;
-        dEndDepth = *gvndSceneDepthMaxSecCam;
+        dStartDepth = *mgvdSceneDepthMinSecCam;
+        dEndDepth = *mgvdSceneDepthMaxSecCam;
 //        cout << "depth not initialised "<< dMean << ", " << dSigma << endl;
     }
     else
@@ -2319,14 +2386,8 @@ bool MapMaker::AddPointEpipolar(boost::shared_ptr<KeyFrame> kSrc,
     v2Normal[1] = -v2AlongProjectedLine[0];
 
     double dNormDist = v2A * v2Normal;
-    if (!nCam){
-        if(fabs(dNormDist) > mCamera->LargestRadiusInImage() )
-            return false;
-    }
-    else{
-        if(fabs(dNormDist) > mCameraSec[nCam - 1]->LargestRadiusInImage() )
-            return false;
-    }
+    if(fabs(dNormDist) > cam->LargestRadiusInImage() )
+        return false;
 
     double dMinLen = min(v2AlongProjectedLine * v2A, v2AlongProjectedLine * v2B) - 0.05;
     double dMaxLen = max(v2AlongProjectedLine * v2A, v2AlongProjectedLine * v2B) + 0.05;
@@ -2340,34 +2401,23 @@ bool MapMaker::AddPointEpipolar(boost::shared_ptr<KeyFrame> kSrc,
     Finder.MakeTemplateCoarseNoWarp(*kSrc, nLevel, irLevelPos);
     if(Finder.TemplateBad())  return false;
 
-    vector<Vector<2> > &vv2Corners = kTarget->aLevels[nLevel].vImplaneCorners;
-    vector<ImageRef> &vIR = kTarget->aLevels[nLevel].vCorners;
-    if(!kTarget->aLevels[nLevel].bImplaneCornersCached)
-    {
-        for(unsigned int i=0; i<vIR.size(); i++)   // over all corners in target img..
-        {
-            if (!nCam)
-                vv2Corners.push_back(imUnProj[ir(LevelZeroPos(vIR[i], nLevel))]);
-            else
-                vv2Corners.push_back(imUnProjsec[ir(LevelZeroPos(vIR[i], nLevel))]);
-        }
-        kTarget->aLevels[nLevel].bImplaneCornersCached = true;
-    }
+    assert(kTarget->aLevels[nLevel].bImplaneCornersCached);
+    const vector<Vector<2> > &vv2Corners = kTarget->aLevels[nLevel].vImplaneCorners;
+    const vector<ImageRef> &vIR = kTarget->aLevels[nLevel].vCorners;
 
     int nBest = -1;
     int nBestZMSSD = Finder.mnMaxSSD + 1;
-    double dMaxDistDiff;
-    if (!nCam){
-        dMaxDistDiff = mCamera->OnePixelDist() * (4.0 + 1.0 * nLevelScale);
-    }
-    else{
-        dMaxDistDiff = mCameraSec[nCam - 1]->OnePixelDist() * (4.0 + 1.0 * nLevelScale);
-    }
+    double dMaxDistDiff = cam->OnePixelDist() * (4.0 + 1.0 * nLevelScale);
     double dMaxDistSq = dMaxDistDiff * dMaxDistDiff;
 
-    for(unsigned int i=0; i<vv2Corners.size(); i++)   // over all corners in target img..
+    // Only look at the corners in the grid cells along the epipolar band
+    vector<int> vInBand;
+    kTarget->aLevels[nLevel].ImplaneGrid.FindInBand(v2AlongProjectedLine, v2Normal, dNormDist,
+                                                    dMinLen, dMaxLen, dMaxDistDiff, vInBand);
+    for(unsigned int j=0; j<vInBand.size(); j++)   // over the target corners near the epipolar line..
     {
-        Vector<2> v2Im = vv2Corners[i];
+        int i = vInBand[j];
+        const Vector<2> &v2Im = vv2Corners[i];
         double dDistDiff = dNormDist - v2Im * v2Normal;
         if(dDistDiff * dDistDiff > dMaxDistSq)	continue; // skip if not along epi line
         if(v2Im * v2AlongProjectedLine < dMinLen)	continue; // skip if not far enough along line
@@ -2390,57 +2440,26 @@ bool MapMaker::AddPointEpipolar(boost::shared_ptr<KeyFrame> kSrc,
 
     // Now triangulate the 3d point...
     // yang, ignore those points whose two view projections have a very similar direction in the world frame
-    static gvar3<double> minViewAngleDiff("MapMaker.minViewAngleDiff", 3.0, SILENT);
-    Vector<3> v3New;
-    if (!nCam){
-        SE3<> tc12 = kSrc->se3CfromW * kTarget->se3CfromW.inverse();
-        Vector<2> nc1, nc2;
-        nc1 = mCamera->UnProject(v2RootPos);
-        nc2 = mCamera->UnProject(Finder.GetSubPixPos());
-        Vector<3> tc1, tc2;
-        tc1 = unproject(nc1);
-        tc2 = unproject(nc2);
-        double viewangle = viewAngleDiffPoint(tc12.inverse().get_rotation()*tc1, tc2);
-        double mindiff = *minViewAngleDiff *2*3.14/180.0;
-        if (viewangle < mindiff)
-            return false;
-
-        Vector<3> reprop = ReprojectPoint(tc12, nc1, nc2);
-        if (reprop[2] <= std::max(0.0, tc12.inverse().get_translation()[2]))
-            return false;
-        else if (sqrt(reprop*reprop) > *gvndSceneDepthMaxSecCam)
-            return false;
-
-        v3New = kTarget->se3CfromW.inverse() * reprop;
-//        pos_log_ << "cam0 view angle: " << viewangle*180/3.14 << ", " << reprop
-//                 << ", " << tc12.get_translation() << ", "
-//                 <<tc12.inverse().get_rotation()*tc1<<", "<< tc2<< endl;
-    }
-    else{
-//        cout << "cam 1 ksc ktarget pixel: " << v2RootPos[0] << ", " << v2RootPos[1] << "  "
-//             << Finder.GetSubPixPos()[0] << ", " << Finder.GetSubPixPos()[1] << endl;
-        SE3<> tc12 = kSrc->se3CfromW * kTarget->se3CfromW.inverse();
-        Vector<2> nc1, nc2;
-        nc1 = mCameraSec[nCam - 1]->UnProject(v2RootPos);
-        nc2 = mCameraSec[nCam - 1]->UnProject(Finder.GetSubPixPos());
-        Vector<3> tc1, tc2;
-        tc1 = unproject(nc1);
-        tc2 = unproject(nc2);
-        double viewangle = viewAngleDiffPoint(tc12.inverse().get_rotation()*tc1, tc2);
-        double mindiff = *minViewAngleDiff *3.14/180.0;
-        if (viewangle < mindiff)
-            return false;
+    // (the main camera asks for twice the view angle of the additional ones)
+    SE3<> tc12 = kSrc->se3CfromW * kTarget->se3CfromW.inverse();
+    Vector<2> nc1, nc2;
+    nc1 = cam->UnProject(v2RootPos);
+    nc2 = cam->UnProject(Finder.GetSubPixPos());
+    Vector<3> tc1, tc2;
+    tc1 = unproject(nc1);
+    tc2 = unproject(nc2);
+    double viewangle = viewAngleDiffPoint(tc12.inverse().get_rotation()*tc1, tc2);
+    double mindiff = *mgvdMinViewAngleDiff * (nCam ? 1.0 : 2.0) *3.14/180.0;
+    if (viewangle < mindiff)
+        return false;
 
-        Vector<3> reprop = ReprojectPoint(tc12, nc1, nc2);
-        if (reprop[2] <= std::max(0.0, tc12.inverse().get_translation()[2]))
-            return false;
-        else if (sqrt(reprop*reprop) > *gvndSceneDepthMaxSecCam)
-            return false;
+    Vector<3> reprop = ReprojectPoint(tc12, nc1, nc2);
+    if (reprop[2] <= std::max(0.0, tc12.inverse().get_translation()[2]))
+        return false;
+    else if (sqrt(reprop*reprop) > *mgvdSceneDepthMaxSecCam)
+        return false;
 
-        v3New = kTarget->se3CfromW.inverse() * reprop;
-//        pos_log_ << "cam1 view angle: " << viewangle*180/3.14 << ", " << reprop
-//                 << ", " <<tc12.inverse().get_rotation()*tc1<<", "<< tc2<< endl;
-    }
+    Vector<3> v3New = kTarget->se3CfromW.inverse() * reprop;
 
     boost::shared_ptr<MapPoint> pNew(new MapPoint);
     pNew->v3WorldPos = v3New;
@@ -2453,16 +2472,9 @@ bool MapMaker::AddPointEpipolar(boost::shared_ptr<KeyFrame> kSrc,
     pNew->nSourceLevel = nLevel;
     pNew->v3Normal_NC = makeVector( 0,0,-1);
     pNew->irCenter = irLevelPos;
-    if (!nCam){
-        pNew->v3Center_NC = unproject(mCamera->UnProject(v2RootPos));
-        pNew->v3OneRightFromCenter_NC = unproject(mCamera->UnProject(v2RootPos + vec(ImageRef(nLevelScale,0))));
-        pNew->v3OneDownFromCenter_NC  = unproject(mCamera->UnProject(v2RootPos + vec(ImageRef(0,nLevelScale))));
-    }
-    else{
-        pNew->v3Center_NC = unproject(mCameraSec[nCam - 1]->UnProject(v2RootPos));
-        pNew->v3OneRightFromCenter_NC = unproject(mCameraSec[nCam - 1]->UnProject(v2RootPos + vec(ImageRef(nLevelScale,0))));
-        pNew->v3OneDownFromCenter_NC  = unproject(mCameraSec[nCam - 1]->UnProject(v2RootPos + vec(ImageRef(0,nLevelScale))));
-    }
+    pNew->v3Center_NC = unproject(cam->UnProject(v2RootPos));
+    pNew->v3OneRightFromCenter_NC = unproject(cam->UnProject(v2RootPos + vec(ImageRef(nLevelScale,0))));
+    pNew->v3OneDownFromCenter_NC  = unproject(cam->UnProject(v2RootPos + vec(ImageRef(0,nLevelScale))));
 
     normalize(pNew->v3Center_NC);
     normalize(pNew->v3OneDownFromCenter_NC);
@@ -2474,21 +2486,18 @@ bool MapMaker::AddPointEpipolar(boost::shared_ptr<KeyFrame> kSrc,
     //if (!nCam)
     pNew->bfixed = kSrc->bFixed&&kTarget->bFixed;
     
-    mMap.vpPoints.push_back(pNew);
-    mqNewQueue.push(pNew);
-    Measurement m;
+    result.pPoint = pNew;
+    Measurement &m = result.mSrc;
     m.dDepth = 0;
     m.Source = Measurement::SRC_ROOT;
     m.v2RootPos = v2RootPos;
     m.nLevel = nLevel;
     m.bSubPix = true;
-    kSrc->mMeasurements[pNew] = m;
 
-    m.Source = Measurement::SRC_EPIPOLAR;
-    m.v2RootPos = Finder.GetSubPixPos();
-    kTarget->mMeasurements[pNew] = m;
-    pNew->MMData.sMeasurementKFs.insert(kSrc);
-    pNew->MMData.sMeasurementKFs.insert(kTarget);
+    result.mTarget = m;
+    result.mTarget.Source = Measurement::SRC_EPIPOLAR;
+    result.mTarget.v2RootPos = Finder.GetSubPixPos();
+    result.bFoundInTarget = true;
     return true;
 }
 
@@ -2921,8 +2930,18 @@ void MapMaker::BundleAdjustRecent()
 void MapMaker::BundleAdjust(set<boost::shared_ptr<KeyFrame> > sAdjustSet, set<boost::shared_ptr<KeyFrame> > sFixedSet, set<boost::shared_ptr<MapPoint> > sMapPoints, bool bRecent, std::set<boost::shared_ptr<KeyFrame> > sAssociatedSet)
 {
     Bundle b;   // Our bundle adjuster
-    mbBundleRunning = true;
+    mbBundleYieldRequested = false;
     mbBundleRunningIsRecent = bRecent;
+    mbBundleRunning = true;
+    if(bRecent)
+    {
+        b.SetWarmStart(mRecentBundleWarmStart);
+        // A local BA forced while keyframes are queued (see run()) only
+        // gets one iteration; keyframes which arrive from now on are
+        // caught by RequestBundleYield().
+        if(QueueSize() > 0)
+            mbBundleYieldRequested = true;
+    }
     for (int i = 0; i < AddCamNumber; i ++)
         if (mMap.vpKeyFramessec[i].size())
         b.Load_Cam2FromCam1(mse3Cam2FromCam1[i], i);
@@ -3075,7 +3094,9 @@ void MapMaker::BundleAdjust(set<boost::shared_ptr<KeyFrame> > sAdjustSet, set<bo
     cout << "Doing LBA Compute..." << endl;
 
     // Run the bundle adjuster. This returns the number of successful iterations
-    int nAccepted = b.Compute(&mbBundleAbortRequested);
+    int nAccepted = b.Compute(&mbBundleAbortRequested, &mbBundleYieldRequested);
+    if(bRecent)
+        mRecentBundleWarmStart = nAccepted < 0 ? BundleWarmStart() : b.GetWarmStart();
     cout << "LBA done, updating the map..." << endl;
 
     if(nAccepted < 0)
@@ -3132,6 +3153,7 @@ void MapMaker::BundleAdjust(set<boost::shared_ptr<KeyFrame> > sAdjustSet, set<bo
         mbBundleConverged_Full = false;
 //        cout << "Keyframe poses updated." << endl;
 
+        PublishMap();
         lock.unlock();
     };
 
@@ -3144,6 +3166,7 @@ void MapMaker::BundleAdjust(set<boost::shared_ptr<KeyFrame> > sAdjustSet, set<bo
 
     mbBundleRunning = false;
     mbBundleAbortRequested = false;
+    mbBundleYieldRequested = false;
 
     static gvar3<int> gvnAlwaysHandleOutliers("MapMaker.AlwaysHandleOutliers", 0, SILENT);
     if (!bRecent || *gvnAlwaysHandleOutliers == 1) {
@@ -3279,191 +3302,291 @@ void MapMaker::BundleAdjust(set<boost::shared_ptr<KeyFrame> > sAdjustSet, set<bo
 //    // and updates those related edges, maybe not needed since they will be overwriten later
 //}
 
-//// Mapmaker's try-to-find-a-point-in-a-keyframe code. This is used to update
-//// data association if a bad measurement was detected, or if a point
-//// was never searched for in a keyframe in the first place. This operates
-//// much like the tracker! So most of the code looks just like in
-//// TrackerData.h.
-//bool MapMaker::ReFind_Common(boost::shared_ptr<KeyFrame> k, boost::shared_ptr<MapPoint> p)
-//{
-//    int nCam= k->nSourceCamera;
-//    // abort if either a measurement is already in the map, or we've
-//    // decided that this point-kf combo is beyond redemption
-//    if(p->MMData.sMeasurementKFs.count(k)
-//            || p->MMData.sNeverRetryKFs.count(k))
-//        return false;
+// Local BA has just adjusted the recent keyframes: (re)make the edges
+// between consecutive ones from their new poses, and hand keyframes and
+// edges to the pose graph. Only the first camera's keyframes go in.
+void MapMaker::SendToPoseGraph()
+{
+    if (!mpPoseGraph)
+        return;
+    static gvar3<int> gvnRecentWindowSize("MapMaker.RecentWindowSize", 4, SILENT);
+    int nFirst = max(0, (int)mMap.vpKeyFrames.size() - *gvnRecentWindowSize - 1);
+    for (unsigned int i = nFirst; i < mMap.vpKeyFrames.size(); i ++){
+        KeyFrame &k = *mMap.vpKeyFrames[i];
+        if (k.id < 0) // not numbered (made by the monocular initialisation)
+            continue;
+        if (i + 1 < mMap.vpKeyFrames.size() && mMap.vpKeyFrames[i+1]->id > k.id){
+            KeyFrame &kNext = *mMap.vpKeyFrames[i+1];
+            // aTb = aTw * wTb
+            boost::shared_ptr<Edge> e(new Edge(k.id, kNext.id, EDGE_PTAM,
+                                               PoseGraph::ToSophus(k.se3CfromW * kNext.se3CfromW.inverse())));
+            e->dSceneDepthMean = (k.dSceneDepthMean + kNext.dSceneDepthMean) / 2.0;
+            k.edges[kNext.id] = e;
+        }
+        mpPoseGraph->AddKeyFrame(k);
+    }
+    mpPoseGraph->Flush();
+}
 
-//    // this line was missing in original ptam code. if you remove it, the assertion at the bottom
-//    // will fail from time to time
-//    if (k->mMeasurements.count(p))
-//        return false;
+// The pose graph moved some keyframes: move the local map along.
+// A batch has every keyframe the graph knows about, moved or not; one it
+// doesn't know about (yet) moves with the nearest earlier keyframe which
+// it does, a map point with its source keyframe, and keyframes of the
+// additional cameras with their associated keyframe of the first camera.
+// The tracker then re-bases its pose on the second last keyframe, see
+// Tracker::MotionModelUpdateByGMap().
+void MapMaker::ApplyPoseGraphCorrections(const PoseGraph::Corrections &corrections)
+{
+    if (mMap.vpKeyFrames.size() < 2)
+        return;
+    std::map<int, SE3<> > mCorrections; // id -> se3NewFromOld, on the right of se3CfromW
+    for (unsigned int i = 0; i < corrections.vCorrections.size(); i ++){
+        const PoseGraph::Correction &c = corrections.vCorrections[i];
+        mCorrections[c.nId] = c.se3OldCfromW.inverse() * c.se3NewCfromW;
+    }
 
-//    static PatchFinder Finder;
-//    Vector<3> v3Cam = k->se3CfromW*p->v3WorldPos;
-//    if(v3Cam[2] < 0.001)
-//    {
-//        p->MMData.sNeverRetryKFs.insert(k);
-//        return false;
-//    }
-//    Vector<2> v2ImPlane = project(v3Cam);
-//    if (nCam){
-//        if( v2ImPlane* v2ImPlane > mCameraSec[nCam - 1]->LargestRadiusInImage() * mCameraSec[nCam - 1]->LargestRadiusInImage())
-//        {
-//            p->MMData.sNeverRetryKFs.insert(k);
-//            return false;
-//        }
-//    }
-//    else if(v2ImPlane* v2ImPlane > mCamera->LargestRadiusInImage() * mCamera->LargestRadiusInImage())
-//    {
-//        p->MMData.sNeverRetryKFs.insert(k);
-//        return false;
-//    }
+    // write access: unique lock
+    boost::unique_lock< boost::shared_mutex > lock(mMap.mutex);
 
-//    Vector<2> v2Image;
-//    if (nCam)
-//    {
-//        v2Image = mCameraSec[nCam - 1]->Project(v2ImPlane);
-//        if(mCameraSec[nCam - 1]->Invalid())
-//        {
-//            p->MMData.sNeverRetryKFs.insert(k);
-//            return false;
-//        }
-//    }
-//    else
-//    {
-//        v2Image = mCamera->Project(v2ImPlane);
-//        if(mCamera->Invalid())
-//        {
-//            p->MMData.sNeverRetryKFs.insert(k);
-//            return false;
-//        }
-//    }
+    // write the reference kf pose, for motion model update in tracker
+    // use the second last kf as reference, since the relative pose to the last kf could be too small
+    mMap.rebase.nKeyFrameId = mMap.vpKeyFrames[mMap.vpKeyFrames.size()-2]->id;
+    mMap.rebase.se3OldCfromW = mMap.vpKeyFrames[mMap.vpKeyFrames.size()-2]->se3CfromW;
+    mMap.rebase.nCount++;
+
+    std::map<KeyFrame*, SE3<> > mKFCorrections;
+    SE3<> se3Correction;    // Of the last keyframe known to the graph; none before the first
+    for (unsigned int i = 0; i < mMap.vpKeyFrames.size(); i ++){
+        KeyFrame &k = *mMap.vpKeyFrames[i];
+        std::map<int, SE3<> >::const_iterator it = mCorrections.find(k.id);
+        if (it != mCorrections.end())
+            se3Correction = it->second;
+        k.se3CfromW = k.se3CfromW * se3Correction;
+        mKFCorrections[&k] = se3Correction;
+
+        if (k.mAssociateKeyframe){
+            for (int cn = 0; cn < AddCamNumber; cn ++){
+                if (mMap.vpKeyFramessec[cn].size() <= k.nAssociatedKf)
+                    continue;
+                KeyFrame &kSec = *mMap.vpKeyFramessec[cn][k.nAssociatedKf];
+                kSec.se3CfromW = kSec.se3CfromW * se3Correction;
+                mKFCorrections[&kSec] = se3Correction;
+            }
+        }
+    }
+    // Additional cameras' keyframes without an association go with the newest
+    for (int cn = 0; cn < AddCamNumber; cn ++)
+        for (unsigned int i = 0; i < mMap.vpKeyFramessec[cn].size(); i ++){
+            KeyFrame &kSec = *mMap.vpKeyFramessec[cn][i];
+            if (!mKFCorrections.count(&kSec)){
+                kSec.se3CfromW = kSec.se3CfromW * se3Correction;
+                mKFCorrections[&kSec] = se3Correction;
+            }
+        }
 
-//    ImageRef irImageSize = k->aLevels[0].im.size();
-//    if(v2Image[0] < 0 || v2Image[1] < 0 || v2Image[0] > irImageSize[0] || v2Image[1] > irImageSize[1])
-//    {
-//        p->MMData.sNeverRetryKFs.insert(k);
-//        return false;
-//    }
+    for (unsigned int i = 0; i < mMap.vpPoints.size(); i ++){
+        MapPoint &p = *mMap.vpPoints[i];
+        boost::shared_ptr<KeyFrame> pSourceKF = p.pPatchSourceKF.lock();
+        std::map<KeyFrame*, SE3<> >::const_iterator it = mKFCorrections.find(pSourceKF.get());
+        const SE3<> &se3 = (it != mKFCorrections.end()) ? it->second : se3Correction;
+        // in camera coordinates nothing changes: CfromW * X == (CfromW * se3) * X'
+        p.v3WorldPos = se3.inverse() * p.v3WorldPos;
+        p.RefreshPixelVectors();
+    }
 
-//    Matrix<2> m2CamDerivs;
-//    if (nCam)
-//        m2CamDerivs = mCameraSec[nCam - 1]->GetProjectionDerivs();
-//    else
-//        m2CamDerivs = mCamera->GetProjectionDerivs();
-//    Finder.MakeTemplateCoarse(*p, k->se3CfromW, m2CamDerivs);
+    // the tracker finds the rebase, and the new pose of its keyframe, in the snapshot
+    PublishMap();
+    lock.unlock();
+    cout << "Pose graph corrected " << corrections.vCorrections.size() << " keyframes." << endl;
+}
 
-//    if(Finder.TemplateBad())
-//    {
-//        p->MMData.sNeverRetryKFs.insert(k);
-//        return false;
-//    }
+// Mapmaker's try-to-find-a-point-in-a-keyframe code. This is used to update
+// data association if a bad measurement was detected, or if a point
+// was never searched for in a keyframe in the first place. This operates
+// much like the tracker! So most of the code looks just like in
+// TrackerData.h.
+// (keyframe, point) pairs are searched for in batches: the pairs are
+// screened and each keyframe's view is set up once by this thread, the
+// patch searches run on the worker pool, and whatever was found goes
+// into the map in one pass under the map's write lock (unless the caller
+// holds it already: bLockMap false).
+int MapMaker::ReFindBatch(vector<ReFindJob> &vJobs, bool bLockMap)
+{
+    // Same pair twice (e.g. from the failure queue) is searched once
+    sort(vJobs.begin(), vJobs.end());
+    vJobs.erase(unique(vJobs.begin(), vJobs.end()), vJobs.end());
+
+    // Drop the pairs which have a measurement already, or which
+    // we've decided are beyond redemption
+    vector<ReFindJob> vSearch;
+    vSearch.reserve(vJobs.size());
+    for(unsigned int i=0; i<vJobs.size(); i++)
+    {
+        ReFindJob &job = vJobs[i];
+        if(job.pPoint->bBad
+                || job.pPoint->MMData.sMeasurementKFs.count(job.pKF)
+                || job.pPoint->MMData.sNeverRetryKFs.count(job.pKF)
+                // this line was missing in original ptam code
+                || job.pKF->mMeasurements.count(job.pPoint))
+            continue;
+        vSearch.push_back(job);
+    }
+    if(vSearch.empty())
+        return 0;
 
-//    bool bFound = Finder.FindPatchCoarse(ir(v2Image), *k, 4);  // Very tight search radius!
-//    if(!bFound)
-//    {
-//        p->MMData.sNeverRetryKFs.insert(k);
-//        return false;
-//    }
+    // One view per keyframe, shared by all its pairs (sorted, so they're adjacent)
+    vector<ReFindView> vViews;
+    for(unsigned int i=0; i<vSearch.size(); i++)
+    {
+        if(vViews.empty() || vSearch[i].pKF != vSearch[i-1].pKF)
+        {
+            KeyFrame &k = *vSearch[i].pKF;
+            CameraModel *cam = WorkerCamera(0, k.nSourceCamera);
+            ReFindView view;
+            view.se3CfromW = k.se3CfromW;
+            view.nCam = k.nSourceCamera;
+            view.dMaxRadiusSquared = cam->LargestRadiusInImage() * cam->LargestRadiusInImage();
+            view.irImageSize = k.aLevels[0].im.size();
+            vViews.push_back(view);
+        }
+        vSearch[i].nView = vViews.size() - 1;
+    }
 
-//    // If we found something, generate a measurement struct and put it in the map
-//    Measurement m;
-//    m.nLevel = Finder.GetLevel();
-//    m.dDepth = Finder.GetCoarseDepth();
-//    m.Source = Measurement::SRC_REFIND;
+    mpWorkers->ParallelFor(vSearch.size(), boost::bind(&MapMaker::ReFindOne, this, boost::cref(vViews),
+                                                       boost::ref(vSearch), _1, _2));
 
-//    if(Finder.GetLevel() > 0)
-//    {
-//        Finder.MakeSubPixTemplate();
-//        Finder.IterateSubPixToConvergence(*k,8);
-//        m.v2RootPos = Finder.GetSubPixPos();
-//        m.bSubPix = true;
-//    }
-//    else
-//    {
-//        m.v2RootPos = Finder.GetCoarsePosAsVector();
-//        m.bSubPix = false;
-//    };
+    // write access: unique lock
+    boost::unique_lock< boost::shared_mutex > lock(mMap.mutex, boost::defer_lock);
+    if(bLockMap)
+        lock.lock();
+    int nFound = 0;
+    for(unsigned int i=0; i<vSearch.size(); i++)
+    {
+        ReFindJob &job = vSearch[i];
+        if(!job.bFound)
+        {
+            job.pPoint->MMData.sNeverRetryKFs.insert(job.pKF);
+            continue;
+        }
+        job.pKF->mMeasurements[job.pPoint] = job.m;
+        job.pPoint->MMData.sMeasurementKFs.insert(job.pKF);
+        nFound++;
+    }
+    return nFound;
+}
 
-//    if(k->mMeasurements.count(p))
-//    {
-//        assert(0); // This should never happen, we checked for this at the start.
-//    }
-//    k->mMeasurements[p] = m;
-//    p->MMData.sMeasurementKFs.insert(k);
-//    return true;
-//}
+// Worker pool job: searches for the pair vJobs[nJob]. Only reads the map;
+// the result goes to the job, see ReFindBatch().
+void MapMaker::ReFindOne(const vector<ReFindView> &vViews, vector<ReFindJob> &vJobs, int nJob, int nWorker)
+{
+    ReFindJob &job = vJobs[nJob];
+    const ReFindView &view = vViews[job.nView];
+    MapPoint &p = *job.pPoint;
+    job.bFound = false;
 
-//// A general data-association update for a single keyframe
-//// Do this on a new key-frame when it's passed in by the tracker
-//int MapMaker::ReFindInSingleKeyFrame(boost::shared_ptr<KeyFrame> k)
-//{
-//    int nCam = k->nSourceCamera;
-//    vector<boost::shared_ptr<MapPoint> > vToFind;
-//    for(unsigned int i=0; i<mMap.vpPoints.size(); i++)
-//    {
-//        // we treat map points from dual camera separately
-//        if (mMap.vpPoints[i]->nSourceCamera == nCam)
-//            vToFind.push_back(mMap.vpPoints[i]);
-//    }
+    Vector<3> v3Cam = view.se3CfromW*p.v3WorldPos;
+    if(v3Cam[2] < 0.001)
+        return;
+    Vector<2> v2ImPlane = project(v3Cam);
+    if(v2ImPlane*v2ImPlane > view.dMaxRadiusSquared)
+        return;
 
-//    int nFoundNow = 0;
-//    for(unsigned int i=0; i<vToFind.size(); i++)
-//        if(ReFind_Common(k, vToFind[i]))
-//            nFoundNow++;
+    CameraModel *cam = WorkerCamera(nWorker, view.nCam);
+    Vector<2> v2Image = cam->Project(v2ImPlane);
+    if(cam->Invalid())
+        return;
+    if(v2Image[0] < 0 || v2Image[1] < 0 || v2Image[0] > view.irImageSize[0] || v2Image[1] > view.irImageSize[1])
+        return;
 
-//    return nFoundNow;
-//};
+    Matrix<2> m2CamDerivs = cam->GetProjectionDerivs();
+    PatchFinder Finder;
+    Finder.MakeTemplateCoarse(p, view.se3CfromW, m2CamDerivs);
+    if(Finder.TemplateBad())
+        return;
 
-//// When new map points are generated, they're only created from a stereo pair
-//// this tries to make additional measurements in other KFs which they might
-//// be in.
-//void MapMaker::ReFindNewlyMade()
-//{
-//    if(mqNewQueue.empty())
-//        return;
-//    int nFound = 0;
-//    int nBad = 0;
-//    bool nullkfsecs = true;
-//    for (int i = 0; i < AddCamNumber; i ++)
-//        if (mvpKeyFrameQueueSec[i].size())
-//            nullkfsecs = false;
-//    while(!mqNewQueue.empty() && mvpKeyFrameQueue.size() == 0
-//          && nullkfsecs)
-//    {
-//        boost::shared_ptr<MapPoint> pNew = mqNewQueue.front();
-//        mqNewQueue.pop();
-//        if(pNew->bBad)
-//        {
-//            nBad++;
-//            continue;
-//        }
-//        if (!pNew->nSourceCamera){
-//            for(unsigned int i=0; i<mMap.vpKeyFrames.size(); i++)
-//                if(ReFind_Common(mMap.vpKeyFrames[i], pNew))
-//                    nFound++;
-//        }
-//        else { // the second camera
-//            for(unsigned int i=0; i<mMap.vpKeyFramessec[pNew->nSourceCamera - 1].size(); i++)
-//                if(ReFind_Common(mMap.vpKeyFramessec[pNew->nSourceCamera - 1][i], pNew))
-//                    nFound++;
-//        }
-//    }
-//};
+    if(!Finder.FindPatchCoarse(ir(v2Image), *job.pKF, 4))  // Very tight search radius!
+        return;
 
-//// Dud measurements get a second chance.
-//void MapMaker::ReFindFromFailureQueue()
-//{
-//    if(mvFailureQueue.size() == 0)
-//        return;
-//    sort(mvFailureQueue.begin(), mvFailureQueue.end());
-//    vector<pair<boost::shared_ptr<KeyFrame>, boost::shared_ptr<MapPoint> > >::iterator it;
-//    int nFound=0;
-//    for(it = mvFailureQueue.begin(); it!=mvFailureQueue.end(); it++)
-//        if(ReFind_Common(it->first, it->second))
-//            nFound++;
-//    mvFailureQueue.erase(mvFailureQueue.begin(), it);
-//};
+    // If we found something, generate a measurement struct for the map
+    Measurement &m = job.m;
+    m.nLevel = Finder.GetLevel();
+    m.dDepth = Finder.GetCoarseDepth();
+    m.Source = Measurement::SRC_REFIND;
+
+    if(Finder.GetLevel() > 0)
+    {
+        Finder.MakeSubPixTemplate();
+        Finder.IterateSubPixToConvergence(*job.pKF,8);
+        m.v2RootPos = Finder.GetSubPixPos();
+        m.bSubPix = true;
+    }
+    else
+    {
+        m.v2RootPos = Finder.GetCoarsePosAsVector();
+        m.bSubPix = false;
+    };
+    job.bFound = true;
+}
+
+// Any keyframes from the tracker waiting?
+bool MapMaker::KeyFramesQueued()
+{
+    return mKeyFrameQueue.Size() > 0;
+}
+
+// A general data-association update for a single keyframe
+// Do this on a new key-frame when it's passed in by the tracker;
+// AddKeyFrameFromTopOfQueue() holds the map's write lock for this.
+int MapMaker::ReFindInSingleKeyFrame(boost::shared_ptr<KeyFrame> k)
+{
+    int nCam = k->nSourceCamera;
+    vector<ReFindJob> vJobs;
+    for(unsigned int i=0; i<mMap.vpPoints.size(); i++)
+    {
+        // we treat map points from dual camera separately
+        if (mMap.vpPoints[i]->nSourceCamera == nCam)
+            vJobs.push_back(ReFindJob(k, mMap.vpPoints[i]));
+    }
+    return ReFindBatch(vJobs, false);
+};
+
+// When new map points are generated, they're only created from a stereo pair
+// this tries to make additional measurements in other KFs which they might
+// be in. Goes a batch of points at a time, and stops as soon as a keyframe
+// is waiting to be added.
+void MapMaker::ReFindNewlyMade()
+{
+    static gvar3<int> gvnBatchPoints("MapMaker.ReFindBatchPoints", 50, SILENT);
+    int nFound = 0;
+    while(!mqNewQueue.empty() && !KeyFramesQueued())
+    {
+        vector<ReFindJob> vJobs;
+        for(int n=0; n<*gvnBatchPoints && !mqNewQueue.empty(); n++)
+        {
+            boost::shared_ptr<MapPoint> pNew = mqNewQueue.front();
+            mqNewQueue.pop();
+            if(pNew->bBad)
+                continue;
+            const vector<boost::shared_ptr<KeyFrame> > &vpKFs =
+                    pNew->nSourceCamera ? mMap.vpKeyFramessec[pNew->nSourceCamera - 1] : mMap.vpKeyFrames;
+            for(unsigned int i=0; i<vpKFs.size(); i++)
+                vJobs.push_back(ReFindJob(vpKFs[i], pNew));
+        }
+        nFound += ReFindBatch(vJobs);
+    }
+};
+
+// Dud measurements get a second chance.
+void MapMaker::ReFindFromFailureQueue()
+{
+    if(mvFailureQueue.size() == 0 || KeyFramesQueued())
+        return;
+    vector<ReFindJob> vJobs;
+    for(unsigned int i=0; i<mvFailureQueue.size(); i++)
+        vJobs.push_back(ReFindJob(mvFailureQueue[i].first, mvFailureQueue[i].second));
+    mvFailureQueue.clear();
+    ReFindBatch(vJobs);
+};
 
 //// Is the tracker's camera pose in cloud-cuckoo land?
 //bool MapMaker::IsDistanceToNearestKeyFrameExcessive(boost::shared_ptr<KeyFrame> kCurrent)
@@ -21,6 +21,13 @@
 #include "Map.h"
 #include "KeyFrame.h"
 #include "CameraModel.h"
+#include "WorkerPool.h"
+#include "KeyFrameBuilder.h"
+#include "Bundle.h"
+#include "PnPRelocaliser.h"
+#include "PoseGraph.h"
+#include "KeyFrameQueue.h"
+#include "KeyFrameStream.h"
 #include <queue>
 #include <memory>
 
@@ -33,6 +40,45 @@
 //#include <backend.h>
 
 namespace ptam{
+// A map point made by one of the point-creation workers. It is only
+// written into the map (and the keyframes' measurements) by the mapmaker
+// thread once the whole batch of candidates has been processed.
+struct NewMapPoint
+{
+  NewMapPoint() : bFoundInTarget(false) {}
+  boost::shared_ptr<MapPoint> pPoint;   // NULL if the candidate didn't make a point
+  Measurement mSrc;                     // Root measurement in the source keyframe
+  bool bFoundInTarget;                  // Was the point also measured in the target keyframe?
+  Measurement mTarget;
+};
+
+// A (keyframe, map point) pair for the re-find stage to search for.
+// The workers fill in the result; the mapmaker thread puts it in the map.
+struct ReFindJob
+{
+  ReFindJob(boost::shared_ptr<KeyFrame> k, boost::shared_ptr<MapPoint> p)
+    : pKF(k), pPoint(p), nView(-1), bFound(false) {}
+  boost::shared_ptr<KeyFrame> pKF;
+  boost::shared_ptr<MapPoint> pPoint;
+  int nView;          // Index of pKF's ReFindView
+  bool bFound;        // Was the point found? Then m is its new measurement
+  Measurement m;
+
+  inline bool operator<(const ReFindJob &rhs) const
+  { return pKF < rhs.pKF || (pKF == rhs.pKF && pPoint < rhs.pPoint); }
+  inline bool operator==(const ReFindJob &rhs) const
+  { return pKF == rhs.pKF && pPoint == rhs.pPoint; }
+};
+
+// What the re-find workers need to know about a keyframe, set up once per batch
+struct ReFindView
+{
+  TooN::SE3<> se3CfromW;
+  int nCam;
+  double dMaxRadiusSquared;   // Of the z=1 plane projections which can be in the image
+  CVD::ImageRef irImageSize;
+};
+
 //typedef boost::function<void(boost::shared_ptr<KeyFrame>)> sendKfCbFunction;
 //typedef boost::function<void(const std::vector<boost::shared_ptr<KeyFrame> >&)> sendEdgesCbFunction;
 
@@ -51,23 +97,26 @@ public:
   bool InitFromStereo(KeyFrame &kFirst, KeyFrame &kSecond, 
 		      std::vector<std::pair<CVD::ImageRef, CVD::ImageRef> > &vMatches,
                       TooN::SE3<> &se3CameraPos,
-                      bool use_circle_ini, int ini_thresh, int ini_times);
+                      bool use_circle_ini, int ini_thresh, int ini_times,
+                      WorkerPool *pWorkers = NULL);
 
   bool InitFromStereo_OLD(KeyFrame &kFirst, KeyFrame &kSecond,  // EXPERIMENTAL HACK
 		      std::vector<std::pair<CVD::ImageRef, CVD::ImageRef> > &vMatches,
                       TooN::SE3<> &se3CameraPos);
   
   
-  bool AddKeyFrame(KeyFrame &k);   // Add a key-frame to the map. Called by the tracker.
-                                   // Returns true if keyframe was added or false if mampaker chose to ignore it
-                                   // e.g. because mapping is disabled.
-  bool AddKeyFrameDual(KeyFrame &k, KeyFrame &ksec);   // Add two key-frame to the map. Called by the tracker.
+  bool AddKeyFrame(const boost::shared_ptr<KeyFrame> &pK);   // Add a key-frame to the map. Called by the tracker, which hands
+                                   // the frame over: it must not touch it any more if this succeeds.
                                    // Returns true if keyframe was added or false if mampaker chose to ignore it
-                                   // e.g. because mapping is disabled.
-  bool AddKeyFrameSec(KeyFrame &ksec);  /// Using multiple cameras, adding additional kfs
+                                   // e.g. because mapping is disabled, or too many keyframes are waiting.
+  bool AddKeyFrame(const boost::shared_ptr<KeyFrame> &pK, const boost::shared_ptr<KeyFrame> apKSec[AddCamNumber]);
+                                   // Same, for the keyframes all cameras took at one instant;
+                                   // null where an additional camera had none.
   void RequestReset();   // Request that the we reset. Called by the tracker.
   bool ResetDone();      // Returns true if the has been done.
-  int  QueueSize() { return mvpKeyFrameQueue.size() ;} // How many KFs in the queue waiting to be added?
+  int  QueueSize() { return mKeyFrameQueue.Size(); } // How many KFs (bundles, with multiple cameras) are waiting to be added?
+  KeyFrameQueue::Statistics KeyFrameQueueStatistics() const { return mKeyFrameQueue.GetStatistics(); }
+  KeyFrameStream* GetKeyFrameStream() { return mpKeyFrameStream.get(); }  // NULL unless MapMaker.KeyFrameStream is set
   bool NeedNewKeyFrame(boost::shared_ptr<KeyFrame> kCurrent);            // Is it a good camera pose to add another KeyFrame?
   bool NeedErgentKeyFrame(boost::shared_ptr<KeyFrame> kCurrent);
   bool IsDistanceToNearestKeyFrameExcessive(boost::shared_ptr<KeyFrame> kCurrent);  // Is the camera far away from the nearest KeyFrame (i.e. maybe lost?)
@@ -122,16 +171,13 @@ public:
 //  sendKfCbFunction sendKfCallback;
 //  sendEdgesCbFunction sendEdgesCallback;
 
-  bool relocaliseRegister(const boost::shared_ptr<KeyFrame> goodkf, const boost::shared_ptr<KeyFrame> kf, Sophus::SE3d &result, double minInliers = .50); // register the relocalisation module for the front-end
+  bool relocaliseRegister(const boost::shared_ptr<KeyFrame> goodkf, const boost::shared_ptr<KeyFrame> kf, TooN::SE3<> &result, double minInliers = .50); // pose of goodkf relative to kf by RANSAC+PnP. Called by the tracker.
 //  void sendKfCallback(boost::shared_ptr<const ptam::KeyFrame> kf, bool sendpoints = false);// send kf to the backend
 //  void sendEdgesCallback(const std::vector<boost::shared_ptr<ptam::KeyFrame> > kfs, const int maxkfsize = 5);// send all edges in BA to backend
 //  void sendKfPoints(boost::shared_ptr<const ptam::KeyFrame> kf);// update old kf points
 //  void updateKfPoses(const std::vector<boost::shared_ptr<ptam::KeyFrame> > kfs);// send all edges in BA to backend
 //  void UpdateLMapByGMap();  // update the local map if the gmap is updated by pgo
 //  void UpdateWaitingList(); // update the waitinglist to reflect the local map update by BA
-  bool needMotionModelUpdate;// motion model of the tracker need to be updated if the local map is updated according to the global map of the back end
-  TooN::SE3<> mse3LatestKFpose;// serve as the reference kf for updating motion model in trackerd
-  int  lastKFid;// the id of the reference kf
   bool debugmarkLoopDetected;
 
   unsigned int imageInputCount;// count the image input for checking stoped or not, read access only in the mapmaker
@@ -142,12 +188,28 @@ protected:
   Map &mMap;               // The map // in this full slam system, this will be only the local map handled by ptam
   std::auto_ptr<CameraModel> mCamera;      // Same as the tracker's camera: N.B. not a reference variable!
   std::auto_ptr<CameraModel> mCameraSec[AddCamNumber];             // Projection model of the second camera
+  boost::scoped_ptr<WorkerPool> mpWorkers;  // Fans new map point candidates and re-find searches out over several threads
+  boost::scoped_ptr<KeyFrameBuilder> mpBuilder;  // Finishes the queued keyframes; kept for its depth pyramids
+  // One private copy of every camera per worker, since Project/UnProject modify the camera's state.
+  // Index 0 is the main camera, index i the additional camera i-1.
+  std::vector<boost::shared_ptr<CameraModel> > mvWorkerCameras[AddCamNumber + 1];
   virtual void run();      // The MapMaker thread code lives here
 
+  PnPRelocaliser mPnPRelocaliser;       // Only used by relocaliseRegister(), from the tracker's thread
+
 //  Map &mGMap;               // the global map of the slam system, handled by the backend, accessed by ptam.
 //  backend::SLAMSystem &mSLAM; // the slam system, which contains the global map
                             // mapmaker will only do read access to it
 //  backend::LoopClosing &mbackend_;// the backend
+  boost::scoped_ptr<PoseGraph> mpPoseGraph;  // The back-end, with MapMaker.fullSLAM; runs on its own thread
+  void SendToPoseGraph();     // Edges and poses of the keyframes which local BA just adjusted
+  void ApplyPoseGraphCorrections(const PoseGraph::Corrections &corrections);
+  boost::scoped_ptr<KeyFrameStream> mpKeyFrameStream;  // The local map's changes, for external back-ends; with MapMaker.KeyFrameStream
+
+  BriefExtractor mRelocaliseExtractor;  // Only used by relocaliseRegister(), from the tracker's thread
+  BriefExtractor mExtractor;            // Describes new keyframes for relocalisation, in the background
+  void DescribeNewKeyFrames();          // The latest keyframe of each camera, if not yet done
+  void PublishMap();                    // Hands the tracker a new snapshot; map locked for writing
 
   // Functions for starting the map from scratch:
   TooN::SE3<> CalcPlaneAligner();
@@ -158,9 +220,18 @@ protected:
   // Map expansion functions:
   void AddKeyFrameFromTopOfQueue();  
   void ThinCandidates(KeyFrame &k, int nLevel);
-  void AddSomeMapPoints(int nLevel, int nCam=0); // for dual camera case, add camera number param.
-  bool AddPointDepth(boost::shared_ptr<KeyFrame> kSrc, boost::shared_ptr<KeyFrame> kTarget, int nLevel, int nCandidate);
-  bool AddPointEpipolar(boost::shared_ptr<KeyFrame> kSrc, boost::shared_ptr<KeyFrame> kTarget, int nLevel, int nCandidate);// add cam number param
+  void AddNewMapPoints(int nCam=0); // Runs AddSomeMapPoints over all levels of the newest keyframe of camera nCam
+  void AddSomeMapPoints(const std::vector<int> &vLevels, int nCam=0); // for dual camera case, add camera number param.
+  void AddPointFromCandidate(boost::shared_ptr<KeyFrame> kSrc, boost::shared_ptr<KeyFrame> kTarget,
+                             const std::vector<std::pair<int, int> > &vJobs, std::vector<NewMapPoint> &vNew,
+                             int nJob, int nWorker); // WorkerPool job: one (level, candidate) pair
+  bool AddPointDepth(boost::shared_ptr<KeyFrame> kSrc, boost::shared_ptr<KeyFrame> kTarget, int nLevel, int nCandidate,
+                     int nWorker, NewMapPoint &result);
+  bool AddPointEpipolar(boost::shared_ptr<KeyFrame> kSrc, boost::shared_ptr<KeyFrame> kTarget, int nLevel, int nCandidate,
+                        int nWorker, NewMapPoint &result);// add cam number param
+  void CommitNewMapPoint(boost::shared_ptr<KeyFrame> kSrc, boost::shared_ptr<KeyFrame> kTarget, NewMapPoint &np);
+  void CacheImplaneCorners(KeyFrame &k, int nLevel);     // Fills vImplaneCorners of one level from the camera's unprojection table
+  CameraModel* WorkerCamera(int nWorker, int nCam) { return mvWorkerCameras[nCam][nWorker].get(); }
   // Returns point in ref frame B
   TooN::Vector<3> ReprojectPoint(TooN::SE3<> se3AfromB, const TooN::Vector<2> &v2A, const TooN::Vector<2> &v2B);
   double viewAngleDiffPoint(TooN::Vector<3> vB2A, TooN::Vector<3> vB2B);
@@ -169,6 +240,7 @@ protected:
   void BundleAdjust(std::set<boost::shared_ptr<KeyFrame> > , std::set<boost::shared_ptr<KeyFrame> >, std::set<boost::shared_ptr<MapPoint> >, bool, std::set<boost::shared_ptr<KeyFrame> > sAssociatedSet=std::set<boost::shared_ptr<KeyFrame> >());
   void BundleAdjustAll();
   void BundleAdjustRecent();
+  void RequestBundleYield();   // A keyframe was queued: let a running local BA finish early
   void BundleAdjustAllsec(); // ba for all kfs from two camera.
 
   // Data association functions:
@@ -176,7 +248,10 @@ protected:
   void ReFindFromFailureQueue();
   void ReFindNewlyMade();
   void ReFindAll();
-  bool ReFind_Common(boost::shared_ptr<KeyFrame> k, boost::shared_ptr<MapPoint> p);
+  int ReFindBatch(std::vector<ReFindJob> &vJobs, bool bLockMap = true);  // Searches for all the pairs in parallel, returns how many were found
+  void ReFindOne(const std::vector<ReFindView> &vViews, std::vector<ReFindJob> &vJobs,
+                 int nJob, int nWorker);            // WorkerPool job: one pair
+  bool KeyFramesQueued();
   void SubPixelRefineMatches(KeyFrame &k, int nLevel);
   
   // General Maintenance/Utility:
@@ -197,15 +272,20 @@ protected:
   std::vector<Command> mvQueuedCommands;
 
   // Member variables:
-  std::vector<boost::shared_ptr<KeyFrame> > mvpKeyFrameQueue;  // Queue of keyframes from the tracker waiting to be processed
+  KeyFrameQueue mKeyFrameQueue;  // Queue of keyframes from the tracker waiting to be processed
   std::vector<std::pair<boost::shared_ptr<KeyFrame>, boost::shared_ptr<MapPoint> > > mvFailureQueue; // Queue of failed observations to re-find
   std::queue<boost::shared_ptr<MapPoint> > mqNewQueue;   // Queue of newly-made map points to re-find in other KeyFrames
-  // second img
-  std::vector<boost::shared_ptr<KeyFrame> > mvpKeyFrameQueueSec[AddCamNumber];  // Queue of keyframes from the tracker waiting to be processed
 
   double mdWiggleScale;  // Metric distance between the first two KeyFrames (copied from GVar)
                          // This sets the scale of the map
   GVars3::gvar3<double> mgvdWiggleScale;   // GVar for above
+  // GVars used by the point-creation workers
+  GVars3::gvar3<int> mgvnAddPoints3D;
+  GVars3::gvar3<int> mgvnAddPointsEpipolar;
+  GVars3::gvar3<double> mgvdUseMaxDepth;
+  GVars3::gvar3<double> mgvdSceneDepthMaxSecCam;
+  GVars3::gvar3<double> mgvdSceneDepthMinSecCam;
+  GVars3::gvar3<double> mgvdMinViewAngleDiff;
   double mdWiggleScaleDepthNormalized;  // The above normalized against scene depth, 
                                         // this controls keyframe separation
 
@@ -218,6 +298,7 @@ protected:
   bool mbResetRequested;   // A reset has been requested
   bool mbResetDone;        // The reset was done.
   bool mbBundleAbortRequested;      // We should stop bundle adjustment
+  bool mbBundleYieldRequested;      // A keyframe is waiting: stop local bundle adjustment after the current iteration
   bool mbBundleRunning;             // Bundle adjustment is running
   bool mbBundleRunningIsRecent;     //    ... and it's a local bundle adjustment.
   bool mbMappingEnabled;            // Is mapping enabled? Allows us to pause mapping.
@@ -225,6 +306,8 @@ protected:
   boost::mutex MappingEnabledMut;
   boost::condition_variable MappingEnabledCond;
 
+  BundleWarmStart mRecentBundleWarmStart;  // LM state left by an interrupted local bundle adjustment
+
   bool newRecentKF;
   int nAddedKfNoBA;// number of added kfs without BA. too many such kfs may lead to un-continuas graph of the backend
 
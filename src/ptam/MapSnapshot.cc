@@ -0,0 +1,54 @@
+#include "MapSnapshot.h"
+#include "Map.h"
+#include "MapPoint.h"
+#include "KeyFrame.h"
+
+using namespace TooN;
+using namespace ptam;
+
+boost::shared_ptr<const MapSnapshot> MapSnapshot::Make(const Map &map, unsigned int nGeneration)
+{
+  boost::shared_ptr<MapSnapshot> pSnapshot(new MapSnapshot);
+  pSnapshot->nGeneration = nGeneration;
+  pSnapshot->bGood = map.bGood;
+  pSnapshot->rebase = map.rebase;
+
+  const Vector<3> v3Z = makeVector(0.0, 0.0, 1.0);
+  pSnapshot->vPoints.reserve(map.vpPoints.size());
+  for(unsigned int i=0; i<map.vpPoints.size(); i++)
+  {
+    const boost::shared_ptr<MapPoint> &p = map.vpPoints[i];
+    if(p->bBad || p->mblocked)
+      continue;
+    boost::shared_ptr<KeyFrame> pSourceKF = p->pPatchSourceKF.lock();
+    if(!pSourceKF)
+      continue;
+
+    Point pt;
+    pt.pPoint = p;
+    pt.v3WorldPos = p->v3WorldPos;
+    pt.v3PixelRight_W = p->v3PixelRight_W;
+    pt.v3PixelDown_W = p->v3PixelDown_W;
+    pt.v3SourceAxis_W = pSourceKF->se3CfromW.get_rotation() * v3Z;
+    pt.nSourceCamera = p->nSourceCamera;
+    pSnapshot->vPoints.push_back(pt);
+  }
+
+  pSnapshot->vKeyFrames.resize(map.vpKeyFrames.size());
+  for(unsigned int i=0; i<map.vpKeyFrames.size(); i++)
+  {
+    KeyFramePose &kp = pSnapshot->vKeyFrames[i];
+    kp.pKF = map.vpKeyFrames[i];
+    kp.nId = kp.pKF->id;
+    kp.se3CfromW = kp.pKF->se3CfromW;
+  }
+  return pSnapshot;
+}
+
+const MapSnapshot::KeyFramePose *MapSnapshot::FindKeyFrame(int nId) const
+{
+  for(int i=vKeyFrames.size()-1; i>=0; i--)
+    if(vKeyFrames[i].nId == nId)
+      return &vKeyFrames[i];
+  return NULL;
+}
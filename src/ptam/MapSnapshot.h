@@ -0,0 +1,76 @@
+// -*- c++ -*-
+//
+// MapSnapshot - one generation of the map, as the tracker sees it.
+//
+// Whoever changes the map (the mapmaker, or the tracker while it
+// initialises) publishes a new generation with Map::PublishSnapshot()
+// before releasing the map's write lock. A snapshot copies out everything
+// the tracker reads to decide which points to search for: the points'
+// positions and patch vectors and the keyframe poses. It is never changed
+// once published, so the tracker pins one per frame with Map::PinSnapshot()
+// and works from it without taking the map's mutex at all.
+//
+// Reclamation is by reference count: a generation, and the points and
+// keyframes it holds on to, goes away when the map has moved on and the
+// last frame that pinned it is done with it.
+
+#ifndef __MAPSNAPSHOT_H
+#define __MAPSNAPSHOT_H
+#include <vector>
+#include <TooN/TooN.h>
+#include <TooN/se3.h>
+#include <boost/shared_ptr.hpp>
+
+namespace ptam{
+
+struct Map;
+struct MapPoint;
+struct KeyFrame;
+
+struct MapSnapshot
+{
+  struct Point
+  {
+    boost::shared_ptr<MapPoint> pPoint;
+    TooN::Vector<3> v3WorldPos;
+    TooN::Vector<3> v3PixelRight_W;
+    TooN::Vector<3> v3PixelDown_W;
+    TooN::Vector<3> v3SourceAxis_W;   // Rotation of the patch source keyframe times z
+    int nSourceCamera;
+  };
+
+  struct KeyFramePose
+  {
+    boost::shared_ptr<KeyFrame> pKF;
+    int nId;
+    TooN::SE3<> se3CfromW;
+  };
+
+  // The last time the pose graph moved the map (Map::rebase): the tracker
+  // re-bases its motion model on the reference keyframe when nCount changes
+  struct Rebase
+  {
+    Rebase() : nCount(0), nKeyFrameId(-1) {}
+    unsigned int nCount;        // Moves so far
+    int nKeyFrameId;            // Reference keyframe; its new pose is in vKeyFrames
+    TooN::SE3<> se3OldCfromW;   // .. and where it was before the move
+  };
+
+  MapSnapshot() : nGeneration(0), bGood(false) {}
+
+  // Copies the map as it is; the caller must keep others from writing it.
+  // Points which are bad, blocked or without a source keyframe are left out.
+  static boost::shared_ptr<const MapSnapshot> Make(const Map &map, unsigned int nGeneration);
+
+  const KeyFramePose *FindKeyFrame(int nId) const;  // Main camera; null if gone
+
+  unsigned int nGeneration;
+  bool bGood;
+  std::vector<Point> vPoints;
+  std::vector<KeyFramePose> vKeyFrames;   // Main camera's, in the map's order
+  Rebase rebase;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,367 @@
+#include "PadDetector.h"
+#include "LevelHelpers.h"
+
+#include <TooN/helpers.h>
+#include <TooN/so2.h>
+#include <cvd/vision.h>
+#include <cvd/timer.h>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+
+using namespace CVD;
+using namespace TooN;
+using namespace ptam;
+
+namespace {
+inline int HammingDistance(const uint64_t *pnA, const uint64_t *pnB)
+{
+  return __builtin_popcountll(pnA[0] ^ pnB[0]) + __builtin_popcountll(pnA[1] ^ pnB[1])
+       + __builtin_popcountll(pnA[2] ^ pnB[2]) + __builtin_popcountll(pnA[3] ^ pnB[3]);
+}
+
+// The first corner of every cell, on the levels asked for
+void SelectCorners(const std::vector<ImageRef> *avCorners, const ImageRef *airSizes,
+                   const PadDetector::Params &params, std::vector<bool> &vbCellTaken, BriefFeatures &features)
+{
+  for(int l=params.nFirstLevel; l<params.nFirstLevel + params.nLevels && l<LEVELS; l++)
+  {
+    const int nCellsX = (airSizes[l].x + params.nCellSize - 1) / params.nCellSize;
+    const int nCellsY = (airSizes[l].y + params.nCellSize - 1) / params.nCellSize;
+    vbCellTaken.assign(nCellsX * nCellsY, false);
+    const std::vector<ImageRef> &vCorners = avCorners[l];
+    for(unsigned int i=0; i<vCorners.size(); i++)
+    {
+      int nCell = (vCorners[i].y / params.nCellSize) * nCellsX + vCorners[i].x / params.nCellSize;
+      if(vbCellTaken[nCell])
+        continue;
+      vbCellTaken[nCell] = true;
+      features.Add(LevelZeroPos(vCorners[i], l), l, 0.0f, i);
+    }
+  }
+}
+}
+
+PadDetector::Params::Params()
+  : nFirstLevel(0), nLevels(3), nCellSize(8), nRotations(12), nMaxHamming(70), dMatchRatio(0.8),
+    nIterations(300), dMaxPixelError(3.0), nMinInliers(15)
+{
+}
+
+PadDetector::Detection::Detection()
+  : nSequence(0), nFrame(-1), bFound(false), nMatches(0), nInliers(0),
+    v3CentreWorld(Zeros), dSeconds(0.0)
+{
+  for(int i=0; i<4; i++)
+    av3CornersWorld[i] = Zeros;
+}
+
+PadDetector::PadDetector(const Params &params)
+  : mParams(params), mdHalfWidth(0.0), mdHalfHeight(0.0),
+    mpSpare(&maFrames[0]), mpPending(&maFrames[1]), mpWorking(&maFrames[2]),
+    mbPending(false), mbStop(false), mnSeed(1),
+    mThread(boost::bind(&PadDetector::Run, this))
+{
+  mStatistics.nPosted = 0;
+  mStatistics.nDropped = 0;
+  mStatistics.nDetected = 0;
+}
+
+PadDetector::~PadDetector()
+{
+  {
+    boost::mutex::scoped_lock lock(mMailboxMutex);
+    mbStop = true;
+  }
+  mMailboxCond.notify_one();
+  mThread.join();
+}
+
+void PadDetector::SetReference(const KeyFrame &kfRef, double dWidth)
+{
+  const ImageRef irSize = kfRef.aLevels[0].im.size();
+  const Vector<2> v2Centre = (vec(irSize) - makeVector(1.0, 1.0)) * 0.5;
+  const double dMetresPerPixel = dWidth / irSize.x;
+
+  // Not the worker's extractor: this runs on the caller's thread
+  BriefExtractor extractor;
+  BriefFeatures features;
+  std::vector<bool> vbCellTaken;
+  std::vector<Vector<2> > vv2Pad;
+  std::vector<uint64_t> vnWords;
+  std::vector<Vector<2> > vv2RefPad;
+  std::vector<int> vnRefPoint;
+
+  std::vector<ImageRef> avCorners[LEVELS];
+  ImageRef airSizes[LEVELS];
+  for(int l=0; l<LEVELS; l++)
+  {
+    avCorners[l] = kfRef.aLevels[l].vCorners;
+    airSizes[l] = kfRef.aLevels[l].im.size();
+  }
+  SelectCorners(avCorners, airSizes, mParams, vbCellTaken, features);
+  for(unsigned int i=0; i<features.size(); i++)
+    vv2Pad.push_back((features.vv2RootPos[i] - v2Centre) * dMetresPerPixel);
+  for(unsigned int i=0; i<features.size(); i++)
+    features.vnSource[i] = i;
+  const BriefFeatures selected = features;
+
+  Image<byte> aimTurned[LEVELS];
+  for(int r=0; r<std::max(mParams.nRotations, 1); r++)
+  {
+    const BasicImage<byte> *apim[LEVELS];
+    features = selected;
+    if(r == 0)
+      for(int l=0; l<LEVELS; l++)
+        apim[l] = &kfRef.aLevels[l].im;
+    else
+    {
+      // Each level turned about the image centre, onto a square which holds all of it
+      const SO2<> so2Turn = SO2<>::exp(2.0 * M_PI * r / mParams.nRotations);
+      for(int l=0; l<LEVELS; l++)
+      {
+        apim[l] = &aimTurned[l];
+        if(l < mParams.nFirstLevel || l >= mParams.nFirstLevel + mParams.nLevels)
+          continue;
+        const BasicImage<byte> &im = kfRef.aLevels[l].im;
+        const int nSide = (int) std::ceil(std::sqrt((double) (im.size().x * im.size().x + im.size().y * im.size().y))) + 1;
+        aimTurned[l].resize(ImageRef(nSide, nSide));
+        Vector<2> v2LevelCentre = LevelNPos(v2Centre, l);
+        Vector<2> v2TurnedCentre = makeVector(nSide - 1, nSide - 1) * 0.5;
+        CVD::transform(im, aimTurned[l], so2Turn.inverse().get_matrix(), v2LevelCentre, v2TurnedCentre, (byte) 0);
+        for(unsigned int i=0; i<features.size(); i++)
+          if(features.vnLevel[i] == l)
+            features.vv2RootPos[i] = LevelZeroPos(so2Turn * (LevelNPos(selected.vv2RootPos[i], l) - v2LevelCentre)
+                                                  + v2TurnedCentre, l);
+      }
+    }
+    extractor.Describe(apim, LEVELS, features);
+    vnWords.insert(vnWords.end(), features.vnWords.begin(), features.vnWords.end());
+    for(unsigned int i=0; i<features.size(); i++)
+    {
+      vv2RefPad.push_back(vv2Pad[features.vnSource[i]]);
+      vnRefPoint.push_back(features.vnSource[i]);
+    }
+  }
+
+  boost::mutex::scoped_lock lock(mReferenceMutex);
+  mvnRefWords.swap(vnWords);
+  mvv2RefPad.swap(vv2RefPad);
+  mvnRefPoint.swap(vnRefPoint);
+  mdHalfWidth = 0.5 * dWidth;
+  mdHalfHeight = 0.5 * irSize.y * dMetresPerPixel;
+}
+
+void PadDetector::Post(const KeyFrame &kf, const CameraModel &camera, int nFrame)
+{
+  Frame &frame = *mpSpare;
+  for(int l=mParams.nFirstLevel; l<mParams.nFirstLevel + mParams.nLevels && l<LEVELS; l++)
+  {
+    frame.aim[l].resize(kf.aLevels[l].im.size());   // Only reallocates if the size changed
+    copy(kf.aLevels[l].im, frame.aim[l]);
+    frame.avCorners[l] = kf.aLevels[l].vCorners;
+  }
+  frame.irSize = kf.aLevels[0].im.size();
+  frame.pUnProjTable = camera.GetUnProjectionTable();
+  frame.se3CamFromWorld = kf.se3CfromW;
+  frame.nFrame = nFrame;
+
+  {
+    boost::mutex::scoped_lock lock(mMailboxMutex);
+    std::swap(mpSpare, mpPending);
+    if(mbPending)
+      mStatistics.nDropped++;
+    mbPending = true;
+    mStatistics.nPosted++;
+  }
+  mMailboxCond.notify_one();
+}
+
+bool PadDetector::GetLatest(unsigned int nSequence, Detection &detection) const
+{
+  boost::mutex::scoped_lock lock(mResultMutex);
+  if(mLatest.nSequence <= nSequence)
+    return false;
+  detection = mLatest;
+  return true;
+}
+
+bool PadDetector::WaitForLatest(unsigned int nSequence, double dSeconds, Detection &detection) const
+{
+  boost::system_time tEnd = boost::get_system_time() + boost::posix_time::microseconds((long) (dSeconds * 1e6));
+  boost::mutex::scoped_lock lock(mResultMutex);
+  while(mLatest.nSequence <= nSequence)
+    if(!mResultCond.timed_wait(lock, tEnd))
+      break;
+  if(mLatest.nSequence <= nSequence)
+    return false;
+  detection = mLatest;
+  return true;
+}
+
+PadDetector::Statistics PadDetector::GetStatistics() const
+{
+  boost::mutex::scoped_lock lock(mMailboxMutex);
+  return mStatistics;
+}
+
+void PadDetector::Run()
+{
+  while(true)
+  {
+    {
+      boost::mutex::scoped_lock lock(mMailboxMutex);
+      while(!mbPending && !mbStop)
+        mMailboxCond.wait(lock);
+      if(mbStop)
+        return;
+      std::swap(mpPending, mpWorking);
+      mbPending = false;
+    }
+
+    Detection detection;
+    Detect(*mpWorking, detection);
+
+    if(detection.bFound)
+    {
+      boost::mutex::scoped_lock lock(mMailboxMutex);
+      mStatistics.nDetected++;
+    }
+    {
+      boost::mutex::scoped_lock lock(mResultMutex);
+      detection.nSequence = mLatest.nSequence + 1;
+      mLatest = detection;
+    }
+    mResultCond.notify_all();
+  }
+}
+
+void PadDetector::Detect(const Frame &frame, Detection &detection)
+{
+  double dStart = timer.get_time();
+  detection.nFrame = frame.nFrame;
+  detection.se3CamFromWorld = frame.se3CamFromWorld;
+  if(!frame.pUnProjTable || frame.pUnProjTable->size() != frame.irSize)
+    return;
+  const CameraModel::UnProjectionTable &table = *frame.pUnProjTable;
+
+  // Residuals on the z=1 plane are scaled to pixels, from the pixel size at the image centre
+  ImageRef irCentre = table.size() / 2;
+  Vector<2> v2Pixel = table[irCentre + ImageRef(1, 0)] - table[irCentre];
+  const double dPixelsPerUnit = 1.0 / std::sqrt(v2Pixel * v2Pixel);
+
+  ImageRef airSizes[LEVELS];
+  const BasicImage<byte> *apim[LEVELS];
+  for(int l=0; l<LEVELS; l++)
+  {
+    airSizes[l] = frame.aim[l].size();
+    apim[l] = &frame.aim[l];
+  }
+  mFeatures.clear();
+  SelectCorners(frame.avCorners, airSizes, mParams, mvbCellTaken, mFeatures);
+  mExtractor.Describe(apim, LEVELS, mFeatures);
+
+  boost::mutex::scoped_lock lock(mReferenceMutex);
+  if(mvv2RefPad.empty())
+    return;
+
+  // Each frame feature's nearest reference feature, if clearly nearer
+  // than any of another point of the pad; the turned copies of the same
+  // point don't count against each other.
+  mRansac.Clear();
+  const int nRef = mvv2RefPad.size();
+  for(unsigned int j=0; j<mFeatures.size(); j++)
+  {
+    const uint64_t *pnFrame = mFeatures.Descriptor(j);
+    int nBest = INT_MAX;
+    int nSecond = INT_MAX;
+    int nBestRef = -1;
+    for(int i=0; i<nRef; i++)
+    {
+      int nDistance = HammingDistance(pnFrame, &mvnRefWords[i * BriefExtractor::Words]);
+      if(nDistance >= nSecond)
+        continue;
+      if(nBestRef >= 0 && mvnRefPoint[i] == mvnRefPoint[nBestRef])
+      {
+        if(nDistance < nBest)
+        {
+          nBest = nDistance;
+          nBestRef = i;
+        }
+      }
+      else if(nDistance < nBest)
+      {
+        nSecond = nBest;
+        nBest = nDistance;
+        nBestRef = i;
+      }
+      else
+        nSecond = nDistance;
+    }
+    if(nBestRef < 0 || nBest > mParams.nMaxHamming)
+      continue;
+    if(nSecond != INT_MAX && nBest > mParams.dMatchRatio * nSecond)
+      continue;
+    const Vector<2> &v2Root = mFeatures.vv2RootPos[j];
+    ImageRef irRoot((int) (v2Root[0] + 0.5), (int) (v2Root[1] + 0.5));
+    if(!table.in_image(irRoot))
+      continue;
+    mRansac.Add(mvv2RefPad[nBestRef], table[irRoot], dPixelsPerUnit);
+  }
+  detection.nMatches = mRansac.size();
+
+  Matrix<3> m3PlaneFromPad;
+  if(FitHomography(m3PlaneFromPad))
+  {
+    // H = s [r1 r2 t] for the plane z=0 of the pad frame
+    Vector<3> v3H1 = m3PlaneFromPad.T()[0];
+    Vector<3> v3H2 = m3PlaneFromPad.T()[1];
+    Vector<3> v3H3 = m3PlaneFromPad.T()[2];
+    double dScale = 2.0 / (std::sqrt(v3H1 * v3H1) + std::sqrt(v3H2 * v3H2));
+    if(dScale * v3H3[2] < 0.0)   // The pad is in front of the camera
+      dScale = -dScale;
+    Matrix<3> m3Rotation;
+    m3Rotation.T()[0] = dScale * v3H1;
+    m3Rotation.T()[1] = dScale * v3H2;
+    m3Rotation.T()[2] = (dScale * v3H1) ^ (dScale * v3H2);
+    detection.se3CamFromPad = SE3<>(SO3<>(m3Rotation), dScale * v3H3);   // SO3 makes it orthonormal
+
+    SE3<> se3WorldFromPad = frame.se3CamFromWorld.inverse() * detection.se3CamFromPad;
+    detection.v3CentreWorld = se3WorldFromPad.get_translation();
+    const double adX[4] = {-mdHalfWidth, mdHalfWidth, mdHalfWidth, -mdHalfWidth};
+    const double adY[4] = {-mdHalfHeight, -mdHalfHeight, mdHalfHeight, mdHalfHeight};
+    for(int i=0; i<4; i++)
+      detection.av3CornersWorld[i] = se3WorldFromPad * makeVector(adX[i], adY[i], 0.0);
+    detection.bFound = true;
+  }
+  detection.nInliers = mvnInliers.size();
+  detection.dSeconds = timer.get_time() - dStart;
+}
+
+bool PadDetector::FitHomography(Matrix<3> &m3PlaneFromPad)
+{
+  mvnInliers.clear();
+  if((int) mRansac.size() < std::max(4, mParams.nMinInliers))
+    return false;
+
+  HomographyRansac::Params params;
+  params.cost = HomographyRansac::COST_OUTLIERS;
+  params.dMaxError = mParams.dMaxPixelError;
+  params.nMaxIterations = mParams.nIterations;
+  params.bCheirality = true;   // The pad is in front of the camera
+  Matrix<3> m3Best;
+  if(!mRansac.Find(params, NULL, rand_r(&mnSeed), m3Best) ||
+     mRansac.LastStatistics().nBestInliers < mParams.nMinInliers)
+    return false;
+
+  // Refined on all inliers, as HomographyInit does
+  for(int i=0; i<2; i++)
+  {
+    if(mRansac.FindInliers(m3Best, mParams.dMaxPixelError, mvnInliers, true) < 4)
+      return false;
+    m3Best = mRansac.Fit(mvnInliers);
+  }
+  mRansac.FindInliers(m3Best, mParams.dMaxPixelError, mvnInliers, true);
+  m3PlaneFromPad = m3Best;
+  return (int) mvnInliers.size() >= mParams.nMinInliers;
+}
@@ -0,0 +1,151 @@
+// -*- c++ -*-
+//
+// PadDetector - finds the landing pad in tracked frames on a thread of
+// its own, and publishes where it is.
+//
+// The tracker posts each frame it has tracked; the detector keeps only the
+// latest one, so a slow detection drops frames instead of holding up the
+// tracker or the mapmaker. Posting copies the pyramid levels and FAST
+// corners the tracker made anyway into a spare buffer, and never waits
+// for the worker: the spare is swapped with the pending frame under a
+// short lock.
+//
+// The worker describes a bucketed subset of the frame's corners with
+// BRIEF, matches them against the reference image's, and fits a
+// homography from the pad plane to the camera's z=1 plane with RANSAC.
+// The pad is flat and of known width, so the homography gives the pad's
+// pose in the camera, and with the frame's tracked pose, in the world.
+// The latest result is kept under a lock for any thread to pick up.
+// BRIEF is not made for turns of more than some 15 degrees, so the
+// reference is described once per turn of a full circle: its levels are
+// turned and its corners moved along, still without detecting anything.
+//
+// The pad frame is centred on the pad, x along the reference image's
+// rows, y down its columns, and z into the pad.
+
+#ifndef __PADDETECTOR_H
+#define __PADDETECTOR_H
+#include <vector>
+#include <TooN/TooN.h>
+#include <TooN/se3.h>
+#include <cvd/image.h>
+#include <cvd/byte.h>
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "KeyFrame.h"
+#include "BriefExtractor.h"
+#include "HomographyRansac.h"
+
+namespace ptam{
+
+class PadDetector
+{
+public:
+  struct Params
+  {
+    Params();
+    int nFirstLevel;           // Corners of this level ..
+    int nLevels;               // .. and of the next nLevels-1 are used
+    int nCellSize;             // At most one corner per cell of this many pixels, on each level
+    int nRotations;            // Turned copies of the reference, as BRIEF only copes with small turns
+    int nMaxHamming;           // Matches further apart are dropped [bits]
+    double dMatchRatio;        // So are those not this much better than the second best
+    int nIterations;           // RANSAC trials at most
+    double dMaxPixelError;     // Inlier threshold [level zero pixels]
+    int nMinInliers;           // Fewer is no detection
+  };
+
+  struct Detection
+  {
+    Detection();
+    unsigned int nSequence;          // Counts the frames looked at; 0 is none yet
+    int nFrame;                      // As posted
+    bool bFound;
+    int nMatches;                    // Descriptor matches
+    int nInliers;                    // Of those, agreeing with the homography
+    TooN::SE3<> se3CamFromWorld;     // The frame's pose, as posted
+    TooN::SE3<> se3CamFromPad;
+    TooN::Vector<3> v3CentreWorld;
+    TooN::Vector<3> av3CornersWorld[4];
+    double dSeconds;                 // Time the detection took
+  };
+
+  struct Statistics
+  {
+    unsigned int nPosted;
+    unsigned int nDropped;           // Replaced by a later frame before the worker took them
+    unsigned int nDetected;          // Frames in which the pad was found
+  };
+
+  PadDetector(const Params &params);
+  ~PadDetector();
+
+  // The pad as seen in kfRef, e.g. made from a picture of it with
+  // MakeKeyFrame_Lite(), and its width along the image rows [m].
+  void SetReference(const KeyFrame &kfRef, double dWidth);
+
+  // Tracker thread. Copies what is needed of the frame, and its pose.
+  void Post(const KeyFrame &kf, const CameraModel &camera, int nFrame);
+
+  // Any thread. True, with the detection, if one newer than nSequence is in.
+  bool GetLatest(unsigned int nSequence, Detection &detection) const;
+  // Waits for that for up to dSeconds.
+  bool WaitForLatest(unsigned int nSequence, double dSeconds, Detection &detection) const;
+  Statistics GetStatistics() const;
+
+protected:
+  // What the worker needs of a posted frame
+  struct Frame
+  {
+    CVD::Image<CVD::byte> aim[LEVELS];          // Only the levels the detector uses
+    std::vector<CVD::ImageRef> avCorners[LEVELS];
+    CVD::ImageRef irSize;                       // Of the frame's level 0
+    boost::shared_ptr<const CameraModel::UnProjectionTable> pUnProjTable;
+    TooN::SE3<> se3CamFromWorld;
+    int nFrame;
+  };
+
+  void Run();
+  void Detect(const Frame &frame, Detection &detection);
+  bool FitHomography(TooN::Matrix<3> &m3PlaneFromPad);
+
+  const Params mParams;
+
+  // Reference; under mReferenceMutex
+  boost::mutex mReferenceMutex;
+  std::vector<uint64_t> mvnRefWords;          // BriefExtractor::Words per reference feature, all turns
+  std::vector<TooN::Vector<2> > mvv2RefPad;   // Position on the pad [m], per reference feature
+  std::vector<int> mvnRefPoint;               // Which corner of the reference it is, the same for all turns
+  double mdHalfWidth, mdHalfHeight;
+
+  // Mailbox: the tracker fills mpSpare, then swaps it with mpPending
+  mutable boost::mutex mMailboxMutex;
+  boost::condition_variable mMailboxCond;
+  Frame maFrames[3];
+  Frame *mpSpare;      // Tracker's
+  Frame *mpPending;    // Under mMailboxMutex
+  Frame *mpWorking;    // Worker's
+  bool mbPending;
+  bool mbStop;
+  Statistics mStatistics;
+
+  // Result
+  mutable boost::mutex mResultMutex;
+  mutable boost::condition_variable mResultCond;
+  Detection mLatest;
+
+  // Worker's scratch
+  BriefExtractor mExtractor;
+  BriefFeatures mFeatures;
+  std::vector<bool> mvbCellTaken;
+  HomographyRansac mRansac;   // Matches from the pad [m] to the z=1 plane
+  std::vector<int> mvnInliers;
+  unsigned int mnSeed;
+
+  boost::thread mThread;   // Last, so that all above is made before it starts
+};
+
+} // namespace
+
+#endif
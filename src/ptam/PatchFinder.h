@@ -64,6 +64,9 @@ public:
   // returned as an int. Negative level returned denotes an inappropriate 
   // transformation.
   int CalcSearchLevelAndWarpMatrix(MapPoint &p, SE3<> se3CFromW, Matrix<2> &m2CamDerivs);
+  // The same from a copy of the point's position and pixel vectors, e.g. a MapSnapshot's.
+  int CalcSearchLevelAndWarpMatrix(const Vector<3> &v3WorldPos, const Vector<3> &v3PixelRight_W,
+                                   const Vector<3> &v3PixelDown_W, SE3<> se3CFromW, Matrix<2> &m2CamDerivs);
   inline int GetLevel() { return mnSearchLevel; }
   inline int GetLevelScale() { return LevelScale(mnSearchLevel); }
   
@@ -0,0 +1,314 @@
+#include "PnPRelocaliser.h"
+#include "KeyFrame.h"
+#include "MapPoint.h"
+#include "CameraModel.h"
+#include <TooN/SVD.h>
+#include <TooN/wls.h>
+#include <gvars3/instances.h>
+#include <cvd/timer.h>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cassert>
+#include <iostream>
+
+using namespace CVD;
+using namespace GVars3;
+using namespace std;
+using namespace TooN;
+using namespace ptam;
+
+namespace {
+// Compiles to four POPCNT instructions where the target has them
+inline int HammingDistance(const uint64_t *pnA, const uint64_t *pnB)
+{
+  return __builtin_popcountll(pnA[0] ^ pnB[0]) + __builtin_popcountll(pnA[1] ^ pnB[1])
+       + __builtin_popcountll(pnA[2] ^ pnB[2]) + __builtin_popcountll(pnA[3] ^ pnB[3]);
+}
+
+inline double Determinant(const Matrix<3> &m)
+{
+  return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+       - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+       + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+}
+}
+
+PnPRelocaliser::PnPRelocaliser()
+{
+  GV3::Register(mgvnMaxHamming, "PnPReloc.MaxHamming", 64, SILENT);
+  GV3::Register(mgvdMatchRatio, "PnPReloc.MatchRatio", 0.8, SILENT);
+  GV3::Register(mgvnMaxIterations, "PnPReloc.MaxIterations", 300, SILENT);
+  GV3::Register(mgvdMaxPixelError, "PnPReloc.MaxPixelError", 3.0, SILENT);
+  GV3::Register(mgvnMinInliers, "PnPReloc.MinInliers", 15, SILENT);
+  GV3::Register(mgvnMinDepthMatches, "PnPReloc.MinDepthMatches", 10, SILENT);
+  GV3::Register(mgvdMaxMilliseconds, "PnPReloc.MaxMilliseconds", 5.0, SILENT);
+}
+
+boost::shared_ptr<const PnPRelocaliser::Target> PnPRelocaliser::MakeTarget(const boost::shared_ptr<KeyFrame> &pkf)
+{
+  const KeyFrame &kf = *pkf;
+  boost::shared_ptr<Target> pTarget(new Target);
+  pTarget->nKeyFrameId = kf.id;
+  for(unsigned int i=0; i<kf.mapPointsFirstLevel.size(); i++)
+    pTarget->vv3Points.push_back(kf.se3CfromW * kf.mapPointsFirstLevel[i]->v3WorldPos);
+  pTarget->vnDescriptors = kf.mpFirstFeatures.vnWords;
+  assert(pTarget->vnDescriptors.size() == pTarget->vv3Points.size() * DescriptorWords);
+
+  mwpCachedKF = pkf;
+  mpCachedTarget = pTarget;
+  return mpCachedTarget;
+}
+
+boost::shared_ptr<const PnPRelocaliser::Target> PnPRelocaliser::CachedTarget(const boost::shared_ptr<KeyFrame> &pkf) const
+{
+  if(mpCachedTarget && mwpCachedKF.lock() == pkf)
+    return mpCachedTarget;
+  return boost::shared_ptr<const Target>();
+}
+
+PnPRelocaliser::Frame PnPRelocaliser::MakeFrame(const KeyFrame &kf, const CameraModel &camera, double dOnePixelDist)
+{
+  Frame frame;
+  frame.dOnePixelDist = dOnePixelDist;
+  const BriefFeatures &features = kf.kpFeatures;
+  frame.vv2Corners.reserve(features.size());
+  frame.vdDepths.reserve(features.size());
+  for(unsigned int i=0; i<features.size(); i++)
+  {
+    const Vector<2> &v2 = features.vv2RootPos[i];
+    frame.vv2Corners.push_back(camera.UnProjectPixel(ImageRef((int)(v2[0] + 0.5), (int)(v2[1] + 0.5))));
+    frame.vdDepths.push_back(features.vfDepth[i] > 0.0f ? features.vfDepth[i] : 0.0);
+  }
+  frame.vnDescriptors = features.vnWords;
+  assert(frame.vnDescriptors.size() == frame.vv2Corners.size() * DescriptorWords);
+  return frame;
+}
+
+// Nearest neighbour in descriptor space, with a ratio test against the
+// second nearest; a frame corner keeps only the best target point to claim it.
+void PnPRelocaliser::FindMatches(const Target &target, const Frame &frame)
+{
+  const int nTarget = target.vv3Points.size();
+  const int nFrame = frame.vv2Corners.size();
+  vector<int> vnClaimedBy(nFrame, -1);
+  vector<int> vnClaimDistance(nFrame, INT_MAX);
+
+  for(int i=0; i<nTarget; i++)
+  {
+    const uint64_t *pnTarget = &target.vnDescriptors[i * DescriptorWords];
+    int nBest = INT_MAX;
+    int nSecond = INT_MAX;
+    int nBestFrame = -1;
+    for(int j=0; j<nFrame; j++)
+    {
+      int nDistance = HammingDistance(pnTarget, &frame.vnDescriptors[j * DescriptorWords]);
+      if(nDistance < nBest)
+      {
+        nSecond = nBest;
+        nBest = nDistance;
+        nBestFrame = j;
+      }
+      else if(nDistance < nSecond)
+        nSecond = nDistance;
+    }
+    if(nBestFrame < 0 || nBest > *mgvnMaxHamming)
+      continue;
+    if(nSecond != INT_MAX && nBest > *mgvdMatchRatio * nSecond)
+      continue;
+    if(nBest < vnClaimDistance[nBestFrame])
+    {
+      vnClaimDistance[nBestFrame] = nBest;
+      vnClaimedBy[nBestFrame] = i;
+    }
+  }
+
+  mvMatches.clear();
+  mvnDepthMatches.clear();
+  for(int j=0; j<nFrame; j++)
+  {
+    if(vnClaimedBy[j] < 0)
+      continue;
+    Match m;
+    m.nTarget = vnClaimedBy[j];
+    m.nFrame = j;
+    if(frame.vdDepths[j] > 0.0)
+      mvnDepthMatches.push_back(mvMatches.size());
+    mvMatches.push_back(m);
+  }
+}
+
+// Absolute orientation of three target points and the frame corners'
+// back-projections (Arun, Huang and Blostein).
+bool PnPRelocaliser::SolveFromDepth(const Target &target, const Frame &frame, const int *pnSample, SE3<> &se3) const
+{
+  Vector<3> av3Target[3];
+  Vector<3> av3Frame[3];
+  Vector<3> v3TargetMean = Zeros;
+  Vector<3> v3FrameMean = Zeros;
+  for(int s=0; s<3; s++)
+  {
+    const Match &m = mvMatches[pnSample[s]];
+    av3Target[s] = target.vv3Points[m.nTarget];
+    av3Frame[s] = frame.vdDepths[m.nFrame] * unproject(frame.vv2Corners[m.nFrame]);
+    v3TargetMean += av3Target[s] / 3.0;
+    v3FrameMean += av3Frame[s] / 3.0;
+  }
+
+  // Nearly collinear samples don't fix the rotation
+  Vector<3> v3Normal = (av3Target[1] - av3Target[0]) ^ (av3Target[2] - av3Target[0]);
+  if(v3Normal * v3Normal < 1e-8)
+    return false;
+
+  Matrix<3> m3Cross = Zeros;
+  for(int s=0; s<3; s++)
+    m3Cross += (av3Target[s] - v3TargetMean).as_col() * (av3Frame[s] - v3FrameMean).as_row();
+  SVD<3> svd(m3Cross);
+  Matrix<3> U = svd.get_U();
+  Matrix<3> V = svd.get_VT().T();
+  if(Determinant(V * U.T()) < 0.0)   // A reflection; flip the least significant axis
+    for(int r=0; r<3; r++)
+      V[r][2] = -V[r][2];
+  Matrix<3> m3R = V * U.T();
+
+  se3 = SE3<>(SO3<>(m3R), v3FrameMean - m3R * v3TargetMean);
+  return true;
+}
+
+// Gauss-Newton on the z=1 plane errors, from whatever se3 holds
+bool PnPRelocaliser::SolveFromPlane(const Target &target, const Frame &frame, const int *pnSample, int nSample,
+                                    SE3<> &se3) const
+{
+  for(int nIter=0; nIter<10; nIter++)
+  {
+    WLS<6> wls;
+    wls.add_prior(1e-6);
+    for(int s=0; s<nSample; s++)
+    {
+      const Match &m = mvMatches[pnSample[s]];
+      Vector<3> v3Cam = se3 * target.vv3Points[m.nTarget];
+      if(v3Cam[2] <= 0.0)
+        return false;
+      double dOneOverCameraZ = 1.0 / v3Cam[2];
+      Vector<2> v2Error = frame.vv2Corners[m.nFrame] - project(v3Cam);
+      Matrix<2,6> m26Jac;
+      for(int n=0; n<6; n++)
+      {
+        const Vector<4> v4Motion = SE3<>::generator_field(n, unproject(v3Cam));
+        m26Jac[0][n] = (v4Motion[0] - v3Cam[0] * v4Motion[2] * dOneOverCameraZ) * dOneOverCameraZ;
+        m26Jac[1][n] = (v4Motion[1] - v3Cam[1] * v4Motion[2] * dOneOverCameraZ) * dOneOverCameraZ;
+      }
+      wls.add_mJ(v2Error[0], m26Jac[0], 1.0);
+      wls.add_mJ(v2Error[1], m26Jac[1], 1.0);
+    }
+    wls.compute();
+    Vector<6> v6Update = wls.get_mu();
+    if(!(v6Update * v6Update < 1e6))   // Also catches NaN
+      return false;
+    se3 = SE3<>::exp(v6Update) * se3;
+    if(v6Update * v6Update < 1e-12)
+      break;
+  }
+  return true;
+}
+
+int PnPRelocaliser::CountInliers(const Target &target, const Frame &frame, const SE3<> &se3,
+                                 double dMaxErrorSquared, vector<int> *pvnInliers) const
+{
+  if(pvnInliers)
+    pvnInliers->clear();
+  int nInliers = 0;
+  for(unsigned int i=0; i<mvMatches.size(); i++)
+  {
+    const Match &m = mvMatches[i];
+    Vector<3> v3Cam = se3 * target.vv3Points[m.nTarget];
+    if(v3Cam[2] <= 0.0)
+      continue;
+    Vector<2> v2Error = frame.vv2Corners[m.nFrame] - project(v3Cam);
+    if(v2Error * v2Error > dMaxErrorSquared)
+      continue;
+    nInliers++;
+    if(pvnInliers)
+      pvnInliers->push_back(i);
+  }
+  return nInliers;
+}
+
+bool PnPRelocaliser::Register(const Target &target, const Frame &frame, double dMinInlierFraction,
+                              SE3<> &se3TargetFromFrame)
+{
+  const double dStartTime = timer.get_time();
+  const double dMaxTime = 1e-3 * *mgvdMaxMilliseconds;
+
+  FindMatches(target, frame);
+  const int nMatches = mvMatches.size();
+  if(nMatches < *mgvnMinInliers || nMatches < 4)
+    return false;
+
+  const bool bUseDepth = (int)mvnDepthMatches.size() >= std::max(*mgvnMinDepthMatches, 3);
+  const int nSampleSize = bUseDepth ? 3 : 4;
+  const int nPool = bUseDepth ? mvnDepthMatches.size() : nMatches;
+  const double dMaxErrorSquared = (*mgvdMaxPixelError * frame.dOnePixelDist) * (*mgvdMaxPixelError * frame.dOnePixelDist);
+
+  // RANSAC, stopping as soon as enough samples have been drawn to have
+  // seen an all-inlier one with 99% probability, or the time is up
+  SE3<> se3FrameFromTarget;
+  int nBestInliers = 0;
+  int nIterations = *mgvnMaxIterations;
+  for(int nIter=0; nIter<nIterations && timer.get_time() - dStartTime < dMaxTime; nIter++)
+  {
+    int anSample[4];
+    for(int s=0; s<nSampleSize; s++)
+    {
+      bool bRepeat;
+      do
+      {
+        int n = rand() % nPool;
+        anSample[s] = bUseDepth ? mvnDepthMatches[n] : n;
+        bRepeat = std::find(anSample, anSample + s, anSample[s]) != anSample + s;
+      } while(bRepeat);
+    }
+
+    SE3<> se3;
+    if(bUseDepth ? !SolveFromDepth(target, frame, anSample, se3)
+                 : !SolveFromPlane(target, frame, anSample, nSampleSize, se3))
+      continue;
+
+    int nInliers = CountInliers(target, frame, se3, dMaxErrorSquared, NULL);
+    if(nInliers <= nBestInliers)
+      continue;
+    nBestInliers = nInliers;
+    se3FrameFromTarget = se3;
+
+    double dAllInliers = pow((double) nInliers / nMatches, nSampleSize);
+    if(dAllInliers > 0.999999)
+      break;
+    int nNeeded = (int) ceil(log(0.01) / log(1.0 - dAllInliers));
+    nIterations = std::min(nIterations, std::max(nNeeded, nIter + 1));
+  }
+  if(nBestInliers < *mgvnMinInliers)
+    return false;
+
+  // Refine on all inliers, keep it if it doesn't lose any
+  vector<int> vnInliers;
+  CountInliers(target, frame, se3FrameFromTarget, dMaxErrorSquared, &vnInliers);
+  SE3<> se3Refined = se3FrameFromTarget;
+  if(SolveFromPlane(target, frame, &vnInliers[0], vnInliers.size(), se3Refined))
+  {
+    int nInliers = CountInliers(target, frame, se3Refined, dMaxErrorSquared, NULL);
+    if(nInliers >= nBestInliers)
+    {
+      nBestInliers = nInliers;
+      se3FrameFromTarget = se3Refined;
+    }
+  }
+
+  cout << "PnP relocalisation: " << nBestInliers << " of " << nMatches << " matches are inliers ("
+       << (bUseDepth ? "depth" : "no depth") << "), " << 1e3 * (timer.get_time() - dStartTime) << " ms" << endl;
+  if(nBestInliers < dMinInlierFraction * nMatches)
+    return false;
+
+  se3TargetFromFrame = se3FrameFromTarget.inverse();
+  return true;
+}
@@ -0,0 +1,103 @@
+// -*- c++ -*-
+//
+// PnPRelocaliser - recovers the pose of a frame relative to a recent
+// keyframe (a "target") from 2D-3D correspondences.
+//
+// The target's map points carry BRIEF descriptors, as do the frame's
+// corners; they are matched by Hamming distance on 64-bit words. Poses
+// are hypothesised by RANSAC from minimal samples: three correspondences
+// whose corner has a depth reading give an absolute orientation problem,
+// which has a closed-form solution. Without depth, four correspondences
+// are fitted by Gauss-Newton starting at the target's pose - good enough
+// since the target is the last keyframe which was tracked well. The best
+// hypothesis is refined on its inliers.
+//
+// A Target is made once per keyframe (the caller needs the map lock for
+// that) and is never changed afterwards, so registering against it needs
+// no locks at all.
+
+#ifndef __PNP_RELOCALISER_H
+#define __PNP_RELOCALISER_H
+#include <TooN/TooN.h>
+#include <TooN/se3.h>
+#include <gvars3/gvars3.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include "BriefExtractor.h"
+#include <vector>
+#include <stdint.h>
+
+namespace ptam{
+
+class KeyFrame;
+class CameraModel;
+
+class PnPRelocaliser
+{
+public:
+  enum { DescriptorWords = BriefExtractor::Words };
+
+  // The keyframe side: its map points in its own camera frame
+  struct Target
+  {
+    int nKeyFrameId;
+    std::vector<TooN::Vector<3> > vv3Points;
+    std::vector<uint64_t> vnDescriptors;  // DescriptorWords per point
+  };
+
+  // The frame side: its corners on the z=1 plane
+  struct Frame
+  {
+    std::vector<TooN::Vector<2> > vv2Corners;
+    std::vector<double> vdDepths;         // 0 if not available
+    std::vector<uint64_t> vnDescriptors;  // DescriptorWords per corner
+    double dOnePixelDist;                 // z=1 distance of one pixel
+  };
+
+  PnPRelocaliser();
+
+  // Target from a keyframe that has been through finalizeKeyframeGoodkf().
+  // The result is kept, and returned by CachedTarget() for the same keyframe.
+  boost::shared_ptr<const Target> MakeTarget(const boost::shared_ptr<KeyFrame> &pkf);
+  boost::shared_ptr<const Target> CachedTarget(const boost::shared_ptr<KeyFrame> &pkf) const;
+
+  // Frame from a keyframe that has been through finalizeKeyframekpts().
+  // Only const calls are made on the camera.
+  static Frame MakeFrame(const KeyFrame &kf, const CameraModel &camera, double dOnePixelDist);
+
+  // Finds se3TargetFromFrame; fails unless at least dMinInlierFraction
+  // of the descriptor matches agree with it.
+  bool Register(const Target &target, const Frame &frame, double dMinInlierFraction,
+                TooN::SE3<> &se3TargetFromFrame);
+
+protected:
+  struct Match
+  {
+    int nTarget;
+    int nFrame;
+  };
+
+  void FindMatches(const Target &target, const Frame &frame);
+  bool SolveFromDepth(const Target &target, const Frame &frame, const int *pnSample, TooN::SE3<> &se3) const;
+  bool SolveFromPlane(const Target &target, const Frame &frame, const int *pnSample, int nSample, TooN::SE3<> &se3) const;
+  int CountInliers(const Target &target, const Frame &frame, const TooN::SE3<> &se3, double dMaxErrorSquared,
+                   std::vector<int> *pvnInliers) const;
+
+  std::vector<Match> mvMatches;
+  std::vector<int> mvnDepthMatches;  // Indices into mvMatches of those with depth
+
+  boost::weak_ptr<KeyFrame> mwpCachedKF;
+  boost::shared_ptr<const Target> mpCachedTarget;
+
+  GVars3::gvar3<int> mgvnMaxHamming;
+  GVars3::gvar3<double> mgvdMatchRatio;
+  GVars3::gvar3<int> mgvnMaxIterations;
+  GVars3::gvar3<double> mgvdMaxPixelError;
+  GVars3::gvar3<int> mgvnMinInliers;
+  GVars3::gvar3<int> mgvnMinDepthMatches;
+  GVars3::gvar3<double> mgvdMaxMilliseconds;
+};
+
+} // namespace
+
+#endif
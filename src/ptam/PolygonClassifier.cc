@@ -0,0 +1,224 @@
+#include "PolygonClassifier.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace TooN;
+using namespace ptam;
+
+namespace {
+// Positive if c is left of a->b
+inline double Orientation(const Vector<2> &v2A, const Vector<2> &v2B, const Vector<2> &v2C)
+{
+  return (v2B[0] - v2A[0]) * (v2C[1] - v2A[1]) - (v2B[1] - v2A[1]) * (v2C[0] - v2A[0]);
+}
+}
+
+PolygonClassifier::PolygonClassifier(int nGridSize)
+  : mnGridSize(std::max(nGridSize, 1)), mbConvex(false),
+    mv2Min(Zeros), mv2Max(Zeros), mv2CellSize(Zeros)
+{
+}
+
+void PolygonClassifier::SetPolygon(const std::vector<Vector<2> > &vv2Vertices)
+{
+  mvv2Vertices = vv2Vertices;
+  mvfA.clear();
+  mvfB.clear();
+  mvfC.clear();
+  mvCells.clear();
+  mbConvex = false;
+  const int nVertices = mvv2Vertices.size();
+  if(nVertices < 3)
+    return;
+
+  // Convex if it turns the same way at every vertex, and only once round
+  double dArea = 0.0;
+  double dTurned = 0.0;
+  bool bLeft = false, bRight = false;
+  for(int i=0; i<nVertices; i++)
+  {
+    const Vector<2> &v2A = mvv2Vertices[i];
+    const Vector<2> &v2B = mvv2Vertices[(i + 1) % nVertices];
+    const Vector<2> &v2C = mvv2Vertices[(i + 2) % nVertices];
+    double dCross = Orientation(v2A, v2B, v2C);
+    bLeft = bLeft || dCross > 0.0;
+    bRight = bRight || dCross < 0.0;
+    dTurned += std::atan2(dCross, (v2B - v2A) * (v2C - v2B));
+    dArea += v2A[0] * v2B[1] - v2B[0] * v2A[1];
+  }
+  mbConvex = (bLeft != bRight) && std::fabs(std::fabs(dTurned) - 2.0 * M_PI) < 1e-3;
+  if(mbConvex)
+  {
+    const double dSign = dArea > 0.0 ? 1.0 : -1.0;
+    for(int i=0; i<nVertices; i++)
+    {
+      const Vector<2> &v2A = mvv2Vertices[i];
+      const Vector<2> &v2B = mvv2Vertices[(i + 1) % nVertices];
+      double dA = -dSign * (v2B[1] - v2A[1]);
+      double dB = dSign * (v2B[0] - v2A[0]);
+      mvfA.push_back(dA);
+      mvfB.push_back(dB);
+      mvfC.push_back(-(dA * v2A[0] + dB * v2A[1]));
+    }
+  }
+
+  // The grid
+  mv2Min = mv2Max = mvv2Vertices[0];
+  for(int i=1; i<nVertices; i++)
+    for(int d=0; d<2; d++)
+    {
+      mv2Min[d] = std::min(mv2Min[d], mvv2Vertices[i][d]);
+      mv2Max[d] = std::max(mv2Max[d], mvv2Vertices[i][d]);
+    }
+  mv2CellSize = (mv2Max - mv2Min) / mnGridSize;
+  if(!(mv2CellSize[0] > 0.0 && mv2CellSize[1] > 0.0))
+    return;
+  mvCells.resize(mnGridSize * mnGridSize);
+  for(int r=0; r<mnGridSize; r++)
+    for(int c=0; c<mnGridSize; c++)
+    {
+      Cell &cell = mvCells[r * mnGridSize + c];
+      cell.vnEdges.clear();
+      double dMinX = mv2Min[0] + c * mv2CellSize[0];
+      double dMinY = mv2Min[1] + r * mv2CellSize[1];
+      double dMaxX = dMinX + mv2CellSize[0];
+      double dMaxY = dMinY + mv2CellSize[1];
+      for(int i=0; i<nVertices; i++)
+        if(EdgeCrossesCell(i, dMinX, dMinY, dMaxX, dMaxY))
+          cell.vnEdges.push_back(i);
+      // The centre of the cell is what points are tested from, as the
+      // edges of the grid may well run along the polygon's
+      Vector<2> v2Centre = makeVector(0.5 * (dMinX + dMaxX), 0.5 * (dMinY + dMaxY));
+      cell.bCentreInside = Crossings(mvv2Vertices, v2Centre);
+      if(!cell.vnEdges.empty())
+        cell.nState = CELL_MIXED;
+      else
+        cell.nState = cell.bCentreInside ? CELL_IN : CELL_OUT;
+    }
+}
+
+// Conservative: the edge's line passes through the cell, and their boxes overlap
+bool PolygonClassifier::EdgeCrossesCell(int nEdge, double dMinX, double dMinY, double dMaxX, double dMaxY) const
+{
+  const Vector<2> &v2A = mvv2Vertices[nEdge];
+  const Vector<2> &v2B = mvv2Vertices[(nEdge + 1) % mvv2Vertices.size()];
+  if(std::max(v2A[0], v2B[0]) < dMinX || std::min(v2A[0], v2B[0]) > dMaxX ||
+     std::max(v2A[1], v2B[1]) < dMinY || std::min(v2A[1], v2B[1]) > dMaxY)
+    return false;
+  int nLeft = 0, nRight = 0;
+  const double adX[4] = {dMinX, dMaxX, dMaxX, dMinX};
+  const double adY[4] = {dMinY, dMinY, dMaxY, dMaxY};
+  for(int i=0; i<4; i++)
+  {
+    double dSide = Orientation(v2A, v2B, makeVector(adX[i], adY[i]));
+    nLeft += dSide >= 0.0;
+    nRight += dSide <= 0.0;
+  }
+  return nLeft > 0 && nRight > 0;
+}
+
+bool PolygonClassifier::GridContains(double dX, double dY) const
+{
+  if(mvCells.empty() || !(dX >= mv2Min[0] && dX <= mv2Max[0] && dY >= mv2Min[1] && dY <= mv2Max[1]))
+    return false;
+  int c = std::min((int) ((dX - mv2Min[0]) / mv2CellSize[0]), mnGridSize - 1);
+  int r = std::min((int) ((dY - mv2Min[1]) / mv2CellSize[1]), mnGridSize - 1);
+  const Cell &cell = mvCells[r * mnGridSize + c];
+  if(cell.nState != CELL_MIXED)
+    return cell.nState == CELL_IN;
+
+  // Each edge crossed on the way to the centre flips the centre's side;
+  // a vertex on the way counts as on the right, so that it is crossed once
+  Vector<2> v2Point = makeVector(dX, dY);
+  Vector<2> v2Centre = mv2Min + makeVector((c + 0.5) * mv2CellSize[0], (r + 0.5) * mv2CellSize[1]);
+  bool bInside = cell.bCentreInside;
+  const int nVertices = mvv2Vertices.size();
+  for(unsigned int i=0; i<cell.vnEdges.size(); i++)
+  {
+    const Vector<2> &v2A = mvv2Vertices[cell.vnEdges[i]];
+    const Vector<2> &v2B = mvv2Vertices[(cell.vnEdges[i] + 1) % nVertices];
+    if((Orientation(v2Point, v2Centre, v2A) > 0.0) != (Orientation(v2Point, v2Centre, v2B) > 0.0) &&
+       (Orientation(v2A, v2B, v2Point) > 0.0) != (Orientation(v2A, v2B, v2Centre) > 0.0))
+      bInside = !bInside;
+  }
+  return bInside;
+}
+
+bool PolygonClassifier::Contains(const Vector<2> &v2Point) const
+{
+  return GridContains(v2Point[0], v2Point[1]);
+}
+
+int PolygonClassifier::Select(const std::vector<Vector<2> > &vv2Points, std::vector<int> &vnInside) const
+{
+  const int nPoints = vv2Points.size();
+  const unsigned int nBefore = vnInside.size();
+  if(!mbConvex)
+  {
+    for(int i=0; i<nPoints; i++)
+      if(GridContains(vv2Points[i][0], vv2Points[i][1]))
+        vnInside.push_back(i);
+    return vnInside.size() - nBefore;
+  }
+
+  const int nEdges = mvfA.size();
+  int i = 0;
+#ifdef __SSE2__
+  // Vector<2>s lie in memory as x y x y ..
+  for(; i + 4 <= nPoints; i+=4)
+  {
+    __m128d vP0 = _mm_loadu_pd(&vv2Points[i][0]);
+    __m128d vP1 = _mm_loadu_pd(&vv2Points[i+1][0]);
+    __m128d vP2 = _mm_loadu_pd(&vv2Points[i+2][0]);
+    __m128d vP3 = _mm_loadu_pd(&vv2Points[i+3][0]);
+    __m128 vX = _mm_movelh_ps(_mm_cvtpd_ps(_mm_unpacklo_pd(vP0, vP1)), _mm_cvtpd_ps(_mm_unpacklo_pd(vP2, vP3)));
+    __m128 vY = _mm_movelh_ps(_mm_cvtpd_ps(_mm_unpackhi_pd(vP0, vP1)), _mm_cvtpd_ps(_mm_unpackhi_pd(vP2, vP3)));
+    __m128 vInside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for(int e=0; e<nEdges; e++)
+    {
+      __m128 vSide = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(mvfA[e]), vX),
+                                           _mm_mul_ps(_mm_set1_ps(mvfB[e]), vY)), _mm_set1_ps(mvfC[e]));
+      vInside = _mm_and_ps(vInside, _mm_cmpge_ps(vSide, _mm_setzero_ps()));
+    }
+    int nMask = _mm_movemask_ps(vInside);
+    for(int j=0; nMask; j++, nMask >>= 1)
+      if(nMask & 1)
+        vnInside.push_back(i + j);
+  }
+#endif
+  for(; i<nPoints; i++)
+  {
+    float fX = vv2Points[i][0];
+    float fY = vv2Points[i][1];
+    bool bInside = true;
+    for(int e=0; e<nEdges && bInside; e++)
+      bInside = mvfA[e] * fX + mvfB[e] * fY + mvfC[e] >= 0.0f;
+    if(bInside)
+      vnInside.push_back(i);
+  }
+  return vnInside.size() - nBefore;
+}
+
+// As cn_PnPoly() of Sunday's "Inclusion of a Point in a Polygon"
+bool PolygonClassifier::Crossings(const std::vector<Vector<2> > &vv2Vertices, const Vector<2> &v2Point)
+{
+  bool bInside = false;
+  const int nVertices = vv2Vertices.size();
+  for(int i=0, j=nVertices-1; i<nVertices; j=i++)
+  {
+    const Vector<2> &v2A = vv2Vertices[j];
+    const Vector<2> &v2B = vv2Vertices[i];
+    if((v2A[1] <= v2Point[1]) != (v2B[1] <= v2Point[1]))
+    {
+      double dX = v2A[0] + (v2Point[1] - v2A[1]) * (v2B[0] - v2A[0]) / (v2B[1] - v2A[1]);
+      if(v2Point[0] < dX)
+        bInside = !bInside;
+    }
+  }
+  return bInside;
+}
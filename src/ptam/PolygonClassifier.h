@@ -0,0 +1,67 @@
+// -*- c++ -*-
+//
+// PolygonClassifier - tells which of many image points lie inside a
+// polygon, e.g. which map points measured in a frame lie on the landing
+// pad.
+//
+// SetPolygon() does the per-polygon work once: a grid over the polygon's
+// bounding box, after the grid method of Haines' "Point in Polygon
+// Strategies" (Graphics Gems IV), whose cells are known to be all in, all
+// out, or crossed by a few edges; and, if the polygon is convex, one half
+// plane per edge. Select() then classifies a batch of points: convex
+// polygons with the half planes, four points at a time with SSE2, others
+// through the grid, where most points are settled by their cell alone.
+//
+// Points on an edge may fall either way.
+
+#ifndef __POLYGONCLASSIFIER_H
+#define __POLYGONCLASSIFIER_H
+#include <vector>
+#include <TooN/TooN.h>
+
+namespace ptam{
+
+class PolygonClassifier
+{
+public:
+  // nGridSize cells along each side of the bounding box
+  PolygonClassifier(int nGridSize = 16);
+
+  // Vertices in order, either way round; the last joins the first
+  void SetPolygon(const std::vector<TooN::Vector<2> > &vv2Vertices);
+  bool IsConvex() const { return mbConvex; }
+
+  bool Contains(const TooN::Vector<2> &v2Point) const;
+  // Appends the indices of the points inside to vnInside; returns how many
+  int Select(const std::vector<TooN::Vector<2> > &vv2Points, std::vector<int> &vnInside) const;
+
+  // The plain crossings test, one point against every edge
+  static bool Crossings(const std::vector<TooN::Vector<2> > &vv2Vertices, const TooN::Vector<2> &v2Point);
+
+protected:
+  enum { CELL_OUT, CELL_IN, CELL_MIXED };
+  struct Cell
+  {
+    int nState;
+    bool bCentreInside;       // Whether the cell's centre is
+    std::vector<int> vnEdges; // Edges crossing the cell, for CELL_MIXED; edge i runs from vertex i
+  };
+
+  bool GridContains(double dX, double dY) const;
+  bool EdgeCrossesCell(int nEdge, double dMinX, double dMinY, double dMaxX, double dMaxY) const;
+
+  const int mnGridSize;
+  std::vector<TooN::Vector<2> > mvv2Vertices;
+  bool mbConvex;
+
+  // Half planes: inside where fA x + fB y + fC >= 0 for every edge
+  std::vector<float> mvfA, mvfB, mvfC;
+
+  TooN::Vector<2> mv2Min, mv2Max;   // Bounding box
+  TooN::Vector<2> mv2CellSize;
+  std::vector<Cell> mvCells;        // Row by row
+};
+
+} // namespace
+
+#endif
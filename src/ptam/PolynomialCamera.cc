@@ -1,8 +1,17 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include <boost/interprocess/file_mapping.hpp>
 #include <TooN/helpers.h>
 #include <cvd/vector_image_ref.h>
 #include "PolynomialCamera.h"
+#include "WorkerPool.h"
 
 using namespace TooN;
 using namespace cv;
@@ -10,6 +19,27 @@ using namespace CVD;
 using namespace std;
 using namespace ptam;
 
+namespace {
+// Layout of a cached lookup table file: this header, then the rows of
+// projLookupX, then the rows of projLookupY.
+struct LookupHeader {
+	char magic[8];
+	unsigned long long hash;
+	int rows, cols;
+	double largestSqRadius;
+};
+const char lookupMagic[8] = {'P','T','A','M','L','U','T','1'};
+
+void HashBytes(unsigned long long& hash, const void* data, size_t size) {
+	// FNV-1a
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for(size_t i=0; i<size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+}
+}
+
 PolynomialCamera::PolynomialCamera(const char* file):
 	onePixelDist(0), largestRadius(0), largestSqRadius(0), invalid(true), scalingFactor(1) {
 	
@@ -29,24 +59,60 @@ PolynomialCamera::PolynomialCamera(const char* file):
 	defaultSize[1] = matSize(1);
 	fs.release();
 	
-	// Create lookup table
-	InitLookupTable();
+	// Create lookup table, or load it from next to the calibration file
+	InitLookupTable(string(file) + ".lut");
 	
 	// By default we chose the image size used for calibration
 	SetImageSize(defaultSize);
 }
 
-void PolynomialCamera::InitLookupTable() {
+void PolynomialCamera::InitLookupTable(const string& cacheFile) {
 	// Create a lookup table for inverse projection. The table has 
 	// twice the size of the image resultion, such that we can
 	// do projections at 0.5 pixel resolution. We also keep the largest
 	// radius.
+	if(LoadLookupTable(cacheFile)) {
+		largestRadius = sqrt(largestSqRadius);
+		return;
+	}
+
 	cout << "Creating projection lookup table... " << flush;
 	
+	projLookupX = Mat_<double>(defaultSize[1]*2, defaultSize[0]*2, -1.0);
+	projLookupY = Mat_<double>(defaultSize[1]*2, defaultSize[0]*2, -1.0);
+
+	// Every entry is the inverse of the distortion at its pixel position,
+	// found by Newton's method. The rows are independent of each other.
+	vector<double> rowSqRadius(projLookupX.rows, 0.0);
+	vector<char> rowOK(projLookupX.rows, 0);
+	{
+		WorkerPool pool(boost::thread::hardware_concurrency());
+		pool.ParallelFor(projLookupX.rows, boost::bind(&PolynomialCamera::SolveLookupRow,
+			this, _1, &rowSqRadius, &rowOK));
+	}
+
+	if(find(rowOK.begin(), rowOK.end(), 0) == rowOK.end())
+		largestSqRadius = *max_element(rowSqRadius.begin(), rowSqRadius.end());
+	else {
+		// Newton didn't converge everywhere, i.e. the distortion folds
+		// over inside the image. Do it the slow way.
+		cout << "falling back to sweep... " << flush;
+		SweepLookupTable();
+	}
+	
+	largestRadius = sqrt(largestSqRadius);
+	
+	cout << "done" << endl;
+
+	SaveLookupTable(cacheFile);
+}
+
+void PolynomialCamera::SweepLookupTable() {
 	projLookupX = Mat_<double>(defaultSize[1]*2, defaultSize[0]*2, -1.0);
 	projLookupY = Mat_<double>(defaultSize[1]*2, defaultSize[0]*2, -1.0);
 	projLookupU = Mat_<double>(defaultSize[1]*2, defaultSize[0]*2, -1e10),
 	projLookupV = Mat_<double>(defaultSize[1]*2, defaultSize[0]*2, -1e10);
+	largestSqRadius = 0;
 	
 	// This is very slow and inefficient but MATLAB can't find the inverse to
 	// the projection functions. However, we only have to do this once.
@@ -61,10 +127,6 @@ void PolynomialCamera::InitLookupTable() {
 	// Top left
 	CreateLookupTableSection(-step, -step);
 	
-	largestRadius = sqrt(largestSqRadius);
-	
-	cout << "done" << endl;
-	
 	// Check if all elements of the lookup tables are initialized
 	for(int v = 0; v<projLookupX.rows; v++)
 		for(int u = 0; u<projLookupX.cols; u++) {
@@ -77,6 +139,143 @@ void PolynomialCamera::InitLookupTable() {
 	projLookupV = Mat_<double>(); // No longer needed
 }
 
+void PolynomialCamera::SolveLookupRow(int row, vector<double>* rowSqRadius, vector<char>* rowOK) {
+	const double &f_x = cameraMatrix(0, 0),
+		&f_y = cameraMatrix(1,1),
+		&c_x = cameraMatrix(0, 2),
+		&c_y = cameraMatrix(1, 2);
+
+	// Distorted z=1 plane position of this row
+	const double yTarget = (row/2.0 - c_y) / f_y;
+	double x = 0, y = 0, maxSqRadius = 0;
+
+	for(int col = 0; col < projLookupX.cols; col++) {
+		const double xTarget = (col/2.0 - c_x) / f_x;
+		// Start from the undistorted position at the beginning of the row,
+		// and from the neighbouring entry afterwards
+		if(col == 0) {
+			x = xTarget;
+			y = yTarget;
+		}
+
+		bool converged = false;
+		for(int i = 0; i < 20; i++) {
+			double xd, yd;
+			TooN::Matrix<2,2> J;
+			Distort(x, y, xd, yd, J);
+			const double ex = xd - xTarget, ey = yd - yTarget;
+			const double det = J[0][0]*J[1][1] - J[0][1]*J[1][0];
+			if(det <= 0)
+				break; // Beyond the point where the distortion folds over
+			if(f_x*f_x*ex*ex + f_y*f_y*ey*ey < 1e-10) {
+				converged = true; // Well below 1e-4 pixels
+				break;
+			}
+			x -= ( J[1][1]*ex - J[0][1]*ey) / det;
+			y -= (-J[1][0]*ex + J[0][0]*ey) / det;
+		}
+		if(!converged) {
+			(*rowOK)[row] = 0;
+			return;
+		}
+
+		projLookupX(row, col) = x;
+		projLookupY(row, col) = y;
+		maxSqRadius = max(maxSqRadius, x*x + y*y);
+	}
+
+	(*rowSqRadius)[row] = maxSqRadius;
+	(*rowOK)[row] = 1;
+}
+
+void PolynomialCamera::Distort(double x, double y, double& xd, double& yd, TooN::Matrix<2,2>& J) const {
+	// Same as Project() without the camera matrix, see there
+	const double &k_1 = distCoeffs(0,0), &k_2 = distCoeffs(0,1), &k_3 = distCoeffs(0,4),
+		&p_1 = distCoeffs(0,2), &p_2 = distCoeffs(0,3);
+
+	const double r2 = x*x + y*y;
+	const double distFactor = 1 + k_1*r2 + k_2*r2*r2 + k_3*r2*r2*r2;
+	const double dDistFactor = 2*k_1 + 4*k_2*r2 + 6*k_3*r2*r2; // d distFactor / d r2, times two
+
+	xd = x * distFactor + 2*p_1*x*y + p_2*(r2 + 2*x*x);
+	yd = y * distFactor + 2*p_2*x*y + p_1*(r2 + 2*y*y);
+
+	J[0][0] = distFactor + x*x*dDistFactor + 2*p_1*y + 6*p_2*x; // dxd/dx
+	J[0][1] = x*y*dDistFactor + 2*p_1*x + 2*p_2*y;              // dxd/dy
+	J[1][0] = x*y*dDistFactor + 2*p_2*y + 2*p_1*x;              // dyd/dx
+	J[1][1] = distFactor + y*y*dDistFactor + 2*p_2*x + 6*p_1*y; // dyd/dy
+}
+
+unsigned long long PolynomialCamera::CalibrationHash() const {
+	unsigned long long hash = 14695981039346656037ULL;
+	HashBytes(hash, lookupMagic, sizeof(lookupMagic));
+	for(MatConstIterator_<double> it = cameraMatrix.begin(); it != cameraMatrix.end(); ++it)
+		HashBytes(hash, &*it, sizeof(double));
+	for(MatConstIterator_<double> it = distCoeffs.begin(); it != distCoeffs.end(); ++it)
+		HashBytes(hash, &*it, sizeof(double));
+	HashBytes(hash, &defaultSize[0], sizeof(double));
+	HashBytes(hash, &defaultSize[1], sizeof(double));
+	return hash;
+}
+
+bool PolynomialCamera::LoadLookupTable(const string& cacheFile) {
+	using namespace boost::interprocess;
+
+	boost::shared_ptr<mapped_region> region;
+	try {
+		file_mapping mapping(cacheFile.c_str(), read_only);
+		region.reset(new mapped_region(mapping, read_only));
+	} catch(const interprocess_exception&) {
+		return false; // Not cached yet
+	}
+
+	const int rows = defaultSize[1]*2, cols = defaultSize[0]*2;
+	if(region->get_size() != sizeof(LookupHeader) + 2*sizeof(double)*rows*cols)
+		return false;
+	const LookupHeader* header = static_cast<const LookupHeader*>(region->get_address());
+	if(memcmp(header->magic, lookupMagic, sizeof(lookupMagic)) != 0 ||
+	   header->hash != CalibrationHash() || header->rows != rows || header->cols != cols) {
+		cout << "Projection lookup table " << cacheFile << " is out of date" << endl;
+		return false;
+	}
+
+	// The tables are only read from, so they can point straight into the mapping
+	double* data = reinterpret_cast<double*>(static_cast<char*>(region->get_address()) + sizeof(LookupHeader));
+	projLookupX = Mat_<double>(rows, cols, data);
+	projLookupY = Mat_<double>(rows, cols, data + rows*cols);
+	largestSqRadius = header->largestSqRadius;
+	lookupRegion = region;
+
+	cout << "Loaded projection lookup table from " << cacheFile << endl;
+	return true;
+}
+
+void PolynomialCamera::SaveLookupTable(const string& cacheFile) const {
+	LookupHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, lookupMagic, sizeof(lookupMagic));
+	header.hash = CalibrationHash();
+	header.rows = projLookupX.rows;
+	header.cols = projLookupX.cols;
+	header.largestSqRadius = largestSqRadius;
+
+	// Write to a temporary file first, such that nobody maps a half written table
+	stringstream tmpFile;
+	tmpFile << cacheFile << ".tmp" << getpid();
+	ofstream out(tmpFile.str().c_str(), ios::binary);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	for(int v = 0; v < projLookupX.rows; v++)
+		out.write(reinterpret_cast<const char*>(projLookupX[v]), projLookupX.cols*sizeof(double));
+	for(int v = 0; v < projLookupY.rows; v++)
+		out.write(reinterpret_cast<const char*>(projLookupY[v]), projLookupY.cols*sizeof(double));
+	out.close();
+
+	if(!out || rename(tmpFile.str().c_str(), cacheFile.c_str()) != 0) {
+		cerr << "Unable to write projection lookup table: " << cacheFile << endl;
+		remove(tmpFile.str().c_str());
+	}
+}
+
 void PolynomialCamera::RefreshParams() {
 	// Just calculate a new scaling factor in case the image size changed
 	scalingFactor = GetImageSize()[0] / defaultSize[0];
@@ -188,6 +387,22 @@ TooN::Vector<2> PolynomialCamera::Project(const TooN::Vector<2>& camframe) {
 		ret[1] < 0 || ret[1] >= GetImageSize()[1];
 	return ret;
 }
+TooN::Vector<2> PolynomialCamera::ProjectSafe(const TooN::Vector<2>& camframe) const {
+	const double &f_x = cameraMatrix(0, 0),
+		&f_y = cameraMatrix(1,1),
+		&c_x = cameraMatrix(0, 2),
+		&c_y = cameraMatrix(1, 2);
+
+	double xp, yp;
+	TooN::Matrix<2,2> J;
+	Distort(camframe[0], camframe[1], xp, yp, J);
+
+	TooN::Vector<2> ret;
+	ret[0] = scalingFactor * (f_x * xp + c_x);
+	ret[1] = scalingFactor * (f_y * yp + c_y);
+	return ret;
+}
+
 TooN::Vector<2> PolynomialCamera::Project_ud(const TooN::Vector<2>& camframe) {
     // Inserts camframe into the projection equations.
     // See http://opencv.itseez.com/modules/calib3d/doc/camera_calibration_and_3d_reconstruction.html
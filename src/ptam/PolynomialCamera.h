@@ -2,6 +2,10 @@
 #define POLYNOMIALCAMERA_H
 
 #include <opencv2/opencv.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <string>
+#include <vector>
 #include "CameraModel.h"
 namespace ptam{
 // Camera model based on the polynomial model employed by OpenV
@@ -16,6 +20,8 @@ public:
 	virtual TooN::Vector<2> Project(const TooN::Vector<2>& camframe);
     // Projects from camera z=1 plane to pixel coordinates, without radial distortion
     virtual TooN::Vector<2> Project_ud(const TooN::Vector<2>& camframe);
+    // Same as Project(), without changing lastProjPos or invalid
+    virtual TooN::Vector<2> ProjectSafe(const TooN::Vector<2>& camframe) const;
 
 	// Inverse operation
 	virtual TooN::Vector<2> UnProject(const TooN::Vector<2>& imframe);
@@ -30,7 +36,7 @@ public:
 	virtual double LargestRadiusInImage() {return largestRadius * scalingFactor;}
 	virtual double OnePixelDist() {return onePixelDist;}
 	
-private:
+protected:
 	cv::Mat_<double> projLookupX, projLookupY;
 	cv::Mat_<double> projLookupU, projLookupV;
 	cv::Mat_<double> cameraMatrix, distCoeffs;
@@ -41,13 +47,25 @@ private:
 	double largestRadius, largestSqRadius;
 	bool invalid;
 	double scalingFactor;
+	// Keeps a lookup table loaded from the cache file mapped. Shared between copies.
+	boost::shared_ptr<boost::interprocess::mapped_region> lookupRegion;
 	
 	// Creates one quarter of the lookup table
 	void CreateLookupTableSection(double incX, double incY);
 	// Inserts a single value into the lookup table
 	bool InsertProjectionLookup(double x, double y);
 	// Triggers the creation of the full lookup table
-	void InitLookupTable();
+	void InitLookupTable(const std::string& cacheFile);
+	// Brute-force sweep, only used if Newton fails for some table entry
+	void SweepLookupTable();
+	// Inverts the distortion for one lookup table row by Newton's method
+	void SolveLookupRow(int row, std::vector<double>* rowSqRadius, std::vector<char>* rowOK);
+	// Distortion on the z=1 plane and its jacobian, without touching any state
+	void Distort(double x, double y, double& xd, double& yd, TooN::Matrix<2,2>& J) const;
+	// Hash of the calibration, identifying a cached lookup table
+	unsigned long long CalibrationHash() const;
+	bool LoadLookupTable(const std::string& cacheFile);
+	void SaveLookupTable(const std::string& cacheFile) const;
 };
 
 } // namespace
@@ -0,0 +1,422 @@
+#include "PoseGraph.h"
+#include "KeyFrame.h"
+#include <gvars3/instances.h>
+#include <algorithm>
+#include <cmath>
+
+using namespace TooN;
+using namespace std;
+using namespace GVars3;
+using namespace ptam;
+
+PoseGraph::PoseGraph()
+  : mnProcessed(0), mpFilling(NULL), mnFlushed(0), mnEpoch(0), mnFetchedGeneration(0),
+    mnGraphEpoch(0), mbDirty(false), mnGeneration(0), mpUnpublished(NULL)
+{
+  GV3::Register(mgvnMaxIterations, "PoseGraph.MaxIterations", 10, SILENT);
+  GV3::Register(mgvdTranslationSigma, "PoseGraph.TranslationSigma", 0.05, SILENT);
+  GV3::Register(mgvdRotationSigma, "PoseGraph.RotationSigma", 0.02, SILENT);
+  GV3::Register(mgvdMinCorrection, "PoseGraph.MinCorrection", 0.001, SILENT);
+  mThread = boost::thread(boost::bind(&PoseGraph::Run, this));
+}
+
+PoseGraph::~PoseGraph()
+{
+  mThread.interrupt();
+  mThread.join();
+
+  delete mpFilling;
+  for(unsigned int i=0; i<mvpHeldBack.size(); i++)
+    delete mvpHeldBack[i];
+  Batch *pBatch;
+  while(mqBatches.pop(pBatch))
+    delete pBatch;
+  Corrections *pCorrections;
+  while(mqCorrections.pop(pCorrections))
+    delete pCorrections;
+  delete mpUnpublished;
+}
+
+Sophus::SE3d PoseGraph::ToSophus(const SE3<> &se3)
+{
+  const Matrix<3> &m3 = se3.get_rotation().get_matrix();
+  Eigen::Matrix3d R;
+  for(int r=0; r<3; r++)
+    for(int c=0; c<3; c++)
+      R(r,c) = m3[r][c];
+  const Vector<3> &v3 = se3.get_translation();
+  return Sophus::SE3d(R, Eigen::Vector3d(v3[0], v3[1], v3[2]));
+}
+
+SE3<> PoseGraph::ToTooN(const Sophus::SE3d &se3)
+{
+  Eigen::Matrix3d R = se3.rotationMatrix();
+  Matrix<3> m3;
+  for(int r=0; r<3; r++)
+    for(int c=0; c<3; c++)
+      m3[r][c] = R(r,c);
+  const Eigen::Vector3d &t = se3.translation();
+  return SE3<>(SO3<>(m3), makeVector(t[0], t[1], t[2]));
+}
+
+void PoseGraph::AddKeyFrame(const KeyFrame &kf)
+{
+  if(!mpFilling)
+  {
+    mpFilling = new Batch;
+    mpFilling->nEpoch = mnEpoch;
+    mpFilling->nGeneration = mnFetchedGeneration;
+  }
+  NodeUpdate node;
+  node.nId = kf.id;
+  node.bFixed = kf.bFixed;
+  node.se3CfromW = kf.se3CfromW;
+  mpFilling->vNodes.push_back(node);
+  for(KeyFrame::EdgeMap::const_iterator it = kf.edges.begin(); it != kf.edges.end(); it++)
+    if(it->second && it->second->valid)
+      mpFilling->vpEdges.push_back(boost::shared_ptr<Edge>(new Edge(*it->second)));
+}
+
+void PoseGraph::Reset()
+{
+  delete mpFilling;
+  mpFilling = NULL;
+  for(unsigned int i=0; i<mvpHeldBack.size(); i++)
+    delete mvpHeldBack[i];
+  mvpHeldBack.clear();
+
+  // An empty batch of the new epoch tells the graph thread
+  mnEpoch++;
+  mnFetchedGeneration = 0;
+  mpFilling = new Batch;
+  mpFilling->nEpoch = mnEpoch;
+  mpFilling->nGeneration = mnFetchedGeneration;
+  Flush();
+}
+
+void PoseGraph::Flush()
+{
+  if(mpFilling)
+  {
+    mvpHeldBack.push_back(mpFilling);
+    mpFilling = NULL;
+  }
+  unsigned int nPushed = 0;
+  while(nPushed < mvpHeldBack.size() && mqBatches.push(mvpHeldBack[nPushed]))
+    nPushed++;
+  mvpHeldBack.erase(mvpHeldBack.begin(), mvpHeldBack.begin() + nPushed);
+  mnFlushed += nPushed;
+}
+
+bool PoseGraph::FetchCorrections(Corrections &corrections)
+{
+  Corrections *pCorrections;
+  while(mqCorrections.pop(pCorrections))
+  {
+    // Anything from before the last Reset() is of no use
+    bool bCurrent = pCorrections->nEpoch == mnEpoch;
+    if(bCurrent)
+    {
+      corrections = *pCorrections;
+      mnFetchedGeneration = pCorrections->nGeneration;
+    }
+    delete pCorrections;
+    if(bCurrent)
+      return true;
+  }
+  return false;
+}
+
+bool PoseGraph::GetPose(int nId, SE3<> &se3CfromW)
+{
+  boost::mutex::scoped_lock lock(mGraphMutex);
+  NodeMap::const_iterator it = mNodes.find(nId);
+  if(it == mNodes.end())
+    return false;
+  se3CfromW = ToTooN(it->second->se3WfromC.inverse());
+  return true;
+}
+
+void PoseGraph::WaitUntilIdle()
+{
+  Flush();
+  boost::mutex::scoped_lock lock(mGraphMutex);
+  while(mnProcessed != mnFlushed || !mvpHeldBack.empty() || mbDirty)
+  {
+    lock.unlock();
+    Flush();
+    lock.lock();
+    mProcessedCond.timed_wait(lock, boost::posix_time::milliseconds(5));
+  }
+}
+
+void PoseGraph::Run()
+{
+  try
+  {
+    while(true)
+    {
+      bool bBusy = false;
+      {
+        boost::mutex::scoped_lock lock(mGraphMutex);
+        Batch *pBatch;
+        while(mqBatches.pop(pBatch))
+        {
+          if(Absorb(*pBatch))
+            mbDirty = true;
+          delete pBatch;
+          mnProcessed++;
+          bBusy = true;
+        }
+
+        // A batch which didn't fit in the queue holds up the next
+        // optimisation: batches have to reach the owner in order.
+        if(mpUnpublished && Publish())
+          bBusy = true;
+        if(mbDirty && !mpUnpublished)
+        {
+          Optimise();
+          mbDirty = false;
+          if(mpUnpublished)
+            Publish();
+          bBusy = true;
+        }
+        mProcessedCond.notify_all();
+      }
+      if(!bBusy)
+        boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+      boost::this_thread::interruption_point();
+    }
+  }
+  catch(boost::thread_interrupted &)
+  {
+  }
+}
+
+bool PoseGraph::Absorb(const Batch &batch)
+{
+  if(batch.nEpoch != mnGraphEpoch)
+  {
+    mnGraphEpoch = batch.nEpoch;
+    mNodes.clear();
+    mEdges.clear();
+    delete mpUnpublished;
+    mpUnpublished = NULL;
+    mbDirty = false;
+    mnGeneration = 0;
+  }
+
+  bool bChanged = false;
+  for(unsigned int i=0; i<batch.vpEdges.size(); i++)
+  {
+    const boost::shared_ptr<Edge> &pEdge = batch.vpEdges[i];
+    boost::shared_ptr<Edge> &pOld = mEdges[make_pair(pEdge->idA, pEdge->idB)];
+    // Local BA re-sends the same edges over and over
+    if(pOld && pOld->type == pEdge->type && pOld->dSceneDepthMean == pEdge->dSceneDepthMean
+       && (pOld->aTb.inverse() * pEdge->aTb).log().lpNorm<Eigen::Infinity>() < 1e-9)
+      continue;
+    pOld = pEdge;
+    bChanged = true;
+  }
+
+  // Poses from an owner which hasn't caught up with our corrections yet
+  // are in the old frame; new keyframes get theirs by chaining from a
+  // known neighbour instead, if there is one.
+  const bool bStale = batch.nGeneration < mnGeneration;
+  for(unsigned int i=0; i<batch.vNodes.size(); i++)
+  {
+    const NodeUpdate &update = batch.vNodes[i];
+    boost::shared_ptr<Node> &pNode = mNodes[update.nId];
+    if(pNode && bStale)
+      continue;
+    Sophus::SE3d se3WfromC = ToSophus(update.se3CfromW).inverse();
+    if(!pNode && bStale)
+    {
+      for(unsigned int j=0; j<batch.vpEdges.size(); j++)
+      {
+        const Edge &e = *batch.vpEdges[j];
+        NodeMap::const_iterator it;
+        if(e.idB == update.nId && (it = mNodes.find(e.idA)) != mNodes.end() && it->second)
+        {
+          se3WfromC = it->second->se3WfromC * e.aTb;
+          break;
+        }
+        if(e.idA == update.nId && (it = mNodes.find(e.idB)) != mNodes.end() && it->second)
+        {
+          se3WfromC = it->second->se3WfromC * e.aTb.inverse();
+          break;
+        }
+      }
+    }
+    if(!pNode)
+    {
+      pNode.reset(new Node);
+      bChanged = true;
+    }
+    pNode->se3WfromC = se3WfromC;
+    pNode->bFixed = update.bFixed;
+  }
+  return bChanged;
+}
+
+// Gauss-Newton on the poses, perturbed on the right: wTc <- wTc exp(d).
+// The residual of edge a->b is log(aTb^-1 wTa^-1 wTb), so to first order
+// d/d(db) = I and d/d(da) = -Adj(wTb^-1 wTa).
+void PoseGraph::Optimise()
+{
+  if(mNodes.empty())
+    return;
+
+  // Which nodes are optimised: not fixed, not the first, and in an edge
+  int nBlocks = 0;
+  for(NodeMap::iterator it = mNodes.begin(); it != mNodes.end(); it++)
+  {
+    it->second->nBlock = -1;
+    it->second->se3Estimate = it->second->se3WfromC;
+  }
+  vector<pair<Node*, Node*> > vEdgeNodes;
+  vector<const Edge*> vpEdges;
+  for(EdgeMap::const_iterator it = mEdges.begin(); it != mEdges.end(); it++)
+  {
+    NodeMap::iterator itA = mNodes.find(it->first.first);
+    NodeMap::iterator itB = mNodes.find(it->first.second);
+    if(itA == mNodes.end() || itB == mNodes.end() || itA == itB)
+      continue;
+    Node *pNodes[2] = {itA->second.get(), itB->second.get()};
+    for(int n=0; n<2; n++)
+      if(pNodes[n]->nBlock < 0 && !pNodes[n]->bFixed && pNodes[n] != mNodes.begin()->second.get())
+        pNodes[n]->nBlock = nBlocks++;
+    vEdgeNodes.push_back(make_pair(pNodes[0], pNodes[1]));
+    vpEdges.push_back(it->second.get());
+  }
+  if(nBlocks == 0)
+    return;
+
+  vector<pair<int, int> > vPattern;
+  for(unsigned int i=0; i<vEdgeNodes.size(); i++)
+    if(vEdgeNodes[i].first->nBlock >= 0 && vEdgeNodes[i].second->nBlock >= 0)
+      vPattern.push_back(make_pair(vEdgeNodes[i].first->nBlock, vEdgeNodes[i].second->nBlock));
+  mSolver.Analyse(nBlocks, vPattern);
+
+  const double dRotationWeight = 1.0 / (*mgvdRotationSigma * *mgvdRotationSigma);
+  for(int nIter=0; nIter<*mgvnMaxIterations; nIter++)
+  {
+    mSolver.Clear();
+    Vector<> vg(nBlocks * 6);
+    vg = Zeros;
+    for(unsigned int i=0; i<vpEdges.size(); i++)
+    {
+      const Edge &e = *vpEdges[i];
+      Node &a = *vEdgeNodes[i].first;
+      Node &b = *vEdgeNodes[i].second;
+      Sophus::Vector6d r = (e.aTb.inverse() * a.se3Estimate.inverse() * b.se3Estimate).log();
+      Sophus::Matrix6d Ja = -(b.se3Estimate.inverse() * a.se3Estimate).Adj();
+
+      // Translations are less certain the further away the scene
+      double dSigma = *mgvdTranslationSigma * max(e.dSceneDepthMean, 0.1);
+      Sophus::Vector6d w;
+      w << 1.0/(dSigma*dSigma), 1.0/(dSigma*dSigma), 1.0/(dSigma*dSigma),
+           dRotationWeight, dRotationWeight, dRotationWeight;
+      Sophus::Matrix6d JaTW = Ja.transpose() * w.asDiagonal();
+
+      if(a.nBlock >= 0)
+      {
+        Sophus::Matrix6d H = JaTW * Ja;
+        Sophus::Vector6d g = JaTW * r;
+        Matrix<6> &m6 = *mSolver.DiagonalBlock(a.nBlock);
+        for(int j=0; j<6; j++)
+        {
+          vg[a.nBlock*6 + j] += g[j];
+          for(int k=0; k<6; k++)
+            m6[j][k] += H(j,k);
+        }
+      }
+      if(b.nBlock >= 0)
+      {
+        Matrix<6> &m6 = *mSolver.DiagonalBlock(b.nBlock);
+        for(int j=0; j<6; j++)
+        {
+          vg[b.nBlock*6 + j] += w[j] * r[j];
+          m6[j][j] += w[j];
+        }
+      }
+      if(a.nBlock >= 0 && b.nBlock >= 0)
+      {
+        bool bTransposed;
+        Matrix<6> &m6 = *mSolver.Block(a.nBlock, b.nBlock, bTransposed);
+        for(int j=0; j<6; j++)
+          for(int k=0; k<6; k++)
+            if(bTransposed)
+              m6[k][j] += JaTW(j,k);
+            else
+              m6[j][k] += JaTW(j,k);
+      }
+    }
+
+    // A touch of damping for keyframes not tied to the gauge
+    for(int n=0; n<nBlocks; n++)
+    {
+      Matrix<6> &m6 = *mSolver.DiagonalBlock(n);
+      for(int j=0; j<6; j++)
+        m6[j][j] += 1e-6;
+    }
+
+    if(!mSolver.Factorise())
+      break;
+    Vector<> vDelta = mSolver.Solve(-vg);
+
+    double dMaxDelta = 0.0;
+    for(NodeMap::iterator it = mNodes.begin(); it != mNodes.end(); it++)
+    {
+      Node &node = *it->second;
+      if(node.nBlock < 0)
+        continue;
+      Sophus::Vector6d d;
+      for(int j=0; j<6; j++)
+      {
+        d[j] = vDelta[node.nBlock*6 + j];
+        dMaxDelta = max(dMaxDelta, fabs(d[j]));
+      }
+      node.se3Estimate = node.se3Estimate * Sophus::SE3d::exp(d);
+    }
+    if(dMaxDelta < 1e-9)
+      break;
+  }
+
+  // Once any keyframe moved noticeably, every keyframe in the graph gets
+  // published, those which stayed put with their pose unchanged, and all of
+  // them take their new pose. So the owner can tell a keyframe the graph
+  // left alone from one it has never seen.
+  Corrections *pCorrections = new Corrections;
+  pCorrections->nEpoch = mnGraphEpoch;
+  bool bMoved = false;
+  for(NodeMap::iterator it = mNodes.begin(); it != mNodes.end(); it++)
+  {
+    Node &node = *it->second;
+    Sophus::Vector6d d = (node.se3WfromC.inverse() * node.se3Estimate).log();
+    if(d.lpNorm<Eigen::Infinity>() >= *mgvdMinCorrection)
+      bMoved = true;
+    Correction c;
+    c.nId = it->first;
+    c.se3OldCfromW = ToTooN(node.se3WfromC.inverse());
+    c.se3NewCfromW = ToTooN(node.se3Estimate.inverse());
+    pCorrections->vCorrections.push_back(c);
+  }
+  if(!bMoved)
+  {
+    delete pCorrections;
+    return;
+  }
+  for(NodeMap::iterator it = mNodes.begin(); it != mNodes.end(); it++)
+    it->second->se3WfromC = it->second->se3Estimate;
+  pCorrections->nGeneration = ++mnGeneration;
+  mpUnpublished = pCorrections;
+}
+
+bool PoseGraph::Publish()
+{
+  if(!mqCorrections.push(mpUnpublished))
+    return false;
+  mpUnpublished = NULL;
+  return true;
+}
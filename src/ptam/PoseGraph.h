@@ -0,0 +1,145 @@
+// -*- c++ -*-
+//
+// PoseGraph - a graph of keyframe poses and the relative pose edges
+// between them (KeyFrame::edges), optimised on a thread of its own.
+//
+// The MapMaker adds keyframes, with their current pose and outgoing
+// edges, whenever it has changed them. Neither side ever waits for the
+// other: additions are handed over through a lock-free single-producer/
+// single-consumer queue (and kept back for the next Flush() should it be
+// full), and the graph thread hands its results back the same way.
+//
+// Whenever edges have changed, the graph thread runs a sparse Gauss-Newton
+// over the SE3 poses, starting from the poses it was told about. The first
+// keyframe and those added as fixed hold the gauge. Once any keyframe moved
+// noticeably, the graph comes back as a batch of corrections (old and new
+// pose), one for every keyframe it holds, those it didn't move included.
+// Once published, the new poses become the graph's own, so batches have to be
+// applied in order; FetchCorrections() returns them that way. A keyframe
+// pose added before its owner had fetched the latest batch is stale, and
+// only used for keyframes the graph hasn't seen yet.
+
+#ifndef __POSEGRAPH_H
+#define __POSEGRAPH_H
+#include <TooN/TooN.h>
+#include <TooN/se3.h>
+#include <gvars3/gvars3.h>
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <sophus/se3.hpp>
+#include <vector>
+#include <map>
+#include <utility>
+
+#include "SparseBlockCholesky.h"
+
+namespace ptam{
+
+class KeyFrame;
+struct Edge;
+
+class PoseGraph
+{
+public:
+  // A keyframe in the graph, and how much it moved
+  struct Correction
+  {
+    int nId;
+    TooN::SE3<> se3OldCfromW;   // As the graph was told
+    TooN::SE3<> se3NewCfromW;   // Where the graph put it
+  };
+
+  struct Corrections
+  {
+    int nEpoch;                 // Reset() starts a new one
+    int nGeneration;            // Batches are numbered from 1
+    std::vector<Correction> vCorrections;   // Every keyframe in the graph
+  };
+
+  PoseGraph();
+  ~PoseGraph();
+
+  // All of these are for one thread, the graph's owner.
+  // Nothing added reaches the graph before Flush().
+  void AddKeyFrame(const KeyFrame &kf);
+  void Reset();                 // Forget everything added so far, and any corrections not fetched
+  void Flush();
+  bool FetchCorrections(Corrections &corrections);  // False if there is nothing new
+
+  // The graph thread's view, for tests and debugging: only meaningful
+  // once Flush()ed additions have been processed, see WaitUntilIdle()
+  bool GetPose(int nId, TooN::SE3<> &se3CfromW);
+  void WaitUntilIdle();
+
+  static Sophus::SE3d ToSophus(const TooN::SE3<> &se3);
+  static TooN::SE3<> ToTooN(const Sophus::SE3d &se3);
+
+protected:
+  struct NodeUpdate
+  {
+    int nId;
+    bool bFixed;
+    TooN::SE3<> se3CfromW;
+  };
+
+  // What Flush() hands over
+  struct Batch
+  {
+    Batch() : nEpoch(0), nGeneration(0) {}
+    int nEpoch;                 // A new one drops the graph before adding the rest
+    int nGeneration;            // Last batch of corrections the owner had fetched
+    std::vector<NodeUpdate> vNodes;
+    std::vector<boost::shared_ptr<Edge> > vpEdges;
+  };
+
+  struct Node
+  {
+    Sophus::SE3d se3WfromC;     // As the graph was told, or as it last published
+    Sophus::SE3d se3Estimate;   // While optimising
+    bool bFixed;
+    int nBlock;                 // In the solver, -1 if not optimised
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+  typedef std::map<int, boost::shared_ptr<Node> > NodeMap;
+  typedef std::map<std::pair<int, int>, boost::shared_ptr<Edge> > EdgeMap;
+
+  void Run();                   // The graph thread
+  bool Absorb(const Batch &batch);  // True if edges changed
+  void Optimise();
+  bool Publish();               // False if the queue was full; try again later
+
+  // Shared between the two sides
+  boost::lockfree::spsc_queue<Batch*, boost::lockfree::capacity<64> > mqBatches;
+  boost::lockfree::spsc_queue<Corrections*, boost::lockfree::capacity<16> > mqCorrections;
+  boost::thread mThread;
+  boost::mutex mGraphMutex;     // Only for GetPose() and WaitUntilIdle() against the graph thread
+  boost::condition_variable mProcessedCond;
+  unsigned int mnProcessed;     // Batches taken in by the graph thread
+
+  // Owner side
+  Batch *mpFilling;             // Not yet handed over
+  std::vector<Batch*> mvpHeldBack;  // Handed over, but the queue was full
+  unsigned int mnFlushed;
+  int mnEpoch;
+  int mnFetchedGeneration;
+
+  // Graph thread
+  NodeMap mNodes;
+  EdgeMap mEdges;
+  int mnGraphEpoch;
+  bool mbDirty;                 // Edges changed since the last optimisation
+  int mnGeneration;             // Of the last published batch
+  Corrections *mpUnpublished;
+
+  SparseBlockCholesky mSolver;
+
+  GVars3::gvar3<int> mgvnMaxIterations;
+  GVars3::gvar3<double> mgvdTranslationSigma;   // Per metre of scene depth
+  GVars3::gvar3<double> mgvdRotationSigma;      // Radians
+  GVars3::gvar3<double> mgvdMinCorrection;      // Metres, or radians
+};
+
+} // namespace
+
+#endif
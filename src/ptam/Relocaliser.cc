@@ -44,7 +44,7 @@ bool Relocaliser::AttemptRecovery(KeyFrame &kCurrent)
 
       SE3<> se3KeyFramePos = mMap.vpKeyFrames[mnBest]->se3CfromW;
       // SE3fromSE2 will set the corret image size for the camera, so no need to call CameraModel::SetImageSize()
-      mse3Best = SmallBlurryImage::SE3fromSE2(mse2, mCamera.get()) * se3KeyFramePos;
+      mse3Best = kCurrent.SBI.SE3fromSE2(mse2, mCamera.get()) * se3KeyFramePos;
   }else
   {
       pair<SE2<>, double> result_pair = kCurrent.SBI.IteratePosRelToTarget(mMap.vpKeyFramessec[kCurrent.nSourceCamera - 1][mnBest2]->SBI, 6);
@@ -54,7 +54,7 @@ bool Relocaliser::AttemptRecovery(KeyFrame &kCurrent)
 
       SE3<> se3KeyFramePos = mMap.vpKeyFramessec[kCurrent.nSourceCamera - 1][mnBest2]->se3CfromW;
       // SE3fromSE2 will set the corret image size for the camera, so no need to call CameraModel::SetImageSize()
-      mse3Best = SmallBlurryImage::SE3fromSE2(mse2sec, mCameraSec[kCurrent.nSourceCamera - 1].get()) * se3KeyFramePos;
+      mse3Best = kCurrent.SBI.SE3fromSE2(mse2sec, mCameraSec[kCurrent.nSourceCamera - 1].get()) * se3KeyFramePos;
   }
   if(dScore < GV2.GetDouble("Reloc2.MaxScore", 9e6, SILENT))
     return true;
@@ -94,12 +94,12 @@ bool Relocaliser::AttemptRecoveryDual(KeyFrame &kCurrent, KeyFrame &kCurrentsec)
   if (dScore1 < dScore2){
       SE3<> se3KeyFramePos = mMap.vpKeyFrames[mnBest]->se3CfromW;
       // SE3fromSE2 will set the corret image size for the camera, so no need to call CameraModel::SetImageSize()
-      mse3Best = SmallBlurryImage::SE3fromSE2(mse2, mCamera.get()) * se3KeyFramePos;
+      mse3Best = kCurrent.SBI.SE3fromSE2(mse2, mCamera.get()) * se3KeyFramePos;
   }else
   {
       SE3<> se3KeyFramePos = mMap.vpKeyFramessec[kCurrentsec.nSourceCamera - 1][mnBest2]->se3CfromW;
       // SE3fromSE2 will set the corret image size for the camera, so no need to call CameraModel::SetImageSize()
-      mse3Best = SmallBlurryImage::SE3fromSE2(mse2sec, mCameraSec[kCurrentsec.nSourceCamera - 1].get()) * se3KeyFramePos;
+      mse3Best = kCurrentsec.SBI.SE3fromSE2(mse2sec, mCameraSec[kCurrentsec.nSourceCamera - 1].get()) * se3KeyFramePos;
   }
 
   return true;
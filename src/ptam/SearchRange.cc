@@ -0,0 +1,42 @@
+#include "SearchRange.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace TooN;
+
+namespace ptam{
+
+namespace SearchRange{
+
+Matrix<6> PredictPoseCovariance(const Matrix<6> &m6Covariance, const Vector<6> &v6Velocity,
+                                double dNoiseTrans, double dNoiseRot, double dNoiseVelocity)
+{
+  Vector<3> v3Trans = v6Velocity.slice<0,3>();
+  Vector<3> v3Rot = v6Velocity.slice<3,3>();
+  double dTrans = dNoiseTrans + dNoiseVelocity * sqrt(v3Trans * v3Trans);
+  double dRot = dNoiseRot + dNoiseVelocity * sqrt(v3Rot * v3Rot);
+  Matrix<6> m6Predicted = m6Covariance;
+  for (int i = 0; i < 3; i++)
+  {
+    m6Predicted(i, i) += dTrans * dTrans;
+    m6Predicted(i + 3, i + 3) += dRot * dRot;
+  }
+  return m6Predicted;
+}
+
+int Radius(const Matrix<2,6> &m26Jacobian, const Matrix<6> &m6Covariance, double dSigmas, int nMinRange)
+{
+  Matrix<2,6> m26JC = m26Jacobian * m6Covariance;
+  double dXX = m26JC[0] * m26Jacobian[0];
+  double dXY = m26JC[0] * m26Jacobian[1];
+  double dYY = m26JC[1] * m26Jacobian[1];
+  // The larger eigenvalue of the symmetric 2x2 [dXX dXY; dXY dYY]
+  double dHalfDiff = 0.5 * (dXX - dYY);
+  double dMaxVariance = 0.5 * (dXX + dYY) + sqrt(dHalfDiff * dHalfDiff + dXY * dXY);
+  return std::max((int) ceil(dSigmas * sqrt(std::max(dMaxVariance, 0.0))), nMinRange);
+}
+
+}
+
+}
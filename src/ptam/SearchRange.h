@@ -0,0 +1,36 @@
+// -*- c++ -*-
+//
+// SearchRange - how far the tracker searches the image for a map point,
+// from how uncertain the pose it projects the point with is.
+//
+// The motion model's pose is uncertain by the last pose's covariance, plus
+// a fixed amount of noise per frame, plus a share of the camera's velocity,
+// since fast motion is the least predictable. Pushed through a point's
+// projection Jacobian J, a pose covariance C gives the point's image
+// covariance J C J^T; the search radius is a number of standard deviations
+// along its most uncertain axis.
+
+#ifndef __SEARCHRANGE_H
+#define __SEARCHRANGE_H
+#include <TooN/TooN.h>
+
+namespace ptam{
+
+namespace SearchRange{
+
+// The covariance of a pose predicted from one with m6Covariance, moving at
+// v6Velocity (translation first, then rotation, per frame). The noise of the
+// translation and the rotation is dNoiseTrans and dNoiseRot per frame, plus
+// dNoiseVelocity times the length of that part of the velocity.
+TooN::Matrix<6> PredictPoseCovariance(const TooN::Matrix<6> &m6Covariance, const TooN::Vector<6> &v6Velocity,
+                                      double dNoiseTrans, double dNoiseRot, double dNoiseVelocity);
+
+// dSigmas standard deviations of J C J^T along its largest eigenvector,
+// rounded up, and at least nMinRange. m26Jacobian is in level zero pixels.
+int Radius(const TooN::Matrix<2,6> &m26Jacobian, const TooN::Matrix<6> &m6Covariance, double dSigmas, int nMinRange);
+
+}
+
+}
+
+#endif
@@ -1,6 +1,9 @@
 // Copyright 2008 Isis Innovation Limited
 #include "ShiTomasi.h"
 #include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace CVD;
 
@@ -35,3 +38,90 @@ double ptam::FindShiTomasiScoreAtPoint(BasicImage<byte> &image,
   return 0.5 * (dXX + dYY - sqrt( (dXX + dYY) * (dXX + dYY) - 4 * (dXX * dYY - dXY * dXY) ));
 };
 
+
+namespace {
+// Smaller eigenvalue from the gradient sums over nPixels pixels
+inline double MinEigenvalue(double dXX, double dYY, double dXY, int nPixels)
+{
+  dXX = dXX / (2.0 * nPixels);
+  dYY = dYY / (2.0 * nPixels);
+  dXY = dXY / (2.0 * nPixels);
+  return 0.5 * (dXX + dYY - sqrt( (dXX + dYY) * (dXX + dYY) - 4 * (dXX * dYY - dXY * dXY) ));
+}
+}
+
+void ptam::FindShiTomasiScores(const BasicImage<byte> &image,
+			       int nHalfBoxSize,
+			       const std::vector<ImageRef> &virCenters,
+			       std::vector<double> &vdScores)
+{
+  const int nBox = 2 * nHalfBoxSize + 1;
+  const int nPixels = nBox * nBox;
+  const ImageRef irSize = image.size();
+  vdScores.resize(virCenters.size());
+
+#ifdef __SSE2__
+  // The eight pixel wide rows read from x-h-1 to x-h+8; lanes past the box are masked off
+  const __m128i vZero = _mm_setzero_si128();
+  __m128i vMask = _mm_setzero_si128();
+  if(nBox <= 8)
+  {
+    short anMask[8];
+    for(int i=0; i<8; i++)
+      anMask[i] = i < nBox ? -1 : 0;
+    vMask = _mm_loadu_si128((const __m128i*) anMask);
+  }
+#endif
+
+  for(unsigned int n=0; n<virCenters.size(); n++)
+  {
+    const ImageRef ir = virCenters[n];
+    int nXX = 0, nYY = 0, nXY = 0;
+#ifdef __SSE2__
+    if(nBox <= 8 &&
+       ir.x - nHalfBoxSize - 1 >= 0 && ir.x - nHalfBoxSize + 8 < irSize.x &&
+       ir.y - nHalfBoxSize - 1 >= 0 && ir.y + nHalfBoxSize + 1 < irSize.y)
+    {
+      __m128i vXX = vZero, vYY = vZero, vXY = vZero;
+      for(int y = ir.y - nHalfBoxSize; y <= ir.y + nHalfBoxSize; y++)
+      {
+        const byte *pRow = &image[y][ir.x - nHalfBoxSize];
+        __m128i vLeft = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (pRow - 1)), vZero);
+        __m128i vRight = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (pRow + 1)), vZero);
+        __m128i vUp = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (pRow - image.row_stride())), vZero);
+        __m128i vDown = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*) (pRow + image.row_stride())), vZero);
+        __m128i vDx = _mm_and_si128(_mm_sub_epi16(vRight, vLeft), vMask);
+        __m128i vDy = _mm_and_si128(_mm_sub_epi16(vDown, vUp), vMask);
+        vXX = _mm_add_epi32(vXX, _mm_madd_epi16(vDx, vDx));
+        vYY = _mm_add_epi32(vYY, _mm_madd_epi16(vDy, vDy));
+        vXY = _mm_add_epi32(vXY, _mm_madd_epi16(vDx, vDy));
+      }
+      int anSums[12];
+      _mm_storeu_si128((__m128i*) &anSums[0], vXX);
+      _mm_storeu_si128((__m128i*) &anSums[4], vYY);
+      _mm_storeu_si128((__m128i*) &anSums[8], vXY);
+      nXX = anSums[0] + anSums[1] + anSums[2] + anSums[3];
+      nYY = anSums[4] + anSums[5] + anSums[6] + anSums[7];
+      nXY = anSums[8] + anSums[9] + anSums[10] + anSums[11];
+    }
+    else
+#endif
+    {
+      for(int y = ir.y - nHalfBoxSize; y <= ir.y + nHalfBoxSize; y++)
+      {
+        const byte *pRow = image[y];
+        const byte *pAbove = image[y-1];
+        const byte *pBelow = image[y+1];
+        for(int x = ir.x - nHalfBoxSize; x <= ir.x + nHalfBoxSize; x++)
+        {
+          int dx = pRow[x+1] - pRow[x-1];
+          int dy = pBelow[x] - pAbove[x];
+          nXX += dx*dx;
+          nYY += dy*dy;
+          nXY += dx*dy;
+        }
+      }
+    }
+    vdScores[n] = MinEigenvalue(nXX, nYY, nXY, nPixels);
+  }
+}
@@ -6,6 +6,9 @@
 #include <TooN/se2.h>
 #include <TooN/Cholesky.h>
 #include <TooN/wls.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "KeyFrame.h"
 #include "CameraModel.h"
@@ -15,8 +18,6 @@ using namespace std;
 using namespace TooN;
 using namespace ptam;
 
-ImageRef SmallBlurryImage::mirSize(-1,-1);
-
 SmallBlurryImage::SmallBlurryImage(KeyFrame &kf, double dBlur)
 {
   mbMadeJacs = false;
@@ -34,11 +35,7 @@ SmallBlurryImage::SmallBlurryImage()
 // of the above)
 void SmallBlurryImage::MakeFromKF(KeyFrame &kf, double dBlur)
 {
-  static int makeSBInum = 0;// ignore mirsize from ref image loading.
-  if(mirSize[0] == -1 || makeSBInum <= 1){
-    mirSize = kf.aLevels[3].im.size() / 2;
-    makeSBInum ++;
-  }
+  mirSize = kf.aLevels[3].im.size() / 2;
   mbMadeJacs = false;
   
   mimSmall.resize(mirSize);
@@ -66,22 +63,27 @@ void SmallBlurryImage::MakeFromKF(KeyFrame &kf, double dBlur)
 // of the blurred template
 void SmallBlurryImage::MakeJacs()
 {
-  mimImageJacs.resize(mirSize);
-  // Fill in the gradient image
-  ImageRef ir;
-  do
+  if(mbMadeJacs)
+    return;
+  mimJacX.resize(mirSize);
+  mimJacY.resize(mirSize);
+  mimJacX.fill(0.0f);
+  mimJacY.fill(0.0f);
+  // Fill in the gradient image; the border stays zero
+  for(int y=1; y<mirSize.y-1; y++)
     {
-      Vector<2> &v2Grad = mimImageJacs[ir];
-      if(mimTemplate.in_image_with_border(ir,1))
+      const float *pRow = mimTemplate[y];
+      const float *pUp = mimTemplate[y-1];
+      const float *pDown = mimTemplate[y+1];
+      float *pX = mimJacX[y];
+      float *pY = mimJacY[y];
+      for(int x=1; x<mirSize.x-1; x++)
 	{
-	  v2Grad[0] = mimTemplate[ir + ImageRef(1,0)] - mimTemplate[ir - ImageRef(1,0)];
-	  v2Grad[1] = mimTemplate[ir + ImageRef(0,1)] - mimTemplate[ir - ImageRef(0,1)];
+	  pX[x] = pRow[x+1] - pRow[x-1];
+	  pY[x] = pDown[x] - pUp[x];
 	  // N.b. missing 0.5 factor in above, this will be added later.
 	}
-      else
-	v2Grad = Zeros;
     }
-  while(ir.next(mirSize));
   mbMadeJacs = true;
 };
 
@@ -101,6 +103,155 @@ double SmallBlurryImage::ZMSSD(SmallBlurryImage &other)
 }
 
 
+namespace {
+
+const float fOutside = -9e20f;   // Warped pixels which fall outside the image
+
+// Warps one row, as CVD::transform() does: bilinear, and fOutside where
+// the source isn't entirely inside the image.
+void WarpRow(const BasicImage<float> &im, Vector<2> v2Pos, const Vector<2> &v2Across, float *pOut)
+{
+  const int nWidth = im.size().x;
+  const double dMaxX = nWidth - 1;
+  const double dMaxY = im.size().y - 1;
+  const int nStride = im.row_stride();
+  // A row is a line: if both ends are inside, all of it is
+  const Vector<2> v2End = v2Pos + (nWidth - 1) * v2Across;
+  const bool bInside = 0 <= v2Pos[0] && 0 <= v2Pos[1] && v2Pos[0] < dMaxX && v2Pos[1] < dMaxY &&
+    0 <= v2End[0] && 0 <= v2End[1] && v2End[0] < dMaxX && v2End[1] < dMaxY;
+  double dX = v2Pos[0];
+  double dY = v2Pos[1];
+  for(int x=0; x<nWidth; x++, dX += v2Across[0], dY += v2Across[1])
+    {
+      if(!bInside && !(0 <= dX && 0 <= dY && dX < dMaxX && dY < dMaxY))
+	{
+	  pOut[x] = fOutside;
+	  continue;
+	}
+      const int lx = (int) dX;
+      const int ly = (int) dY;
+      const float *p = im[ly] + lx;
+      const float e = p[0] - p[1];
+      const double fx = dX - lx;
+      const double fy = dY - ly;
+      pOut[x] = (float) (fx*(fy*(e - p[nStride] + p[nStride+1]) - e) + fy*(p[nStride] - p[0]) + p[0]);
+    }
+}
+
+// What one ESM iteration sums over the image: J^T e, the lower-left
+// triangle of J^T J (row by row) and the squared error. The jacobian of
+// a pixel is (gx, gy, rotation, 1).
+struct ESMSums
+{
+  double adJTe[4];
+  double adJTJ[10];
+  double dScore;
+};
+
+inline void AddPixel(ESMSums &sums, double j0, double j1, double j2, double dDiff)
+{
+  sums.dScore += dDiff * dDiff;
+  sums.adJTe[0] += dDiff * j0;
+  sums.adJTe[1] += dDiff * j1;
+  sums.adJTe[2] += dDiff * j2;
+  sums.adJTe[3] += dDiff;
+  double *p = sums.adJTJ;
+  *p++ += j0 * j0;
+  *p++ += j1 * j0;
+  *p++ += j1 * j1;
+  *p++ += j2 * j0;
+  *p++ += j2 * j1;
+  *p++ += j2 * j2;
+  *p++ += j0;
+  *p++ += j1;
+  *p++ += j2;
+  *p++ += 1.0;
+}
+
+#ifdef __SSE2__
+inline double HorizontalSum(__m128 v)
+{
+  float af[4];
+  _mm_storeu_ps(af, v);
+  return (double) af[0] + af[1] + af[2] + af[3];
+}
+#endif
+
+// Sums one row y of the warped template, given rows y-1, y and y+1,
+// against the target's row y. Pixels next to a warped pixel outside the
+// image are left out, as are the first and last of the row.
+void AddRow(ESMSums &sums, const float *pUp, const float *pHere, const float *pDown,
+	    const float *pTarget, const float *pTargetJacX, const float *pTargetJacY,
+	    int nWidth, double dY, double dCenterX, double dMeanOffset)
+{
+  // The 0.25 is from missing 0.5 factors: One for the fact we average two
+  // gradients, the other from each gradient missing a 0.5 factor.
+  int x = 1;
+#ifdef __SSE2__
+  {
+    const __m128 vQuarter = _mm_set1_ps(0.25f);
+    const __m128 vLimit = _mm_set1_ps(-9999.9f);
+    const __m128 vOne = _mm_set1_ps(1.0f);
+    const __m128 vY = _mm_set1_ps((float) dY);
+    const __m128 vOffset = _mm_set1_ps((float) dMeanOffset);
+    const __m128 vStep = _mm_set1_ps(4.0f);
+    __m128 vX = _mm_setr_ps((float) (1 - dCenterX), (float) (2 - dCenterX), (float) (3 - dCenterX), (float) (4 - dCenterX));
+    __m128 avSums[15];
+    for(int i=0; i<15; i++)
+      avSums[i] = _mm_setzero_ps();
+    for(; x + 4 <= nWidth - 1; x += 4, vX = _mm_add_ps(vX, vStep))
+      {
+	const __m128 vL = _mm_loadu_ps(pHere + x - 1);
+	const __m128 vR = _mm_loadu_ps(pHere + x + 1);
+	const __m128 vU = _mm_loadu_ps(pUp + x);
+	const __m128 vD = _mm_loadu_ps(pDown + x);
+	const __m128 vC = _mm_loadu_ps(pHere + x);
+	const __m128 vMask = _mm_cmpge_ps(_mm_add_ps(_mm_add_ps(_mm_add_ps(vL, vR), _mm_add_ps(vU, vD)), vC), vLimit);
+
+	const __m128 vJ0 = _mm_and_ps(vMask, _mm_mul_ps(vQuarter, _mm_add_ps(_mm_sub_ps(vR, vL), _mm_loadu_ps(pTargetJacX + x))));
+	const __m128 vJ1 = _mm_and_ps(vMask, _mm_mul_ps(vQuarter, _mm_add_ps(_mm_sub_ps(vD, vU), _mm_loadu_ps(pTargetJacY + x))));
+	const __m128 vJ2 = _mm_sub_ps(_mm_mul_ps(vX, vJ1), _mm_mul_ps(vY, vJ0));
+	const __m128 vJ3 = _mm_and_ps(vMask, vOne);
+	const __m128 vDiff = _mm_and_ps(vMask, _mm_add_ps(_mm_sub_ps(vC, _mm_loadu_ps(pTarget + x)), vOffset));
+
+	avSums[0] = _mm_add_ps(avSums[0], _mm_mul_ps(vDiff, vJ0));
+	avSums[1] = _mm_add_ps(avSums[1], _mm_mul_ps(vDiff, vJ1));
+	avSums[2] = _mm_add_ps(avSums[2], _mm_mul_ps(vDiff, vJ2));
+	avSums[3] = _mm_add_ps(avSums[3], vDiff);
+	avSums[4] = _mm_add_ps(avSums[4], _mm_mul_ps(vJ0, vJ0));
+	avSums[5] = _mm_add_ps(avSums[5], _mm_mul_ps(vJ1, vJ0));
+	avSums[6] = _mm_add_ps(avSums[6], _mm_mul_ps(vJ1, vJ1));
+	avSums[7] = _mm_add_ps(avSums[7], _mm_mul_ps(vJ2, vJ0));
+	avSums[8] = _mm_add_ps(avSums[8], _mm_mul_ps(vJ2, vJ1));
+	avSums[9] = _mm_add_ps(avSums[9], _mm_mul_ps(vJ2, vJ2));
+	avSums[10] = _mm_add_ps(avSums[10], vJ0);
+	avSums[11] = _mm_add_ps(avSums[11], vJ1);
+	avSums[12] = _mm_add_ps(avSums[12], vJ2);
+	avSums[13] = _mm_add_ps(avSums[13], vJ3);
+	avSums[14] = _mm_add_ps(avSums[14], _mm_mul_ps(vDiff, vDiff));
+      }
+    // Lanes add up a row at most in floats, rows add up in doubles
+    for(int i=0; i<4; i++)
+      sums.adJTe[i] += HorizontalSum(avSums[i]);
+    for(int i=0; i<10; i++)
+      sums.adJTJ[i] += HorizontalSum(avSums[4 + i]);
+    sums.dScore += HorizontalSum(avSums[14]);
+  }
+#endif
+  for(; x < nWidth - 1; x++)
+    {
+      const float l = pHere[x-1], r = pHere[x+1], u = pUp[x], d = pDown[x], here = pHere[x];
+      if(l + r + u + d + here < -9999.9)   // This means it's out of the image; c.f. fOutside.
+	continue;
+      const double j0 = 0.25 * ((r - l) + pTargetJacX[x]);
+      const double j1 = 0.25 * ((d - u) + pTargetJacY[x]);
+      const double j2 = -dY * j0 + (x - dCenterX) * j1;
+      AddPixel(sums, j0, j1, j2, here - pTarget[x] + dMeanOffset);
+    }
+}
+
+} // namespace
+
 // Find an SE2 which best aligns an SBI to a target
 // Do this by ESM-tracking a la Benhimane & Malis
 pair<SE2<>,double> SmallBlurryImage::IteratePosRelToTarget(SmallBlurryImage &other, int nIterations)
@@ -117,75 +268,31 @@ pair<SE2<>,double> SmallBlurryImage::IteratePosRelToTarget(SmallBlurryImage &oth
       assert(other.mbMadeJacs);
     };
   
+  const int nWidth = mirSize.x;
+  const int nHeight = mirSize.y;
+  mvfWarped.resize(3 * nWidth);
   double dMeanOffset = 0.0;
-  Vector<4> v4Accum;
-  
-  Vector<10> v10Triangle;
-  Image<float> imWarped(mirSize);
-
   double dFinalScore = 0.0;
   for(int it = 0; it<nIterations; it++)
     {
-      dFinalScore = 0.0;
-      v4Accum = Zeros;
-      v10Triangle = Zeros; // Holds the bottom-left triangle of JTJ
-      Vector<4> v4Jac;
-      v4Jac[3] = 1.0;
-      
       SE2<> se2XForm = se2WfromC * se2CtoC * se2WfromC.inverse();
-      
-      // Make the warped current image template:
-      Vector<2> v2Zero = Zeros;
-      CVD::transform(mimTemplate, imWarped, se2XForm.get_rotation().get_matrix(), se2XForm.get_translation(), v2Zero, -9e20f);
+      const Matrix<2> m2Rot = se2XForm.get_rotation().get_matrix();
+      const Vector<2> v2Across = m2Rot.T()[0];
+      const Vector<2> v2Down = m2Rot.T()[1];
+      const Vector<2> v2Origin = se2XForm.get_translation();
 
-      // Now compare images, calc differences, and current image jacobian:
-      ImageRef ir;
-      do
+      ESMSums sums = {};
+      // Row y of the warped template lives in row y % 3 of the scratch buffer
+      WarpRow(mimTemplate, v2Origin, v2Across, &mvfWarped[0]);
+      WarpRow(mimTemplate, v2Origin + v2Down, v2Across, &mvfWarped[nWidth]);
+      for(int y=1; y<nHeight-1; y++)
 	{
-	  if(!imWarped.in_image_with_border(ir,1))
-	    continue;
-	  float l,r,u,d,here;
-	  l = imWarped[ir - ImageRef(1,0)];
-	  r = imWarped[ir + ImageRef(1,0)];
-	  u = imWarped[ir - ImageRef(0,1)];
-	  d = imWarped[ir + ImageRef(0,1)];
-	  here = imWarped[ir];
-	  if(l + r + u + d + here < -9999.9)   // This means it's out of the image; c.f. the -9e20f param to transform.
-	    continue;
-
-	  Vector<2> v2CurrentGrad;
-	  v2CurrentGrad[0] = r - l; // Missing 0.5 factor
-	  v2CurrentGrad[1] = d - u;
-	
-	  Vector<2> v2SumGrad = 0.25 * (v2CurrentGrad  + other.mimImageJacs[ir]); 
-	  // Why 0.25? This is from missing 0.5 factors: One for 
-	  // the fact we average two gradients, the other from 
-	  // each gradient missing a 0.5 factor.
-
-	  v4Jac[0] = v2SumGrad[0];
-	  v4Jac[1] = v2SumGrad[1];
-	  v4Jac[2] = -(ir.y - irCenter.y) * v2SumGrad[0] + (ir.x - irCenter.x) * v2SumGrad[1];
-	  //	  v4Jac[3] = 1.0;
-	  
-	  double dDiff = imWarped[ir] - other.mimTemplate[ir] + dMeanOffset;
-	  dFinalScore += dDiff * dDiff;
-	  
-	  v4Accum += dDiff * v4Jac;
-	  
-	  // Speedy fill of the LL triangle of JTJ:
-	  double *p = &v10Triangle[0];
-	  *p++ += v4Jac[0] * v4Jac[0];
-	  *p++ += v4Jac[1] * v4Jac[0];
-	  *p++ += v4Jac[1] * v4Jac[1];
-	  *p++ += v4Jac[2] * v4Jac[0];
-	  *p++ += v4Jac[2] * v4Jac[1];
-	  *p++ += v4Jac[2] * v4Jac[2];
-	  *p++ += v4Jac[0];
-	  *p++ += v4Jac[1];
-	  *p++ += v4Jac[2];
-	  *p++ += 1.0;
+	  WarpRow(mimTemplate, v2Origin + (y + 1) * v2Down, v2Across, &mvfWarped[((y + 1) % 3) * nWidth]);
+	  AddRow(sums, &mvfWarped[((y - 1) % 3) * nWidth], &mvfWarped[(y % 3) * nWidth], &mvfWarped[((y + 1) % 3) * nWidth],
+		 other.mimTemplate[y], other.mimJacX[y], other.mimJacY[y],
+		 nWidth, y - irCenter.y, irCenter.x, dMeanOffset);
 	}
-      while(ir.next(mirSize));
+      dFinalScore = sums.dScore;
       
       Vector<4> v4Update;
       
@@ -195,9 +302,9 @@ pair<SE2<>,double> SmallBlurryImage::IteratePosRelToTarget(SmallBlurryImage &oth
 	int v=0;
 	for(int j=0; j<4; j++)
 	  for(int i=0; i<=j; i++)
-	    m4[j][i] = m4[i][j] = v10Triangle[v++];
+	    m4[j][i] = m4[i][j] = sums.adJTJ[v++];
 	Cholesky<4> chol(m4);
-	v4Update = chol.backsub(v4Accum);
+	v4Update = chol.backsub(makeVector(sums.adJTe[0], sums.adJTe[1], sums.adJTe[2], sums.adJTe[3]));
       }
       
       SE2<> se2Update;
@@ -215,7 +322,7 @@ pair<SE2<>,double> SmallBlurryImage::IteratePosRelToTarget(SmallBlurryImage &oth
 
 // What is the 3D camera rotation (zero trans) SE3<> which causes an
 // input image SO2 rotation?
-SE3<> SmallBlurryImage::SE3fromSE2(SE2<> se2, CameraModel* camera) 
+SE3<> SmallBlurryImage::SE3fromSE2(SE2<> se2, CameraModel* camera) const
 {
   // Do this by projecting two points, and then iterating the SE3<> (SO3
   // actually) until convergence. It might seem stupid doing this so
@@ -3,6 +3,13 @@
 //
 // SmallBlurryImage - A small and blurry representation of an image.
 // used by the relocaliser.
+//
+// The tracker also aligns the SBIs of consecutive frames of every camera,
+// each frame. So IteratePosRelToTarget() does all of an ESM iteration in
+// one pass over the image: it warps three rows at a time into a scratch
+// buffer and takes gradients, residuals and the normal equations from
+// there, four pixels at a time with SSE2. The buffers are kept from one
+// call to the next; MakeFromKF() into an old SBI reuses its images.
 
 #ifndef __SMALLBLURRYIMAGE_H
 #define __SMALLBLURRYIMAGE_H
@@ -11,6 +18,7 @@
 #include <TooN/se2.h>
 #include <TooN/se3.h>
 #include <memory>
+#include <vector>
 
 namespace ptam{
 class KeyFrame;
@@ -22,17 +30,19 @@ class SmallBlurryImage
   SmallBlurryImage();
   SmallBlurryImage(KeyFrame &kf, double dBlur = 2.5);
   void MakeFromKF(KeyFrame &kf, double dBlur = 2.5);
-  void MakeJacs();
+  void MakeJacs();   // Gradients of the template, for SBIs used as a target. Only made once.
   double ZMSSD(SmallBlurryImage &other);
   std::pair<TooN::SE2<>,double> IteratePosRelToTarget(SmallBlurryImage &other, int nIterations = 10);
-  static TooN::SE3<> SE3fromSE2(TooN::SE2<> se2, CameraModel* camera);
+  TooN::SE3<> SE3fromSE2(TooN::SE2<> se2, CameraModel* camera) const;   // For an se2 found at this image's size
   
 protected:
   CVD::Image<CVD::byte> mimSmall;
   CVD::Image<float> mimTemplate;
-  CVD::Image<TooN::Vector<2> > mimImageJacs;
+  CVD::Image<float> mimJacX;      // The gradients, x and y apart
+  CVD::Image<float> mimJacY;
   bool mbMadeJacs;
-  static CVD::ImageRef mirSize;
+  std::vector<float> mvfWarped;   // Three rows of the warped template, for IteratePosRelToTarget()
+  CVD::ImageRef mirSize;          // Half that of the keyframe's coarsest level
 };
 } // namespace
 
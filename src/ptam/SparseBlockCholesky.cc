@@ -0,0 +1,252 @@
+#include "SparseBlockCholesky.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <set>
+
+using namespace TooN;
+using namespace std;
+using namespace ptam;
+
+namespace {
+// m = L L^T, with L overwriting the lower triangle and the rest zeroed.
+bool CholeskyInPlace(Matrix<6> &m)
+{
+  for(int c=0; c<6; c++)
+  {
+    double d = m[c][c];
+    for(int k=0; k<c; k++)
+      d -= m[c][k] * m[c][k];
+    if(!(d > 0.0))
+      return false;
+    d = sqrt(d);
+    m[c][c] = d;
+    for(int r=c+1; r<6; r++)
+    {
+      double v = m[r][c];
+      for(int k=0; k<c; k++)
+        v -= m[r][k] * m[c][k];
+      m[r][c] = v / d;
+    }
+    for(int r=0; r<c; r++)
+      m[r][c] = 0.0;
+  }
+  return true;
+}
+
+// m = m L^-T, for lower triangular L
+void RightSolveTransposed(const Matrix<6> &L, Matrix<6> &m)
+{
+  for(int r=0; r<6; r++)
+    for(int c=0; c<6; c++)
+    {
+      double v = m[r][c];
+      for(int k=0; k<c; k++)
+        v -= m[r][k] * L[c][k];
+      m[r][c] = v / L[c][c];
+    }
+}
+
+// m -= a b^T
+void SubtractOuter(Matrix<6> &m, const Matrix<6> &a, const Matrix<6> &b)
+{
+  for(int r=0; r<6; r++)
+    for(int c=0; c<6; c++)
+    {
+      double v = 0.0;
+      for(int k=0; k<6; k++)
+        v += a[r][k] * b[c][k];
+      m[r][c] -= v;
+    }
+}
+}
+
+void SparseBlockCholesky::Analyse(int nBlocks, const vector<pair<int, int> > &vOffDiagonal)
+{
+  // Minimum degree ordering on the block graph. The neighbours a block
+  // has when it is eliminated are exactly the rows of its factor column.
+  vector<set<int> > vAdjacent(nBlocks);
+  for(unsigned int i=0; i<vOffDiagonal.size(); i++)
+  {
+    int j = vOffDiagonal[i].first;
+    int k = vOffDiagonal[i].second;
+    assert(j >= 0 && j < nBlocks && k >= 0 && k < nBlocks);
+    if(j == k)
+      continue;
+    vAdjacent[j].insert(k);
+    vAdjacent[k].insert(j);
+  }
+
+  mvnOrder.resize(nBlocks);
+  mvnPosition.assign(nBlocks, -1);
+  vector<vector<int> > vColumnRows(nBlocks);
+  for(int nPos=0; nPos<nBlocks; nPos++)
+  {
+    int nBest = -1;
+    for(int b=0; b<nBlocks; b++)
+      if(mvnPosition[b] < 0 && (nBest < 0 || vAdjacent[b].size() < vAdjacent[nBest].size()))
+        nBest = b;
+
+    mvnOrder[nPos] = nBest;
+    mvnPosition[nBest] = nPos;
+    vColumnRows[nPos].assign(vAdjacent[nBest].begin(), vAdjacent[nBest].end());
+
+    // Eliminating nBest joins all its neighbours up
+    const vector<int> &vNeighbours = vColumnRows[nPos];
+    for(unsigned int a=0; a<vNeighbours.size(); a++)
+    {
+      set<int> &s = vAdjacent[vNeighbours[a]];
+      s.erase(nBest);
+      for(unsigned int b=0; b<vNeighbours.size(); b++)
+        if(b != a)
+          s.insert(vNeighbours[b]);
+    }
+    vAdjacent[nBest].clear();
+  }
+
+  mvColumns.clear();
+  mvColumns.resize(nBlocks);
+  for(int nPos=0; nPos<nBlocks; nPos++)
+  {
+    Column &col = mvColumns[nPos];
+    for(unsigned int i=0; i<vColumnRows[nPos].size(); i++)
+      col.vnRows.push_back(mvnPosition[vColumnRows[nPos][i]]);
+    sort(col.vnRows.begin(), col.vnRows.end());
+    col.vm6Blocks.resize(col.vnRows.size());
+  }
+  Clear();
+}
+
+int SparseBlockCholesky::NumBlocks() const
+{
+  int n = mvColumns.size();
+  for(unsigned int i=0; i<mvColumns.size(); i++)
+    n += mvColumns[i].vnRows.size();
+  return n;
+}
+
+void SparseBlockCholesky::Clear()
+{
+  for(unsigned int i=0; i<mvColumns.size(); i++)
+  {
+    Column &col = mvColumns[i];
+    col.m6Diag = Zeros;
+    for(unsigned int n=0; n<col.vm6Blocks.size(); n++)
+      col.vm6Blocks[n] = Zeros;
+  }
+}
+
+Matrix<6> *SparseBlockCholesky::FindInColumn(int nColumn, int nRow)
+{
+  Column &col = mvColumns[nColumn];
+  vector<int>::iterator it = lower_bound(col.vnRows.begin(), col.vnRows.end(), nRow);
+  if(it == col.vnRows.end() || *it != nRow)
+    return NULL;
+  return &col.vm6Blocks[it - col.vnRows.begin()];
+}
+
+Matrix<6> *SparseBlockCholesky::Block(int j, int k, bool &bTransposed)
+{
+  int nJ = mvnPosition[j];
+  int nK = mvnPosition[k];
+  bTransposed = false;
+  if(nJ == nK)
+    return &mvColumns[nJ].m6Diag;
+  if(nJ < nK)
+  {
+    swap(nJ, nK);
+    bTransposed = true;
+  }
+  Matrix<6> *pm6 = FindInColumn(nK, nJ);
+  assert(pm6 != NULL);   // (j,k) wasn't in the pattern given to Analyse()
+  return pm6;
+}
+
+bool SparseBlockCholesky::Factorise()
+{
+  // Right-looking: factor one column, then push its updates to the
+  // columns to its right. Symbolic analysis made room for all of them.
+  for(unsigned int nPos=0; nPos<mvColumns.size(); nPos++)
+  {
+    Column &col = mvColumns[nPos];
+    if(!CholeskyInPlace(col.m6Diag))
+      return false;
+    for(unsigned int a=0; a<col.vnRows.size(); a++)
+      RightSolveTransposed(col.m6Diag, col.vm6Blocks[a]);
+
+    for(unsigned int a=0; a<col.vnRows.size(); a++)
+    {
+      const Matrix<6> &m6A = col.vm6Blocks[a];
+      SubtractOuter(mvColumns[col.vnRows[a]].m6Diag, m6A, m6A);
+      for(unsigned int b=0; b<a; b++)
+      {
+        Matrix<6> *pm6Target = FindInColumn(col.vnRows[b], col.vnRows[a]);
+        assert(pm6Target != NULL);
+        SubtractOuter(*pm6Target, m6A, col.vm6Blocks[b]);
+      }
+    }
+  }
+  return true;
+}
+
+Vector<> SparseBlockCholesky::Solve(const Vector<> &vb) const
+{
+  const int nBlocks = mvColumns.size();
+  assert(vb.size() == nBlocks * 6);
+
+  // Permute into elimination order
+  vector<Vector<6> > vy(nBlocks);
+  for(int nPos=0; nPos<nBlocks; nPos++)
+    for(int i=0; i<6; i++)
+      vy[nPos][i] = vb[mvnOrder[nPos] * 6 + i];
+
+  // L y = b
+  for(int nPos=0; nPos<nBlocks; nPos++)
+  {
+    const Column &col = mvColumns[nPos];
+    Vector<6> &v6 = vy[nPos];
+    for(int r=0; r<6; r++)
+    {
+      double v = v6[r];
+      for(int k=0; k<r; k++)
+        v -= col.m6Diag[r][k] * v6[k];
+      v6[r] = v / col.m6Diag[r][r];
+    }
+    for(unsigned int a=0; a<col.vnRows.size(); a++)
+    {
+      const Matrix<6> &m6 = col.vm6Blocks[a];
+      Vector<6> &v6Row = vy[col.vnRows[a]];
+      for(int r=0; r<6; r++)
+        for(int k=0; k<6; k++)
+          v6Row[r] -= m6[r][k] * v6[k];
+    }
+  }
+
+  // L^T x = y
+  for(int nPos=nBlocks-1; nPos>=0; nPos--)
+  {
+    const Column &col = mvColumns[nPos];
+    Vector<6> &v6 = vy[nPos];
+    for(unsigned int a=0; a<col.vnRows.size(); a++)
+    {
+      const Matrix<6> &m6 = col.vm6Blocks[a];
+      const Vector<6> &v6Row = vy[col.vnRows[a]];
+      for(int k=0; k<6; k++)
+        for(int r=0; r<6; r++)
+          v6[k] -= m6[r][k] * v6Row[r];
+    }
+    for(int r=5; r>=0; r--)
+    {
+      double v = v6[r];
+      for(int k=r+1; k<6; k++)
+        v -= col.m6Diag[k][r] * v6[k];
+      v6[r] = v / col.m6Diag[r][r];
+    }
+  }
+
+  Vector<> vx(nBlocks * 6);
+  for(int nPos=0; nPos<nBlocks; nPos++)
+    for(int i=0; i<6; i++)
+      vx[mvnOrder[nPos] * 6 + i] = vy[nPos][i];
+  return vx;
+}
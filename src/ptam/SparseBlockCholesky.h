@@ -0,0 +1,61 @@
+// -*- c++ -*-
+//
+// SparseBlockCholesky - solves a symmetric positive definite system made
+// of 6x6 blocks, such as the reduced camera system of the bundle adjuster
+// (one block row per adjusted keyframe).
+//
+// Analyse() is given the block sparsity pattern once; it picks a
+// fill-reducing elimination order (minimum degree) and allocates the
+// blocks of the factor, fill-in included. After that, every solve is
+// Clear(), accumulate into the blocks returned by Block(), Factorise()
+// and Solve(). Only the lower triangle is stored.
+
+#ifndef __SPARSEBLOCKCHOLESKY_H
+#define __SPARSEBLOCKCHOLESKY_H
+#include <TooN/TooN.h>
+#include <vector>
+#include <utility>
+
+namespace ptam{
+
+class SparseBlockCholesky
+{
+public:
+  SparseBlockCholesky() {}
+
+  // vOffDiagonal lists the (j,k) block pairs which may be non-zero,
+  // in any order. Diagonal blocks are always there.
+  void Analyse(int nBlocks, const std::vector<std::pair<int, int> > &vOffDiagonal);
+
+  // Storage of block (j,k) of the matrix. Only one of (j,k) and (k,j) is
+  // stored; if bTransposed comes back true, the returned block holds (k,j).
+  // The pointer stays valid until the next Analyse().
+  TooN::Matrix<6> *Block(int j, int k, bool &bTransposed);
+  TooN::Matrix<6> *DiagonalBlock(int j) { return &mvColumns[mvnPosition[j]].m6Diag; }
+
+  void Clear();       // Zeros all blocks, keeps the pattern
+  bool Factorise();   // In place; false if the matrix isn't positive definite
+  TooN::Vector<> Solve(const TooN::Vector<> &vb) const;  // Needs Factorise() first
+
+  int Size() const { return mvColumns.size(); }
+  int NumBlocks() const;    // Stored blocks in the factor, diagonal included
+
+protected:
+  // One block column of the factor, in elimination order
+  struct Column
+  {
+    TooN::Matrix<6> m6Diag;
+    std::vector<int> vnRows;                // Positions (not indices!) of the blocks below the diagonal, sorted
+    std::vector<TooN::Matrix<6> > vm6Blocks;
+  };
+
+  TooN::Matrix<6> *FindInColumn(int nColumn, int nRow);
+
+  std::vector<Column> mvColumns;
+  std::vector<int> mvnOrder;     // Block index eliminated at each position
+  std::vector<int> mvnPosition;  // Inverse of mvnOrder
+};
+
+} // namespace
+
+#endif
@@ -6,18 +6,22 @@
 #include "PatchFinder.h"
 #include "MapPoint.h"
 #include "TrackerData.h"
+#include "SearchRange.h"
 //#include <cs_geometry/Conversions.h>
 
 #include <cvd/utility.h>
 #include <cvd/fast_corner.h>
 #include <cvd/vision.h>
 #include <cvd/image_io.h>
+#include <cvd/timer.h>
 
 #include <gvars3/instances.h>
 #include <gvars3/GStringUtil.h>
 
 #include <Eigen/Core>
 
+#include <boost/bind.hpp>
+
 #include <fstream>
 #include <fcntl.h>
 
@@ -30,7 +34,8 @@ using namespace ptam;
 // The constructor mostly sets up interal reference variables
 // to the other classes..
 Tracker::Tracker(Map &m, MapMaker &mm) :
-    mCurrentKF(new KeyFrame()),
+    mFramePool(2 * (AddCamNumber + 1)),
+    mCurrentKF(mFramePool.Get()),
     mMap(m),
     mMapMaker(mm),
     mCamera(CameraModel::CreateCamera()),
@@ -41,8 +46,7 @@ Tracker::Tracker(Map &m, MapMaker &mm) :
         std::auto_ptr<CameraModel> camera_temp (CameraModel::CreateCamera(i + 1));
         mCameraSec[i] = camera_temp;
 
-        boost::shared_ptr<KeyFrame> kf_temp (new KeyFrame());
-        mCurrentKFsec[i] = kf_temp;
+        mCurrentKFsec[i] = mFramePool.Get();
         mCurrentKFsec[i]->bFixed = false;
 
         mse3CamFromWorldsec[i] = SE3<>();
@@ -51,6 +55,8 @@ Tracker::Tracker(Map &m, MapMaker &mm) :
     GUI.RegisterCommand("KeyPress", GUICommandCallBack, this);
     GUI.RegisterCommand("PokeTracker", GUICommandCallBack, this);
 
+    SelectMEstimator();
+
     mpSBILastFrame = NULL;
     mpSBIThisFrame = NULL;
     for (int i = 0; i < AddCamNumber; i ++){
@@ -58,6 +64,14 @@ Tracker::Tracker(Map &m, MapMaker &mm) :
         mpSBIThisFramesec[i] = NULL;
     }
 
+    // By default one worker per camera
+    static gvar3<int> gvnWorkers("Tracker.Workers", AddCamNumber + 1, SILENT);
+    mpWorkers.reset(new WorkerPool(*gvnWorkers));
+    mpBuilder.reset(new KeyFrameBuilder(*mpWorkers));
+    mpDenseAligner.reset(new DenseAligner(*mCamera));
+    for (int i = 0; i < AddCamNumber; i ++)
+        mpDenseAlignersec[i].reset(new DenseAligner(*mCameraSec[i]));
+
     // Most of the initialisation is done in Reset()
     Reset();
 
@@ -78,6 +92,7 @@ Tracker::Tracker(Map &m, MapMaker &mm) :
     istrackPad = false;
     isLandingpadPoseGet = false;
     isFinishPadDetection = false;
+    mnPadSequence = 0;
 
     time_last_detect = ros::Time::now();
     timecost_vo = 0;
@@ -109,19 +124,24 @@ void Tracker::Reset()
     mnFailureFrames = 0;
     mbOldMaplocked = false;
     mdMSDScaledVelocityMagnitude = 0;
+    mmCovariances = Zeros;
     mCurrentKF->dSceneDepthMean = 1.0;
     mCurrentKF->dSceneDepthSigma = 1.0;
     mnInitialStage = TRAIL_TRACKING_NOT_STARTED;
     mlTrails.clear();
     mCurrentKF->mMeasurements.clear();
+    mbKeyFramePending = false;
     mnLastKeyFrameDropped = -20;
     mnFrame=0;
     mnKeyFrames=0;
     mv6CameraVelocity = Zeros;
     mbJustRecoveredSoUseCoarse = false;
+    mnDenseReferenceFrame = -2;
+    mbDensePriorGood = false;
     mUsingDualImg = false;
     mUseDualshould = false;
     debugmarkLoopDetected = false;
+    mnRebaseCount = 0;
     boost::shared_ptr<KeyFrame> kf_temp (new KeyFrame());
     mGoodKFtoTrack= kf_temp;
     for (int i = 0; i < AddCamNumber; i ++){
@@ -175,6 +195,7 @@ void Tracker::UpdateImageSize(const CVD::ImageRef& size)
 // or not (it should not draw, for example, when AR stuff is being shown.)
 void Tracker::TrackFrame(Image<byte> &imFrame)
 {
+    HandOverKeyFrame();
     cout << "Dual images made kfs1..." <<"\n";
     mUsingDualImg = false;
     mMessageForUser.str("");   // Wipe the user message clean
@@ -185,12 +206,12 @@ void Tracker::TrackFrame(Image<byte> &imFrame)
     // This does things like generate the image pyramid and find FAST corners
     mCurrentKF->mMeasurements.clear();
     mCurrentKF->MakeKeyFrame_Lite(imFrame);
-    mCurrentKF->MakeKeyFrame_Rest();
     mCurrentKF->nSourceCamera = 0;
 
     initNewFrame();
     if(!trackMap()) {
-        // If there is no map, try to make one.
+        // If there is no map, try to make one. That takes the whole keyframe.
+        mCurrentKF->MakeKeyFrame_Rest();
         if (use_circle_ini){
             if (use_one_circle && circle_pose_get){ //&& (se3CfromW.inverse().get_translation()[2] > 0.4)){
                 mse3CamFromWorld = se3CfromW;
@@ -228,6 +249,7 @@ void Tracker::TrackFrame(Image<byte> &imFrame)
 // use dual image: sec img with known extrinsic param w.r.t the main img
 void Tracker::TrackFrame(Image<byte> &imFrame, Image<byte> &imFramesec)
 {
+    HandOverKeyFrame();
     mUsingDualImg = true;
     mMessageForUser.str("");   // Wipe the user message clean
     UpdateImageSize(imFrame.size());
@@ -238,12 +260,10 @@ void Tracker::TrackFrame(Image<byte> &imFrame, Image<byte> &imFramesec)
     // This does things like generate the image pyramid and find FAST corners
     mCurrentKF->mMeasurements.clear();
     mCurrentKF->MakeKeyFrame_Lite(imFrame);
-    mCurrentKF->MakeKeyFrame_Rest();
     mCurrentKF->nSourceCamera = 0;
     // and the second camera img
     mCurrentKFsec[0]->mMeasurements.clear();
     mCurrentKFsec[0]->MakeKeyFrame_Lite(imFramesec, 1);
-    mCurrentKFsec[0]->MakeKeyFrame_Rest();
     mCurrentKFsec[0]->nSourceCamera = 1;
     mCurrentKFsec[0]->mAssociateKeyframe = true;
 
@@ -252,7 +272,8 @@ void Tracker::TrackFrame(Image<byte> &imFrame, Image<byte> &imFramesec)
     initNewFrame_sec();// the second current keyframe
 
     if(!trackMapDual()) {
-        // If there is no map, try to make one.
+        // If there is no map, try to make one. That takes the whole keyframe.
+        mCurrentKF->MakeKeyFrame_Rest();
         if (use_circle_ini){
             if (use_one_circle && circle_pose_get){ //&& (se3CfromW.inverse().get_translation()[2] > 0.4)){
                 mse3CamFromWorld = se3CfromW;
@@ -297,6 +318,7 @@ void Tracker::TrackFrame(Image<byte> &imFrame, Image<byte> &imFramesec)
 
 void Tracker::TrackFrame(CVD::Image<CVD::byte> &imFrame, CVD::Image<uint16_t> &imFrameD)
 {
+    HandOverKeyFrame();
     mMessageForUser.str("");   // Wipe the user message clean
 
     UpdateImageSize(imFrame.size());
@@ -304,11 +326,17 @@ void Tracker::TrackFrame(CVD::Image<CVD::byte> &imFrame, CVD::Image<uint16_t> &i
     // Take the input video image, and convert it into the tracker's keyframe struct
     // This does things like generate the image pyramid and find FAST corners
     mCurrentKF->mMeasurements.clear();
-    mCurrentKF->MakeKeyFrame(imFrame,imFrameD,mCamera.get());
+    mpBuilder->AddLite(*mCurrentKF, imFrame, &imFrameD);
+    mpBuilder->Run();
+    // Kept for the mapmaker, which finishes the frame should it become a keyframe
+    mCurrentKF->depthImage.resize(imFrameD.size());
+    copy(imFrameD, mCurrentKF->depthImage);
 
     initNewFrame();
     if(!trackMap()) {
-        // If there is no map, try to make one.
+        // If there is no map, try to make one. That takes the whole keyframe.
+        mpBuilder->AddMade(*mCurrentKF);
+        mpBuilder->Run();
         mMapMaker.InitFromRGBD(*mCurrentKF);
         mnKeyFrames = 1;
     }
@@ -319,10 +347,12 @@ void Tracker::TrackFrame(CVD::Image<CVD::byte> &imFrame, CVD::Image<uint16_t> &i
 // use rgb image, for RGB-D SLAM using backend
 void Tracker::TrackFrame(CVD::Image<CVD::Rgb<CVD::byte> > &imFrameRGB, CVD::Image<uint16_t> &imFrameD, bool isBgr)
 {
+    HandOverKeyFrame();
     mMessageForUser.str("");   // Wipe the user message clean
     cout << "Doing tracking process ..." << endl;
 
-    CVD::Image<CVD::byte> imFrame;
+    mvimGrey.resize(1);
+    CVD::Image<CVD::byte> &imFrame = mvimGrey[0];
     imFrame.resize(imFrameRGB.size());
     CVD::convert_image(imFrameRGB,imFrame);
     UpdateImageSize(imFrame.size());
@@ -330,7 +360,8 @@ void Tracker::TrackFrame(CVD::Image<CVD::Rgb<CVD::byte> > &imFrameRGB, CVD::Imag
     // Take the input video image, and convert it into the tracker's keyframe struct
     // This does things like generate the image pyramid and find FAST corners
     mCurrentKF->mMeasurements.clear();
-    mCurrentKF->MakeKeyFrame(imFrame,imFrameD,mCamera.get());
+    mpBuilder->AddLite(*mCurrentKF, imFrame, &imFrameD);
+    mpBuilder->Run();
     mCurrentKF->rgbIsBgr_ = isBgr;
 
     // Add depth and rgb image to the keyframe
@@ -348,6 +379,8 @@ void Tracker::TrackFrame(CVD::Image<CVD::Rgb<CVD::byte> > &imFrameRGB, CVD::Imag
                               0, 0, -1.0, // a world frame which pointing downward.
                               1.0, 0, 0);
         IniPose.get_rotation() = datam;
+        mpBuilder->AddMade(*mCurrentKF);
+        mpBuilder->Run();
         mMapMaker.InitFromRGBD(*mCurrentKF, IniPose);
         mse3CamFromWorld = mMap.vpKeyFrames[0]->se3CfromW;
         mnKeyFrames = 1;
@@ -359,6 +392,7 @@ void Tracker::TrackFrame(std::vector<CVD::Image<CVD::Rgb<CVD::byte> > > &imFrame
                          std::vector<CVD::Image<uint16_t> > &imFrameD,
                          std::vector<int> adcamIndex, bool isBgr)
 {
+    HandOverKeyFrame();
     cout << "Dual images received" <<"\n";
     mUsingDualImg = true;
     assert((imFrameRGB.size() == imFrameD.size())
@@ -371,15 +405,25 @@ void Tracker::TrackFrame(std::vector<CVD::Image<CVD::Rgb<CVD::byte> > > &imFrame
         trackerlog << "frame time: " << timevobegin.toSec() << " ";
     }
 
-    // Add the main camera data
-    CVD::Image<CVD::byte> imFrame;
-    imFrame.resize(imFrameRGB[0].size());
-    CVD::convert_image(imFrameRGB[0],imFrame);
-    UpdateImageSize(imFrame.size());
-    // Take the input video image, and convert it into the tracker's keyframe struct
-    // This does things like generate the image pyramid and find FAST corners
+    // Take the input video images, and convert them into the tracker's keyframe structs
+    // This does things like generate the image pyramid and find FAST corners,
+    // for all cameras at once
+    std::vector<CVD::Image<CVD::byte> > &imFrames = mvimGrey;
+    imFrames.resize(imFrameRGB.size());
+    for (unsigned int i = 0; i < imFrameRGB.size(); i ++) {
+        imFrames[i].resize(imFrameRGB[i].size());
+        CVD::convert_image(imFrameRGB[i],imFrames[i]);
+    }
+    UpdateImageSize(imFrames[0].size());
     mCurrentKF->mMeasurements.clear();
-    mCurrentKF->MakeKeyFrame(imFrame,imFrameD[0],mCamera.get());
+    mpBuilder->AddLite(*mCurrentKF, imFrames[0], &imFrameD[0]);
+    for (int i = 0; i < adcamIndex.size(); i ++) {
+        mCurrentKFsec[adcamIndex[i]]->mMeasurements.clear();
+        mpBuilder->AddLite(*mCurrentKFsec[adcamIndex[i]], imFrames[i + 1], &imFrameD[i + 1]);
+    }
+    mpBuilder->Run();
+
+    // Add the main camera data
     mCurrentKF->rgbIsBgr_ = isBgr;
     // Add depth and rgb image to the keyframe
     mCurrentKF->rgbImage.resize(imFrameRGB[0].size());
@@ -395,14 +439,6 @@ void Tracker::TrackFrame(std::vector<CVD::Image<CVD::Rgb<CVD::byte> > > &imFrame
         mCurrentKFsec[i]->bNewsec = false;
     ActiveAdCamIndex = adcamIndex; // direct copy
     for (int i = 0; i < adcamIndex.size(); i ++) {
-        CVD::Image<CVD::byte> imFrame;
-        imFrame.resize(imFrameRGB[i+1].size());
-        CVD::convert_image(imFrameRGB[i+1],imFrame);
-
-        // Take the input video image, and convert it into the tracker's keyframe struct
-        // This does things like generate the image pyramid and find FAST corners
-        mCurrentKFsec[adcamIndex[i]]->mMeasurements.clear();
-        mCurrentKFsec[adcamIndex[i]]->MakeKeyFrame(imFrame,imFrameD[i + 1],mCameraSec[adcamIndex[i]].get());
         mCurrentKFsec[adcamIndex[i]]->rgbIsBgr_ = isBgr;
         mCurrentKFsec[adcamIndex[i]]->nSourceCamera = adcamIndex[i] + 1; // mCameraSec begin with 0, while nSourceCamera begin with 1!
 
@@ -424,6 +460,12 @@ void Tracker::TrackFrame(std::vector<CVD::Image<CVD::Rgb<CVD::byte> > > &imFrame
                               0, 0, -1.0, // a world frame which pointing downward.
                               1.0, 0, 0);
         IniPose.get_rotation() = datam;
+        if (adcamIndex.size() == AddCamNumber) {
+            mpBuilder->AddMade(*mCurrentKF);
+            for (int i = 0; i < AddCamNumber; i ++)
+                mpBuilder->AddMade(*mCurrentKFsec[i]);
+            mpBuilder->Run();
+        }
         if ((adcamIndex.size() == AddCamNumber) && mMapMaker.InitFromRGBD(*mCurrentKF, mCurrentKFsec, IniPose)){
             mnKeyFrames = 1;
             mse3CamFromWorld = mMap.vpKeyFrames[0]->se3CfromW;
@@ -451,6 +493,7 @@ void Tracker::TrackFrame(std::vector<CVD::Image<CVD::Rgb<CVD::byte> > > &imFrame
 // Tracks a frame obtained through stereo matching
 void Tracker::TrackFrame(CVD::Image<CVD::byte> &imFrame, const sensor_msgs::PointCloud& points)
 {
+    HandOverKeyFrame();
     mMessageForUser.str("");   // Wipe the user message clean
 
     UpdateImageSize(imFrame.size());
@@ -482,9 +525,9 @@ void Tracker::initNewFrame() {
     }
     else
     {
-        delete  mpSBILastFrame;
-        mpSBILastFrame = mpSBIThisFrame;
-        mpSBIThisFrame = new SmallBlurryImage(*mCurrentKF, *gvdSBIBlur);
+        // The last frame's SBI is made over for this frame, buffers and all
+        std::swap(mpSBILastFrame, mpSBIThisFrame);
+        mpSBIThisFrame->MakeFromKF(*mCurrentKF, *gvdSBIBlur);
     }
 
     // From now on we only use the keyframe struct!
@@ -500,9 +543,8 @@ void Tracker::initNewFrame_sec(int camIndex) {
     }
     else
     {
-        delete  mpSBILastFramesec[camIndex];
-        mpSBILastFramesec[camIndex] = mpSBIThisFramesec[camIndex];
-        mpSBIThisFramesec[camIndex] = new SmallBlurryImage(*mCurrentKFsec[camIndex], *gvdSBIBlur);
+        std::swap(mpSBILastFramesec[camIndex], mpSBIThisFramesec[camIndex]);
+        mpSBIThisFramesec[camIndex]->MakeFromKF(*mCurrentKFsec[camIndex], *gvdSBIBlur);
     }
 
     // From now on we only use the keyframe struct!
@@ -524,7 +566,10 @@ bool Tracker::trackMap() {
         if (pose_ekf_get && mnLostFrames >= 3)
             ApplyMotionModel_EKF();     //  TODO: use pose prediction from EKF only when the filter is trustable, not at the beginning
         else
+        {
             ApplyMotionModel();
+            ApplyDenseOdometry();
+        }
         TrackMap();               //  These three lines do the main tracking work.
         cout << "kf pose: " << mCurrentKF->se3CfromW << endl;
 
@@ -538,6 +583,8 @@ bool Tracker::trackMap() {
 
         AssessTrackingQuality();  //  Check if we're lost or if tracking is poor.
 
+        TrackPad();               //  Before a new keyframe takes mCurrentKF away
+
         { // Provide some feedback for the user:
             mMessageForUser << "Tracking Map, quality ";
             if(mTrackingQuality == GOOD)  mMessageForUser << "good.";
@@ -556,7 +603,7 @@ bool Tracker::trackMap() {
         if(mTrackingQuality == GOOD &&
                 mMapMaker.NeedNewKeyFrame(mCurrentKF) &&
                 (mnFrame - mnLastKeyFrameDropped) > *minInterval  &&
-                mMapMaker.QueueSize() < 3)
+                MapMakerAcceptsKeyFrame())
         {
             mMessageForUser << " Adding key-frame.";
             //			assert(mCurrentKF.aLevels[0].vCandidates.size() > 0);
@@ -599,7 +646,10 @@ bool Tracker::trackMapDual() {
         if (pose_ekf_get && mnLostFrames >= 3)
             ApplyMotionModel_EKF();     //  TODO: use pose prediction from EKF only when the filter is trustable, not at the beginning
         else
+        {
             ApplyMotionModel();
+            ApplyDenseOdometry();
+        }
 
         ros::Time timetrack_b = ros::Time::now();
 
@@ -620,6 +670,8 @@ bool Tracker::trackMapDual() {
 
         AssessTrackingQuality();  //  Check if we're lost or if tracking is poor.
 
+        TrackPad();               //  Before a new keyframe takes mCurrentKF away
+
         { // Provide some feedback for the user:
             mMessageForUser << "Tracking Map, quality ";
             if(mTrackingQuality == GOOD)  mMessageForUser << "good.";
@@ -638,7 +690,7 @@ bool Tracker::trackMapDual() {
         if(mTrackingQuality == GOOD &&
                 mMapMaker.NeedNewKeyFrame(mCurrentKF) &&
                 (mnFrame - mnLastKeyFrameDropped) > *minInterval  &&
-                mMapMaker.QueueSize() < 3)
+                MapMakerAcceptsKeyFrame())
         {
             mMessageForUser << " Adding key-frame.";
             //			assert(mCurrentKF.aLevels[0].vCandidates.size() > 0);
@@ -647,7 +699,7 @@ bool Tracker::trackMapDual() {
         else if((mTrackingQuality == GOOD || mTrackingQuality == DODGY) && // too far away without a new keyframe, deem to fail pose tracking
                 mMapMaker.NeedErgentKeyFrame(mCurrentKF) &&
                 (mnFrame - mnLastKeyFrameDropped) > *minInterval  &&
-                mMapMaker.QueueSize() < 3)
+                MapMakerAcceptsKeyFrame())
         {
             mMessageForUser << " Adding Ergent key-frame.";
             //			assert(mCurrentKF.aLevels[0].vCandidates.size() > 0);
@@ -833,25 +885,13 @@ bool Tracker::AttemptRecovery()
     return true;
 }
 
+// mse3Best is the pose of goodkf relative to kf. The map is only locked
+// (by the mapmaker) the first time goodkf is used for relocalisation.
 bool Tracker::AttemptRecovery(boost::shared_ptr<KeyFrame> goodkf, boost::shared_ptr<KeyFrame> kf, TooN::SE3<> &mse3Best, double minInliers)
 {
-    // write access: unique lock
-    boost::unique_lock< boost::shared_mutex > lock(mMap.mutex);
-    goodkf->finalizeKeyframeGoodkf();
-    boost::shared_ptr<KeyFrame> goodkftrack(new KeyFrame);
-    *goodkftrack = *goodkf;
-    lock.unlock();
-
     cout << "goodkf id: " << goodkf->id << endl;
-    kf->finalizeKeyframekpts();
-    Sophus::SE3d relPoseAB;
-
-//    if (mMapMaker.relocaliseRegister(goodkftrack, kf, relPoseAB, minInliers)){
-//        mse3Best = toToonSE3(relPoseAB);
-//        return true;
-//    }
-//    else
-        return false;
+    kf->finalizeKeyframekpts(mExtractor);
+    return mMapMaker.relocaliseRegister(goodkf, kf, mse3Best, minInliers);
 }
 
 // GUI interface. Stuff commands onto the back of a queue so the tracker handles
@@ -972,7 +1012,7 @@ void Tracker::TrackForInitialMap()
                                                             i->irCurrentPos));
 
             if (!use_circle_ini){
-                if (mMapMaker.InitFromStereo(mFirstKF, *mCurrentKF, vMatches, mse3CamFromWorld, false, 0, 0))  // This will take some time!
+                if (mMapMaker.InitFromStereo(mFirstKF, *mCurrentKF, vMatches, mse3CamFromWorld, false, 0, 0, mpWorkers.get()))  // This will take some time!
                 {
                     mnInitialStage = TRAIL_TRACKING_COMPLETE;
                     mnKeyFrames = 2;
@@ -982,7 +1022,7 @@ void Tracker::TrackForInitialMap()
                 static int circle_get_thresh = 3;//filter outlier
                 static int circle_pose_count = 0;
                 mCurrentKF->se3CfromW = se3CfromW;
-                if (mMapMaker.InitFromStereo(mFirstKF, *mCurrentKF, vMatches, mse3CamFromWorld, true, circle_get_thresh -1, circle_pose_count))
+                if (mMapMaker.InitFromStereo(mFirstKF, *mCurrentKF, vMatches, mse3CamFromWorld, true, circle_get_thresh -1, circle_pose_count, mpWorkers.get()))
                 {
                     circle_pose_count ++;
                     if (circle_pose_count >= circle_get_thresh){
@@ -1013,7 +1053,8 @@ void Tracker::TrackForInitialMap()
 // The current frame is to be the first keyframe!
 void Tracker::TrailTracking_Start()
 {
-    mCurrentKF->MakeKeyFrame_Rest();  // This populates the Candidates list, which is Shi-Tomasi thresholded.
+    if(!mCurrentKF->bComplete)
+        mCurrentKF->MakeKeyFrame_Rest();  // This populates the Candidates list, which is Shi-Tomasi thresholded.
     mFirstKF = *mCurrentKF;
     vector<pair<double,ImageRef> > vCornersAndSTScores;
     for(unsigned int i=0; i<mCurrentKF->aLevels[0].vCandidates.size(); i++)  // Copy candidates into a trivially sortable vector
@@ -1082,6 +1123,12 @@ int Tracker::TrailTracking_Advance()
     return nGoodTrails;
 }
 
+// Search order, see SchedulePVS()
+static bool BySchedule(const boost::shared_ptr<MapPoint> &a, const boost::shared_ptr<MapPoint> &b)
+{
+    return a->TData.nScheduleRank < b->TData.nScheduleRank;
+}
+
 // TrackMap is the main purpose of the Tracker.
 // It first projects all map points into the image to find a potentially-visible-set (PVS);
 // * we should only project map points with the same source camera to the correspondng camera img
@@ -1123,17 +1170,19 @@ void Tracker::TrackMap()
         avPVSsec[j][i].reserve(500);
 
 //    debugmarkLoopDetected = false;
-    // read access: shared lock
-    boost::shared_lock< boost::shared_mutex > lock(mMap.mutex);
-
-    // For thread safe, update motion model which caused by local map update from pgo, here
-    if (mMapMaker.needMotionModelUpdate){
-        MotionModelUpdateByGMap();
+    // No map lock: the whole frame works from one generation of the map,
+    // so the tracker never waits for the mapmaker's writes.
+    boost::shared_ptr<const MapSnapshot> pSnapshot = mMap.PinSnapshot();
+
+    // For thread safe, update motion model which caused by local map update from pgo, here:
+    // the snapshot counts the moves, so none is missed, and carries the reference pose with it
+    if (pSnapshot->rebase.nCount != mnRebaseCount){
+        mnRebaseCount = pSnapshot->rebase.nCount;
+        MotionModelUpdateByGMap(*pSnapshot);
         if (mMapMaker.debugmarkLoopDetected){
             debugmarkLoopDetected = true;
             mMapMaker.debugmarkLoopDetected = false;
         }
-        mMapMaker.needMotionModelUpdate = false;
     }
 
     SE3<> posesecCamFromWorld[AddCamNumber];
@@ -1151,61 +1200,24 @@ void Tracker::TrackMap()
     /// when there's no overlapping FOV, each point has a single trakerdata,
     /// otherwise, multiple trackerdata can be coded, or a more straightforward way is
     /// only track the point in one camera
-    for(unsigned int i=0; i<mMap.vpPoints.size(); i++)
+    /// patch vectors of points handed to a new source kf are redone by the mapmaker (MapMaker::PublishMap)
+    Vector<3> z;
+    z[0] = z[1] = 0.0; z[2] = 1.0;
+    for(unsigned int i=0; i<pSnapshot->vPoints.size(); i++)
     {
-        if (mMap.vpPoints[i]->mblocked)
-            continue;
-
-        boost::shared_ptr<MapPoint> p= mMap.vpPoints[i];
+        const MapSnapshot::Point &pt = pSnapshot->vPoints[i];
+        const boost::shared_ptr<MapPoint> &p = pt.pPoint;
         TrackerData &TData = p->TData;
-
-        if (!p->nSourceCamera){ // from cam 0
-            if (p->sourceKfIDtransfered && !p->refreshed){
-                p->v3Center_NC = unproject(mCamera->UnProject(p->pPatchSourceKF.lock()->mMeasurements[p].v2RootPos));
-                p->v3OneRightFromCenter_NC = unproject(mCamera->UnProject(p->pPatchSourceKF.lock()->mMeasurements[p].v2RootPos + vec(ImageRef(p->pPatchSourceKF.lock()->mMeasurements[p].nLevel,0))));
-                p->v3OneDownFromCenter_NC  = unproject(mCamera->UnProject(p->pPatchSourceKF.lock()->mMeasurements[p].v2RootPos + vec(ImageRef(0,p->pPatchSourceKF.lock()->mMeasurements[p].nLevel))));
-                normalize(p->v3Center_NC);
-                normalize(p->v3OneDownFromCenter_NC);
-                normalize(p->v3OneRightFromCenter_NC);
-                p->RefreshPixelVectors();
-
-                p->refreshed = true;
-            }
-        }
-        else {
-            int adcamIndex = p->nSourceCamera - 1;
-
-            if (p->sourceKfIDtransfered && !p->refreshed){
-                p->v3Center_NC = unproject(mCameraSec[adcamIndex]->UnProject(p->pPatchSourceKF.lock()->mMeasurements[p].v2RootPos));
-                p->v3OneRightFromCenter_NC = unproject(mCameraSec[adcamIndex]->UnProject(p->pPatchSourceKF.lock()->mMeasurements[p].v2RootPos + vec(ImageRef(p->pPatchSourceKF.lock()->mMeasurements[p].nLevel,0))));
-                p->v3OneDownFromCenter_NC  = unproject(mCameraSec[adcamIndex]->UnProject(p->pPatchSourceKF.lock()->mMeasurements[p].v2RootPos + vec(ImageRef(0,p->pPatchSourceKF.lock()->mMeasurements[p].nLevel))));
-                normalize(p->v3Center_NC);
-                normalize(p->v3OneDownFromCenter_NC);
-                normalize(p->v3OneRightFromCenter_NC);
-                p->RefreshPixelVectors();
-
-                p->refreshed = true;
-            }
-        }
+        TData.v3WorldPos = pt.v3WorldPos;
 
         /// each mp should be checked for each camera
         /// First, for the master camera
         // Project according to current view, and if it's not in the image, skip.
-        TData.Project(p->v3WorldPos, mse3CamFromWorld, mCamera.get());
+        TData.Project(TData.v3WorldPos, mse3CamFromWorld, mCamera.get());
         if (TData.bInImage)
         {
             // Hack by Jonathan Klimesch: Need to see a point from roughly the same angle.
-            double cosAngle;
-            {
-                Vector<3> z;
-                z[0] = z[1] = 0.0; z[2] = 1.0;
-                boost::shared_ptr<KeyFrame> kf = p->pPatchSourceKF.lock();
-                if(kf.get() == NULL)
-                    continue;// done
-
-                //            cosAngle = (mCurrentKF->se3CfromW.get_rotation()*z)*(kf->se3CfromW.get_rotation()*z);
-                cosAngle = (mse3CamFromWorld.get_rotation()*z)*(kf->se3CfromW.get_rotation()*z);
-            }
+            double cosAngle = (mse3CamFromWorld.get_rotation()*z)*pt.v3SourceAxis_W;
             if (cosAngle < 0) { // |angle| > 90°
                 continue; // done
             }
@@ -1214,11 +1226,14 @@ void Tracker::TrackMap()
             TData.GetDerivsUnsafe(mCamera.get());
 
             // And check what the PatchFinder (included in TrackerData) makes of the mappoint in this view..
-            TData.nSearchLevel = TData.Finder.CalcSearchLevelAndWarpMatrix(*p, mse3CamFromWorld, TData.m2CamDerivs);
+            TData.nSearchLevel = TData.Finder.CalcSearchLevelAndWarpMatrix(pt.v3WorldPos, pt.v3PixelRight_W, pt.v3PixelDown_W,
+                                                                           mse3CamFromWorld, TData.m2CamDerivs);
             if(TData.nSearchLevel == -1) {
                 continue;   // done. a negative search pyramid level indicates an inappropriate warp for this view, so skip.
             }
             // Otherwise, this point is suitable to be searched in the current image! Add to the PVS.
+            TData.nSearchRange = 0;
+            TData.nScheduleRank = 0;
             TData.bSearched = false;
             TData.bFound = false;
             p->nFoundCamera = 0;
@@ -1231,20 +1246,10 @@ void Tracker::TrackMap()
             for (int cn = 0; cn < AddCamNumber; cn ++)
             {
                 // Project according to current view, and if it's not in the image, skip.
-                TData.Project(p->v3WorldPos, mse3CamFromWorldsec[cn], mCameraSec[cn].get());
+                TData.Project(TData.v3WorldPos, mse3CamFromWorldsec[cn], mCameraSec[cn].get());
                 if (TData.bInImage){
                     // Hack by Jonathan Klimesch: Need to see a point from roughly the same angle.
-                    double cosAngle;
-                    {
-                        Vector<3> z;
-                        z[0] = z[1] = 0.0; z[2] = 1.0;
-                        boost::shared_ptr<KeyFrame> kf = p->pPatchSourceKF.lock();
-                        if(kf.get() == NULL)
-                            continue;
-
-                        //            cosAngle = (mCurrentKF->se3CfromW.get_rotation()*z)*(kf->se3CfromW.get_rotation()*z);
-                        cosAngle = (mse3CamFromWorldsec[cn].get_rotation()*z)*(kf->se3CfromW.get_rotation()*z);
-                    }
+                    double cosAngle = (mse3CamFromWorldsec[cn].get_rotation()*z)*pt.v3SourceAxis_W;
                     if (cosAngle < 0) { // |angle| > 90°
                         continue;
                     }
@@ -1253,11 +1258,14 @@ void Tracker::TrackMap()
                     TData.GetDerivsUnsafe(mCameraSec[cn].get());
 
                     // And check what the PatchFinder (included in TrackerData) makes of the mappoint in this view..
-                    TData.nSearchLevel = TData.Finder.CalcSearchLevelAndWarpMatrix(*p, mse3CamFromWorldsec[cn], TData.m2CamDerivs);
+                    TData.nSearchLevel = TData.Finder.CalcSearchLevelAndWarpMatrix(pt.v3WorldPos, pt.v3PixelRight_W, pt.v3PixelDown_W,
+                                                                                   mse3CamFromWorldsec[cn], TData.m2CamDerivs);
                     if(TData.nSearchLevel == -1) {
                         continue;   // a negative search pyramid level indicates an inappropriate warp for this view, so skip.
                     }
                     // Otherwise, this point is suitable to be searched in the current image! Add to the PVS.
+                    TData.nSearchRange = 0;
+                    TData.nScheduleRank = 0;
                     TData.bSearched = false;
                     TData.bFound = false;
                     p->nFoundCamera = cn + 1;
@@ -1266,72 +1274,29 @@ void Tracker::TrackMap()
                 }
             }
         }
-        if (false)//else if (mUsingDualImg)// on the second image
-        {
-            boost::shared_ptr<MapPoint> p= mMap.vpPoints[i];
-            TrackerData &TData = p->TData;
-            int adcamIndex = p->nSourceCamera - 1;
-
-            if (p->sourceKfIDtransfered && !p->refreshed){
-                p->v3Center_NC = unproject(mCameraSec[adcamIndex]->UnProject(p->pPatchSourceKF.lock()->mMeasurements[p].v2RootPos));
-                p->v3OneRightFromCenter_NC = unproject(mCameraSec[adcamIndex]->UnProject(p->pPatchSourceKF.lock()->mMeasurements[p].v2RootPos + vec(ImageRef(p->pPatchSourceKF.lock()->mMeasurements[p].nLevel,0))));
-                p->v3OneDownFromCenter_NC  = unproject(mCameraSec[adcamIndex]->UnProject(p->pPatchSourceKF.lock()->mMeasurements[p].v2RootPos + vec(ImageRef(0,p->pPatchSourceKF.lock()->mMeasurements[p].nLevel))));
-                normalize(p->v3Center_NC);
-                normalize(p->v3OneDownFromCenter_NC);
-                normalize(p->v3OneRightFromCenter_NC);
-                p->RefreshPixelVectors();
-
-                p->refreshed = true;
-            }
-
-            // Project according to current view, and if it's not in the image, skip.
-            TData.Project(p->v3WorldPos, posesecCamFromWorld[adcamIndex], mCameraSec[adcamIndex].get());
-            if(!TData.bInImage) {
-                continue;
-            }
-
-            // Hack by Jonathan Klimesch: Need to see a point from roughly the same angle.
-            double cosAngle;
-            {
-                Vector<3> z;
-                z[0] = z[1] = 0.0; z[2] = 1.0;
-                boost::shared_ptr<KeyFrame> kf = p->pPatchSourceKF.lock();
-                if(kf.get() == NULL)
-                    continue;
-
-                cosAngle = (posesecCamFromWorld[adcamIndex].get_rotation()*z)*(kf->se3CfromW.get_rotation()*z);
-            }
-            if (cosAngle < 0) { // |angle| > 90°
-                continue;
-            }
-
-            // Calculate camera projection derivatives of this point.
-            TData.GetDerivsUnsafe(mCameraSec[adcamIndex].get());
-
-            // And check what the PatchFinder (included in TrackerData) makes of the mappoint in this view..
-            TData.nSearchLevel = TData.Finder.CalcSearchLevelAndWarpMatrix(*p, posesecCamFromWorld[adcamIndex], TData.m2CamDerivs);
-            if(TData.nSearchLevel == -1) {
-                continue;   // a negative search pyramid level indicates an inappropriate warp for this view, so skip.
-            }
-            // Otherwise, this point is suitable to be searched in the current image! Add to the PVS.
-            TData.bSearched = false;
-            TData.bFound = false;
-            p->nFoundCamera = adcamIndex + 1;
-            avPVSsec[adcamIndex][TData.nSearchLevel].push_back(p);
-        }
     }
 
-    lock.unlock(); // problem: ownership of TData unclear
-
     // Next: A large degree of faffing about and deciding which points are going to be measured!
-    // First, randomly shuffle the individual levels of the PVS.
-    for(int i=0; i<LEVELS; i++)
+    // First, put each camera's PVS in the order to search it in, keeping no more of it
+    // than the camera's budget, see SchedulePVS(). With Tracker.PrioritisePVS 0,
+    // randomly shuffle the individual levels of the PVS instead.
+    static gvar3<int> gvnPrioritisePVS("Tracker.PrioritisePVS", 1, SILENT);
+    static gvar3<int> gvnMaxPatchesPerFrame("Tracker.MaxPatchesPerFrame", 1000, SILENT);  // Per camera
+    if (*gvnPrioritisePVS)
     {
-        random_shuffle(avPVS[i].begin(), avPVS[i].end());
+        SchedulePVS(avPVS, *mCurrentKF, *gvnMaxPatchesPerFrame);
         if (mUsingDualImg)
             for (int j = 0; j < AddCamNumber; j ++)
-            random_shuffle(avPVSsec[j][i].begin(), avPVSsec[j][i].end());
+                SchedulePVS(avPVSsec[j], *mCurrentKFsec[j], *gvnMaxPatchesPerFrame);
     }
+    else
+        for(int i=0; i<LEVELS; i++)
+        {
+            random_shuffle(avPVS[i].begin(), avPVS[i].end());
+            if (mUsingDualImg)
+                for (int j = 0; j < AddCamNumber; j ++)
+                random_shuffle(avPVSsec[j][i].begin(), avPVSsec[j][i].end());
+        }
 
     // The next two data structs contain the list of points which will next
     // be searched for in the image, and then used in pose update.
@@ -1347,17 +1312,32 @@ void Tracker::TrackMap()
     static gvar3<int> gvnCoarseSubPixIts("Tracker.CoarseSubPixIts", 8, SILENT); // Max sub-pixel iterations for coarse features
     static gvar3<int> gvnCoarseDisabled("Tracker.DisableCoarse", 0, SILENT);    // Set this to 1 to disable coarse stage (except after recovery)
     static gvar3<double> gvdCoarseMinVel("Tracker.CoarseMinVelocity", 0.0, SILENT);  // Speed above which coarse stage is used.
+    static gvar3<int> gvnDenseFineRange("Tracker.DenseFineRange", 5, SILENT);   // Pixel search radius of the fine stage after dense alignment
+
+    // Size each point's search window from the uncertainty of the pose prior, see
+    // SetSearchRanges(); the fixed ranges below are then only upper bounds. Not
+    // when the pose has just jumped (relocalisation, pose graph corrections).
+    static gvar3<int> gvnAdaptiveSearch("Tracker.AdaptiveSearch", 1, SILENT);
+    static gvar3<double> gvdSearchBudget("Tracker.SearchBudget", 10.0, SILENT);  // [ms] for the whole search, 0 for no limit
+    static gvar3<int> gvnSearchMinFound("Tracker.SearchMinFound", 150, SILENT);  // The fine stage goes on until it has these anyway
+    const bool bAdaptiveSearch = *gvnAdaptiveSearch && !mbJustRecoveredSoUseCoarse && mmCovariances(0, 0) > 0.0;
+    Matrix<6> m6SearchCovariance = PredictPoseCovariance();
+    mdSearchDeadline = timer.get_time() + *gvdSearchBudget * 1e-3;
 
     unsigned int nCoarseMax = *gvnCoarseMax;
     unsigned int nCoarseRange = *gvnCoarseRange;
 
     mbDidCoarse = false;
+    const bool bDensePrior = mbDensePriorGood;
+    mbDensePriorGood = false;
 
     // Set of heuristics to check if we should do a coarse tracking stage.
+    // A prior from dense alignment is better than the coarse stage would make it.
     bool bTryCoarse = true;
     if(*gvnCoarseDisabled ||
             mdMSDScaledVelocityMagnitude < *gvdCoarseMinVel  ||
-            nCoarseMax == 0)
+            nCoarseMax == 0 ||
+            bDensePrior)
         bTryCoarse = false;
     if(mbJustRecoveredSoUseCoarse)
     {
@@ -1390,7 +1370,7 @@ void Tracker::TrackMap()
             avPVS[LEVELS-1].clear();
         }
         else
-        { // ..otherwise choose nCoarseMax at random, again removing from the PVS list.
+        { // ..otherwise take the first nCoarseMax (the best, or random ones), again removing from the PVS list.
             for(unsigned int i=0; i<nCoarseMax; i++){
                 vNextToSearch.push_back(avPVS[LEVELS-1][i]);
             }
@@ -1418,6 +1398,8 @@ void Tracker::TrackMap()
             }
         }
         // Now go and attempt to find these points in the image!
+        if (bAdaptiveSearch)
+            SetSearchRanges(vNextToSearch, m6SearchCovariance);
         nFound = SearchForPoints(vNextToSearch, nCoarseRange, *gvnCoarseSubPixIts);
         vIterationSet = vNextToSearch;  // Copy over into the to-be-optimised list.
 
@@ -1432,7 +1414,7 @@ void Tracker::TrackMap()
                 { // Re-project the points on all but the first iteration.
                     for(unsigned int i=0; i<vIterationSet.size(); i++)
                         if(vIterationSet[i]->TData.bFound)
-                            vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->v3WorldPos, mse3CamFromWorld, mCamera.get());
+                            vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->TData.v3WorldPos, mse3CamFromWorld, mCamera.get());
                 }
                 for(unsigned int i=0; i<vIterationSet.size(); i++)
                     if(vIterationSet[i]->TData.bFound)
@@ -1476,7 +1458,7 @@ void Tracker::TrackMap()
                 avPVSsec[0][LEVELS-1].clear();
             }
             else
-            { // ..otherwise choose nCoarseMax at random, again removing from the PVS list.
+            { // ..otherwise take the first nCoarseMax (the best, or random ones), again removing from the PVS list.
                 for(unsigned int i=0; i<nCoarseMax; i++)
                     vNextToSearchsec[0].push_back(avPVSsec[0][LEVELS-1][i]);
                 avPVSsec[0][LEVELS-1].erase(avPVSsec[0][LEVELS-1].begin(), avPVSsec[0][LEVELS-1].begin() + nCoarseMax);
@@ -1502,6 +1484,8 @@ void Tracker::TrackMap()
                 }
             }
             // Now go and attempt to find these points in the second image!
+            if (bAdaptiveSearch)
+                SetSearchRanges(vNextToSearchsec[0], m6SearchCovariance);
             nFound += SearchForPoints(vNextToSearchsec[0], nCoarseRange, *gvnCoarseSubPixIts, 1);
             // Copy over into the to-be-optimised list.
             for (unsigned int i = 0; i < vNextToSearchsec[0].size(); i ++)
@@ -1522,15 +1506,15 @@ void Tracker::TrackMap()
                             {
                                 if (use_seccam_track){//if only try using second img
                                     if (vIterationSet[i]->nFoundCamera)// second img
-                                        vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->v3WorldPos, posesecCamFromWorld[vIterationSet[i]->nFoundCamera -1], mCameraSec[vIterationSet[i]->nFoundCamera - 1].get());
+                                        vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->TData.v3WorldPos, posesecCamFromWorld[vIterationSet[i]->nFoundCamera -1], mCameraSec[vIterationSet[i]->nFoundCamera - 1].get());
 //                                    else
 //                                        vIterationSet[i]->TData.bFound = false;
                                 }else
                                 {
                                     if (vIterationSet[i]->nFoundCamera)// second img
-                                        vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->v3WorldPos, posesecCamFromWorld[vIterationSet[i]->nFoundCamera -1], mCameraSec[vIterationSet[i]->nFoundCamera -1].get());
+                                        vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->TData.v3WorldPos, posesecCamFromWorld[vIterationSet[i]->nFoundCamera -1], mCameraSec[vIterationSet[i]->nFoundCamera -1].get());
                                     else
-                                        vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->v3WorldPos, mse3CamFromWorld, mCamera.get());
+                                        vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->TData.v3WorldPos, mse3CamFromWorld, mCamera.get());
                                 }
                             }
                     }
@@ -1590,9 +1574,9 @@ void Tracker::TrackMap()
                     for(unsigned int i=0; i<vIterationSet.size(); i++)
                         if(vIterationSet[i]->TData.bFound){
                             if (vIterationSet[i]->nFoundCamera)// second img
-                                vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->v3WorldPos, posesecCamFromWorld[vIterationSet[i]->nFoundCamera - 1], mCameraSec[vIterationSet[i]->nFoundCamera - 1].get());
+                                vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->TData.v3WorldPos, posesecCamFromWorld[vIterationSet[i]->nFoundCamera - 1], mCameraSec[vIterationSet[i]->nFoundCamera - 1].get());
                             else
-                                vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->v3WorldPos, mse3CamFromWorld, mCamera.get());
+                                vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->TData.v3WorldPos, mse3CamFromWorld, mCamera.get());
                         }
                 }
                 for(unsigned int i=0; i<vIterationSet.size(); i++)
@@ -1633,6 +1617,14 @@ void Tracker::TrackMap()
     int nFineRange = 10;  // Pixel search range for the fine stage.
     if(mbDidCoarse)       // Can use a tighter search if the coarse stage was already done.
         nFineRange = 5;
+    else if(bDensePrior)  // .. or the pose came from dense alignment
+        nFineRange = *gvnDenseFineRange;
+    // The coarse stage's pose comes with a covariance of its own
+    if (mbDidCoarse){
+        Matrix<6> m6Coarse = GetPoseCovariance();
+        if (m6Coarse(0, 0) > 0.0)
+            m6SearchCovariance = m6Coarse;
+    }
 
     // What patches shall we use this time? The high-level ones are quite important,
     // so do all of these, with sub-pixel refinement.
@@ -1640,10 +1632,12 @@ void Tracker::TrackMap()
     if (mbDidCoarse){
         for(unsigned int i=0; i<avPVS[l].size(); i++)
             if (avPVS[l][i]->nFoundCamera)// second img
-                avPVS[l][i]->TData.ProjectAndDerivs(avPVS[l][i]->v3WorldPos, posesecCamFromWorld[avPVS[l][i]->nFoundCamera - 1], mCameraSec[avPVS[l][i]->nFoundCamera - 1].get());
+                avPVS[l][i]->TData.ProjectAndDerivs(avPVS[l][i]->TData.v3WorldPos, posesecCamFromWorld[avPVS[l][i]->nFoundCamera - 1], mCameraSec[avPVS[l][i]->nFoundCamera - 1].get());
             else
-                avPVS[l][i]->TData.ProjectAndDerivs(avPVS[l][i]->v3WorldPos, mse3CamFromWorld, mCamera.get());
+                avPVS[l][i]->TData.ProjectAndDerivs(avPVS[l][i]->TData.v3WorldPos, mse3CamFromWorld, mCamera.get());
     }
+    if (bAdaptiveSearch)
+        SetSearchRanges(avPVS[l], m6SearchCovariance);
     SearchForPoints(avPVS[l], nFineRange, 8);
     for(unsigned int i=0; i<avPVS[l].size(); i++)
         vIterationSet.push_back(avPVS[l][i]);  // Again, plonk all searched points onto the (maybe already populate) vIterationSet.
@@ -1653,10 +1647,12 @@ void Tracker::TrackMap()
             if (mbDidCoarse)
                 for(unsigned int i=0; i<avPVSsec[cn][l].size(); i++){
                     if (avPVSsec[cn][l][i]->nFoundCamera)// second img
-                        avPVSsec[cn][l][i]->TData.ProjectAndDerivs(avPVSsec[cn][l][i]->v3WorldPos, posesecCamFromWorld[avPVSsec[cn][l][i]->nFoundCamera - 1], mCameraSec[avPVSsec[cn][l][i]->nFoundCamera - 1].get());
+                        avPVSsec[cn][l][i]->TData.ProjectAndDerivs(avPVSsec[cn][l][i]->TData.v3WorldPos, posesecCamFromWorld[avPVSsec[cn][l][i]->nFoundCamera - 1], mCameraSec[avPVSsec[cn][l][i]->nFoundCamera - 1].get());
                     else
-                        avPVSsec[cn][l][i]->TData.ProjectAndDerivs(avPVSsec[cn][l][i]->v3WorldPos, mse3CamFromWorld, mCamera.get());
+                        avPVSsec[cn][l][i]->TData.ProjectAndDerivs(avPVSsec[cn][l][i]->TData.v3WorldPos, mse3CamFromWorld, mCamera.get());
                 }
+            if (bAdaptiveSearch)
+                SetSearchRanges(avPVSsec[cn][l], m6SearchCovariance);
             SearchForPoints(avPVSsec[cn][l], nFineRange, 8, 1);
             for(unsigned int i=0; i<avPVSsec[cn][l].size(); i++)
                 vIterationSet.push_back(avPVSsec[cn][l][i]);  // Again, plonk all searched points onto the (maybe already populate) vIterationSet.
@@ -1675,9 +1671,9 @@ void Tracker::TrackMap()
                     vNextToSearchsec[cn].push_back(avPVSsec[cn][l][i]);
         }
 
-    // But we haven't got CPU to track _all_ patches in the map - arbitrarily limit
-    // ourselves to 1000, and choose these randomly.
-    // * randomly chose points from both img
+    // But we haven't got CPU to track _all_ patches in the map - limit ourselves
+    // to Tracker.MaxPatchesPerFrame per camera. SchedulePVS() has already done
+    // so, by priority; otherwise choose these randomly.
     int numFirstcam = 0;
     int numSeccam = 0;/// a vector when more than one addcam
     for (int i = 0; i < vIterationSet.size(); i ++){
@@ -1686,19 +1682,27 @@ void Tracker::TrackMap()
         else
             numFirstcam ++;
     }
-    static gvar3<int> gvnMaxPatchesPerFrame("Tracker.MaxPatchesPerFrame", 1000, SILENT);
     int nFinePatchesToUse = *gvnMaxPatchesPerFrame - numFirstcam;//vIterationSet.size();
     if(nFinePatchesToUse < 0)
         nFinePatchesToUse = 0;
-    if((int) vNextToSearch.size() > nFinePatchesToUse)
-    {
+    // Ordered even when all are used, so that what the time budget cuts off
+    // the end is the least useful, or a random few, rather than the finest level.
+    if (*gvnPrioritisePVS)
+        sort(vNextToSearch.begin(), vNextToSearch.end(), BySchedule);
+    else
         random_shuffle(vNextToSearch.begin(), vNextToSearch.end());
+    if((int) vNextToSearch.size() > nFinePatchesToUse)
         vNextToSearch.resize((int) nFinePatchesToUse); // Chop!
-    };
     // and the second img, each chose nFinePatchesToUse/2
     nFinePatchesToUse = *gvnMaxPatchesPerFrame - numSeccam;
     for (int cn = 0; cn < AddCamNumber; cn ++)
-        if(mUsingDualImg && (int) vNextToSearchsec[cn].size() > nFinePatchesToUse)// nFinePatchesToUse/2
+        if(mUsingDualImg && *gvnPrioritisePVS)
+        {
+            sort(vNextToSearchsec[cn].begin(), vNextToSearchsec[cn].end(), BySchedule);
+            if((int) vNextToSearchsec[cn].size() > nFinePatchesToUse)
+                vNextToSearchsec[cn].resize((int) nFinePatchesToUse); // Chop!
+        }
+        else if(mUsingDualImg && (int) vNextToSearchsec[cn].size() > nFinePatchesToUse)// nFinePatchesToUse/2
         {
             random_shuffle(vNextToSearchsec[cn].begin(), vNextToSearchsec[cn].end());
             // TODO: sort the set accordinig to its distance to the camera
@@ -1710,23 +1714,38 @@ void Tracker::TrackMap()
     {
         for(unsigned int i=0; i<vNextToSearch.size(); i++){
             if (vNextToSearch[i]->nFoundCamera)// second img
-                vNextToSearch[i]->TData.ProjectAndDerivs(vNextToSearch[i]->v3WorldPos, posesecCamFromWorld[vNextToSearch[i]->nFoundCamera - 1], mCameraSec[vNextToSearch[i]->nFoundCamera - 1].get());
+                vNextToSearch[i]->TData.ProjectAndDerivs(vNextToSearch[i]->TData.v3WorldPos, posesecCamFromWorld[vNextToSearch[i]->nFoundCamera - 1], mCameraSec[vNextToSearch[i]->nFoundCamera - 1].get());
             else
-                vNextToSearch[i]->TData.ProjectAndDerivs(vNextToSearch[i]->v3WorldPos, mse3CamFromWorld, mCamera.get());
+                vNextToSearch[i]->TData.ProjectAndDerivs(vNextToSearch[i]->TData.v3WorldPos, mse3CamFromWorld, mCamera.get());
         }
         if (mUsingDualImg){
             for (int cn = 0; cn < AddCamNumber; cn ++)
                 for(unsigned int i=0; i<vNextToSearchsec[cn].size(); i++){
                     if (vNextToSearchsec[cn][i]->nFoundCamera)// second img
-                        vNextToSearchsec[cn][i]->TData.ProjectAndDerivs(vNextToSearchsec[cn][i]->v3WorldPos, posesecCamFromWorld[vNextToSearchsec[cn][i]->nFoundCamera - 1], mCameraSec[vNextToSearchsec[cn][i]->nFoundCamera - 1].get());
+                        vNextToSearchsec[cn][i]->TData.ProjectAndDerivs(vNextToSearchsec[cn][i]->TData.v3WorldPos, posesecCamFromWorld[vNextToSearchsec[cn][i]->nFoundCamera - 1], mCameraSec[vNextToSearchsec[cn][i]->nFoundCamera - 1].get());
                     else
-                        vNextToSearchsec[cn][i]->TData.ProjectAndDerivs(vNextToSearchsec[cn][i]->v3WorldPos, mse3CamFromWorld, mCamera.get());
+                        vNextToSearchsec[cn][i]->TData.ProjectAndDerivs(vNextToSearchsec[cn][i]->TData.v3WorldPos, mse3CamFromWorld, mCamera.get());
                 }
         }
     }
 
-    // Find fine points in image:
-    SearchForPoints(vNextToSearch, nFineRange, 0);
+    if (bAdaptiveSearch){
+        SetSearchRanges(vNextToSearch, m6SearchCovariance);
+        if (mUsingDualImg)
+            for (int cn = 0; cn < AddCamNumber; cn ++)
+                SetSearchRanges(vNextToSearchsec[cn], m6SearchCovariance);
+    }
+
+    // Find fine points in image, for as long as there is time; but
+    // at least Tracker.SearchMinFound of them, whatever it takes.
+    int nEnough = -1;
+    if (*gvdSearchBudget > 0.0){
+        int nFoundSoFar = 0;
+        for (unsigned int i = 0; i < vIterationSet.size(); i ++)
+            nFoundSoFar += vIterationSet[i]->TData.bFound;
+        nEnough = max(*gvnSearchMinFound - nFoundSoFar, 0);
+    }
+    SearchForPoints(vNextToSearch, nFineRange, 0, 0, nEnough);
     for(unsigned int i=0; i<vNextToSearch.size(); i++)
         if (vNextToSearch[i]->TData.bFound)//yang
             vIterationSet.push_back(vNextToSearch[i]);
@@ -1735,7 +1754,7 @@ void Tracker::TrackMap()
     for (int cn = 0; cn < AddCamNumber; cn ++)
         if (mUsingDualImg && vNextToSearchsec[cn].size())
         {
-            SearchForPoints(vNextToSearchsec[cn], nFineRange, 0, 1);
+            SearchForPoints(vNextToSearchsec[cn], nFineRange, 0, 1, nEnough);
             // And attach them all to the end of the optimisation-set.
             for(unsigned int i=0; i<vNextToSearchsec[cn].size(); i++)
                 if (vNextToSearchsec[cn][i]->TData.bFound)
@@ -1776,15 +1795,15 @@ void Tracker::TrackMap()
                     {
                         if (use_seccam_track){//if only try using second img
                             if (vIterationSet[i]->nFoundCamera)// second img
-                                vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->v3WorldPos, posesecCamFromWorld[vIterationSet[i]->nFoundCamera - 1], mCameraSec[vIterationSet[i]->nFoundCamera - 1].get());
+                                vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->TData.v3WorldPos, posesecCamFromWorld[vIterationSet[i]->nFoundCamera - 1], mCameraSec[vIterationSet[i]->nFoundCamera - 1].get());
 //                            else
 //                                vIterationSet[i]->TData.bFound = false;
                         }else
                         {
                             if (vIterationSet[i]->nFoundCamera)// second img
-                                vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->v3WorldPos, posesecCamFromWorld[vIterationSet[i]->nFoundCamera - 1], mCameraSec[vIterationSet[i]->nFoundCamera - 1].get());
+                                vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->TData.v3WorldPos, posesecCamFromWorld[vIterationSet[i]->nFoundCamera - 1], mCameraSec[vIterationSet[i]->nFoundCamera - 1].get());
                             else
-                                vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->v3WorldPos, mse3CamFromWorld, mCamera.get());
+                                vIterationSet[i]->TData.ProjectAndDerivs(vIterationSet[i]->TData.v3WorldPos, mse3CamFromWorld, mCamera.get());
                         }
                     }
             }
@@ -1890,6 +1909,13 @@ void Tracker::TrackMap()
         }
     };
 
+    // Keep the pose's covariance for the next frame's search ranges. CalcPoseUpdate()
+    // leaves the last system in wls only if it had measurements.
+    int nFoundFinal = 0;
+    for (unsigned int i = 0; i < vIterationSet.size(); i ++)
+        nFoundFinal += vIterationSet[i]->TData.bFound;
+    mmCovariances = nFoundFinal ? GetPoseCovariance() : Matrix<6>(Zeros);
+
     // Update the current keyframe with info on what was found in the frame.
     // Strictly speaking this is unnecessary to do every frame, it'll only be
     // needed if the KF gets added to MapMaker. Do it anyway.
@@ -2028,11 +2054,87 @@ Matrix<6, 6> Tracker::GetPoseCovariance() const {
     //            return decomp;
 }
 
+// Orders the potentially visible points of one camera for searching, and
+// keeps no more than nBudget of them, spread over the image, see
+// FeatureBudget. A point's priority is its inlier ratio in the frames which
+// measured it so far, a new point counting as half an inlier; more for the
+// coarser levels, which the tracker relies on most; and more where the frame
+// has depth at the point. Each level of avPVS is left in search order, and
+// every point kept has its place in TData.nScheduleRank.
+void Tracker::SchedulePVS(vector<boost::shared_ptr<MapPoint> > avPVS[LEVELS], const KeyFrame &kf, unsigned int nBudget)
+{
+    static gvar3<double> gvdLevelWeight("Tracker.PVSLevelWeight", 0.25, SILENT);  // Priority gained per level up
+    static gvar3<double> gvdDepthWeight("Tracker.PVSDepthWeight", 0.25, SILENT);  // .. and with depth
+    const bool bDepth = kf.depthImage.totalsize() > 0;
+    mFeatureBudget.Clear(kf.aLevels[0].im.size());
+    mvpScheduleCandidates.clear();
+    for(int l=0; l<LEVELS; l++)
+        for(unsigned int i=0; i<avPVS[l].size(); i++)
+        {
+            const MapPoint &p = *avPVS[l][i];
+            const TrackerData &TD = p.TData;
+            double dPriority = (p.nMEstimatorInlierCount + 1.0) / (p.nMEstimatorInlierCount + p.nMEstimatorOutlierCount + 2.0);
+            dPriority *= 1.0 + *gvdLevelWeight * l;
+            if (bDepth){
+                ImageRef irPos = ir(TD.v2Image);
+                if (kf.depthImage.in_image(irPos) && kf.depthImage[irPos] > 0)
+                    dPriority *= 1.0 + *gvdDepthWeight;
+            }
+            mFeatureBudget.Add(TD.v2Image, dPriority);
+            mvpScheduleCandidates.push_back(avPVS[l][i]);
+        }
+
+    mvnScheduled.clear();
+    mFeatureBudget.Select(nBudget, mvnScheduled);
+    for(int l=0; l<LEVELS; l++)
+        avPVS[l].clear();
+    for(unsigned int r=0; r<mvnScheduled.size(); r++)
+    {
+        const boost::shared_ptr<MapPoint> &p = mvpScheduleCandidates[mvnScheduled[r]];
+        p->TData.nScheduleRank = r;
+        avPVS[p->TData.nSearchLevel].push_back(p);
+    }
+    mvpScheduleCandidates.clear();
+}
+
+// The covariance of the motion model's pose: that of the last frame's pose,
+// plus what the motion model may have got wrong, i.e. an acceleration's
+// worth and a part of the velocity it assumed. Like the motion model, this
+// goes by frames, not time.
+Matrix<6> Tracker::PredictPoseCovariance() const
+{
+    static gvar3<double> gvdMotionNoiseTrans("Tracker.MotionNoiseTrans", 0.002, SILENT);  // [m] per frame
+    static gvar3<double> gvdMotionNoiseRot("Tracker.MotionNoiseRot", 0.002, SILENT);      // [rad] per frame
+    static gvar3<double> gvdMotionNoiseVelocity("Tracker.MotionNoiseVelocity", 0.3, SILENT);  // Relative to the velocity
+    return SearchRange::PredictPoseCovariance(mmCovariances, mv6CameraVelocity,
+                                              *gvdMotionNoiseTrans, *gvdMotionNoiseRot, *gvdMotionNoiseVelocity);
+}
+
+// Sets each point's search radius to Tracker.SearchSigmas standard deviations
+// of where the pose covariance puts it in the image, along the axis of most
+// uncertainty (see SearchRange::Radius()), and at least
+// Tracker.MinSearchRange. SearchForPoints() caps it at the stage's range.
+// The points must have been projected, with derivatives, in this frame.
+void Tracker::SetSearchRanges(vector<boost::shared_ptr<MapPoint> > &vTD, const Matrix<6> &m6Covariance)
+{
+    static gvar3<double> gvdSearchSigmas("Tracker.SearchSigmas", 3.0, SILENT);
+    static gvar3<int> gvnMinSearchRange("Tracker.MinSearchRange", 3, SILENT);
+    for(unsigned int i=0; i<vTD.size(); i++)
+    {
+        TrackerData &TD = vTD[i]->TData;
+        if (vTD[i]->nFoundCamera)
+            TD.CalcJacobiansec(mse3Cam1FromCam2[vTD[i]->nFoundCamera - 1].inverse());
+        else
+            TD.CalcJacobian();
+        TD.nSearchRange = SearchRange::Radius(TD.m26Jacobian, m6Covariance, *gvdSearchSigmas, *gvnMinSearchRange);
+    }
+}
+
 // Find points in the image. Uses the PatchFinder struct stored in TrackerData
 // yang, should be able to search in individual dual image.
 // we should not attempt to search for map points, produced by one-camera images,
 // in another one-camera images
-int Tracker::SearchForPoints(vector<boost::shared_ptr<MapPoint> >& vTD, int nRange, int nSubPixIts, int nCamera)
+int Tracker::SearchForPoints(vector<boost::shared_ptr<MapPoint> >& vTD, int nRange, int nSubPixIts, int nCamera, int nEnough)
 {
     static gvar3<int> gvnUseDepthTracking("Tracker.UseDepth",0,SILENT);
     static gvar3<int> gvnUse3DTracking("Tracker.Use3D",0,SILENT);
@@ -2040,6 +2142,10 @@ int Tracker::SearchForPoints(vector<boost::shared_ptr<MapPoint> >& vTD, int nRan
 
     for(unsigned int i=0; i<vTD.size(); i++)   // for each point..
     {
+        // Out of time? The rest stay unsearched, if enough have been found.
+        if(nEnough >= 0 && nFound >= nEnough && (i & 15) == 0 && timer.get_time() > mdSearchDeadline)
+            break;
+
         // First, attempt a search at pixel locations which are FAST corners.
         // (PatchFinder::FindPatchCoarse)
         TrackerData &TD = vTD[i]->TData;
@@ -2052,11 +2158,14 @@ int Tracker::SearchForPoints(vector<boost::shared_ptr<MapPoint> >& vTD, int nRan
         }
         manMeasAttempted[Finder.GetLevel()]++;  // Stats for tracking quality assessment
 
+        int nPointRange = nRange;
+        if (TD.nSearchRange > 0 && TD.nSearchRange < nRange)
+            nPointRange = TD.nSearchRange;
         bool bFound = false;
         if (!vTD[i]->nFoundCamera)
-            bFound = Finder.FindPatchCoarse(ir(TD.v2Image), *mCurrentKF, nRange);
+            bFound = Finder.FindPatchCoarse(ir(TD.v2Image), *mCurrentKF, nPointRange);
         else// search on the second image
-            bFound = Finder.FindPatchCoarse(ir(TD.v2Image), *mCurrentKFsec[vTD[i]->nFoundCamera - 1], nRange);
+            bFound = Finder.FindPatchCoarse(ir(TD.v2Image), *mCurrentKFsec[vTD[i]->nFoundCamera - 1], nPointRange);
         TD.bSearched = true;
         if(!bFound)
         {
@@ -2102,9 +2211,9 @@ int Tracker::SearchForPoints(vector<boost::shared_ptr<MapPoint> >& vTD, int nRan
 
         if ((TD.dFoundDepth > 0.0)&& TD.dFoundDepth < mMaxDepth) {
             if (!vTD[i]->nFoundCamera)
-                TD.v3Found = TD.dFoundDepth*unproject(mCamera->UnProject(ir(TD.v2Found)));
+                TD.v3Found = TD.dFoundDepth*unproject(mCamera->UnProjectPixel(ir(TD.v2Found)));
             else
-                TD.v3Found = TD.dFoundDepth*unproject(mCameraSec[vTD[i]->nFoundCamera - 1]->UnProject(ir(TD.v2Found)));
+                TD.v3Found = TD.dFoundDepth*unproject(mCameraSec[vTD[i]->nFoundCamera - 1]->UnProjectPixel(ir(TD.v2Found)));
 
             if (*gvnUseDepthTracking == 1 || *gvnUse3DTracking == 1) {
                 static gvar3<double> gvdDepthErrorScale("Tracker.DepthErrorScale",0.0025,SILENT);
@@ -2117,42 +2226,61 @@ int Tracker::SearchForPoints(vector<boost::shared_ptr<MapPoint> >& vTD, int nRan
 };
 
 //Calculate a pose update 6-vector from a bunch of image measurements.
-//User-selectable M-Estimator.
+// Picks the M-estimator named by the TrackerMEstimator GVar. This is done
+// once, at construction; CalcPoseUpdate() and CalcPoseUpdateDualCam() then
+// call the pose solver specialised for that estimator.
+void Tracker::SelectMEstimator()
+{
+    static gvar3<string> gvsEstimator("TrackerMEstimator", "Tukey", SILENT);
+    if(*gvsEstimator == "Cauchy")
+    {
+        mpfCalcPoseUpdate = &Tracker::CalcPoseUpdateWith<Cauchy>;
+        mpfCalcPoseUpdateDualCam = &Tracker::CalcPoseUpdateDualCamWith<Cauchy>;
+    }
+    else if(*gvsEstimator == "Huber")
+    {
+        mpfCalcPoseUpdate = &Tracker::CalcPoseUpdateWith<Huber>;
+        mpfCalcPoseUpdateDualCam = &Tracker::CalcPoseUpdateDualCamWith<Huber>;
+    }
+    else if(*gvsEstimator == "LeastSquares")
+    {
+        mpfCalcPoseUpdate = &Tracker::CalcPoseUpdateWith<LeastSquares>;
+        mpfCalcPoseUpdateDualCam = &Tracker::CalcPoseUpdateDualCamWith<LeastSquares>;
+    }
+    else
+    {
+        if(*gvsEstimator != "Tukey")
+        {
+            cout << "Invalid TrackerMEstimator, choices are Tukey, Cauchy, Huber, LeastSquares" << endl;
+            *gvsEstimator = "Tukey";
+        }
+        mpfCalcPoseUpdate = &Tracker::CalcPoseUpdateWith<Tukey>;
+        mpfCalcPoseUpdateDualCam = &Tracker::CalcPoseUpdateDualCamWith<Tukey>;
+    }
+}
+
+//Calculates the pose update vector from the measurements, using the
+//M-Estimator picked by SelectMEstimator().
 //Normally this robustly estimates a sigma-squared for all the measurements
 //to reduce outlier influence, but this can be overridden if
 //dOverrideSigma is positive. Also, bMarkOutliers set to true
 //records any instances of a point being marked an outlier measurement
 //by the Tukey MEstimator.
-Vector<6> Tracker::CalcPoseUpdate(vector<boost::shared_ptr<MapPoint> > vTD, double dOverrideSigma, bool bMarkOutliers, bool debug)
+template<class MEstimator>
+Vector<6> Tracker::CalcPoseUpdateWith(const vector<boost::shared_ptr<MapPoint> > &vTD, double dOverrideSigma, bool bMarkOutliers, bool debug)
 {
     static  gvar3<int> gvnUseDepthTracking("Tracker.UseDepth",0,SILENT);
     static gvar3<int> gvnUse3DTracking("Tracker.Use3D",0,SILENT);
     static gvar3<int> gvnUseDiffMEstimate("Tracker.UseDiffMEstimate",0,SILENT);
     static bool bUseDiffMEstimate = *gvnUseDiffMEstimate && *gvnUseDepthTracking;
-
-
-    // Which M-estimator are we using?
-    int nEstimator = 0;
-    static gvar3<string> gvsEstimator("TrackerMEstimator", "Tukey", SILENT);
-    if(*gvsEstimator == "Tukey")
-        nEstimator = 0;
-    else if(*gvsEstimator == "Cauchy")
-        nEstimator = 1;
-    else if(*gvsEstimator == "Huber")
-        nEstimator = 2;
-    else if(*gvsEstimator == "LeastSquares")
-        nEstimator = 3;
-    else
-    {
-        cout << "Invalid TrackerMEstimator, choices are Tukey, Cauchy, Huber, LeastSquares" << endl;
-        nEstimator = 0;
-        *gvsEstimator = "Tukey";
-    };
+    const bool bUseDepthTracking = (*gvnUseDepthTracking == 1);
+    const bool bUse3D = (*gvnUse3DTracking == 1);
 
     // Find the covariance-scaled reprojection error for each measurement.
     // Also, store the square of these quantities for M-Estimator sigma squared estimation.
-    vector<double> vdErrorSquared;
-    vector<double> vdErrorSquaredDepth;
+    // (Depth errors only go in here if they're not weighted separately.)
+    vector<double> &vdErrorSquared = mvdErrorSquared;
+    vdErrorSquared.clear();
     for(unsigned int f=0; f<vTD.size(); f++)
     {
         TrackerData &TD = vTD[f]->TData;
@@ -2162,16 +2290,15 @@ Vector<6> Tracker::CalcPoseUpdate(vector<boost::shared_ptr<MapPoint> > vTD, doub
             continue;
 
         TD.v2Error_CovScaled = TD.dSqrtInvNoise* (TD.v2Found - TD.v2Image);
-        if (*gvnUseDepthTracking == 1 && TD.dFoundDepth > 0.0) {
+        if (bUseDepthTracking && TD.dFoundDepth > 0.0) {
             // 2d error:
             vdErrorSquared.push_back(TD.v2Error_CovScaled * TD.v2Error_CovScaled);
             // depth error:
-            double depthError_CovScaled = TD.dSqrtInvDepthNoise*(TD.dFoundDepth - TD.v3Cam[2]);
-            if (!bUseDiffMEstimate)
+            if (!bUseDiffMEstimate) {
+                double depthError_CovScaled = TD.dSqrtInvDepthNoise*(TD.dFoundDepth - TD.v3Cam[2]);
                 vdErrorSquared.push_back(depthError_CovScaled*depthError_CovScaled);
-            else
-                vdErrorSquaredDepth.push_back(depthError_CovScaled*depthError_CovScaled);
-        } else if (*gvnUse3DTracking == 1 && TD.dFoundDepth > 0.0) {
+            }
+        } else if (bUse3D && TD.dFoundDepth > 0.0) {
             TD.v3Error_CovScaled = (TD.dSqrtInvDepthNoise+TD.dSqrtInvNoise)*(TD.v3Found - TD.v3Cam);
             vdErrorSquared.push_back(TD.v3Error_CovScaled * TD.v3Error_CovScaled);
         } else {
@@ -2185,25 +2312,10 @@ Vector<6> Tracker::CalcPoseUpdate(vector<boost::shared_ptr<MapPoint> > vTD, doub
 
     // What is the distribution of errors?
     double dSigmaSquared;
-    double dSigmaSquaredDepth;
     if(dOverrideSigma > 0)
         dSigmaSquared = dOverrideSigma; // Bit of a waste having stored the vector of square errors in this case!
     else
-    {
-        if (nEstimator == 0){
-            dSigmaSquared = Tukey::FindSigmaSquared(vdErrorSquared);
-            if (bUseDiffMEstimate && vdErrorSquaredDepth.size()>0)
-                dSigmaSquaredDepth = Tukey::FindSigmaSquared(vdErrorSquaredDepth);
-        }
-        else if(nEstimator == 1)
-            dSigmaSquared = Cauchy::FindSigmaSquared(vdErrorSquared);
-        else if(nEstimator == 2)
-            dSigmaSquared = Huber::FindSigmaSquared(vdErrorSquared);
-        else if (nEstimator == 3)
-            dSigmaSquared = LeastSquares::FindSigmaSquared(vdErrorSquared);
-        else
-            assert(false);
-    }
+        dSigmaSquared = MEstimator::FindSigmaSquared(vdErrorSquared);
 
     // The TooN WLSCholesky class handles reweighted least squares.
     // It just needs errors and jacobians.
@@ -2218,36 +2330,14 @@ Vector<6> Tracker::CalcPoseUpdate(vector<boost::shared_ptr<MapPoint> > vTD, doub
         if (!vTD[f]->nSourceCamera && debug)
             continue;
 
+        bool bUse3DTracking = bUse3D && (TD.dFoundDepth > 0.0);
         double dErrorSq;
-        double dWeight;
-        double dErrorSqDepth;
-        double dWeightDepth;
-
-        bool bUse3DTracking = (*gvnUse3DTracking == 1) && (TD.dFoundDepth > 0.0);
-        bool bUseDiffErr = bUseDiffMEstimate && (TD.dFoundDepth > 0.0);
-
-        if (bUse3DTracking) {
-            Vector<3> &v3 = TD.v3Error_CovScaled;
-            dErrorSq = v3 * v3;
-            //std::cout << "using 3d" << std::endl;
-        } else {
-            Vector<2> &v2 = TD.v2Error_CovScaled;
-            dErrorSq = v2 * v2;
-        }
-
-        if(nEstimator == 0)
-            dWeight= Tukey::Weight(dErrorSq, dSigmaSquared);
-        else if(nEstimator == 1)
-            dWeight= Cauchy::Weight(dErrorSq, dSigmaSquared);
-        else if (nEstimator == 2)
-            dWeight= Huber::Weight(dErrorSq, dSigmaSquared);
-        else if (nEstimator == 3)
-            dWeight= LeastSquares::Weight(dErrorSq, dSigmaSquared);
+        if (bUse3DTracking)
+            dErrorSq = TD.v3Error_CovScaled * TD.v3Error_CovScaled;
         else
-            assert(false);
+            dErrorSq = TD.v2Error_CovScaled * TD.v2Error_CovScaled;
 
-//        if (vTD[f]->nSourceCamera) /// TODO: remove this line!
-//            dWeight = dWeight *0.6;
+        double dWeight = MEstimator::Weight(dErrorSq, dSigmaSquared);
 
         // Inlier/outlier accounting, only really works for cut-off estimators such as Tukey.
         if(dWeight == 0.0)
@@ -2280,32 +2370,18 @@ Vector<6> Tracker::CalcPoseUpdate(vector<boost::shared_ptr<MapPoint> > vTD, doub
 }
 
 //output vector: pose update + cam2cam calibration error update
-Vector<12> Tracker::CalcPoseUpdateDualCam(vector<boost::shared_ptr<MapPoint> > vTD, double dOverrideSigma, bool bMarkOutliers, bool debug)
+template<class MEstimator>
+Vector<12> Tracker::CalcPoseUpdateDualCamWith(const vector<boost::shared_ptr<MapPoint> > &vTD, double dOverrideSigma, bool bMarkOutliers, bool debug)
 {
     static  gvar3<int> gvnUseDepthTracking("Tracker.UseDepth",0,SILENT);
     static gvar3<int> gvnUse3DTracking("Tracker.Use3D",0,SILENT);
-
-    // Which M-estimator are we using?
-    int nEstimator = 0;
-    static gvar3<string> gvsEstimator("TrackerMEstimator", "Tukey", SILENT);
-    if(*gvsEstimator == "Tukey")
-        nEstimator = 0;
-    else if(*gvsEstimator == "Cauchy")
-        nEstimator = 1;
-    else if(*gvsEstimator == "Huber")
-        nEstimator = 2;
-    else if(*gvsEstimator == "LeastSquares")
-        nEstimator = 3;
-    else
-    {
-        cout << "Invalid TrackerMEstimator, choices are Tukey, Cauchy, Huber, LeastSquares" << endl;
-        nEstimator = 0;
-        *gvsEstimator = "Tukey";
-    };
+    const bool bUseDepthTracking = (*gvnUseDepthTracking == 1);
+    const bool bUse3D = (*gvnUse3DTracking == 1);
 
     // Find the covariance-scaled reprojection error for each measurement.
     // Also, store the square of these quantities for M-Estimator sigma squared estimation.
-    vector<double> vdErrorSquared;
+    vector<double> &vdErrorSquared = mvdErrorSquared;
+    vdErrorSquared.clear();
     for(unsigned int f=0; f<vTD.size(); f++)
     {
         TrackerData &TD = vTD[f]->TData;
@@ -2315,13 +2391,13 @@ Vector<12> Tracker::CalcPoseUpdateDualCam(vector<boost::shared_ptr<MapPoint> > v
             continue;
 
         TD.v2Error_CovScaled = TD.dSqrtInvNoise* (TD.v2Found - TD.v2Image);
-        if (*gvnUseDepthTracking == 1 && TD.dFoundDepth > 0.0) {
+        if (bUseDepthTracking && TD.dFoundDepth > 0.0) {
             // 2d error:
             vdErrorSquared.push_back(TD.v2Error_CovScaled * TD.v2Error_CovScaled);
             // depth error:
             double depthError_CovScaled = TD.dSqrtInvDepthNoise*(TD.dFoundDepth - TD.v3Cam[2]);
             vdErrorSquared.push_back(depthError_CovScaled*depthError_CovScaled);
-        } else if (*gvnUse3DTracking == 1 && TD.dFoundDepth > 0.0) {
+        } else if (bUse3D && TD.dFoundDepth > 0.0) {
             TD.v3Error_CovScaled = (TD.dSqrtInvDepthNoise+TD.dSqrtInvNoise)*(TD.v3Found - TD.v3Cam);
             vdErrorSquared.push_back(TD.v3Error_CovScaled * TD.v3Error_CovScaled);
         } else {
@@ -2338,18 +2414,7 @@ Vector<12> Tracker::CalcPoseUpdateDualCam(vector<boost::shared_ptr<MapPoint> > v
     if(dOverrideSigma > 0)
         dSigmaSquared = dOverrideSigma; // Bit of a waste having stored the vector of square errors in this case!
     else
-    {
-        if (nEstimator == 0)
-            dSigmaSquared = Tukey::FindSigmaSquared(vdErrorSquared);
-        else if(nEstimator == 1)
-            dSigmaSquared = Cauchy::FindSigmaSquared(vdErrorSquared);
-        else if(nEstimator == 2)
-            dSigmaSquared = Huber::FindSigmaSquared(vdErrorSquared);
-        else if (nEstimator == 3)
-            dSigmaSquared = LeastSquares::FindSigmaSquared(vdErrorSquared);
-        else
-            assert(false);
-    }
+        dSigmaSquared = MEstimator::FindSigmaSquared(vdErrorSquared);
 
     // The TooN WLSCholesky class handles reweighted least squares.
     // It just needs errors and jacobians.
@@ -2365,29 +2430,12 @@ Vector<12> Tracker::CalcPoseUpdateDualCam(vector<boost::shared_ptr<MapPoint> > v
             continue;
 
         double dErrorSq;
-        double dWeight;
-
-        bool bUse3DTracking = (*gvnUse3DTracking == 1) && (TD.dFoundDepth > 0.0);
-
-        if (bUse3DTracking) {
-            Vector<3> &v3 = TD.v3Error_CovScaled;
-            dErrorSq = v3 * v3;
-            //std::cout << "using 3d" << std::endl;
-        } else {
-            Vector<2> &v2 = TD.v2Error_CovScaled;
-            dErrorSq = v2 * v2;
-        }
-
-        if(nEstimator == 0)
-            dWeight= Tukey::Weight(dErrorSq, dSigmaSquared);
-        else if(nEstimator == 1)
-            dWeight= Cauchy::Weight(dErrorSq, dSigmaSquared);
-        else if (nEstimator == 2)
-            dWeight= Huber::Weight(dErrorSq, dSigmaSquared);
-        else if (nEstimator == 3)
-            dWeight= LeastSquares::Weight(dErrorSq, dSigmaSquared);
+        if (bUse3D && TD.dFoundDepth > 0.0)
+            dErrorSq = TD.v3Error_CovScaled * TD.v3Error_CovScaled;
         else
-            assert(false);
+            dErrorSq = TD.v2Error_CovScaled * TD.v2Error_CovScaled;
+
+        double dWeight = MEstimator::Weight(dErrorSq, dSigmaSquared);
 
         // Inlier/outlier accounting, only really works for cut-off estimators such as Tukey.
         if(dWeight == 0.0)
@@ -2426,6 +2474,8 @@ Vector<12> Tracker::CalcPoseUpdateDualCam(vector<boost::shared_ptr<MapPoint> > v
 void Tracker::ApplyMotionModel()
 {
     mse3StartPos = mse3CamFromWorld;
+    for (int i = 0; i < AddCamNumber; i ++)
+        mse3StartPossec[i] = mse3CamFromWorldsec[i];
     Vector<6> v6Velocity = mv6CameraVelocity;
     Vector<6> v6Velocitysec[AddCamNumber];
     for (int i = 0; i < AddCamNumber; i ++)
@@ -2483,20 +2533,20 @@ void Tracker::ApplyMotionModel_EKF()
 
 // assume speed unchanged, which could be updated upon a scale later
 // assume translation to reference kf unchanged, which should be updated upon a scale too
-void Tracker::MotionModelUpdateByGMap()
+void Tracker::MotionModelUpdateByGMap(const MapSnapshot &snapshot)
 {
 //    cout << "old current cam pose: \n" << mse3CamFromWorld << endl;
 //    trackerlog << "old current cam pose: \n" << mse3CamFromWorld << endl;
     // TODO: apply scale update when SIM3 PGO is used
-    SE3<> relpos2refkf = mse3CamFromWorld * mMapMaker.mse3LatestKFpose.inverse();
+    const MapSnapshot::Rebase &rebase = snapshot.rebase;
+    SE3<> relpos2refkf = mse3CamFromWorld * rebase.se3OldCfromW.inverse();
     SE3<> newkfpose;
     bool posefound = false;
-    for (int i = mMap.vpKeyFrames.size()-1; i >=0; i --)
-        if (mMap.vpKeyFrames[i]->id == mMapMaker.lastKFid){
-            newkfpose = mMap.vpKeyFrames[i]->se3CfromW;
-            posefound = true;
-            break;
-        }
+    const MapSnapshot::KeyFramePose *pRefKF = snapshot.FindKeyFrame(rebase.nKeyFrameId);
+    if (pRefKF){
+        newkfpose = pRefKF->se3CfromW;
+        posefound = true;
+    }
     if (posefound){
         SE3<> se3Old = mse3CamFromWorld;
         mse3CamFromWorld = relpos2refkf * newkfpose;
@@ -2506,7 +2556,7 @@ void Tracker::MotionModelUpdateByGMap()
 //        trackerlog << "Updated current cam pose: \n" << mse3CamFromWorld << endl;
 
         // and update the startpose, for velocity update
-        relpos2refkf = mse3StartPos * mMapMaker.mse3LatestKFpose.inverse();
+        relpos2refkf = mse3StartPos * rebase.se3OldCfromW.inverse();
         mse3StartPos = relpos2refkf * newkfpose;
 
         mv6CameraVelocity = Zeros;
@@ -2518,6 +2568,91 @@ void Tracker::MotionModelUpdateByGMap()
     mbJustRecoveredSoUseCoarse = true;
 }
 
+// Replaces the motion model's guess for each camera with the motion which
+// best aligns its current frame to the last one, see DenseAligner. This
+// needs depth, so mono frames keep the guess; so does a camera where the
+// alignment fails. Either way the current frames become the references
+// for the next frame. The cameras are aligned in parallel on the workers.
+void Tracker::ApplyDenseOdometry()
+{
+    static gvar3<int> gvnDenseOdometry("Tracker.DenseOdometry", 1, SILENT);  // Set this to 0 to rely on the motion model alone
+    static gvar3<int> gvnDenseFinestLevel("Tracker.DenseFinestLevel", 2, SILENT);
+    static gvar3<int> gvnDenseIterations("Tracker.DenseIterations", 4, SILENT);
+    static gvar3<double> gvdDenseMinGradient("Tracker.DenseMinGradient", 6.0, SILENT);
+    static gvar3<double> gvdDenseDepthWeight("Tracker.DenseDepthWeight", 20.0, SILENT);
+    static gvar3<int> gvnDenseMinPoints("Tracker.DenseMinPoints", 300, SILENT);
+    static gvar3<double> gvdDenseMaxError("Tracker.DenseMaxError", 20.0, SILENT);
+
+    mbDensePriorGood = false;
+    const DepthPyramid *pDepth = mpBuilder->LastDepth(0);
+    if (!*gvnDenseOdometry || !pDepth) {
+        mnDenseReferenceFrame = -2;
+        return;
+    }
+    mDenseParams.nFinestLevel = std::min(std::max(*gvnDenseFinestLevel, 0), LEVELS - 1);
+    mDenseParams.nIterations = *gvnDenseIterations;
+    mDenseParams.dMinGradient = *gvdDenseMinGradient;
+    mDenseParams.dDepthWeight = *gvdDenseDepthWeight;
+    mDenseParams.nMinPoints = *gvnDenseMinPoints;
+    mDenseParams.dMaxError = *gvdDenseMaxError;
+
+    // The frames are in the builder in the order TrackFrame() added them
+    const bool bFollows = (mnDenseReferenceFrame == mnFrame - 1);
+    mvDenseJobs.clear();
+    DenseJob job;
+    job.pAligner = mpDenseAligner.get();
+    job.pKF = mCurrentKF.get();
+    job.pDepth = pDepth;
+    job.pse3CamFromWorld = &mse3CamFromWorld;
+    job.se3StartPos = mse3StartPos;
+    job.bAlign = bFollows && mpDenseAligner->HasReference();
+    mvDenseJobs.push_back(job);
+    bool abActive[AddCamNumber] = {};
+    if (mUsingDualImg)
+        for (unsigned int i = 0; i < ActiveAdCamIndex.size(); i ++) {
+            const int cn = ActiveAdCamIndex[i];
+            job.pDepth = mpBuilder->LastDepth(i + 1);
+            if (!job.pDepth)
+                continue;
+            abActive[cn] = true;
+            job.pAligner = mpDenseAlignersec[cn].get();
+            job.pKF = mCurrentKFsec[cn].get();
+            job.pse3CamFromWorld = &mse3CamFromWorldsec[cn];
+            job.se3StartPos = mse3StartPossec[cn];
+            job.bAlign = bFollows && mpDenseAlignersec[cn]->HasReference();
+            mvDenseJobs.push_back(job);
+        }
+    // A camera without a frame now would be left with a stale reference
+    for (int i = 0; i < AddCamNumber; i ++)
+        if (!abActive[i])
+            mpDenseAlignersec[i]->ClearReference();
+
+    for (unsigned int i = 0; i < mvDenseJobs.size(); i ++) {
+        mvDenseJobs[i].se3CurFromRef = *mvDenseJobs[i].pse3CamFromWorld * mvDenseJobs[i].se3StartPos.inverse();
+        mvDenseJobs[i].bGood = false;
+    }
+    mpWorkers->ParallelFor(mvDenseJobs.size(), boost::bind(&Tracker::AlignCamera, this, _1, _2));
+    mnDenseReferenceFrame = mnFrame;
+
+    mbDensePriorGood = true;
+    for (unsigned int i = 0; i < mvDenseJobs.size(); i ++) {
+        const DenseJob &done = mvDenseJobs[i];
+        if (done.bGood)
+            *done.pse3CamFromWorld = done.se3CurFromRef * done.se3StartPos;
+        else
+            mbDensePriorGood = false;
+    }
+    mse3CamFromWorldPub = mse3CamFromWorld;
+}
+
+void Tracker::AlignCamera(int nJob, int nWorker)
+{
+    DenseJob &job = mvDenseJobs[nJob];
+    if (job.bAlign)
+        job.bGood = job.pAligner->Align(*job.pKF, *job.pDepth, mDenseParams, job.se3CurFromRef);
+    job.pAligner->SetReference(*job.pKF, *job.pDepth, mDenseParams);
+}
+
 // The motion model is entirely the tracker's, and is kept as a decaying
 // constant velocity model.
 void Tracker::UpdateMotionModel()
@@ -2570,31 +2705,69 @@ void Tracker::MotionCheck()
 // *kfs should be treated seperately, but we simply add them at the same poses
 void Tracker::AddNewKeyFrame()
 {
-    if (mUsingDualImg){
+    if (mUsingDualImg)
         for (int i = 0; i < AddCamNumber; i ++)
             if (!mCurrentKFsec[i]->bNewsec)
                 return;// Now we force the system to add kfs from multi-cam together
 
-        if (mMapMaker.AddKeyFrame(*mCurrentKF)) {
-            mnLastKeyFrameDropped = mnFrame;
-            mnKeyFrames++;
-        } // else: mapmaker chose to ignore this keyframe, e.g. because mapping is disabled
-        for (int i = 0; i < AddCamNumber; i ++) {
-            if (!mCurrentKFsec[i]->bNewsec)
-                continue;
+    // The rest of this frame, and whoever shows it after TrackFrame()
+    // returns, still read the frames; the mapmaker gets them with the next one.
+    mbKeyFramePending = true;
+}
 
-            if (mMapMaker.AddKeyFrameSec(*mCurrentKFsec[i])){
-                mnLastKeyFrameDropped = mnFrame;
-                mnKeyFramessec[i]++;
-            }
+// Called first thing in TrackFrame(), before the frames are overwritten:
+// the frames picked last time go to the mapmaker as they are, no copies,
+// and tracking carries on in frames from the pool.
+void Tracker::HandOverKeyFrame()
+{
+    if (!mbKeyFramePending)
+        return;
+    mbKeyFramePending = false;
+
+    bool bAdded;
+    if (mUsingDualImg)
+        bAdded = mMapMaker.AddKeyFrame(mCurrentKF, mCurrentKFsec);
+    else
+        bAdded = mMapMaker.AddKeyFrame(mCurrentKF);
+    if (!bAdded)
+        return; // mapmaker chose to ignore this keyframe, e.g. because mapping is disabled; the frames stay ours
+
+    mnLastKeyFrameDropped = mnFrame;   // Still that of the frame picked
+    mnKeyFrames++;
+    TakeFreshFrame(mCurrentKF);
+    if (mUsingDualImg)
+        for (int i = 0; i < AddCamNumber; i ++){
+            mnKeyFramessec[i]++;
+            TakeFreshFrame(mCurrentKFsec[i]);
         }
-    }
-    else {
-        if (mMapMaker.AddKeyFrame(*mCurrentKF)) {
-            mnLastKeyFrameDropped = mnFrame;
-            mnKeyFrames++;
-        } // else: mapmaker chose to ignore this keyframe, e.g. because mapping is disabled
-    }
+}
+
+void Tracker::TakeFreshFrame(boost::shared_ptr<KeyFrame> &pKF)
+{
+    boost::shared_ptr<KeyFrame> pFresh = mFramePool.Get();
+    // What carries over from one frame to the next
+    pFresh->nSourceCamera = pKF->nSourceCamera;
+    pFresh->mAssociateKeyframe = pKF->mAssociateKeyframe;
+    pFresh->rgbIsBgr_ = pKF->rgbIsBgr_;
+    pFresh->se3CfromW = pKF->se3CfromW;
+    pFresh->se3Cam2fromCam1 = pKF->se3Cam2fromCam1;
+    pFresh->dSceneDepthMean = pKF->dSceneDepthMean;
+    pFresh->dSceneDepthSigma = pKF->dSceneDepthSigma;
+    pFresh->dSceneDepthMedian = pKF->dSceneDepthMedian;
+    pKF = pFresh;
+}
+
+// Is the mapmaker keeping up with the keyframes? If it is behind,
+// more of them would only wait in its queue, or be turned away.
+bool Tracker::MapMakerAcceptsKeyFrame()
+{
+    static gvar3<int> gvnMaxQueued("Tracker.MaxQueuedKeyFrames", 3, SILENT);
+    static gvar3<double> gvdMaxQueueWait("Tracker.MaxKeyFrameQueueWait", 1.0, SILENT);
+    KeyFrameQueue::Statistics queue = mMapMaker.KeyFrameQueueStatistics();
+    if ((int) queue.nQueued >= *gvnMaxQueued)
+        return false;
+    // Slow to take them in lately: only one at a time
+    return queue.dMeanWait < *gvdMaxQueueWait || queue.nQueued == 0;
 }
 
 // Some heuristics to decide if tracking is any good, for this frame.
@@ -2666,23 +2839,140 @@ string Tracker::GetMessageForUser()
     return mMessageForUser.str();
 }
 
+// The cameras' rotations are independent, so they are found in parallel
 void Tracker::CalcSBIRotation()
 {
-    mpSBILastFrame->MakeJacs();
+    mpWorkers->ParallelFor(mUsingDualImg ? AddCamNumber + 1 : 1,
+                           boost::bind(&Tracker::CalcSBIRotationOf, this, _1, _2));
+}
+
+void Tracker::CalcSBIRotationOf(int nJob, int nWorker)
+{
+    if (nJob == 0) {
+        mpSBILastFrame->MakeJacs();
+        pair<SE2<>, double> result_pair;
+        result_pair = mpSBIThisFrame->IteratePosRelToTarget(*mpSBILastFrame, 6);
+        SE3<> se3Adjust = mpSBIThisFrame->SE3fromSE2(result_pair.first, mCamera.get());
+        mv6SBIRot = se3Adjust.ln();
+        return;
+    }
+    const int i = nJob - 1;
+    mpSBILastFramesec[i]->MakeJacs();
     pair<SE2<>, double> result_pair;
-    result_pair = mpSBIThisFrame->IteratePosRelToTarget(*mpSBILastFrame, 6);
-    SE3<> se3Adjust = SmallBlurryImage::SE3fromSE2(result_pair.first, mCamera.get());
-    mv6SBIRot = se3Adjust.ln();
+    result_pair = mpSBIThisFramesec[i]->IteratePosRelToTarget(*mpSBILastFramesec[i], 6);
+    SE3<> se3Adjust = mpSBIThisFramesec[i]->SE3fromSE2(result_pair.first, mCameraSec[i].get());
+    mv6SBIRotSec[i] = se3Adjust.ln();
+}
+
+// Loads the picture of the landing pad and starts the detector on it.
+// Without Tracker.PadDetection set, or without a picture, nothing is detected.
+void Tracker::load_reflandingpad(std::string &path)
+{
+    static gvar3<int> gvnPadDetection("Tracker.PadDetection", 0, SILENT);
+    static gvar3<double> gvdPadWidth("PadDetector.Width", 0.5, SILENT);  // Of the pad, along the picture's rows [m]
+    static gvar3<int> gvnPadFirstLevel("PadDetector.FirstLevel", 0, SILENT);
+    static gvar3<int> gvnPadLevels("PadDetector.Levels", 3, SILENT);
+    static gvar3<int> gvnPadRotations("PadDetector.Rotations", 12, SILENT);
+    static gvar3<int> gvnPadMaxHamming("PadDetector.MaxHamming", 70, SILENT);
+    static gvar3<double> gvdPadMatchRatio("PadDetector.MatchRatio", 0.8, SILENT);
+    static gvar3<int> gvnPadIterations("PadDetector.Iterations", 300, SILENT);
+    static gvar3<double> gvdPadMaxPixelError("PadDetector.MaxPixelError", 3.0, SILENT);
+    static gvar3<int> gvnPadMinInliers("PadDetector.MinInliers", 15, SILENT);
+
+    mpPadDetector.reset();
+    istrackPad = false;
+    if (!*gvnPadDetection || path.empty())
+        return;
+    Image<byte> imPad;
+    try {
+        img_load(imPad, path);
+    }
+    catch (CVD::Exceptions::All &e) {
+        cerr << "Tracker: could not load the landing pad from " << path << ": " << e.what << endl;
+        return;
+    }
+
+    // The same pyramid and corners as every frame gets
+    mReflandingpadFrame.MakeKeyFrame_Lite(imPad);
+
+    PadDetector::Params params;
+    params.nFirstLevel = std::min(std::max(*gvnPadFirstLevel, 0), LEVELS - 1);
+    params.nLevels = *gvnPadLevels;
+    params.nRotations = *gvnPadRotations;
+    params.nMaxHamming = *gvnPadMaxHamming;
+    params.dMatchRatio = *gvdPadMatchRatio;
+    params.nIterations = *gvnPadIterations;
+    params.dMaxPixelError = *gvdPadMaxPixelError;
+    params.nMinInliers = *gvnPadMinInliers;
+    mpPadDetector.reset(new PadDetector(params));
+    mpPadDetector->SetReference(mReflandingpadFrame, *gvdPadWidth);
+    istrackPad = true;
+}
 
-    if (mUsingDualImg){
-        for (int i = 0; i < AddCamNumber; i ++) {
-            mpSBILastFramesec[i]->MakeJacs();
-            pair<SE2<>, double> result_pair;
-            result_pair = mpSBIThisFramesec[i]->IteratePosRelToTarget(*mpSBILastFramesec[i], 6);
-            SE3<> se3Adjust = SmallBlurryImage::SE3fromSE2(result_pair.first, mCameraSec[i].get());
-            mv6SBIRotSec[i] = se3Adjust.ln();
+// The detector works on the frame in the background; what it found in an
+// earlier frame is taken up here, without waiting.
+void Tracker::TrackPad()
+{
+    // The frame struct is used again for the next frame unless it becomes a keyframe
+    mCurrentKF->islandingpadDetected = false;
+    mCurrentKF->mPadCorners.clear();
+    mCurrentKF->mMapPointsInPad.clear();
+    if (!mpPadDetector || !istrackPad || isFinishPadDetection)
+        return;
+    if (mTrackingQuality == GOOD)
+        mpPadDetector->Post(*mCurrentKF, *mCamera, mnFrame);
+
+    PadDetector::Detection detection;
+    if (mpPadDetector->GetLatest(mnPadSequence, detection)) {
+        mnPadSequence = detection.nSequence;
+        if (detection.bFound) {
+            mPadCenterWorld = detection.v3CentreWorld;
+            mPadCornersWorld.assign(detection.av3CornersWorld, detection.av3CornersWorld + 4);
+            Vector<3> v3CameraWorld = detection.se3CamFromWorld.inverse().get_translation();
+            if (!isLandingpadPoseGet) {
+                iniPadCenterWorld = mPadCenterWorld;
+                iniPadCameraPoseWorld = v3CameraWorld;
+                isLandingpadPoseGet = true;
+            }
+            finishPadCameraPoseWorld = v3CameraWorld;
         }
     }
+
+    // The pad stays where it was found, so every frame after is marked
+    if (isLandingpadPoseGet && mTrackingQuality == GOOD)
+        SelectPadPoints();
+}
+
+// Projects the pad's corners into the frame, and picks the measurements
+// inside in one batch.
+void Tracker::SelectPadPoints()
+{
+    if (mPadCornersWorld.size() != 4)
+        return;
+    mvv2PadOutline.clear();
+    for (int i = 0; i < 4; i++) {
+        Vector<3> v3Cam = mCurrentKF->se3CfromW * mPadCornersWorld[i];
+        if (v3Cam[2] <= 0.001)
+            return;
+        mvv2PadOutline.push_back(mCamera->Project(project(v3Cam)));
+    }
+    mPadClassifier.SetPolygon(mvv2PadOutline);
+
+    mvv2PadMeasurements.clear();
+    mvpPadCandidates.clear();
+    for (map<boost::shared_ptr<MapPoint>, Measurement>::iterator it = mCurrentKF->mMeasurements.begin();
+         it != mCurrentKF->mMeasurements.end(); it++) {
+        mvv2PadMeasurements.push_back(it->second.v2RootPos);
+        mvpPadCandidates.push_back(it->first);
+    }
+    mvnInPad.clear();
+    mPadClassifier.Select(mvv2PadMeasurements, mvnInPad);
+    for (unsigned int i = 0; i < mvnInPad.size(); i++)
+        mCurrentKF->mMapPointsInPad.push_back(mvpPadCandidates[mvnInPad[i]]);
+
+    for (int i = 0; i < 4; i++)
+        mCurrentKF->mPadCorners.push_back(cv::Point((int) (mvv2PadOutline[i][0] + 0.5), (int) (mvv2PadOutline[i][1] + 0.5)));
+    mCurrentKF->islandingpadDetected = true;
 }
 
 ImageRef TrackerData::irImageSize;  // Static member of TrackerData lives here
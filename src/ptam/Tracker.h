@@ -25,6 +25,13 @@
 #include "CameraModel.h"
 #include "MiniPatch.h"
 #include "Relocaliser.h"
+#include "WorkerPool.h"
+#include "KeyFrameBuilder.h"
+#include "FramePool.h"
+#include "DenseAligner.h"
+#include "PadDetector.h"
+#include "PolygonClassifier.h"
+#include "FeatureBudget.h"
 
 #include <sstream>
 #include <vector>
@@ -130,12 +137,14 @@ public:
       mUseDualshould = true;
   }
 
-  void MotionModelUpdateByGMap(); // update the motion model if the local map is updated with the global map
+  void MotionModelUpdateByGMap(const MapSnapshot &snapshot); // update the motion model if the local map is updated with the global map
+  unsigned int mnRebaseCount;   // MapSnapshot::Rebase::nCount the motion model was last re-based for
   bool debugmarkLoopDetected;
 
   double timecost_vo;// time cost of the VO in each image frame.
 
 protected:
+  FramePool mFramePool;                              // Frames to carry on in once the current ones go to the mapmaker
   boost::shared_ptr<KeyFrame> mCurrentKF;            // The current working frame as a keyframe struct
   boost::shared_ptr<KeyFrame> mCurrentKFsec[AddCamNumber];            // The current working frame as a keyframe struct
                                                             /// abusing "second" in this project, which means all those additional cameras
@@ -149,6 +158,10 @@ protected:
   std::auto_ptr<CameraModel> mCameraSec[AddCamNumber];             // Projection model of the second camera
                                   // transformation w.r.t the master camera need to be counted.
   Relocaliser mRelocaliser;       // Relocalisation module
+  BriefExtractor mExtractor;      // Describes the corners of lost frames for PnP relocalisation
+  boost::scoped_ptr<WorkerPool> mpWorkers;  // Makes the keyframes of all cameras of a frame in parallel, see KeyFrameBuilder
+  boost::scoped_ptr<KeyFrameBuilder> mpBuilder;  // Kept from frame to frame for its depth pyramids
+  std::vector<CVD::Image<CVD::byte> > mvimGrey;  // The RGB frames converted, one per camera; only reallocated when their size changes
 
   CVD::ImageRef mirSize;          // Image size of whole image or (0,0) if we don't know yet.
   
@@ -172,18 +185,43 @@ protected:
   void ApplyMotionModel();        // Decaying velocity motion model applied prior to TrackMap
   void ApplyMotionModel_EKF();        // Using EKF information
   void UpdateMotionModel();       // Motion model is updated after TrackMap
+  void ApplyDenseOdometry();      // Refines the motion model's guess by dense alignment to the last frame, with depth only
+  void AlignCamera(int nJob, int nWorker);  // One camera of ApplyDenseOdometry(), on the workers
   int SearchForPoints(std::vector<boost::shared_ptr<MapPoint> > &vTD, 
 		      int nRange, 
               int nFineIts,
-              int nCamera = 0);  // Finds points in the image
-  Vector<6> CalcPoseUpdate(std::vector<boost::shared_ptr<MapPoint> > vTD, 
+              int nCamera = 0,
+              int nEnough = -1);  // Finds points in the image; with nEnough >= 0, stops once that many
+                                  // are found and the frame's search time is up (mdSearchDeadline)
+  Matrix<6> PredictPoseCovariance() const;   // Of the motion model's pose, from the last frame's
+  void SetSearchRanges(std::vector<boost::shared_ptr<MapPoint> > &vTD, const Matrix<6> &m6Covariance);
+  // Orders one camera's potentially visible set for searching, and keeps at most nBudget of it
+  void SchedulePVS(std::vector<boost::shared_ptr<MapPoint> > avPVS[LEVELS], const KeyFrame &kf, unsigned int nBudget);
+  FeatureBudget mFeatureBudget;
+  std::vector<boost::shared_ptr<MapPoint> > mvpScheduleCandidates;
+  std::vector<int> mvnScheduled;
+  Vector<6> CalcPoseUpdate(const std::vector<boost::shared_ptr<MapPoint> > &vTD,
 			   double dOverrideSigma = 0.0, 
                bool bMarkOutliers = false,
-               bool debug = false); // Updates pose from found points.
-  Vector<12> CalcPoseUpdateDualCam(std::vector<boost::shared_ptr<MapPoint> > vTD,
+               bool debug = false) // Updates pose from found points.
+  { return (this->*mpfCalcPoseUpdate)(vTD, dOverrideSigma, bMarkOutliers, debug); }
+  Vector<12> CalcPoseUpdateDualCam(const std::vector<boost::shared_ptr<MapPoint> > &vTD,
                double dOverrideSigma = 0.0,
                bool bMarkOutliers = false,
-               bool debug = false); // Updates pose from found points. Also update camera-to-camera calibration error
+               bool debug = false) // Updates pose from found points. Also update camera-to-camera calibration error
+  { return (this->*mpfCalcPoseUpdateDualCam)(vTD, dOverrideSigma, bMarkOutliers, debug); }
+
+  // The pose solvers, specialised for each M-estimator (see MEstimator.h)
+  template<class MEstimator>
+  Vector<6> CalcPoseUpdateWith(const std::vector<boost::shared_ptr<MapPoint> > &vTD,
+                               double dOverrideSigma, bool bMarkOutliers, bool debug);
+  template<class MEstimator>
+  Vector<12> CalcPoseUpdateDualCamWith(const std::vector<boost::shared_ptr<MapPoint> > &vTD,
+                                       double dOverrideSigma, bool bMarkOutliers, bool debug);
+  void SelectMEstimator();  // Picks the solvers below according to the TrackerMEstimator GVar
+  Vector<6> (Tracker::*mpfCalcPoseUpdate)(const std::vector<boost::shared_ptr<MapPoint> > &, double, bool, bool);
+  Vector<12> (Tracker::*mpfCalcPoseUpdateDualCam)(const std::vector<boost::shared_ptr<MapPoint> > &, double, bool, bool);
+  std::vector<double> mvdErrorSquared;  // Squared errors for the sigma estimate, kept to avoid reallocating every iteration
 
   SE3<> mse3CamFromWorld;           // Camera pose: this is what the tracker updates every frame.
   SE3<> mse3CamFromWorldsec[AddCamNumber];           // Camera pose: this is what the tracker updates every frame.
@@ -191,14 +229,35 @@ protected:
   Vector<6> mv6cam2fromcam1Error;   // the error of calibrated cam21 transform
 
   SE3<> mse3StartPos;               // What the camera pose was at the start of the frame.
+  SE3<> mse3StartPossec[AddCamNumber];  // Likewise for the other cameras
   Vector<6> mv6CameraVelocity;    // Motion model
   Vector<6> mv6CameraVelocitysec[AddCamNumber];    // Motion model for the second cam
   double mdVelocityMagnitude;     // Used to decide on coarse tracking
   double mdMSDScaledVelocityMagnitude; // Velocity magnitude scaled by relative scene depth.
   bool mbDidCoarse;               // Did tracking use the coarse tracking stage?
 
+  // Dense frame-to-frame alignment, see ApplyDenseOdometry():
+  struct DenseJob
+  {
+    DenseAligner *pAligner;
+    const KeyFrame *pKF;
+    const DepthPyramid *pDepth;
+    SE3<> *pse3CamFromWorld;      // Pose to refine ..
+    SE3<> se3StartPos;            // .. and the one of the last frame
+    SE3<> se3CurFromRef;          // Guess in, result out
+    bool bAlign;                  // Is the reference the last frame?
+    bool bGood;
+  };
+  boost::scoped_ptr<DenseAligner> mpDenseAligner;
+  boost::scoped_ptr<DenseAligner> mpDenseAlignersec[AddCamNumber];
+  std::vector<DenseJob> mvDenseJobs;
+  DenseAligner::Params mDenseParams;  // Read by ApplyDenseOdometry(), for the workers
+  int mnDenseReferenceFrame;      // Frame the aligners' references were taken from
+  bool mbDensePriorGood;          // Did this frame's pose prior come from dense alignment?
+
   // eth
-  Matrix<6>	mmCovariances;		// covariance of current converged pose estimate
+  Matrix<6>	mmCovariances;		// covariance of current converged pose estimate; zero if there is none
+  double mdSearchDeadline;        // End of this frame's time for the fine search, see SearchForPoints()
 
   // Interface with map maker:
   int mnFrame;                    // Frames processed since last reset
@@ -212,7 +271,11 @@ protected:
   WLS<6> wls; // Weighted least square solver
   WLS<12> wls2; // Weighted least square solver when included cam2cam calibration error
 
-  void AddNewKeyFrame();          // Gives the current frame to the mapmaker to use as a keyframe
+  void AddNewKeyFrame();          // Picks the current frame for the mapmaker to use as a keyframe..
+  void HandOverKeyFrame();        // .. and gives it over once the tracker is done with it, at the next frame
+  void TakeFreshFrame(boost::shared_ptr<KeyFrame> &pKF); // Replaces a frame handed over with one from the pool
+  bool mbKeyFramePending;         // Picked, but not handed over yet
+  bool MapMakerAcceptsKeyFrame(); // Back-pressure from the mapmaker's keyframe queue
   
   // Tracking quality control:
   int manMeasAttempted[LEVELS];
@@ -231,6 +294,7 @@ protected:
   SmallBlurryImage *mpSBILastFrame;
   SmallBlurryImage *mpSBIThisFrame;
   void CalcSBIRotation();
+  void CalcSBIRotationOf(int nJob, int nWorker);  // One camera of CalcSBIRotation(), on the workers
   Vector<6> mv6SBIRot;
   // second image sbi should be calc seperately
   SmallBlurryImage * mpSBILastFramesec[AddCamNumber];
@@ -264,6 +328,17 @@ protected:
 
   ros::Time time_last_detect;// last ros time, when the last new frame is passed to mapmaker
   KeyFrame  mReflandingpadFrame;// ref image of the landing pad
+
+  // Landing pad detection, on its own thread; see load_reflandingpad()
+  void TrackPad();                // Posts the tracked frame, and takes up the latest detection
+  boost::scoped_ptr<PadDetector> mpPadDetector;
+  unsigned int mnPadSequence;     // Of the last detection taken up
+  void SelectPadPoints();         // The map points measured on the pad, for the keyframe this frame may become
+  PolygonClassifier mPadClassifier;
+  std::vector<TooN::Vector<2> > mvv2PadOutline;
+  std::vector<TooN::Vector<2> > mvv2PadMeasurements;
+  std::vector<boost::shared_ptr<MapPoint> > mvpPadCandidates;
+  std::vector<int> mvnInPad;
 };
 } // namespace
 
@@ -20,6 +20,7 @@ struct TrackerData
   PatchFinder Finder;
   
   // Projection itermediates:
+  Vector<3> v3WorldPos;   // As of the map generation pinned for this frame
   Vector<3> v3Cam;        // Coords in current cam frame
   Vector<2> v2ImPlane;    // Coords in current cam z=1 plane
   Vector<2> v2Image;      // Pixel coords in LEVEL0
@@ -30,6 +31,8 @@ struct TrackerData
   bool bPotentiallyVisible;
   
   int nSearchLevel;
+  int nSearchRange;       // From the pose covariance, in level zero pixels; 0 for the stage's own range
+  int nScheduleRank;      // Place in the order to search in, see Tracker::SchedulePVS()
   bool bSearched;
   bool bFound;
   bool bDidSubPix;
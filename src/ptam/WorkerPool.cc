@@ -0,0 +1,94 @@
+#include "WorkerPool.h"
+#include <algorithm>
+#include <boost/bind.hpp>
+
+using namespace ptam;
+
+WorkerPool::WorkerPool(int nWorkers)
+  : mnWorkers(std::max(nWorkers, 1)), mpJob(NULL), mnJobs(0), mnNextJob(0),
+    mnActive(0), mnBatch(0), mbStop(false)
+{
+  // Worker 0 is whoever calls ParallelFor(), so it doesn't get a thread of its own.
+  for(int i=1; i<mnWorkers; i++)
+    mThreads.create_thread(boost::bind(&WorkerPool::WorkerLoop, this, i));
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    boost::mutex::scoped_lock lock(mMutex);
+    mbStop = true;
+  }
+  mWakeCond.notify_all();
+  mThreads.join_all();
+}
+
+void WorkerPool::ParallelFor(int nJobs, const Job &job)
+{
+  if(nJobs <= 0)
+    return;
+
+  // Not worth waking anybody up for this.
+  if(mnWorkers == 1 || nJobs == 1)
+  {
+    for(int i=0; i<nJobs; i++)
+      job(i, 0);
+    return;
+  }
+
+  {
+    boost::mutex::scoped_lock lock(mMutex);
+    mpJob = &job;
+    mnJobs = nJobs;
+    mnNextJob = 0;
+    mnActive = mnWorkers - 1;
+    mnBatch++;
+  }
+  mWakeCond.notify_all();
+
+  RunJobs(0);
+
+  // Every pool thread has to check out of this batch before job goes out of scope.
+  boost::mutex::scoped_lock lock(mMutex);
+  while(mnActive > 0)
+    mDoneCond.wait(lock);
+  mpJob = NULL;
+}
+
+void WorkerPool::WorkerLoop(int nWorker)
+{
+  unsigned int nSeenBatch = 0;
+  while(true)
+  {
+    {
+      boost::mutex::scoped_lock lock(mMutex);
+      while(!mbStop && mnBatch == nSeenBatch)
+        mWakeCond.wait(lock);
+      if(mbStop)
+        return;
+      nSeenBatch = mnBatch;
+    }
+
+    RunJobs(nWorker);
+
+    boost::mutex::scoped_lock lock(mMutex);
+    if(--mnActive == 0)
+      mDoneCond.notify_one();
+  }
+}
+
+// Keeps taking jobs off the current batch until there are none left.
+void WorkerPool::RunJobs(int nWorker)
+{
+  while(true)
+  {
+    int nJob;
+    {
+      boost::mutex::scoped_lock lock(mMutex);
+      if(mnNextJob >= mnJobs)
+        return;
+      nJob = mnNextJob++;
+    }
+    (*mpJob)(nJob, nWorker);
+  }
+}
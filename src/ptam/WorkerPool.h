@@ -0,0 +1,53 @@
+// -*- c++ -*-
+//
+// WorkerPool - a small fixed-size pool of threads which the MapMaker uses
+// to fan independent jobs (e.g. one per new map point candidate) out
+// over several cores.
+//
+// Jobs are indexed 0..nJobs-1 and handed out one at a time. The thread
+// calling ParallelFor() takes part in the work as worker 0 and only
+// returns once every job of the batch has finished, so callers may keep
+// all job inputs and outputs on their own stack.
+// ParallelFor() is not re-entrant: only one thread should feed the pool.
+
+#ifndef __WORKERPOOL_H
+#define __WORKERPOOL_H
+#include <boost/thread.hpp>
+#include <boost/function.hpp>
+
+namespace ptam{
+
+class WorkerPool
+{
+public:
+  // A job is called as job(nJob, nWorker); nWorker is in [0, Size())
+  // and may be used to index per-worker scratch data.
+  typedef boost::function<void(int, int)> Job;
+
+  WorkerPool(int nWorkers);
+  ~WorkerPool();
+
+  int Size() const { return mnWorkers; }   // Number of workers, including the calling thread
+  void ParallelFor(int nJobs, const Job &job);
+
+protected:
+  void WorkerLoop(int nWorker);
+  void RunJobs(int nWorker);
+
+  int mnWorkers;
+  boost::thread_group mThreads;
+
+  boost::mutex mMutex;
+  boost::condition_variable mWakeCond;   // A new batch was posted, or we are shutting down
+  boost::condition_variable mDoneCond;   // All pool threads left the current batch
+  const Job *mpJob;
+  int mnJobs;
+  int mnNextJob;
+  int mnActive;          // Pool threads still working on the current batch
+  unsigned int mnBatch;  // Incremented for every posted batch
+  bool mbStop;
+};
+
+} // namespace
+
+#endif
@@ -0,0 +1,136 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <iostream>
+#include <TooN/TooN.h>
+#include <cvd/image.h>
+
+#include <ptam/BriefExtractor.h>
+#include <ptam/LevelHelpers.h>
+
+#include "Stopwatch.h"
+
+using namespace ptam;
+using namespace TooN;
+
+// Gives the test access to the sampling pattern
+class BriefExtractorProbe : public BriefExtractor {
+public:
+    using BriefExtractor::Test;
+    using BriefExtractor::Pattern;
+};
+
+// Two pyramid levels of smooth random texture
+class BriefExtractorTest : public testing::Test {
+protected:
+    BriefExtractorTest() {
+        srand(42);
+        MakeTexture(levels[0], CVD::ImageRef(640, 480));
+        MakeTexture(levels[1], CVD::ImageRef(320, 240));
+        apim[0] = &levels[0];
+        apim[1] = &levels[1];
+    }
+
+    static void MakeTexture(CVD::Image<CVD::byte> &im, CVD::ImageRef irSize) {
+        im.resize(irSize);
+        for (int y = 0; y < irSize.y; y++)
+            for (int x = 0; x < irSize.x; x++)
+                im[y][x] = (CVD::byte) (128 + 60*sin(x*0.21 + y*0.07) + rand()%60 - 30);
+    }
+
+    // Straight from the definition: box filter, then the comparisons
+    static int Smoothed(const CVD::Image<CVD::byte> &im, int x, int y) {
+        int nSum = 0;
+        for (int dy = -2; dy <= 2; dy++)
+            for (int dx = -2; dx <= 2; dx++)
+                nSum += im[y+dy][x+dx];
+        return (nSum + 12) / 25;
+    }
+
+    static void Reference(const CVD::Image<CVD::byte> &im, int x, int y, uint64_t *pnWords) {
+        const std::vector<BriefExtractorProbe::Test> &vPattern = BriefExtractorProbe::Pattern();
+        for (int w = 0; w < BriefExtractor::Words; w++)
+            pnWords[w] = 0;
+        for (int i = 0; i < BriefExtractor::Bits; i++) {
+            const BriefExtractorProbe::Test &t = vPattern[i];
+            if (Smoothed(im, x + t.nX1, y + t.nY1) < Smoothed(im, x + t.nX2, y + t.nY2))
+                pnWords[i / 64] |= 1ull << (i % 64);
+        }
+    }
+
+    CVD::Image<CVD::byte> levels[2];
+    const CVD::BasicImage<CVD::byte> *apim[2];
+    BriefExtractor extractor;
+};
+
+TEST_F(BriefExtractorTest, matchesReference)
+{
+    BriefFeatures features;
+    for (int i = 0; i < 200; i++) {
+        int nLevel = i % 2;
+        CVD::ImageRef ir(20 + rand() % (levels[nLevel].size().x - 40),
+                         20 + rand() % (levels[nLevel].size().y - 40));
+        features.Add(LevelZeroPos(ir, nLevel), nLevel, 1.0f + i, i);
+    }
+    extractor.Describe(apim, 2, features);
+    ASSERT_EQ(200u, features.size());
+
+    for (unsigned int i = 0; i < features.size(); i++) {
+        EXPECT_EQ((int) i, features.vnSource[i]);
+        EXPECT_FLOAT_EQ(1.0f + i, features.vfDepth[i]);
+        int l = features.vnLevel[i];
+        Vector<2> v2 = LevelNPos(features.vv2RootPos[i], l);
+        uint64_t anExpected[BriefExtractor::Words];
+        Reference(levels[l], (int) floor(v2[0] + 0.5), (int) floor(v2[1] + 0.5), anExpected);
+        for (int w = 0; w < BriefExtractor::Words; w++)
+            EXPECT_EQ(anExpected[w], features.Descriptor(i)[w]);
+    }
+}
+
+TEST_F(BriefExtractorTest, dropsBorderAndUnavailableLevels)
+{
+    BriefFeatures features;
+    features.Add(makeVector(5.0, 100.0), 0, 0.0f, 0);    // Too close to the border
+    features.Add(makeVector(100.0, 100.0), 0, 0.0f, 1);
+    features.Add(makeVector(100.0, 100.0), 2, 0.0f, 2);  // No such level
+    features.Add(LevelZeroPos(CVD::ImageRef(310, 120), 1), 1, 0.0f, 3);  // Border on level 1
+    features.Add(LevelZeroPos(CVD::ImageRef(100, 120), 1), 1, 0.0f, 4);
+    extractor.Describe(apim, 2, features);
+
+    ASSERT_EQ(2u, features.size());
+    EXPECT_EQ(1, features.vnSource[0]);
+    EXPECT_EQ(4, features.vnSource[1]);
+    EXPECT_EQ(2u * BriefExtractor::Words, features.vnWords.size());
+}
+
+// Not a pass/fail test: prints descriptors per second for keyframe-sized
+// batches, with the extractor reused as in the mapmaker.
+TEST_F(BriefExtractorTest, DISABLED_benchmark)
+{
+    const int nFeatures = 1000;
+    const int nRuns = 50;
+    BriefFeatures features;
+    double dTime = 0.0;
+    for (int r = 0; r < nRuns; r++) {
+        features.clear();
+        for (int i = 0; i < nFeatures; i++) {
+            int nLevel = i % 4 == 0 ? 1 : 0;
+            CVD::ImageRef ir(20 + rand() % (levels[nLevel].size().x - 40),
+                             20 + rand() % (levels[nLevel].size().y - 40));
+            features.Add(LevelZeroPos(ir, nLevel), nLevel, 0.0f, i);
+        }
+        Stopwatch watch;
+        extractor.Describe(apim, 2, features);
+        dTime += watch.Seconds();
+        EXPECT_EQ((unsigned int) nFeatures, features.size());
+    }
+    std::cout << nFeatures << " features on two levels: " << nRuns*nFeatures/dTime
+              << " descriptors/s, including smoothing" << std::endl;
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include <iostream>
+
+#include <ptam/CornerGrid.h>
+
+#include "Stopwatch.h"
+
+using namespace ptam;
+
+// A dense indoor level-0 frame has a few thousand FAST corners; spread them
+// over the z=1-plane footprint of a Kinect (about 58x45 degrees).
+class CornerGridTest : public testing::Test {
+protected:
+    CornerGridTest(): onePixelDist_(1.0/525.0), bandDist_(5.0*onePixelDist_) {
+        srand(42);
+        corners_.resize(4000);
+        for (unsigned int i = 0; i < corners_.size(); i++) {
+            corners_[i][0] = 1.2*rand()/(RAND_MAX+1.0) - 0.6;
+            corners_[i][1] = 0.9*rand()/(RAND_MAX+1.0) - 0.45;
+        }
+        grid_.Build(corners_, 2.0*bandDist_);
+    }
+
+    // A random epipolar band, parameterized like in MapMaker::AddPointEpipolar
+    void RandomBand(TooN::Vector<2> &dirn, TooN::Vector<2> &normal,
+                    double &normDist, double &minLen, double &maxLen) {
+        double angle = 2.0*M_PI*rand()/(RAND_MAX+1.0);
+        dirn[0] = cos(angle);
+        dirn[1] = sin(angle);
+        normal[0] = dirn[1];
+        normal[1] = -dirn[0];
+        normDist = 0.8*rand()/(RAND_MAX+1.0) - 0.4;
+        minLen = 1.2*rand()/(RAND_MAX+1.0) - 0.6;
+        maxLen = minLen + 0.4*rand()/(RAND_MAX+1.0);
+    }
+
+    bool InBand(int i, const TooN::Vector<2> &dirn, const TooN::Vector<2> &normal,
+                double normDist, double minLen, double maxLen) {
+        double distDiff = normDist - corners_[i] * normal;
+        double len = corners_[i] * dirn;
+        return distDiff*distDiff <= bandDist_*bandDist_ && len >= minLen && len <= maxLen;
+    }
+
+    const double onePixelDist_;
+    const double bandDist_;
+    std::vector<TooN::Vector<2> > corners_;
+    CornerGrid grid_;
+};
+
+TEST_F(CornerGridTest, sameCornersAsLinearScan)
+{
+    for (int q = 0; q < 500; q++) {
+        TooN::Vector<2> dirn, normal;
+        double normDist, minLen, maxLen;
+        RandomBand(dirn, normal, normDist, minLen, maxLen);
+
+        std::vector<int> expected;
+        for (unsigned int i = 0; i < corners_.size(); i++)
+            if (InBand(i, dirn, normal, normDist, minLen, maxLen))
+                expected.push_back(i);
+
+        std::vector<int> found, foundInBand;
+        grid_.FindInBand(dirn, normal, normDist, minLen, maxLen, bandDist_, found);
+        for (unsigned int j = 0; j < found.size(); j++)
+            if (InBand(found[j], dirn, normal, normDist, minLen, maxLen))
+                foundInBand.push_back(found[j]);
+
+        EXPECT_EQ(expected, foundInBand);
+    }
+}
+
+// Not a pass/fail test: prints the time per epipolar query for the linear
+// scan and the grid lookup.
+TEST_F(CornerGridTest, DISABLED_benchmark)
+{
+    const int nQueries = 20000;
+    std::vector<TooN::Vector<2> > dirns(nQueries), normals(nQueries);
+    std::vector<double> normDists(nQueries), minLens(nQueries), maxLens(nQueries);
+    for (int q = 0; q < nQueries; q++)
+        RandomBand(dirns[q], normals[q], normDists[q], minLens[q], maxLens[q]);
+
+    int nLinear = 0;
+    Stopwatch watch;
+    for (int q = 0; q < nQueries; q++)
+        for (unsigned int i = 0; i < corners_.size(); i++)
+            if (InBand(i, dirns[q], normals[q], normDists[q], minLens[q], maxLens[q]))
+                nLinear++;
+    double linearTime = watch.Seconds();
+
+    int nGrid = 0;
+    std::vector<int> found;
+    watch.Restart();
+    for (int q = 0; q < nQueries; q++) {
+        found.clear();
+        grid_.FindInBand(dirns[q], normals[q], normDists[q], minLens[q], maxLens[q], bandDist_, found);
+        for (unsigned int j = 0; j < found.size(); j++)
+            if (InBand(found[j], dirns[q], normals[q], normDists[q], minLens[q], maxLens[q]))
+                nGrid++;
+    }
+    double gridTime = watch.Seconds();
+
+    EXPECT_EQ(nLinear, nGrid);
+    std::cout << corners_.size() << " corners, per query: linear scan "
+              << 1e6*linearTime/nQueries << " us, grid "
+              << 1e6*gridTime/nQueries << " us" << std::endl;
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
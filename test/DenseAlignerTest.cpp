@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <iostream>
+#include <TooN/TooN.h>
+#include <TooN/se3.h>
+#include <gvars3/instances.h>
+
+#include <ptam/ATANCamera.h>
+#include <ptam/KeyFrame.h>
+#include <ptam/DepthPyramid.h>
+#include <ptam/DenseAligner.h>
+
+#include "Stopwatch.h"
+
+using namespace ptam;
+using namespace TooN;
+
+// A textured wall two to three metres away, seen from two poses
+class DenseAlignerTest : public testing::Test {
+protected:
+    DenseAlignerTest() {
+        GVars3::GUI.LoadFile("data/kinect-atan.cfg");
+        camera.reset(new ATANCamera("Camera"));
+        camera->SetImageSize(CVD::ImageRef(640, 480));
+    }
+
+    static double Texture(double x, double y) {
+        return 128 + 50*sin(2*x)*cos(3*y) + 30*sin(5*x + 1.5*y) + 20*cos(9*y - 4*x);
+    }
+
+    // Ray-casts the wall z = 2.5 + 0.2 x (world frame)
+    void Render(const SE3<> &se3CamFromWorld, KeyFrame &kf, CVD::Image<uint16_t> &depth) {
+        CVD::ImageRef irSize(640, 480);
+        kf.aLevels[0].im.resize(irSize);
+        depth.resize(irSize);
+        SE3<> se3WorldFromCam = se3CamFromWorld.inverse();
+        Vector<3> v3Centre = se3WorldFromCam.get_translation();
+        for (int y = 0; y < irSize.y; y++)
+            for (int x = 0; x < irSize.x; x++) {
+                Vector<2> v2ImPlane = camera->UnProject(makeVector(x, y));
+                Vector<3> v3Ray = se3WorldFromCam.get_rotation() * makeVector(v2ImPlane[0], v2ImPlane[1], 1.0);
+                double t = (2.5 + 0.2*v3Centre[0] - v3Centre[2]) / (v3Ray[2] - 0.2*v3Ray[0]);
+                Vector<3> v3World = v3Centre + t * v3Ray;
+                kf.aLevels[0].im[y][x] = (CVD::byte) Texture(v3World[0], v3World[1]);
+                depth[y][x] = (uint16_t) ((se3CamFromWorld * v3World)[2] * 1000.0 + 0.5);
+            }
+        // A hole, as Kinects have
+        for (int y = 200; y < 260; y++)
+            for (int x = 300; x < 380; x++)
+                depth[y][x] = 0;
+        for (int l = 1; l < LEVELS; l++) {
+            const CVD::Image<CVD::byte> &imIn = kf.aLevels[l-1].im;
+            CVD::Image<CVD::byte> &imOut = kf.aLevels[l].im;
+            imOut.resize(imIn.size() / 2);
+            for (int y = 0; y < imOut.size().y; y++)
+                for (int x = 0; x < imOut.size().x; x++)
+                    imOut[y][x] = (imIn[2*y][2*x] + imIn[2*y][2*x+1] + imIn[2*y+1][2*x] + imIn[2*y+1][2*x+1] + 2) / 4;
+        }
+    }
+
+    // Aligns a frame seen after se3Motion to one seen from the origin
+    bool Align(const SE3<> &se3Motion, SE3<> &se3CurFromRef) {
+        Render(SE3<>(), kfRef, imDepthRef);
+        Render(se3Motion, kfCur, imDepthCur);
+        DepthPyramid depthRef, depthCur;
+        depthRef.Make(imDepthRef, LEVELS, 1);
+        depthCur.Make(imDepthCur, LEVELS, 1);
+
+        DenseAligner aligner(*camera);
+        aligner.SetReference(kfRef, depthRef, params);
+        return aligner.Align(kfCur, depthCur, params, se3CurFromRef);
+    }
+
+    static void ExpectNear(const SE3<> &se3A, const SE3<> &se3B) {
+        Vector<6> v6Error = (se3A * se3B.inverse()).ln();
+        for (int i = 0; i < 3; i++)
+            EXPECT_NEAR(0.0, v6Error[i], 0.005);   // 5 mm
+        for (int i = 3; i < 6; i++)
+            EXPECT_NEAR(0.0, v6Error[i], 0.005);   // 0.3 degrees
+    }
+
+    std::auto_ptr<CameraModel> camera;
+    DenseAligner::Params params;
+    KeyFrame kfRef, kfCur;
+    CVD::Image<uint16_t> imDepthRef, imDepthCur;
+};
+
+TEST_F(DenseAlignerTest, smallMotion)
+{
+    SE3<> se3Motion = SE3<>::exp(makeVector(0.02, -0.01, 0.03, 0.01, 0.02, -0.01));
+    SE3<> se3CurFromRef;
+    ASSERT_TRUE(Align(se3Motion, se3CurFromRef));
+    ExpectNear(se3Motion, se3CurFromRef);
+}
+
+// The case the motion model gets wrong: a quick turn, with the guess at rest
+TEST_F(DenseAlignerTest, fastRotation)
+{
+    SE3<> se3Motion = SE3<>::exp(makeVector(0.01, 0.0, 0.0, 0.02, 0.09, 0.01));
+    SE3<> se3CurFromRef;
+    ASSERT_TRUE(Align(se3Motion, se3CurFromRef));
+    ExpectNear(se3Motion, se3CurFromRef);
+}
+
+TEST_F(DenseAlignerTest, failsWithoutOverlap)
+{
+    params.dDepthWeight = 0.0;
+    SE3<> se3Motion = SE3<>::exp(makeVector(0.0, 0.0, 0.0, 0.0, 1.2, 0.0));
+    SE3<> se3CurFromRef;
+    EXPECT_FALSE(Align(se3Motion, se3CurFromRef));
+    // Left as it was
+    ExpectNear(SE3<>(), se3CurFromRef);
+}
+
+// Not a pass/fail test: prints the time per camera and frame
+TEST_F(DenseAlignerTest, DISABLED_benchmark)
+{
+    Render(SE3<>(), kfRef, imDepthRef);
+    Render(SE3<>::exp(makeVector(0.01, 0.0, 0.0, 0.0, 0.03, 0.0)), kfCur, imDepthCur);
+    DepthPyramid depthRef, depthCur;
+    depthRef.Make(imDepthRef, LEVELS, 1);
+    depthCur.Make(imDepthCur, LEVELS, 1);
+    DenseAligner aligner(*camera);
+
+    const int nRuns = 20;
+    int nGood = 0;
+    Stopwatch watch;
+    for (int r = 0; r < nRuns; r++) {
+        aligner.SetReference(kfRef, depthRef, params);
+        SE3<> se3CurFromRef;
+        nGood += aligner.Align(kfCur, depthCur, params, se3CurFromRef);
+    }
+    double dTime = watch.Seconds() / nRuns;
+    EXPECT_EQ(nRuns, nGood);
+    std::cout << "dense alignment: " << dTime * 1e3 << " ms, mean error "
+              << aligner.LastError() << std::endl;
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <vector>
+#include <iostream>
+#include <cvd/image.h>
+
+#include <ptam/DepthPyramid.h>
+
+#include "Stopwatch.h"
+
+using namespace ptam;
+
+class DepthPyramidTest : public testing::Test {
+protected:
+    DepthPyramidTest() {
+        depth.resize(CVD::ImageRef(640, 480));
+        depth.fill(2000);
+    }
+
+    CVD::Image<uint16_t> depth;
+    DepthPyramid pyramid;
+};
+
+TEST_F(DepthPyramidTest, levelSizes)
+{
+    pyramid.Make(depth, 4, 0);
+    ASSERT_EQ(4, pyramid.Levels());
+    EXPECT_EQ(&depth[0][0], pyramid.Level(0).data());
+    EXPECT_EQ(CVD::ImageRef(320, 240), pyramid.Level(1).size());
+    EXPECT_EQ(CVD::ImageRef(80, 60), pyramid.Level(3).size());
+}
+
+TEST_F(DepthPyramidTest, nearestValidDepth)
+{
+    // One block with a hole and a far pixel, one with nothing valid
+    depth[0][0] = 0;
+    depth[0][1] = 3000;
+    depth[1][0] = 1500;
+    depth[1][1] = 0;
+    depth[0][2] = depth[0][3] = depth[1][2] = depth[1][3] = 0;
+    pyramid.Make(depth, 4, 0);
+    EXPECT_EQ(1500, pyramid.Level(1)[0][0]);
+    EXPECT_EQ(0, pyramid.Level(1)[0][1]);
+    EXPECT_EQ(1500, pyramid.Level(2)[0][0]);
+}
+
+TEST_F(DepthPyramidTest, sampleAndFillHoles)
+{
+    for (int y = 100; y < 110; y++)
+        for (int x = 100; x < 110; x++)
+            depth[y][x] = 0;
+    depth[99][99] = 1000;
+
+    std::vector<CVD::ImageRef> vir;
+    vir.push_back(CVD::ImageRef(50, 50));      // Valid
+    vir.push_back(CVD::ImageRef(100, 100));    // At the edge of the hole
+    vir.push_back(CVD::ImageRef(105, 105));    // In the middle of it
+    std::vector<double> vdDepth;
+
+    pyramid.Make(depth, 4, 0);
+    pyramid.Sample(0, vir, vdDepth);
+    ASSERT_EQ(3u, vdDepth.size());
+    EXPECT_DOUBLE_EQ(2.0, vdDepth[0]);
+    EXPECT_EQ(0.0, vdDepth[1]);
+    EXPECT_EQ(0.0, vdDepth[2]);
+
+    // The nearest depth on the ring wins, not the first one found
+    pyramid.Make(depth, 4, 1);
+    pyramid.Sample(0, vir, vdDepth);
+    EXPECT_DOUBLE_EQ(1.0, vdDepth[1]);
+    EXPECT_EQ(0.0, vdDepth[2]);
+
+    // Filled on the higher levels too, from the halved near pixel
+    pyramid.Sample(2, std::vector<CVD::ImageRef>(1, CVD::ImageRef(25, 25)), vdDepth);
+    EXPECT_DOUBLE_EQ(1.0, vdDepth[0]);
+}
+
+// Not a pass/fail test: prints the time for a 640x480 pyramid and a
+// level's worth of corners
+TEST_F(DepthPyramidTest, DISABLED_benchmark)
+{
+    srand(11);
+    for (int y = 0; y < depth.size().y; y++)
+        for (int x = 0; x < depth.size().x; x++)
+            depth[y][x] = (rand() % 5 == 0) ? 0 : 500 + rand() % 4000;
+    std::vector<CVD::ImageRef> vir;
+    for (int i = 0; i < 3000; i++)
+        vir.push_back(CVD::ImageRef(rand() % 640, rand() % 480));
+    const int nRuns = 100;
+    std::vector<double> vdDepth;
+    double dSum = 0.0;
+
+    Stopwatch watch;
+    for (int r = 0; r < nRuns; r++)
+        pyramid.Make(depth, 4, 1);
+    double dMake = watch.Seconds() / nRuns;
+
+    watch.Restart();
+    for (int r = 0; r < nRuns; r++) {
+        pyramid.Sample(0, vir, vdDepth);
+        dSum += vdDepth[r];
+    }
+    double dSample = watch.Seconds() / nRuns;
+
+    EXPECT_GT(dSum, 0.0);
+    std::cout << "pyramid: " << dMake * 1e3 << " ms, " << vir.size() << " corners: "
+              << dSample * 1e3 << " ms" << std::endl;
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <TooN/TooN.h>
+
+#include <ptam/FeatureBudget.h>
+
+#include "Stopwatch.h"
+
+using namespace ptam;
+using namespace TooN;
+
+// Candidates spread over a 640x480 image, with random priorities; 8x6
+// buckets of 80x80 pixels
+class FeatureBudgetTest : public testing::Test {
+protected:
+    FeatureBudgetTest() : budget(8, 6) {
+        srand(5);
+        for (int i = 0; i < 3000; i++) {
+            vv2Points.push_back(makeVector(640.0 * rand() / RAND_MAX, 480.0 * rand() / RAND_MAX));
+            vdPriorities.push_back((double) rand() / RAND_MAX);
+        }
+    }
+
+    void AddAll() {
+        budget.Clear(CVD::ImageRef(640, 480));
+        for (unsigned int i = 0; i < vv2Points.size(); i++)
+            budget.Add(vv2Points[i], vdPriorities[i]);
+    }
+
+    static int Bucket(const Vector<2> &v2) {
+        return (int) (v2[1] / 80) * 8 + (int) (v2[0] / 80);
+    }
+
+    FeatureBudget budget;
+    std::vector<Vector<2> > vv2Points;
+    std::vector<double> vdPriorities;
+};
+
+// Within budget, everything is selected, once
+TEST_F(FeatureBudgetTest, allWithinBudget)
+{
+    AddAll();
+    EXPECT_EQ(vv2Points.size(), budget.Size());
+    std::vector<int> vnSelected;
+    budget.Select(vv2Points.size() + 10, vnSelected);
+    ASSERT_EQ(vv2Points.size(), vnSelected.size());
+    std::set<int> snSelected(vnSelected.begin(), vnSelected.end());
+    EXPECT_EQ(vv2Points.size(), snSelected.size());
+    EXPECT_EQ(0, *snSelected.begin());
+    EXPECT_EQ((int) vv2Points.size() - 1, *snSelected.rbegin());
+}
+
+// The first round takes the best candidate of every bucket, best first
+TEST_F(FeatureBudgetTest, firstRound)
+{
+    AddAll();
+    std::vector<int> vnSelected;
+    budget.Select(48, vnSelected);
+    ASSERT_EQ(48u, vnSelected.size());
+
+    std::vector<double> vdBest(48, -1.0);
+    for (unsigned int i = 0; i < vv2Points.size(); i++)
+        vdBest[Bucket(vv2Points[i])] = std::max(vdBest[Bucket(vv2Points[i])], vdPriorities[i]);
+    std::set<int> snBuckets;
+    for (unsigned int i = 0; i < vnSelected.size(); i++) {
+        int n = vnSelected[i];
+        snBuckets.insert(Bucket(vv2Points[n]));
+        EXPECT_EQ(vdBest[Bucket(vv2Points[n])], vdPriorities[n]);
+        if (i > 0)
+            EXPECT_GE(vdPriorities[vnSelected[i-1]], vdPriorities[n]);
+    }
+    EXPECT_EQ(48u, snBuckets.size());
+}
+
+// A cluster of the best candidates doesn't crowd out the rest of the image
+TEST_F(FeatureBudgetTest, spread)
+{
+    AddAll();
+    for (int i = 0; i < 500; i++) {
+        budget.Add(makeVector(20.0 + 0.1 * i, 20.0), 10.0 + i);
+        vv2Points.push_back(makeVector(20.0 + 0.1 * i, 20.0));
+    }
+    std::vector<int> vnSelected;
+    budget.Select(480, vnSelected);
+    ASSERT_EQ(480u, vnSelected.size());
+    int nCluster = 0;
+    for (unsigned int i = 0; i < vnSelected.size(); i++)
+        nCluster += vnSelected[i] >= 3000;
+    // 10 rounds; the cluster's bucket gets one candidate in each
+    EXPECT_EQ(10, nCluster);
+    // .. its best ones, first in each round
+    EXPECT_EQ(3499, vnSelected[0]);
+    EXPECT_EQ(3498, vnSelected[48]);
+}
+
+// Within a bucket, by priority; ties go by the order of Add()
+TEST_F(FeatureBudgetTest, priorityInBucket)
+{
+    budget.Clear(CVD::ImageRef(640, 480));
+    double adPriorities[6] = {0.2, 0.9, 0.5, 0.5, 0.1, 0.7};
+    for (int i = 0; i < 6; i++)
+        budget.Add(makeVector(300.0 + i, 200.0), adPriorities[i]);
+    budget.Add(makeVector(-5.0, 1000.0), 0.3);   // Off the image: clamped to the nearest bucket
+    std::vector<int> vnSelected;
+    budget.Select(5, vnSelected);
+    ASSERT_EQ(5u, vnSelected.size());
+    EXPECT_EQ(1, vnSelected[0]);
+    EXPECT_EQ(6, vnSelected[1]);
+    EXPECT_EQ(5, vnSelected[2]);
+    EXPECT_EQ(2, vnSelected[3]);
+    EXPECT_EQ(3, vnSelected[4]);
+}
+
+// Not a pass/fail test: a frame's worth of candidates against the tracker's
+// default budget
+TEST_F(FeatureBudgetTest, DISABLED_benchmark)
+{
+    const int nRuns = 200;
+    std::vector<int> vnSelected;
+    Stopwatch watch;
+    for (int r = 0; r < nRuns; r++) {
+        AddAll();
+        vnSelected.clear();
+        budget.Select(1000, vnSelected);
+    }
+    double dTime = watch.Seconds();
+    EXPECT_EQ(1000u, vnSelected.size());
+    std::cout << vv2Points.size() << " candidates to 1000: " << dTime / nRuns * 1e3 << " ms" << std::endl;
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+
+#include <boost/thread.hpp>
+
+#include <ptam/FramePool.h>
+#include <ptam/KeyFrame.h>
+#include <ptam/MapPoint.h>
+
+using namespace ptam;
+
+TEST(FramePoolTest, recyclesFrames)
+{
+    FramePool pool(2);
+    KeyFrame *pRaw;
+    boost::weak_ptr<MapPoint> wpPoint;
+    {
+        boost::shared_ptr<KeyFrame> pKF = pool.Get();
+        pRaw = pKF.get();
+        pKF->aLevels[0].im.resize(CVD::ImageRef(640, 480));
+        pKF->id = 12;
+        pKF->bFixed = true;
+        pKF->aLevels[0].bImplaneCornersCached = true;
+        pKF->aLevels[0].vMaxCorners.push_back(CVD::ImageRef(20, 30));
+        pKF->aLevels[0].vMaxCornersDepth.push_back(1.5);
+        boost::shared_ptr<MapPoint> p(new MapPoint);
+        wpPoint = p;
+        pKF->mMeasurements[p] = Measurement();
+    }
+    EXPECT_EQ(1u, pool.Free());
+    // The frame lets go of the map, but not of its images
+    EXPECT_TRUE(wpPoint.expired());
+
+    boost::shared_ptr<KeyFrame> pKF = pool.Get();
+    EXPECT_EQ(pRaw, pKF.get());
+    EXPECT_EQ(0u, pool.Free());
+    EXPECT_EQ(-1, pKF->id);
+    EXPECT_FALSE(pKF->bFixed);
+    EXPECT_FALSE(pKF->bComplete);
+    EXPECT_FALSE(pKF->aLevels[0].bImplaneCornersCached);
+    EXPECT_TRUE(pKF->aLevels[0].vMaxCorners.empty());
+    EXPECT_TRUE(pKF->aLevels[0].vMaxCornersDepth.empty());
+    EXPECT_TRUE(pKF->mMeasurements.empty());
+    EXPECT_EQ(CVD::ImageRef(640, 480), pKF->aLevels[0].im.size());
+}
+
+TEST(FramePoolTest, keepsFewFrames)
+{
+    FramePool pool(2);
+    {
+        boost::shared_ptr<KeyFrame> apKF[4];
+        for (int i = 0; i < 4; i++)
+            apKF[i] = pool.Get();
+    }
+    EXPECT_EQ(2u, pool.Free());
+}
+
+// Frames handed over may come back on another thread, and after the pool
+void Release(boost::shared_ptr<KeyFrame> pKF)
+{
+    pKF.reset();
+}
+
+TEST(FramePoolTest, framesOutlivePool)
+{
+    boost::shared_ptr<KeyFrame> pKF;
+    {
+        FramePool pool(2);
+        pKF = pool.Get();
+    }
+    boost::thread t(Release, pKF);
+    pKF.reset();
+    t.join();
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,252 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <TooN/TooN.h>
+#include <TooN/helpers.h>
+
+#include <ptam/HomographyRansac.h>
+#include <ptam/WorkerPool.h>
+
+#include "Stopwatch.h"
+
+using namespace ptam;
+using namespace TooN;
+
+namespace {
+double Uniform(double dMin, double dMax) {
+    return dMin + (dMax - dMin) * rand() / RAND_MAX;
+}
+}
+
+// Matches on the z=1 plane of two views of a plane, with some outliers;
+// residuals are scaled to pixels of a 500 pixel focal length
+class HomographyRansacTest : public testing::Test {
+protected:
+    HomographyRansacTest() : dPixels(500.0) {
+        m3True[0] = makeVector(0.95, -0.1, 0.05);
+        m3True[1] = makeVector(0.12, 1.02, -0.03);
+        m3True[2] = makeVector(0.08, -0.05, 1.0);
+    }
+
+    void Make(int nMatches, double dOutlierRatio) {
+        srand(11);
+        ransac.Clear();
+        vbInlier.clear();
+        vv2First.clear();
+        vv2Second.clear();
+        for (int i = 0; i < nMatches; i++) {
+            Vector<2> v2First = makeVector(Uniform(-0.6, 0.6), Uniform(-0.45, 0.45));
+            Vector<2> v2Second;
+            bool bInlier = Uniform(0.0, 1.0) >= dOutlierRatio;
+            if (bInlier)
+                v2Second = project(m3True * unproject(v2First))
+                           + makeVector(Uniform(-0.5, 0.5), Uniform(-0.5, 0.5)) / dPixels;
+            else
+                v2Second = makeVector(Uniform(-0.6, 0.6), Uniform(-0.45, 0.45));
+            ransac.Add(v2First, v2Second, dPixels);
+            vbInlier.push_back(bInlier);
+            vv2First.push_back(v2First);
+            vv2Second.push_back(v2Second);
+        }
+    }
+
+    // Largest distance [pixels] between where the two homographies map points of the first view
+    double Difference(const Matrix<3> &m3A, const Matrix<3> &m3B) {
+        double dMax = 0.0;
+        for (double x = -0.6; x <= 0.6; x += 0.1)
+            for (double y = -0.45; y <= 0.45; y += 0.1) {
+                Vector<2> v2Error = project(m3A * makeVector(x, y, 1.0)) - project(m3B * makeVector(x, y, 1.0));
+                dMax = std::max(dMax, dPixels * std::sqrt(v2Error * v2Error));
+            }
+        return dMax;
+    }
+
+    // As HomographyInit did it: 300 trials, each scored on all matches
+    Matrix<3> Reference(const HomographyRansac::Params &params, unsigned int nSeed) {
+        Matrix<3> m3Best = Identity;
+        double dBestCost = HUGE_VAL;
+        std::vector<int> vnSample(4);
+        std::vector<int> vnInliers;
+        const int nMatches = ransac.size();
+        for (int r = 0; r < params.nMaxIterations; r++) {
+            for (int i = 0; i < 4; i++) {
+                bool bUnique;
+                do {
+                    vnSample[i] = rand_r(&nSeed) % nMatches;
+                    bUnique = true;
+                    for (int j = 0; j < i; j++)
+                        if (vnSample[j] == vnSample[i])
+                            bUnique = false;
+                } while (!bUnique);
+            }
+            Matrix<3> m3 = ransac.Fit(vnSample);
+            int nInliers = ransac.FindInliers(m3, params.dMaxError, vnInliers);
+            double dCost = (nMatches - nInliers) * params.dMaxError * params.dMaxError;
+            for (unsigned int i = 0; i < vnInliers.size(); i++) {
+                Vector<2> v2Error = project(m3 * unproject(vv2First[vnInliers[i]])) - vv2Second[vnInliers[i]];
+                dCost += dPixels * dPixels * (v2Error * v2Error);
+            }
+            if (dCost < dBestCost) {
+                dBestCost = dCost;
+                m3Best = m3;
+            }
+        }
+        return m3Best;
+    }
+
+    double dPixels;
+    Matrix<3> m3True;
+    HomographyRansac ransac;
+    std::vector<bool> vbInlier;
+    std::vector<Vector<2> > vv2First, vv2Second;
+};
+
+TEST_F(HomographyRansacTest, findsHomography)
+{
+    Make(400, 0.4);
+    HomographyRansac::Params params;
+    Matrix<3> m3;
+    ASSERT_TRUE(ransac.Find(params, NULL, 1, m3));
+    EXPECT_LT(Difference(m3, m3True), 3.0);
+
+    // The inliers found are the true ones
+    std::vector<int> vnInliers;
+    ransac.FindInliers(m3, params.dMaxError, vnInliers);
+    int nTrue = 0;
+    for (unsigned int i = 0; i < vnInliers.size(); i++)
+        nTrue += vbInlier[vnInliers[i]];
+    int nInliers = std::count(vbInlier.begin(), vbInlier.end(), true);
+    EXPECT_GT(nTrue, 0.95 * nInliers);
+
+    // And refitted on them, better still
+    EXPECT_LT(Difference(ransac.Fit(vnInliers), m3True), 0.5);
+
+    // 60% inliers need some 50 hypotheses for 99.9%, not 300
+    const HomographyRansac::Statistics &stats = ransac.LastStatistics();
+    EXPECT_LT(stats.nHypotheses, 100);
+    EXPECT_GT(stats.nPreempted, 0);
+    EXPECT_GT(stats.nBestInliers, 0.9 * nInliers);
+}
+
+TEST_F(HomographyRansacTest, countsOutliers)
+{
+    Make(200, 0.5);
+    HomographyRansac::Params params;
+    params.cost = HomographyRansac::COST_OUTLIERS;
+    params.dMaxError = 3.0;
+    Matrix<3> m3;
+    ASSERT_TRUE(ransac.Find(params, NULL, 5, m3));
+    EXPECT_LT(Difference(m3, m3True), 3.0);
+}
+
+// The samples don't depend on the workers, so neither does the result
+TEST_F(HomographyRansacTest, sameWithWorkers)
+{
+    Make(4000, 0.7);
+    HomographyRansac::Params params;
+    Matrix<3> m3Serial, m3Parallel;
+    ASSERT_TRUE(ransac.Find(params, NULL, 3, m3Serial));
+    HomographyRansac::Statistics serial = ransac.LastStatistics();
+
+    WorkerPool workers(4);
+    ASSERT_TRUE(ransac.Find(params, &workers, 3, m3Parallel));
+    HomographyRansac::Statistics parallel = ransac.LastStatistics();
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 3; c++)
+            EXPECT_EQ(m3Serial[r][c], m3Parallel[r][c]);
+    EXPECT_EQ(serial.nBestInliers, parallel.nBestInliers);
+    EXPECT_LT(Difference(m3Parallel, m3True), 3.0);
+}
+
+// The views of a plane which the second camera's horizon runs through:
+// the matches mapped to w <= 0 would be behind it
+TEST_F(HomographyRansacTest, cheirality)
+{
+    Matrix<3> m3Behind = Identity;
+    m3Behind[2] = makeVector(-2.0, 0.0, 0.4);   // w <= 0 for x >= 0.2
+    srand(13);
+    int nInFront = 0;
+    for (int i = 0; i < 200; i++) {
+        Vector<2> v2 = makeVector(Uniform(-0.6, 0.6), Uniform(-0.45, 0.45));
+        ransac.Add(v2, project(m3Behind * unproject(v2)), dPixels);
+        nInFront += v2[0] < 0.2;
+    }
+    HomographyRansac::Params params;
+    params.cost = HomographyRansac::COST_OUTLIERS;
+    Matrix<3> m3;
+    ASSERT_TRUE(ransac.Find(params, NULL, 1, m3));
+    EXPECT_EQ(200, ransac.LastStatistics().nBestInliers);
+
+    params.bCheirality = true;
+    ASSERT_TRUE(ransac.Find(params, NULL, 1, m3));
+    EXPECT_EQ(nInFront, ransac.LastStatistics().nBestInliers);
+    std::vector<int> vnInliers;
+    EXPECT_EQ(200, ransac.FindInliers(m3, params.dMaxError, vnInliers));
+    EXPECT_EQ(nInFront, ransac.FindInliers(m3, params.dMaxError, vnInliers, true));
+    // The same homography, the other way up
+    EXPECT_EQ(200 - nInFront, ransac.FindInliers(-m3, params.dMaxError, vnInliers, true));
+}
+
+// Points in a line give no homography
+TEST_F(HomographyRansacTest, degenerate)
+{
+    for (int i = 0; i < 50; i++) {
+        Vector<2> v2 = makeVector(-0.5 + 0.02 * i, 0.1 - 0.01 * i);
+        ransac.Add(v2, project(m3True * unproject(v2)), dPixels);
+    }
+    HomographyRansac::Params params;
+    params.nMaxIterations = 50;
+    Matrix<3> m3;
+    EXPECT_FALSE(ransac.Find(params, NULL, 1, m3));
+    EXPECT_EQ(50, ransac.LastStatistics().nDegenerate);
+}
+
+// Not a pass/fail test: prints the time of 300 trials each scored on all
+// matches, as HomographyInit did, against that of the engine, with and
+// without workers
+TEST_F(HomographyRansacTest, DISABLED_benchmark)
+{
+    const int nMatches = 4000;
+    Make(nMatches, 0.5);
+    HomographyRansac::Params params;
+    const int nRuns = 10;
+    Matrix<3> m3;
+    Stopwatch watch;
+    for (int r = 0; r < nRuns; r++)
+        m3 = Reference(params, r + 1);
+    double dReference = watch.Seconds() / nRuns;
+    EXPECT_LT(Difference(m3, m3True), 5.0);   // Fits of four noisy matches, not yet refined
+
+    watch.Restart();
+    for (int r = 0; r < nRuns; r++)
+        ransac.Find(params, NULL, r + 1, m3);
+    double dSerial = watch.Seconds() / nRuns;
+    EXPECT_LT(Difference(m3, m3True), 5.0);
+    const HomographyRansac::Statistics stats = ransac.LastStatistics();
+
+    WorkerPool workers(4);
+    watch.Restart();
+    for (int r = 0; r < nRuns; r++)
+        ransac.Find(params, &workers, r + 1, m3);
+    double dParallel = watch.Seconds() / nRuns;
+
+    // All 300, to compare the scoring alone
+    params.dConfidence = 0.0;
+    watch.Restart();
+    for (int r = 0; r < nRuns; r++)
+        ransac.Find(params, NULL, r + 1, m3);
+    double dAll = watch.Seconds() / nRuns;
+
+    std::cout << "homography, " << nMatches << " matches: reference " << dReference * 1e3
+              << " ms, engine " << dSerial * 1e3 << " ms (" << stats.nHypotheses << " hypotheses, "
+              << stats.nPreempted << " preempted), 4 workers " << dParallel * 1e3
+              << " ms, 300 hypotheses " << dAll * 1e3 << " ms" << std::endl;
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
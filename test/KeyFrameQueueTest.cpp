@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#include <ptam/KeyFrame.h>
+#include <ptam/KeyFrameQueue.h>
+
+using namespace ptam;
+
+class KeyFrameQueueTest : public testing::Test {
+public:
+    static KeyFrameBundle MakeBundle(int id, bool bAllCameras) {
+        KeyFrameBundle bundle;
+        bundle.pKF.reset(new KeyFrame);
+        bundle.pKF->id = id;
+        for (int i = 0; i < AddCamNumber; i++)
+            if (bAllCameras)
+                bundle.apKFSec[i].reset(new KeyFrame);
+        return bundle;
+    }
+
+    void Produce(int nBundles) {
+        for (int i = 0; i < nBundles; i++) {
+            KeyFrameBundle bundle = MakeBundle(i, true);
+            while (!queue.Push(bundle))
+                boost::this_thread::sleep(boost::posix_time::microseconds(100));
+        }
+    }
+
+protected:
+    KeyFrameQueue queue;
+};
+
+TEST_F(KeyFrameQueueTest, rejectsWhenFull)
+{
+    for (int i = 0; i < KeyFrameQueue::Capacity; i++) {
+        KeyFrameBundle bundle = MakeBundle(i, i % 2 == 0);
+        EXPECT_TRUE(queue.Push(bundle));
+    }
+    KeyFrameBundle extra = MakeBundle(-1, true);
+    EXPECT_FALSE(queue.Push(extra));
+
+    KeyFrameQueue::Statistics stats = queue.GetStatistics();
+    EXPECT_EQ((unsigned int) KeyFrameQueue::Capacity, stats.nQueued);
+    EXPECT_EQ((unsigned int) KeyFrameQueue::Capacity, stats.nMaxQueued);
+    EXPECT_EQ(1u, stats.nRejected);
+
+    KeyFrameBundle bundle;
+    ASSERT_TRUE(queue.Pop(bundle));
+    EXPECT_EQ(0, bundle.pKF->id);
+    EXPECT_TRUE(bundle.HasAllCameras());
+    ASSERT_TRUE(queue.Pop(bundle));
+    EXPECT_EQ(AddCamNumber == 0, bundle.HasAllCameras());
+
+    queue.Clear();
+    EXPECT_EQ(0, (int) queue.Size());
+    EXPECT_FALSE(queue.Pop(bundle));
+}
+
+TEST_F(KeyFrameQueueTest, handsOverInOrder)
+{
+    const int nBundles = 1000;
+    boost::thread producer(boost::bind(&KeyFrameQueueTest::Produce, this, nBundles));
+    int nNext = 0;
+    while (nNext < nBundles) {
+        queue.Wait(0.01);
+        KeyFrameBundle bundle;
+        while (queue.Pop(bundle)) {
+            ASSERT_EQ(nNext, bundle.pKF->id);
+            nNext++;
+        }
+    }
+    producer.join();
+    EXPECT_EQ((unsigned int) nBundles, queue.GetStatistics().nPushed);
+    EXPECT_EQ(0u, queue.GetStatistics().nQueued);
+}
+
+TEST_F(KeyFrameQueueTest, waitEndsWithPush)
+{
+    boost::thread producer(boost::bind(&KeyFrameQueueTest::Produce, this, 1));
+    // Far longer than it takes, unless the push didn't wake us
+    EXPECT_TRUE(queue.Wait(10.0));
+    producer.join();
+
+    KeyFrameBundle bundle;
+    ASSERT_TRUE(queue.Pop(bundle));
+    queue.Wake();
+    EXPECT_FALSE(queue.Wait(10.0));
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,382 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+#include <ptam/KeyFrameStream.h>
+#include <ptam/ImageCodec.h>
+#include <ptam/MapPoint.h>
+#include <ptam/KeyFrame.h>
+#include <ptam/LevelHelpers.h>
+
+#include "Stopwatch.h"
+
+using namespace ptam;
+using namespace TooN;
+
+// A local map of a few keyframes in a row, each the source of some points
+class KeyFrameStreamTest : public testing::Test {
+protected:
+    KeyFrameStreamTest() {
+        for (int k = 0; k < 3; k++)
+            AddKeyFrame(k, 30);
+    }
+
+    void AddKeyFrame(int nId, int nPoints) {
+        boost::shared_ptr<KeyFrame> pKF(new KeyFrame);
+        pKF->id = nId;
+        pKF->se3CfromW = SE3<>(SO3<>(), makeVector(-0.2 * nId, 0.0, 0.0));
+        vpKeyFrames.push_back(pKF);
+        for (int i = 0; i < nPoints; i++) {
+            boost::shared_ptr<MapPoint> p(new MapPoint);
+            p->v3WorldPos = pKF->se3CfromW.inverse() * makeVector(0.01 * i, 0.02 * i - 0.3, 2.0);
+            p->pPatchSourceKF = pKF;
+            p->nSourceLevel = i % LEVELS;
+            p->irCenter = CVD::ImageRef(i, 2 * i);
+            vpPoints.push_back(p);
+        }
+    }
+
+    // Moves keyframe k, and its points along with it
+    void MoveKeyFrame(int k, const SE3<> &se3Delta) {
+        boost::shared_ptr<KeyFrame> pKF = vpKeyFrames[k];
+        SE3<> se3New = se3Delta * pKF->se3CfromW;
+        for (unsigned int i = 0; i < vpPoints.size(); i++)
+            if (vpPoints[i]->pPatchSourceKF.lock() == pKF)
+                vpPoints[i]->v3WorldPos = se3New.inverse() * (pKF->se3CfromW * vpPoints[i]->v3WorldPos);
+        pKF->se3CfromW = se3New;
+    }
+
+    static void ExpectSame(const SE3<> &a, const SE3<> &b) {
+        Vector<6> v6 = (a * b.inverse()).ln();
+        EXPECT_NEAR(0.0, v6 * v6, 1e-20);
+    }
+
+    std::vector<boost::shared_ptr<KeyFrame> > vpKeyFrames;
+    std::vector<boost::shared_ptr<MapPoint> > vpPoints;
+};
+
+TEST_F(KeyFrameStreamTest, firstUpdateHasEverything)
+{
+    KeyFrameStream stream((KeyFrameStream::Params()));
+    boost::shared_ptr<const KeyFrameStream::Update> pUpdate;
+    EXPECT_FALSE(stream.Fetch(pUpdate));
+
+    stream.Collect(vpKeyFrames, vpPoints);
+    ASSERT_TRUE(stream.Fetch(pUpdate));
+    EXPECT_EQ(1u, pUpdate->nSequence);
+    EXPECT_TRUE(pUpdate->bReset);
+    ASSERT_EQ(3u, pUpdate->vAdded.size());
+    EXPECT_TRUE(pUpdate->vPoses.empty());
+    ASSERT_EQ(90u, pUpdate->vPoints.size());
+    EXPECT_TRUE(pUpdate->vnRemovedPoints.empty());
+    EXPECT_TRUE(pUpdate->vnRetiredKeyFrames.empty());
+
+    // The keyframe itself, not a copy
+    EXPECT_EQ(vpKeyFrames[1].get(), pUpdate->vAdded[1].pKF.get());
+    EXPECT_EQ(1, pUpdate->vAdded[1].nId);
+    ExpectSame(vpKeyFrames[1]->se3CfromW, pUpdate->vAdded[1].se3CfromW);
+
+    // Points relative to their keyframe, all with their own id
+    const KeyFrameStream::Point &point = pUpdate->vPoints[35];
+    EXPECT_EQ(1, point.nKeyFrameId);
+    EXPECT_NEAR(0.05, point.v3PosInKF[0], 1e-12);
+    EXPECT_NEAR(2.0, point.v3PosInKF[2], 1e-12);
+    EXPECT_EQ(5 % LEVELS, point.nLevel);
+    Vector<2> v2RootPos = LevelZeroPos(CVD::ImageRef(5, 10), point.nLevel);
+    EXPECT_EQ(v2RootPos[0], point.v2RootPos[0]);
+    EXPECT_EQ(v2RootPos[1], point.v2RootPos[1]);
+    std::vector<unsigned int> vnIds;
+    for (unsigned int i = 0; i < pUpdate->vPoints.size(); i++)
+        vnIds.push_back(pUpdate->vPoints[i].nId);
+    std::sort(vnIds.begin(), vnIds.end());
+    EXPECT_TRUE(std::unique(vnIds.begin(), vnIds.end()) == vnIds.end());
+
+    // Nothing changed, nothing to send
+    stream.Collect(vpKeyFrames, vpPoints);
+    EXPECT_FALSE(stream.Fetch(pUpdate));
+}
+
+// Keyframes with a negative id, and their points, are left out
+TEST_F(KeyFrameStreamTest, unnumberedKeyFrames)
+{
+    vpKeyFrames[0]->id = -1;
+    KeyFrameStream stream((KeyFrameStream::Params()));
+    boost::shared_ptr<const KeyFrameStream::Update> pUpdate;
+    stream.Collect(vpKeyFrames, vpPoints);
+    ASSERT_TRUE(stream.Fetch(pUpdate));
+    EXPECT_EQ(2u, pUpdate->vAdded.size());
+    EXPECT_EQ(60u, pUpdate->vPoints.size());
+}
+
+// A keyframe moved along with its points: only its pose goes out
+TEST_F(KeyFrameStreamTest, poseOnly)
+{
+    KeyFrameStream stream((KeyFrameStream::Params()));
+    boost::shared_ptr<const KeyFrameStream::Update> pUpdate;
+    stream.Collect(vpKeyFrames, vpPoints);
+    ASSERT_TRUE(stream.Fetch(pUpdate));
+
+    MoveKeyFrame(2, SE3<>::exp(makeVector(0.01, -0.02, 0.005, 0.001, 0.002, -0.003)));
+    stream.Collect(vpKeyFrames, vpPoints);
+    ASSERT_TRUE(stream.Fetch(pUpdate));
+    EXPECT_EQ(2u, pUpdate->nSequence);
+    EXPECT_FALSE(pUpdate->bReset);
+    EXPECT_TRUE(pUpdate->vAdded.empty());
+    ASSERT_EQ(1u, pUpdate->vPoses.size());
+    EXPECT_EQ(2, pUpdate->vPoses[0].nId);
+    ExpectSame(vpKeyFrames[2]->se3CfromW, pUpdate->vPoses[0].se3CfromW);
+    EXPECT_TRUE(pUpdate->vPoints.empty());
+
+    // Moves below the thresholds are held back ..
+    MoveKeyFrame(0, SE3<>::exp(makeVector(1e-5, 0.0, 0.0, 0.0, 0.0, 0.0)));
+    stream.Collect(vpKeyFrames, vpPoints);
+    EXPECT_FALSE(stream.Fetch(pUpdate));
+    // .. until they add up
+    for (int i = 0; i < 10; i++)
+        MoveKeyFrame(0, SE3<>::exp(makeVector(1e-5, 0.0, 0.0, 0.0, 0.0, 0.0)));
+    stream.Collect(vpKeyFrames, vpPoints);
+    ASSERT_TRUE(stream.Fetch(pUpdate));
+    ASSERT_EQ(1u, pUpdate->vPoses.size());
+    EXPECT_EQ(0, pUpdate->vPoses[0].nId);
+}
+
+TEST_F(KeyFrameStreamTest, pointDeltas)
+{
+    KeyFrameStream stream((KeyFrameStream::Params()));
+    boost::shared_ptr<const KeyFrameStream::Update> pFirst, pUpdate;
+    stream.Collect(vpKeyFrames, vpPoints);
+    ASSERT_TRUE(stream.Fetch(pFirst));
+
+    // One point moved, one handed to another keyframe, one bad, one new
+    vpPoints[3]->v3WorldPos[2] += 0.01;
+    vpPoints[40]->pPatchSourceKF = vpKeyFrames[2];
+    vpPoints[70]->bBad = true;
+    boost::shared_ptr<MapPoint> pNew(new MapPoint);
+    pNew->v3WorldPos = makeVector(0.0, 0.0, 3.0);
+    pNew->pPatchSourceKF = vpKeyFrames[0];
+    vpPoints.push_back(pNew);
+
+    stream.Collect(vpKeyFrames, vpPoints);
+    ASSERT_TRUE(stream.Fetch(pUpdate));
+    EXPECT_TRUE(pUpdate->vPoses.empty());
+    ASSERT_EQ(3u, pUpdate->vPoints.size());
+    EXPECT_EQ(pFirst->vPoints[3].nId, pUpdate->vPoints[0].nId);
+    EXPECT_NEAR(pFirst->vPoints[3].v3PosInKF[2] + 0.01, pUpdate->vPoints[0].v3PosInKF[2], 1e-12);
+    EXPECT_EQ(pFirst->vPoints[40].nId, pUpdate->vPoints[1].nId);
+    EXPECT_EQ(2, pUpdate->vPoints[1].nKeyFrameId);
+    EXPECT_EQ(0, pUpdate->vPoints[2].nKeyFrameId);
+    ASSERT_EQ(1u, pUpdate->vnRemovedPoints.size());
+    EXPECT_EQ(pFirst->vPoints[70].nId, pUpdate->vnRemovedPoints[0]);
+}
+
+// Destroys a map point, but leaves its memory for the next one
+struct DestroyOnly {
+    void operator()(MapPoint *p) const { p->~MapPoint(); }
+};
+
+// A point erased from the map, and another one made at its address
+TEST_F(KeyFrameStreamTest, pointReplaced)
+{
+    void *pMemory = ::operator new(sizeof(MapPoint));
+    vpPoints[5].reset(new (pMemory) MapPoint, DestroyOnly());
+    vpPoints[5]->v3WorldPos = makeVector(0.0, 0.0, 2.0);
+    vpPoints[5]->pPatchSourceKF = vpKeyFrames[0];
+
+    KeyFrameStream stream((KeyFrameStream::Params()));
+    boost::shared_ptr<const KeyFrameStream::Update> pFirst, pUpdate;
+    stream.Collect(vpKeyFrames, vpPoints);
+    ASSERT_TRUE(stream.Fetch(pFirst));
+
+    vpPoints[5].reset();
+    vpPoints[5].reset(new (pMemory) MapPoint, DestroyOnly());   // As the allocator may well do
+    vpPoints[5]->v3WorldPos = makeVector(0.0, 0.0, 4.0);
+    vpPoints[5]->pPatchSourceKF = vpKeyFrames[0];
+
+    stream.Collect(vpKeyFrames, vpPoints);
+    ASSERT_TRUE(stream.Fetch(pUpdate));
+    ASSERT_EQ(1u, pUpdate->vnRemovedPoints.size());
+    EXPECT_EQ(pFirst->vPoints[5].nId, pUpdate->vnRemovedPoints[0]);
+    ASSERT_EQ(1u, pUpdate->vPoints.size());
+    EXPECT_NE(pFirst->vPoints[5].nId, pUpdate->vPoints[0].nId);
+
+    vpPoints.clear();
+    ::operator delete(pMemory);
+}
+
+TEST_F(KeyFrameStreamTest, retiredKeyFrame)
+{
+    KeyFrameStream stream((KeyFrameStream::Params()));
+    boost::shared_ptr<const KeyFrameStream::Update> pFirst, pUpdate;
+    stream.Collect(vpKeyFrames, vpPoints);
+    ASSERT_TRUE(stream.Fetch(pFirst));
+
+    // Keyframe 0 leaves the local map, but its points are still around for now
+    vpKeyFrames.erase(vpKeyFrames.begin());
+    stream.Collect(vpKeyFrames, vpPoints);
+    ASSERT_TRUE(stream.Fetch(pUpdate));
+    ASSERT_EQ(1u, pUpdate->vnRetiredKeyFrames.size());
+    EXPECT_EQ(0, pUpdate->vnRetiredKeyFrames[0]);
+    EXPECT_EQ(30u, pUpdate->vnRemovedPoints.size());
+    EXPECT_TRUE(pUpdate->vPoints.empty());
+
+    // A new keyframe
+    AddKeyFrame(3, 10);
+    stream.Collect(vpKeyFrames, vpPoints);
+    ASSERT_TRUE(stream.Fetch(pUpdate));
+    ASSERT_EQ(1u, pUpdate->vAdded.size());
+    EXPECT_EQ(3, pUpdate->vAdded[0].nId);
+    EXPECT_EQ(10u, pUpdate->vPoints.size());
+}
+
+// A consumer which doesn't keep up gets everything again, as a reset
+TEST_F(KeyFrameStreamTest, overflow)
+{
+    KeyFrameStream::Params params;
+    params.nMaxQueued = 2;
+    KeyFrameStream stream(params);
+    boost::shared_ptr<const KeyFrameStream::Update> pUpdate;
+    for (int i = 0; i < 3; i++) {
+        MoveKeyFrame(1, SE3<>::exp(makeVector(0.01, 0.0, 0.0, 0.0, 0.0, 0.0)));
+        stream.Collect(vpKeyFrames, vpPoints);
+    }
+    ASSERT_TRUE(stream.Fetch(pUpdate));
+    EXPECT_EQ(3u, pUpdate->nSequence);
+    EXPECT_TRUE(pUpdate->bReset);
+    EXPECT_EQ(3u, pUpdate->vAdded.size());
+    EXPECT_EQ(90u, pUpdate->vPoints.size());
+    EXPECT_FALSE(stream.Fetch(pUpdate));
+
+    // As after a map reset
+    stream.Reset();
+    stream.Collect(vpKeyFrames, vpPoints);
+    ASSERT_TRUE(stream.Fetch(pUpdate));
+    EXPECT_TRUE(pUpdate->bReset);
+    EXPECT_EQ(3u, pUpdate->vAdded.size());
+
+    KeyFrameStream::Statistics statistics = stream.GetStatistics();
+    EXPECT_EQ(4u, statistics.nUpdates);
+    EXPECT_EQ(3u, statistics.nResets);
+    EXPECT_EQ(9u, statistics.nKeyFrames);
+}
+
+// A smooth image with some noise, like a camera's
+template<class T>
+static void MakeImage(CVD::BasicImage<T> &im, int nRange)
+{
+    for (int y = 0; y < im.size().y; y++)
+        for (int x = 0; x < im.size().x; x++)
+            im[y][x] = (T) ((x * 3 + y * 2 + rand() % 4) % nRange);
+}
+
+TEST(ImageCodecTest, roundTrips)
+{
+    srand(5);
+    CVD::Image<CVD::byte> imByte(CVD::ImageRef(161, 120)), imByteOut(imByte.size());
+    CVD::Image<uint16_t> imDepth(CVD::ImageRef(161, 120)), imDepthOut(imDepth.size());
+    CVD::Image<CVD::Rgb<CVD::byte> > imRgb(CVD::ImageRef(161, 120)), imRgbOut(imRgb.size());
+    MakeImage(imByte, 256);
+    MakeImage(imDepth, 8000);
+    for (int y = 0; y < imRgb.size().y; y++)
+        for (int x = 0; x < imRgb.size().x; x++)
+            imRgb[y][x] = CVD::Rgb<CVD::byte>(x, y, x + y);
+
+    ImageCodec::Compression aCompressions[2] = {ImageCodec::COMPRESSION_RAW, ImageCodec::COMPRESSION_DEFLATE};
+    for (int c = 0; c < 2; c++) {
+        std::vector<unsigned char> vData;
+        EXPECT_EQ(aCompressions[c], ImageCodec::Encode(imByte, aCompressions[c], vData));
+        ASSERT_TRUE(ImageCodec::Decode(vData, aCompressions[c], imByteOut));
+        EXPECT_TRUE(std::equal(imByte.begin(), imByte.end(), imByteOut.begin()));
+
+        EXPECT_EQ(aCompressions[c], ImageCodec::Encode(imDepth, aCompressions[c], vData));
+        ASSERT_TRUE(ImageCodec::Decode(vData, aCompressions[c], imDepthOut));
+        EXPECT_TRUE(std::equal(imDepth.begin(), imDepth.end(), imDepthOut.begin()));
+
+        EXPECT_EQ(aCompressions[c], ImageCodec::Encode(imRgb, aCompressions[c], vData));
+        ASSERT_TRUE(ImageCodec::Decode(vData, aCompressions[c], imRgbOut));
+        EXPECT_TRUE(std::equal(imRgb.begin(), imRgb.end(), imRgbOut.begin()));
+        if (c == 1)
+            EXPECT_LT(vData.size(), imRgb.totalsize() * 3u / 10);
+    }
+
+    // Of the wrong size
+    std::vector<unsigned char> vData;
+    ImageCodec::Encode(imByte, ImageCodec::COMPRESSION_DEFLATE, vData);
+    CVD::Image<CVD::byte> imSmaller(CVD::ImageRef(160, 120));
+    EXPECT_FALSE(ImageCodec::Decode(vData, ImageCodec::COMPRESSION_DEFLATE, imSmaller));
+    ImageCodec::Encode(imByte, ImageCodec::COMPRESSION_RAW, vData);
+    EXPECT_FALSE(ImageCodec::Decode(vData, ImageCodec::COMPRESSION_RAW, imSmaller));
+    vData.resize(vData.size() / 2);
+    EXPECT_FALSE(ImageCodec::Decode(vData, ImageCodec::COMPRESSION_DEFLATE, imByteOut));
+}
+
+// Not a pass/fail test: bytes on the wire and time taken for a local map
+// of 20 keyframes, each with a VGA grey and depth image and 300 points,
+// when local BA moves the last few keyframes; every keyframe and point
+// sent after every BA, against the stream's updates.
+TEST(KeyFrameStreamBenchmark, DISABLED_resendAgainstDeltas)
+{
+    const int nKeyFrames = 20, nPoints = 300, nRounds = 50, nWindow = 5;
+    srand(7);
+    CVD::Image<CVD::byte> im(CVD::ImageRef(640, 480));
+    CVD::Image<uint16_t> imDepth(CVD::ImageRef(640, 480));
+    MakeImage(im, 256);
+    MakeImage(imDepth, 8000);
+    std::vector<unsigned char> vData;
+    Stopwatch watch;
+    ImageCodec::Encode(im, ImageCodec::COMPRESSION_DEFLATE, vData);
+    size_t nImageBytes = vData.size();
+    ImageCodec::Encode(imDepth, ImageCodec::COMPRESSION_DEFLATE, vData);
+    nImageBytes += vData.size();
+    double dEncode = watch.Seconds();
+    std::cout << "VGA grey + depth: " << im.totalsize() * 3 << " bytes raw, " << nImageBytes
+              << " deflated in " << dEncode * 1e3 << " ms" << std::endl;
+
+    std::vector<boost::shared_ptr<KeyFrame> > vpKeyFrames;
+    std::vector<boost::shared_ptr<MapPoint> > vpPoints;
+    for (int k = 0; k < nKeyFrames; k++) {
+        boost::shared_ptr<KeyFrame> pKF(new KeyFrame);
+        pKF->id = k;
+        pKF->se3CfromW = SE3<>(SO3<>(), makeVector(-0.2 * k, 0.0, 0.0));
+        vpKeyFrames.push_back(pKF);
+        for (int i = 0; i < nPoints; i++) {
+            boost::shared_ptr<MapPoint> p(new MapPoint);
+            p->v3WorldPos = makeVector(0.2 * k + 0.001 * i, 0.0, 2.0 + 0.001 * i);
+            p->pPatchSourceKF = pKF;
+            vpPoints.push_back(p);
+        }
+    }
+
+    const size_t nPoseBytes = 8 + 7 * 8, nPointBytes = 4 + 8 + 6 * 4;
+    size_t nResendBytes = 0, nDeltaBytes = 0;
+    double dCollect = 0.0;
+    KeyFrameStream stream((KeyFrameStream::Params()));
+    boost::shared_ptr<const KeyFrameStream::Update> pUpdate;
+    for (int r = 0; r < nRounds; r++) {
+        // BA: the window's keyframes move, and its points a little within them
+        for (int k = nKeyFrames - nWindow; k < nKeyFrames; k++)
+            vpKeyFrames[k]->se3CfromW = SE3<>::exp(makeVector(1e-3, 0.0, 0.0, 0.0, 1e-3, 0.0)) * vpKeyFrames[k]->se3CfromW;
+        for (unsigned int i = (nKeyFrames - nWindow) * nPoints; i < vpPoints.size(); i++)
+            vpPoints[i]->v3WorldPos[2] += (rand() % 2) * 1e-3;
+
+        nResendBytes += nKeyFrames * (nImageBytes + nPoseBytes) + vpPoints.size() * nPointBytes;
+        watch.Restart();
+        stream.Collect(vpKeyFrames, vpPoints);
+        dCollect += watch.Seconds();
+        while (stream.Fetch(pUpdate))
+            nDeltaBytes += pUpdate->vAdded.size() * (nImageBytes + nPoseBytes) + pUpdate->vPoses.size() * nPoseBytes +
+                           pUpdate->vPoints.size() * nPointBytes + pUpdate->vnRemovedPoints.size() * 4 +
+                           pUpdate->vnRetiredKeyFrames.size() * 8;
+    }
+    EXPECT_LT(nDeltaBytes, nResendBytes);
+    KeyFrameStream::Statistics statistics = stream.GetStatistics();
+    std::cout << nRounds << " BAs: resend " << nResendBytes / 1024 << " kB, stream " << nDeltaBytes / 1024
+              << " kB (" << statistics.nKeyFrames << " keyframes, " << statistics.nPoses << " poses, "
+              << statistics.nPoints << " points); Collect " << dCollect / nRounds * 1e3 << " ms" << std::endl;
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
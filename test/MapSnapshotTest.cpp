@@ -0,0 +1,184 @@
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <algorithm>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/atomic.hpp>
+
+#include <ptam/Map.h>
+#include <ptam/MapPoint.h>
+#include <ptam/KeyFrame.h>
+
+#include "Stopwatch.h"
+
+using namespace ptam;
+using namespace TooN;
+
+// A map of points all made in one keyframe
+class MapSnapshotTest : public testing::Test {
+public:
+    MapSnapshotTest() : bStop(false) {
+        pKF.reset(new KeyFrame);
+        pKF->id = 7;
+        map.vpKeyFrames.push_back(pKF);
+        for (int i = 0; i < 2000; i++) {
+            boost::shared_ptr<MapPoint> p(new MapPoint);
+            p->v3WorldPos = makeVector(0.0, 0.01 * i, 2.0);
+            p->pPatchSourceKF = pKF;
+            map.vpPoints.push_back(p);
+        }
+        map.bGood = true;
+        map.PublishSnapshot();
+    }
+
+    // Stands in for the mapmaker: every write holds the lock for a while
+    // (bundle adjustment, erasing keyframes) and moves all the points.
+    void Write() {
+        double x = 0.0;
+        while (!bStop) {
+            {
+                boost::unique_lock<boost::shared_mutex> lock(map.mutex);
+                x += 1.0;
+                for (unsigned int i = 0; i < map.vpPoints.size(); i++)
+                    map.vpPoints[i]->v3WorldPos[0] = x;
+                boost::this_thread::sleep(boost::posix_time::milliseconds(3));
+                map.PublishSnapshot();
+            }
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+        }
+    }
+
+protected:
+    Map map;
+    boost::shared_ptr<KeyFrame> pKF;
+    boost::atomic<bool> bStop;
+};
+
+TEST_F(MapSnapshotTest, generationsDontChange)
+{
+    boost::shared_ptr<const MapSnapshot> pOld = map.PinSnapshot();
+    ASSERT_EQ(2000u, pOld->vPoints.size());
+    EXPECT_TRUE(pOld->bGood);
+
+    map.vpPoints[0]->v3WorldPos[0] = 1.0;
+    map.vpPoints[1]->bBad = true;
+    map.vpPoints[2]->mblocked = true;
+    pKF->se3CfromW = SE3<>(SO3<>(), makeVector(0.0, 0.0, 1.0));
+    map.PublishSnapshot();
+    boost::shared_ptr<const MapSnapshot> pNew = map.PinSnapshot();
+
+    EXPECT_EQ(pOld->nGeneration + 1, pNew->nGeneration);
+    EXPECT_EQ(0.0, pOld->vPoints[0].v3WorldPos[0]);
+    EXPECT_EQ(2000u, pOld->vPoints.size());
+    EXPECT_EQ(0.0, pOld->FindKeyFrame(7)->se3CfromW.get_translation()[2]);
+
+    // Bad and blocked points are left out
+    ASSERT_EQ(1998u, pNew->vPoints.size());
+    EXPECT_EQ(1.0, pNew->vPoints[0].v3WorldPos[0]);
+    EXPECT_EQ(map.vpPoints[3], pNew->vPoints[1].pPoint);
+    EXPECT_EQ(1.0, pNew->FindKeyFrame(7)->se3CfromW.get_translation()[2]);
+    EXPECT_TRUE(pNew->FindKeyFrame(8) == NULL);
+}
+
+// A pose graph move reaches the tracker with the snapshot that has the
+// moved keyframes, and is counted so that none is missed
+TEST_F(MapSnapshotTest, rebaseComesWithItsGeneration)
+{
+    boost::shared_ptr<const MapSnapshot> pOld = map.PinSnapshot();
+    EXPECT_EQ(0u, pOld->rebase.nCount);
+
+    {
+        boost::unique_lock<boost::shared_mutex> lock(map.mutex);
+        map.rebase.nKeyFrameId = 7;
+        map.rebase.se3OldCfromW = pKF->se3CfromW;
+        map.rebase.nCount++;
+        pKF->se3CfromW = SE3<>(SO3<>(), makeVector(0.5, 0.0, 0.0));
+        map.PublishSnapshot();
+    }
+    boost::shared_ptr<const MapSnapshot> pNew = map.PinSnapshot();
+
+    EXPECT_EQ(0u, pOld->rebase.nCount);
+    EXPECT_EQ(1u, pNew->rebase.nCount);
+    EXPECT_EQ(7, pNew->rebase.nKeyFrameId);
+    EXPECT_EQ(0.0, pNew->rebase.se3OldCfromW.get_translation()[0]);
+    EXPECT_EQ(0.5, pNew->FindKeyFrame(pNew->rebase.nKeyFrameId)->se3CfromW.get_translation()[0]);
+}
+
+TEST_F(MapSnapshotTest, pinnedGenerationOutlivesMap)
+{
+    boost::shared_ptr<const MapSnapshot> pPinned = map.PinSnapshot();
+    boost::weak_ptr<const MapSnapshot> pUnpinned = map.PinSnapshot();
+    boost::weak_ptr<MapPoint> pPoint = map.vpPoints[0];
+
+    map.EraseAll();
+    pKF.reset();
+    EXPECT_TRUE(map.PinSnapshot()->vPoints.empty());
+
+    // Still there for whoever pinned it
+    EXPECT_FALSE(pPoint.expired());
+    EXPECT_EQ(2000u, pPinned->vPoints.size());
+
+    pPinned.reset();
+    EXPECT_TRUE(pUnpinned.expired());
+    EXPECT_TRUE(pPoint.expired());
+}
+
+// Every generation the tracker pins is all of one write, however the
+// mapmaker's writes fall between the tracker's reads
+TEST_F(MapSnapshotTest, generationsAreWholeWhileWritten)
+{
+    boost::thread writer(boost::bind(&MapSnapshotTest::Write, this));
+    for (int f = 0; f < 100; f++) {
+        boost::shared_ptr<const MapSnapshot> pSnapshot = map.PinSnapshot();
+        ASSERT_EQ(2000u, pSnapshot->vPoints.size());
+        for (unsigned int i = 1; i < pSnapshot->vPoints.size(); i++)
+            ASSERT_EQ(pSnapshot->vPoints[0].v3WorldPos[0], pSnapshot->vPoints[i].v3WorldPos[0]);
+        boost::this_thread::sleep(boost::posix_time::microseconds(500));
+    }
+    bStop = true;
+    writer.join();
+}
+
+// Not a pass/fail test: prints how long the tracker's read of the map takes,
+// through the lock and through a snapshot, while the mapmaker keeps writing
+TEST_F(MapSnapshotTest, DISABLED_contentionBenchmark)
+{
+    boost::thread writer(boost::bind(&MapSnapshotTest::Write, this));
+    const int nFrames = 300;
+    double dLockMean = 0.0, dLockMax = 0.0, dSnapshotMean = 0.0, dSnapshotMax = 0.0;
+    double dSum = 0.0;
+    for (int f = 0; f < nFrames; f++) {
+        Stopwatch watch;
+        {
+            boost::shared_lock<boost::shared_mutex> lock(map.mutex);
+            for (unsigned int i = 0; i < map.vpPoints.size(); i++)
+                dSum += map.vpPoints[i]->v3WorldPos[1];
+        }
+        double dLock = watch.Seconds();
+
+        watch.Restart();
+        boost::shared_ptr<const MapSnapshot> pSnapshot = map.PinSnapshot();
+        for (unsigned int i = 0; i < pSnapshot->vPoints.size(); i++)
+            dSum += pSnapshot->vPoints[i].v3WorldPos[1];
+        double dSnapshot = watch.Seconds();
+
+        dLockMean += dLock / nFrames;
+        dLockMax = std::max(dLockMax, dLock);
+        dSnapshotMean += dSnapshot / nFrames;
+        dSnapshotMax = std::max(dSnapshotMax, dSnapshot);
+        boost::this_thread::sleep(boost::posix_time::microseconds(500));
+    }
+    bStop = true;
+    writer.join();
+
+    EXPECT_GT(dSum, 0.0);
+    std::cout << "Reading 2000 points while the map is written: shared lock "
+              << dLockMean * 1e3 << " ms mean, " << dLockMax * 1e3 << " ms worst; snapshot "
+              << dSnapshotMean * 1e3 << " ms mean, " << dSnapshotMax * 1e3 << " ms worst" << std::endl;
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,217 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <TooN/TooN.h>
+#include <TooN/se3.h>
+#include <gvars3/instances.h>
+#include <cvd/vision.h>
+#include <cvd/fast_corner.h>
+
+#include <ptam/ATANCamera.h>
+#include <ptam/KeyFrame.h>
+#include <ptam/PadDetector.h>
+
+#include "Stopwatch.h"
+
+using namespace ptam;
+using namespace TooN;
+
+// A 0.5 m wide pad lying in the world plane z = 3, seen from above
+class PadDetectorTest : public testing::Test {
+protected:
+    PadDetectorTest() {
+        GVars3::GUI.LoadFile("data/kinect-atan.cfg");
+        camera.reset(new ATANCamera("Camera"));
+        camera->SetImageSize(CVD::ImageRef(640, 480));
+        se3WorldFromPad = SE3<>(SO3<>::exp(makeVector(0.0, 0.0, 0.3)), makeVector(0.2, -0.1, 3.0));
+
+        // Grey blocks of all sizes make for corners and for texture to tell them apart
+        imPad.resize(CVD::ImageRef(320, 240));
+        imPad.fill(128);
+        srand(7);
+        for (int i = 0; i < 150; i++) {
+            int nW = 6 + rand() % 40, nH = 6 + rand() % 40;
+            int nX = rand() % (320 - nW), nY = rand() % (240 - nH);
+            CVD::byte nGrey = 20 + rand() % 216;
+            for (int y = nY; y < nY + nH; y++)
+                for (int x = nX; x < nX + nW; x++)
+                    imPad[y][x] = nGrey;
+        }
+        Make(imPad, kfRef);
+    }
+
+    // Pyramid and FAST corners, as MakeKeyFrame_Lite() makes them
+    static void Make(const CVD::Image<CVD::byte> &im, KeyFrame &kf) {
+        kf.aLevels[0].im.resize(im.size());
+        CVD::copy(im, kf.aLevels[0].im);
+        const int anThreshold[LEVELS] = {20, 18, 14, 12};
+        for (int l = 0; l < LEVELS; l++) {
+            if (l > 0) {
+                kf.aLevels[l].im.resize(kf.aLevels[l-1].im.size() / 2);
+                CVD::halfSample(kf.aLevels[l-1].im, kf.aLevels[l].im);
+            }
+            kf.aLevels[l].vCorners.clear();
+            CVD::fast_corner_detect_10(kf.aLevels[l].im, kf.aLevels[l].vCorners, anThreshold[l]);
+        }
+    }
+
+    // Ray-casts the pad, with noise around it
+    void Render(const SE3<> &se3CamFromWorld, KeyFrame &kf) {
+        CVD::ImageRef irSize(640, 480);
+        CVD::Image<CVD::byte> im(irSize);
+        SE3<> se3PadFromCam = se3WorldFromPad.inverse() * se3CamFromWorld.inverse();
+        Vector<3> v3Centre = se3PadFromCam.get_translation();
+        const double dPixelsPerMetre = imPad.size().x / 0.5;
+        for (int y = 0; y < irSize.y; y++)
+            for (int x = 0; x < irSize.x; x++) {
+                Vector<2> v2ImPlane = camera->UnProject(makeVector(x, y));
+                Vector<3> v3Ray = se3PadFromCam.get_rotation() * makeVector(v2ImPlane[0], v2ImPlane[1], 1.0);
+                Vector<3> v3Pad = v3Centre - (v3Centre[2] / v3Ray[2]) * v3Ray;
+                double u = v3Pad[0] * dPixelsPerMetre + 0.5 * (imPad.size().x - 1);
+                double v = v3Pad[1] * dPixelsPerMetre + 0.5 * (imPad.size().y - 1);
+                if (u >= 0 && v >= 0 && u < imPad.size().x - 1 && v < imPad.size().y - 1) {
+                    int nU = (int) u, nV = (int) v;
+                    double du = u - nU, dv = v - nV;
+                    im[y][x] = (CVD::byte) ((1 - dv) * ((1 - du) * imPad[nV][nU] + du * imPad[nV][nU+1])
+                                            + dv * ((1 - du) * imPad[nV+1][nU] + du * imPad[nV+1][nU+1]) + 0.5);
+                }
+                else
+                    im[y][x] = 100 + ((x * 7919 + y * 104729) >> 3) % 16;
+            }
+        Make(im, kf);
+        kf.se3CfromW = se3CamFromWorld;
+    }
+
+    // A camera a metre (by default) above the pad, tilted and turned about the pad's normal
+    SE3<> CameraPose(double dTurn, double dHeight = 1.0) {
+        SE3<> se3CamFromPad(SO3<>::exp(makeVector(0.15, -0.1, 0.0)) * SO3<>::exp(makeVector(0.0, 0.0, dTurn)),
+                            makeVector(0.03, -0.02, dHeight));
+        return se3CamFromPad * se3WorldFromPad.inverse();
+    }
+
+    void ExpectFound(const PadDetector::Detection &detection) {
+        ASSERT_TRUE(detection.bFound);
+        Vector<3> v3Error = detection.v3CentreWorld - se3WorldFromPad.get_translation();
+        EXPECT_LT(std::sqrt(v3Error * v3Error), 0.01);   // 1 cm
+        const double adX[4] = {-0.25, 0.25, 0.25, -0.25};
+        const double adY[4] = {-0.1875, -0.1875, 0.1875, 0.1875};
+        for (int i = 0; i < 4; i++) {
+            v3Error = detection.av3CornersWorld[i] - se3WorldFromPad * makeVector(adX[i], adY[i], 0.0);
+            EXPECT_LT(std::sqrt(v3Error * v3Error), 0.02);
+        }
+    }
+
+    std::auto_ptr<CameraModel> camera;
+    SE3<> se3WorldFromPad;
+    CVD::Image<CVD::byte> imPad;
+    KeyFrame kfRef, kfFrame;
+};
+
+TEST_F(PadDetectorTest, findsPad)
+{
+    PadDetector detector((PadDetector::Params()));
+    detector.SetReference(kfRef, 0.5);
+    Render(CameraPose(0.2), kfFrame);
+    detector.Post(kfFrame, *camera, 1);
+
+    PadDetector::Detection detection;
+    ASSERT_TRUE(detector.WaitForLatest(0, 5.0, detection));
+    EXPECT_EQ(1, detection.nFrame);
+    ExpectFound(detection);
+}
+
+// Far from any of the reference's turns which are described
+TEST_F(PadDetectorTest, findsTurnedPad)
+{
+    PadDetector detector((PadDetector::Params()));
+    detector.SetReference(kfRef, 0.5);
+    Render(CameraPose(1.8), kfFrame);
+    detector.Post(kfFrame, *camera, 1);
+
+    PadDetector::Detection detection;
+    ASSERT_TRUE(detector.WaitForLatest(0, 5.0, detection));
+    ExpectFound(detection);
+}
+
+// Without level 0, which the worker then doesn't copy; closer, so that
+// the coarser levels have corners enough
+TEST_F(PadDetectorTest, findsPadOnCoarserLevels)
+{
+    PadDetector::Params params;
+    params.nFirstLevel = 1;
+    PadDetector detector(params);
+    detector.SetReference(kfRef, 0.5);
+    Render(CameraPose(0.2, 0.5), kfFrame);
+    detector.Post(kfFrame, *camera, 1);
+
+    PadDetector::Detection detection;
+    ASSERT_TRUE(detector.WaitForLatest(0, 5.0, detection));
+    ExpectFound(detection);
+}
+
+TEST_F(PadDetectorTest, nothingWithoutPad)
+{
+    PadDetector detector((PadDetector::Params()));
+    detector.SetReference(kfRef, 0.5);
+    // Looking away
+    Render(SE3<>::exp(makeVector(0.0, 0.0, 0.0, 1.5, 0.0, 0.0)) * CameraPose(0.0), kfFrame);
+    detector.Post(kfFrame, *camera, 1);
+
+    PadDetector::Detection detection;
+    ASSERT_TRUE(detector.WaitForLatest(0, 5.0, detection));
+    EXPECT_FALSE(detection.bFound);
+}
+
+// Frames posted faster than the worker takes them replace each other
+TEST_F(PadDetectorTest, latestFrameWins)
+{
+    PadDetector detector((PadDetector::Params()));
+    detector.SetReference(kfRef, 0.5);
+    Render(CameraPose(0.2), kfFrame);
+    const int nFrames = 10;
+    for (int i = 1; i <= nFrames; i++)
+        detector.Post(kfFrame, *camera, i);
+
+    PadDetector::Detection detection;
+    unsigned int nSequence = 0;
+    while (detector.WaitForLatest(nSequence, 5.0, detection) && detection.nFrame != nFrames)
+        nSequence = detection.nSequence;
+    EXPECT_EQ(nFrames, detection.nFrame);
+    ExpectFound(detection);
+
+    PadDetector::Statistics stats = detector.GetStatistics();
+    EXPECT_EQ((unsigned int) nFrames, stats.nPosted);
+    EXPECT_EQ(stats.nPosted - stats.nDropped, detection.nSequence);
+    EXPECT_EQ(detection.nSequence, stats.nDetected);
+    EXPECT_GT(stats.nDropped, 0u);
+}
+
+// Not a pass/fail test: prints what posting costs the tracker, and what a detection costs the worker
+TEST_F(PadDetectorTest, DISABLED_benchmark)
+{
+    PadDetector detector((PadDetector::Params()));
+    detector.SetReference(kfRef, 0.5);
+    Render(CameraPose(0.2), kfFrame);
+
+    const int nRuns = 20;
+    double dPost = 0.0, dDetect = 0.0;
+    PadDetector::Detection detection;
+    for (int r = 0; r < nRuns; r++) {
+        Stopwatch watch;
+        detector.Post(kfFrame, *camera, r);
+        dPost += watch.Seconds();
+        ASSERT_TRUE(detector.WaitForLatest(detection.nSequence, 5.0, detection));
+        dDetect += detection.dSeconds;
+    }
+    EXPECT_TRUE(detection.bFound);
+    std::cout << "pad detection: post " << dPost / nRuns * 1e6 << " us, detect "
+              << dDetect / nRuns * 1e3 << " ms, " << detection.nInliers << "/"
+              << detection.nMatches << " inliers" << std::endl;
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
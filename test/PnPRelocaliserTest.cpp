@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <vector>
+#include <TooN/TooN.h>
+#include <TooN/se3.h>
+
+#include <ptam/PnPRelocaliser.h>
+
+using namespace ptam;
+using namespace TooN;
+
+// A keyframe's map points seen again from a nearby pose, with some wrong
+// matches and some corners which aren't map points at all.
+class PnPRelocaliserTest : public testing::Test {
+protected:
+    PnPRelocaliserTest() {
+        srand(42);
+        se3FrameFromTarget = SE3<>::exp(makeVector(0.10, -0.05, 0.08, 0.04, -0.10, 0.03));
+    }
+
+    static double Random() { return rand()/(RAND_MAX+1.0); }
+    static uint64_t RandomWord() {
+        return ((uint64_t) rand() << 40) ^ ((uint64_t) rand() << 20) ^ (uint64_t) rand();
+    }
+
+    void Make(int nPoints, double dOutlierFraction, bool bDepth) {
+        target = PnPRelocaliser::Target();
+        frame = PnPRelocaliser::Frame();
+        frame.dOnePixelDist = 1.0/500.0;
+        for (int i = 0; i < nPoints; i++) {
+            Vector<3> v3Point = makeVector(4*Random() - 2, 3*Random() - 1.5, 2 + 3*Random());
+            target.vv3Points.push_back(v3Point);
+            for (int w = 0; w < PnPRelocaliser::DescriptorWords; w++)
+                target.vnDescriptors.push_back(RandomWord());
+
+            Vector<3> v3Cam = se3FrameFromTarget * v3Point;
+            Vector<2> v2Corner = project(v3Cam);
+            if (Random() < dOutlierFraction)
+                v2Corner = makeVector(Random() - 0.5, Random() - 0.5);
+            frame.vv2Corners.push_back(v2Corner);
+            frame.vdDepths.push_back(bDepth ? v3Cam[2] : 0.0);
+            // Same descriptor, a few bits off
+            for (int w = 0; w < PnPRelocaliser::DescriptorWords; w++)
+                frame.vnDescriptors.push_back(target.vnDescriptors[i*PnPRelocaliser::DescriptorWords + w]
+                                              ^ (1ull << (rand() % 64)));
+        }
+        // Corners without a map point
+        for (int i = 0; i < nPoints/2; i++) {
+            frame.vv2Corners.push_back(makeVector(Random() - 0.5, Random() - 0.5));
+            frame.vdDepths.push_back(bDepth ? 1 + 3*Random() : 0.0);
+            for (int w = 0; w < PnPRelocaliser::DescriptorWords; w++)
+                frame.vnDescriptors.push_back(RandomWord());
+        }
+    }
+
+    void ExpectPose(const SE3<> &se3TargetFromFrame) {
+        Vector<6> v6Error = (se3TargetFromFrame * se3FrameFromTarget).ln();
+        for (int i = 0; i < 6; i++)
+            EXPECT_NEAR(0.0, v6Error[i], 1e-6);
+    }
+
+    SE3<> se3FrameFromTarget;
+    PnPRelocaliser::Target target;
+    PnPRelocaliser::Frame frame;
+    PnPRelocaliser relocaliser;
+};
+
+TEST_F(PnPRelocaliserTest, withDepth)
+{
+    Make(200, 0.3, true);
+    SE3<> se3TargetFromFrame;
+    ASSERT_TRUE(relocaliser.Register(target, frame, 0.5, se3TargetFromFrame));
+    ExpectPose(se3TargetFromFrame);
+}
+
+TEST_F(PnPRelocaliserTest, withoutDepth)
+{
+    Make(200, 0.3, false);
+    SE3<> se3TargetFromFrame;
+    ASSERT_TRUE(relocaliser.Register(target, frame, 0.5, se3TargetFromFrame));
+    ExpectPose(se3TargetFromFrame);
+}
+
+TEST_F(PnPRelocaliserTest, tooFewInliers)
+{
+    Make(200, 0.8, true);
+    SE3<> se3TargetFromFrame;
+    EXPECT_FALSE(relocaliser.Register(target, frame, 0.5, se3TargetFromFrame));
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,170 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+#include <TooN/TooN.h>
+
+#include <ptam/PolygonClassifier.h>
+
+#include "Stopwatch.h"
+
+using namespace ptam;
+using namespace TooN;
+
+// Points spread over a 640x480 image
+class PolygonClassifierTest : public testing::Test {
+protected:
+    PolygonClassifierTest() {
+        srand(3);
+        for (int i = 0; i < 20000; i++)
+            vv2Points.push_back(makeVector(640.0 * rand() / RAND_MAX, 480.0 * rand() / RAND_MAX));
+    }
+
+    // A pad seen at an angle: a convex quadrilateral
+    static std::vector<Vector<2> > Pad() {
+        std::vector<Vector<2> > vv2;
+        vv2.push_back(makeVector(210.3, 120.7));
+        vv2.push_back(makeVector(455.1, 141.2));
+        vv2.push_back(makeVector(430.8, 362.5));
+        vv2.push_back(makeVector(188.6, 330.4));
+        return vv2;
+    }
+
+    // A five-pointed star, not convex
+    static std::vector<Vector<2> > Star() {
+        std::vector<Vector<2> > vv2;
+        for (int i = 0; i < 10; i++) {
+            double dRadius = (i % 2) ? 80.0 : 200.0;
+            double dAngle = M_PI * i / 5.0 + 0.1;
+            vv2.push_back(makeVector(320.0 + dRadius * std::cos(dAngle), 240.0 + dRadius * std::sin(dAngle)));
+        }
+        return vv2;
+    }
+
+    // Select() and Contains() agree with the crossings test, away from the edges
+    void ExpectAgrees(const std::vector<Vector<2> > &vv2Polygon) {
+        PolygonClassifier classifier;
+        classifier.SetPolygon(vv2Polygon);
+        std::vector<int> vnInside;
+        classifier.Select(vv2Points, vnInside);
+        std::vector<bool> vbSelected(vv2Points.size(), false);
+        for (unsigned int i = 0; i < vnInside.size(); i++)
+            vbSelected[vnInside[i]] = true;
+
+        int nInside = 0;
+        for (unsigned int i = 0; i < vv2Points.size(); i++) {
+            if (DistanceToEdges(vv2Polygon, vv2Points[i]) < 1e-3)
+                continue;
+            bool bInside = PolygonClassifier::Crossings(vv2Polygon, vv2Points[i]);
+            nInside += bInside;
+            EXPECT_EQ(bInside, vbSelected[i]) << i;
+            EXPECT_EQ(bInside, classifier.Contains(vv2Points[i])) << i;
+        }
+        EXPECT_GT(nInside, 1000);
+    }
+
+    static double DistanceToEdges(const std::vector<Vector<2> > &vv2Polygon, const Vector<2> &v2) {
+        double dMin = HUGE_VAL;
+        for (unsigned int i = 0; i < vv2Polygon.size(); i++) {
+            Vector<2> v2A = vv2Polygon[i];
+            Vector<2> v2AB = vv2Polygon[(i + 1) % vv2Polygon.size()] - v2A;
+            double t = std::min(std::max(((v2 - v2A) * v2AB) / (v2AB * v2AB), 0.0), 1.0);
+            Vector<2> v2Diff = v2 - (v2A + t * v2AB);
+            dMin = std::min(dMin, std::sqrt(v2Diff * v2Diff));
+        }
+        return dMin;
+    }
+
+    std::vector<Vector<2> > vv2Points;
+};
+
+TEST_F(PolygonClassifierTest, convexPad)
+{
+    PolygonClassifier classifier;
+    classifier.SetPolygon(Pad());
+    EXPECT_TRUE(classifier.IsConvex());
+    ExpectAgrees(Pad());
+
+    // Either way round
+    std::vector<Vector<2> > vv2Reversed = Pad();
+    std::reverse(vv2Reversed.begin(), vv2Reversed.end());
+    classifier.SetPolygon(vv2Reversed);
+    EXPECT_TRUE(classifier.IsConvex());
+    ExpectAgrees(vv2Reversed);
+}
+
+TEST_F(PolygonClassifierTest, star)
+{
+    PolygonClassifier classifier;
+    classifier.SetPolygon(Star());
+    EXPECT_FALSE(classifier.IsConvex());
+    ExpectAgrees(Star());
+}
+
+// The edges of the grid run along the edges of a rectangle
+TEST_F(PolygonClassifierTest, rectangle)
+{
+    std::vector<Vector<2> > vv2;
+    vv2.push_back(makeVector(100.0, 100.0));
+    vv2.push_back(makeVector(500.0, 100.0));
+    vv2.push_back(makeVector(500.0, 400.0));
+    vv2.push_back(makeVector(300.0, 400.0));
+    vv2.push_back(makeVector(300.0, 250.0));   // Notched, so that the grid is used
+    vv2.push_back(makeVector(100.0, 250.0));
+    ExpectAgrees(vv2);
+}
+
+// Crossing itself, so turning the same way everywhere isn't enough for convex
+TEST_F(PolygonClassifierTest, pentagram)
+{
+    std::vector<Vector<2> > vv2;
+    for (int i = 0; i < 5; i++) {
+        double dAngle = 4.0 * M_PI * i / 5.0 + 0.2;
+        vv2.push_back(makeVector(320.0 + 200.0 * std::cos(dAngle), 240.0 + 200.0 * std::sin(dAngle)));
+    }
+    PolygonClassifier classifier;
+    classifier.SetPolygon(vv2);
+    EXPECT_FALSE(classifier.IsConvex());
+    ExpectAgrees(vv2);
+}
+
+// Not a pass/fail test: points per second of the crossings test one point
+// at a time, against Select(), grid building included
+TEST_F(PolygonClassifierTest, DISABLED_benchmark)
+{
+    const int nRuns = 50;
+    std::vector<Vector<2> > avv2Polygons[2] = {Pad(), Star()};
+    const char *apcNames[2] = {"pad", "star"};
+    for (int p = 0; p < 2; p++) {
+        const std::vector<Vector<2> > &vv2Polygon = avv2Polygons[p];
+        int nCrossings = 0;
+        Stopwatch watch;
+        for (int r = 0; r < nRuns; r++)
+            for (unsigned int i = 0; i < vv2Points.size(); i++)
+                nCrossings += PolygonClassifier::Crossings(vv2Polygon, vv2Points[i]);
+        double dCrossings = watch.Seconds();
+
+        PolygonClassifier classifier;
+        std::vector<int> vnInside;
+        int nSelected = 0;
+        watch.Restart();
+        for (int r = 0; r < nRuns; r++) {
+            classifier.SetPolygon(vv2Polygon);
+            vnInside.clear();
+            nSelected += classifier.Select(vv2Points, vnInside);
+        }
+        double dSelect = watch.Seconds();
+        EXPECT_NEAR(nCrossings, nSelected, nRuns * 5);
+
+        double dPoints = (double) nRuns * vv2Points.size();
+        std::cout << apcNames[p] << ": crossings " << dPoints / dCrossings * 1e-6 << " Mpoints/s, select "
+                  << dPoints / dSelect * 1e-6 << " Mpoints/s" << std::endl;
+    }
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,128 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <opencv2/opencv.hpp>
+#include <TooN/TooN.h>
+
+#include <ptam/PolynomialCamera.h>
+
+using namespace ptam;
+
+// Opens up the lookup tables of the camera
+class InspectablePolynomialCamera : public PolynomialCamera {
+public:
+    InspectablePolynomialCamera(const char* file): PolynomialCamera(file) {}
+
+    cv::Mat_<double> LookupX() const { return projLookupX.clone(); }
+    cv::Mat_<double> LookupY() const { return projLookupY.clone(); }
+    double LargestSqRadius() const { return largestSqRadius; }
+    bool Mapped() const { return lookupRegion.get() != NULL; }   // Loaded from the cache
+    void Sweep() { SweepLookupTable(); }
+};
+
+// Each test gets its own copy of the calibration in a directory of its own,
+// so that it starts without a cached lookup table
+class PolynomialCameraTest : public testing::Test {
+protected:
+    PolynomialCameraTest() {
+        char dir[] = "/tmp/PolynomialCameraTestXXXXXX";
+        if (mkdtemp(dir) == NULL)
+            abort();
+        dir_ = dir;
+        file_ = dir_ + "/camera.xml";
+
+        cv::FileStorage fs("data/kinect-poly.xml", cv::FileStorage::READ);
+        fs["M1"] >> cameraMatrix_;
+        fs["D1"] >> distCoeffs_;
+        fs["size"] >> size_;
+        fs.release();
+        WriteCalibration();
+    }
+
+    virtual ~PolynomialCameraTest() {
+        remove(file_.c_str());
+        remove(CacheFile().c_str());
+        rmdir(dir_.c_str());
+    }
+
+    void WriteCalibration() {
+        cv::FileStorage fs(file_, cv::FileStorage::WRITE);
+        fs << "M1" << cv::Mat(cameraMatrix_) << "D1" << cv::Mat(distCoeffs_) << "size" << cv::Mat(size_);
+    }
+
+    std::string CacheFile() const { return file_ + ".lut"; }
+
+    std::string dir_, file_;
+    cv::Mat_<double> cameraMatrix_, distCoeffs_;
+    cv::Mat_<int> size_;
+};
+
+// The table solved by Newton is what the old sweep would have built, to
+// within the sweep's resolution, and inverts the distortion far more exactly
+TEST_F(PolynomialCameraTest, newtonMatchesSweep)
+{
+    InspectablePolynomialCamera camera(file_.c_str());
+    ASSERT_FALSE(camera.Mapped());
+    cv::Mat_<double> newtonX = camera.LookupX(), newtonY = camera.LookupY();
+    double newtonSqRadius = camera.LargestSqRadius();
+
+    // Each entry projects back onto its half pixel, i.e. Newton converged
+    // everywhere and the sweep wasn't needed
+    for (int v = 0; v < newtonX.rows; v++)
+        for (int u = 0; u < newtonX.cols; u++) {
+            TooN::Vector<2> v2Image = camera.ProjectSafe(TooN::makeVector(newtonX(v, u), newtonY(v, u)));
+            ASSERT_NEAR(u / 2.0, v2Image[0], 1e-4);
+            ASSERT_NEAR(v / 2.0, v2Image[1], 1e-4);
+        }
+
+    // The sweep samples the z=1 plane every 5e-4, and takes the sample
+    // nearest to each entry
+    const double tolerance = 1e-3;
+    camera.Sweep();
+    cv::Mat_<double> sweepX = camera.LookupX(), sweepY = camera.LookupY();
+    ASSERT_EQ(newtonX.rows, sweepX.rows);
+    ASSERT_EQ(newtonX.cols, sweepX.cols);
+    for (int v = 0; v < newtonX.rows; v++)
+        for (int u = 0; u < newtonX.cols; u++) {
+            ASSERT_NEAR(sweepX(v, u), newtonX(v, u), tolerance);
+            ASSERT_NEAR(sweepY(v, u), newtonY(v, u), tolerance);
+        }
+    EXPECT_NEAR(sqrt(camera.LargestSqRadius()), sqrt(newtonSqRadius), tolerance);
+}
+
+// The table is cached next to the calibration, reloaded as long as the
+// calibration is the same, and rebuilt once it changes
+TEST_F(PolynomialCameraTest, cachedLookupTable)
+{
+    InspectablePolynomialCamera built(file_.c_str());
+    EXPECT_FALSE(built.Mapped());
+    ASSERT_EQ(0, access(CacheFile().c_str(), R_OK));
+
+    InspectablePolynomialCamera loaded(file_.c_str());
+    EXPECT_TRUE(loaded.Mapped());
+    EXPECT_EQ(0, cv::norm(built.LookupX(), loaded.LookupX(), cv::NORM_INF));
+    EXPECT_EQ(0, cv::norm(built.LookupY(), loaded.LookupY(), cv::NORM_INF));
+    EXPECT_EQ(built.LargestSqRadius(), loaded.LargestSqRadius());
+
+    // A different k_1: the cache is out of date
+    distCoeffs_(0, 0) += 0.01;
+    WriteCalibration();
+    InspectablePolynomialCamera rebuilt(file_.c_str());
+    EXPECT_FALSE(rebuilt.Mapped());
+    EXPECT_GT(cv::norm(built.LookupX(), rebuilt.LookupX(), cv::NORM_INF), 1e-4);
+
+    // ... and has been replaced by the new table
+    InspectablePolynomialCamera reloaded(file_.c_str());
+    EXPECT_TRUE(reloaded.Mapped());
+    EXPECT_EQ(0, cv::norm(rebuilt.LookupX(), reloaded.LookupX(), cv::NORM_INF));
+    EXPECT_EQ(0, cv::norm(rebuilt.LookupY(), reloaded.LookupY(), cv::NORM_INF));
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <vector>
+#include <TooN/TooN.h>
+#include <TooN/se3.h>
+
+#include <ptam/KeyFrame.h>
+#include <ptam/PoseGraph.h>
+
+using namespace ptam;
+using namespace TooN;
+
+// Keyframes on a circle, with edges between neighbours and one loop edge
+// from the last back to the first.
+class PoseGraphTest : public testing::Test {
+protected:
+    PoseGraphTest() {
+        srand(42);
+        for (int i = 0; i < 12; i++) {
+            double dAngle = i * 0.5;
+            SE3<> se3WfromC(SO3<>(makeVector(0.0, dAngle, 0.0)),
+                            makeVector(3*sin(dAngle), 0.0, 3 - 3*cos(dAngle)));
+            truth.push_back(se3WfromC.inverse());
+        }
+    }
+
+    static double Random() { return rand()/(RAND_MAX+1.0) - 0.5; }
+
+    static boost::shared_ptr<Edge> MakeEdge(int a, int b, EdgeType type,
+                                            const SE3<> &se3A, const SE3<> &se3B) {
+        return boost::shared_ptr<Edge>(new Edge(a, b, type, PoseGraph::ToSophus(se3A * se3B.inverse())));
+    }
+
+    // Edges from edgePoses, keyframes posted at postedPoses
+    void Post(const std::vector<SE3<> > &edgePoses, const std::vector<SE3<> > &postedPoses, bool bLoop) {
+        for (unsigned int i = 0; i < truth.size(); i++) {
+            KeyFrame kf;
+            kf.id = i;
+            kf.bFixed = (i == 0);
+            kf.se3CfromW = postedPoses[i];
+            if (i + 1 < truth.size())
+                kf.edges[i+1] = MakeEdge(i, i+1, EDGE_PTAM, edgePoses[i], edgePoses[i+1]);
+            if (bLoop && i + 1 == truth.size())
+                kf.edges[0] = MakeEdge(i, 0, EDGE_LOOP, edgePoses[i], edgePoses[0]);
+            graph.AddKeyFrame(kf);
+        }
+        graph.Flush();
+        graph.WaitUntilIdle();
+    }
+
+    std::vector<SE3<> > truth;
+    PoseGraph graph;
+};
+
+TEST_F(PoseGraphTest, closesLoop)
+{
+    // Consistent edges, but the keyframes were posted where drift left them
+    std::vector<SE3<> > drifted(truth);
+    for (unsigned int i = 1; i < truth.size(); i++)
+        drifted[i] = truth[i] * SE3<>::exp(makeVector(Random(), Random(), Random(),
+                                                      Random(), Random(), Random()) * 0.02 * i);
+    Post(truth, drifted, true);
+
+    PoseGraph::Corrections corrections;
+    ASSERT_TRUE(graph.FetchCorrections(corrections));
+    EXPECT_EQ(1, corrections.nGeneration);
+    EXPECT_EQ((int) truth.size(), (int) corrections.vCorrections.size());
+    for (unsigned int i = 0; i < corrections.vCorrections.size(); i++) {
+        const PoseGraph::Correction &c = corrections.vCorrections[i];
+        Vector<6> v6Old = (c.se3OldCfromW * drifted[c.nId].inverse()).ln();
+        Vector<6> v6New = (c.se3NewCfromW * truth[c.nId].inverse()).ln();
+        for (int j = 0; j < 6; j++) {
+            EXPECT_NEAR(0.0, v6Old[j], 1e-9);
+            EXPECT_NEAR(0.0, v6New[j], 1e-6);
+        }
+    }
+    EXPECT_FALSE(graph.FetchCorrections(corrections));
+}
+
+TEST_F(PoseGraphTest, chainNeedsNoCorrection)
+{
+    // What local BA sends: edges made from the very poses posted
+    Post(truth, truth, false);
+    PoseGraph::Corrections corrections;
+    EXPECT_FALSE(graph.FetchCorrections(corrections));
+    SE3<> se3;
+    ASSERT_TRUE(graph.GetPose(5, se3));
+    Vector<6> v6 = (se3 * truth[5].inverse()).ln();
+    for (int j = 0; j < 6; j++)
+        EXPECT_NEAR(0.0, v6[j], 1e-9);
+}
+
+TEST_F(PoseGraphTest, keyframesLeftInPlaceAreCorrectedToo)
+{
+    // Only the last keyframe is off; the gauge and its neighbours stay put
+    std::vector<SE3<> > drifted(truth);
+    drifted.back() = truth.back() * SE3<>::exp(makeVector(0.2, 0.0, 0.0, 0.0, 0.1, 0.0));
+    Post(truth, drifted, false);
+
+    PoseGraph::Corrections corrections;
+    ASSERT_TRUE(graph.FetchCorrections(corrections));
+    ASSERT_EQ((int) truth.size(), (int) corrections.vCorrections.size());
+    for (unsigned int i = 0; i < corrections.vCorrections.size(); i++) {
+        const PoseGraph::Correction &c = corrections.vCorrections[i];
+        EXPECT_EQ((int) i, c.nId);
+        Vector<6> v6Moved = (c.se3NewCfromW * c.se3OldCfromW.inverse()).ln();
+        if (c.nId + 1 < (int) truth.size())
+            for (int j = 0; j < 6; j++)
+                EXPECT_NEAR(0.0, v6Moved[j], 1e-6);
+        else
+            EXPECT_GT(v6Moved * v6Moved, 1e-3);
+    }
+}
+
+TEST_F(PoseGraphTest, reset)
+{
+    std::vector<SE3<> > drifted(truth);
+    drifted.back() = truth.back() * SE3<>::exp(makeVector(0.2, 0.0, 0.0, 0.0, 0.1, 0.0));
+    Post(truth, drifted, true);
+    graph.Reset();
+    graph.WaitUntilIdle();
+    PoseGraph::Corrections corrections;
+    EXPECT_FALSE(graph.FetchCorrections(corrections));
+    SE3<> se3;
+    EXPECT_FALSE(graph.GetPose(0, se3));
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
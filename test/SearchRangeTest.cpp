@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <TooN/TooN.h>
+
+#include <ptam/SearchRange.h>
+
+using namespace ptam;
+using namespace TooN;
+
+// A Jacobian that maps the translation straight onto the image, so that
+// J C J^T is the top left 2x2 block of C
+static Matrix<2,6> TranslationJacobian()
+{
+    Matrix<2,6> m26J = Zeros;
+    m26J(0, 0) = 1;
+    m26J(1, 1) = 1;
+    return m26J;
+}
+
+TEST(SearchRangeTest, isotropic)
+{
+    // 2 pixels' standard deviation in x and y: 3 sigmas is 6 pixels
+    Matrix<6> m6C = Identity * 4.0;
+    EXPECT_EQ(6, SearchRange::Radius(TranslationJacobian(), m6C, 3.0, 1));
+    // Rounded up
+    EXPECT_EQ(5, SearchRange::Radius(TranslationJacobian(), m6C, 2.1, 1));
+    // Only the rows of J count: the rotation's variance doesn't move the point
+    m6C(5, 5) = 1e6;
+    EXPECT_EQ(6, SearchRange::Radius(TranslationJacobian(), m6C, 3.0, 1));
+}
+
+TEST(SearchRangeTest, elongated)
+{
+    // Along x, 5 pixels' standard deviation; along y, 1
+    Matrix<6> m6C = Identity;
+    m6C(0, 0) = 25;
+    EXPECT_EQ(15, SearchRange::Radius(TranslationJacobian(), m6C, 3.0, 1));
+
+    // The same ellipse, turned 45 degrees: it is the largest eigenvalue
+    // that counts, not the variance along either image axis
+    double dHalf = 0.5 * (25 - 1);
+    m6C(0, 0) = m6C(1, 1) = 0.5 * (25 + 1);
+    m6C(0, 1) = m6C(1, 0) = dHalf;
+    EXPECT_EQ(15, SearchRange::Radius(TranslationJacobian(), m6C, 3.0, 1));
+
+    // Scaling J scales the radius
+    EXPECT_EQ(30, SearchRange::Radius(TranslationJacobian() * 2.0, m6C, 3.0, 1));
+}
+
+TEST(SearchRangeTest, clampsToMinimum)
+{
+    Matrix<6> m6C = Identity * 1e-6;
+    EXPECT_EQ(3, SearchRange::Radius(TranslationJacobian(), m6C, 3.0, 3));
+    m6C = Zeros;
+    EXPECT_EQ(3, SearchRange::Radius(TranslationJacobian(), m6C, 3.0, 3));
+    // Above the minimum, it has no effect
+    m6C = Identity * 4.0;
+    EXPECT_EQ(6, SearchRange::Radius(TranslationJacobian(), m6C, 3.0, 3));
+}
+
+TEST(SearchRangeTest, predictedCovariance)
+{
+    Matrix<6> m6Last = Identity * 1e-4;
+    m6Last(0, 1) = m6Last(1, 0) = 5e-5;
+
+    // Standing still: the per frame noise only, on the diagonal
+    Matrix<6> m6C = SearchRange::PredictPoseCovariance(m6Last, Zeros, 0.01, 0.02, 0.3);
+    for (int i = 0; i < 3; i++)
+    {
+        EXPECT_NEAR(1e-4 + 0.01 * 0.01, m6C(i, i), 1e-12);
+        EXPECT_NEAR(1e-4 + 0.02 * 0.02, m6C(i + 3, i + 3), 1e-12);
+    }
+    EXPECT_DOUBLE_EQ(5e-5, m6C(0, 1));
+    EXPECT_DOUBLE_EQ(5e-5, m6C(1, 0));
+
+    // Moving: a share of the length of each half of the velocity on top
+    Vector<6> v6Velocity = makeVector(0.03, 0, 0.04, 0, 0.1, 0);
+    m6C = SearchRange::PredictPoseCovariance(m6Last, v6Velocity, 0.01, 0.02, 0.3);
+    double dTrans = 0.01 + 0.3 * 0.05;
+    double dRot = 0.02 + 0.3 * 0.1;
+    for (int i = 0; i < 3; i++)
+    {
+        EXPECT_NEAR(1e-4 + dTrans * dTrans, m6C(i, i), 1e-12);
+        EXPECT_NEAR(1e-4 + dRot * dRot, m6C(i + 3, i + 3), 1e-12);
+    }
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
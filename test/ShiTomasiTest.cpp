@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <iostream>
+#include <cvd/image.h>
+
+#include <ptam/ShiTomasi.h>
+
+#include "Stopwatch.h"
+
+using namespace ptam;
+
+class ShiTomasiTest : public testing::Test {
+protected:
+    ShiTomasiTest() {
+        srand(7);
+        im.resize(CVD::ImageRef(640, 480));
+        for (int y = 0; y < im.size().y; y++)
+            for (int x = 0; x < im.size().x; x++)
+                im[y][x] = (CVD::byte) (128 + 60*sin(x*0.3) * cos(y*0.17) + rand()%80 - 40);
+    }
+
+    CVD::Image<CVD::byte> im;
+};
+
+TEST_F(ShiTomasiTest, matchesPointwise)
+{
+    std::vector<CVD::ImageRef> vir;
+    for (int i = 0; i < 2000; i++)
+        vir.push_back(CVD::ImageRef(10 + rand() % 620, 10 + rand() % 460));
+    // Right at the border, where only the plain loop may run
+    vir.push_back(CVD::ImageRef(6, 6));
+    vir.push_back(CVD::ImageRef(633, 473));
+    vir.push_back(CVD::ImageRef(629, 100));
+
+    for (int nHalfBoxSize = 1; nHalfBoxSize <= 4; nHalfBoxSize++) {
+        std::vector<double> vdScores;
+        FindShiTomasiScores(im, nHalfBoxSize, vir, vdScores);
+        ASSERT_EQ(vir.size(), vdScores.size());
+        for (unsigned int i = 0; i < vir.size(); i++)
+            ASSERT_EQ(FindShiTomasiScoreAtPoint(im, nHalfBoxSize, vir[i]), vdScores[i]);
+    }
+}
+
+// Not a pass/fail test: prints the time for a level's worth of corners
+TEST_F(ShiTomasiTest, DISABLED_benchmark)
+{
+    std::vector<CVD::ImageRef> vir;
+    for (int i = 0; i < 3000; i++)
+        vir.push_back(CVD::ImageRef(10 + rand() % 620, 10 + rand() % 460));
+    const int nRuns = 100;
+    std::vector<double> vdScores;
+    double dSum = 0.0;
+
+    Stopwatch watch;
+    for (int r = 0; r < nRuns; r++)
+        for (unsigned int i = 0; i < vir.size(); i++)
+            dSum += FindShiTomasiScoreAtPoint(im, 3, vir[i]);
+    double dPointwise = watch.Seconds() / nRuns;
+
+    watch.Restart();
+    for (int r = 0; r < nRuns; r++) {
+        FindShiTomasiScores(im, 3, vir, vdScores);
+        dSum += vdScores[r];
+    }
+    double dBatch = watch.Seconds() / nRuns;
+
+    EXPECT_GT(dSum, 0.0);
+    std::cout << vir.size() << " corners: " << dPointwise * 1e3 << " ms point by point, "
+              << dBatch * 1e3 << " ms batched" << std::endl;
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
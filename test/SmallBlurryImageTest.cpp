@@ -0,0 +1,189 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <iostream>
+#include <TooN/TooN.h>
+#include <TooN/se2.h>
+#include <TooN/Cholesky.h>
+#include <cvd/vision.h>
+
+#include <ptam/KeyFrame.h>
+#include <ptam/SmallBlurryImage.h>
+
+#include "Stopwatch.h"
+
+using namespace ptam;
+using namespace TooN;
+
+// Keeps the alignment as it was before it was fused, to compare against
+class ReferenceSBI : public SmallBlurryImage {
+public:
+    ReferenceSBI(KeyFrame &kf) : SmallBlurryImage(kf, 0.75) {}
+
+    void MakeReferenceJacs() {
+        MakeJacs();
+        mimImageJacs.resize(mimTemplate.size());
+        CVD::ImageRef ir;
+        do {
+            mimImageJacs[ir][0] = mimJacX[ir];
+            mimImageJacs[ir][1] = mimJacY[ir];
+        } while (ir.next(mimTemplate.size()));
+    }
+
+    std::pair<SE2<>, double> ReferenceIterate(ReferenceSBI &other, int nIterations) {
+        CVD::ImageRef irSize = mimTemplate.size();
+        SE2<> se2CtoC;
+        SE2<> se2WfromC;
+        CVD::ImageRef irCenter = irSize / 2;
+        se2WfromC.get_translation() = vec(irCenter);
+        double dMeanOffset = 0.0;
+        CVD::Image<float> imWarped(irSize);
+        double dFinalScore = 0.0;
+        for (int it = 0; it < nIterations; it++) {
+            dFinalScore = 0.0;
+            Vector<4> v4Accum = Zeros;
+            Vector<10> v10Triangle = Zeros;
+            Vector<4> v4Jac;
+            v4Jac[3] = 1.0;
+            SE2<> se2XForm = se2WfromC * se2CtoC * se2WfromC.inverse();
+            Vector<2> v2Zero = Zeros;
+            CVD::transform(mimTemplate, imWarped, se2XForm.get_rotation().get_matrix(), se2XForm.get_translation(), v2Zero, -9e20f);
+            CVD::ImageRef ir;
+            do {
+                if (!imWarped.in_image_with_border(ir, 1))
+                    continue;
+                float l = imWarped[ir - CVD::ImageRef(1,0)];
+                float r = imWarped[ir + CVD::ImageRef(1,0)];
+                float u = imWarped[ir - CVD::ImageRef(0,1)];
+                float d = imWarped[ir + CVD::ImageRef(0,1)];
+                float here = imWarped[ir];
+                if (l + r + u + d + here < -9999.9)
+                    continue;
+                Vector<2> v2CurrentGrad = makeVector(r - l, d - u);
+                Vector<2> v2SumGrad = 0.25 * (v2CurrentGrad + other.mimImageJacs[ir]);
+                v4Jac[0] = v2SumGrad[0];
+                v4Jac[1] = v2SumGrad[1];
+                v4Jac[2] = -(ir.y - irCenter.y) * v2SumGrad[0] + (ir.x - irCenter.x) * v2SumGrad[1];
+                double dDiff = imWarped[ir] - other.mimTemplate[ir] + dMeanOffset;
+                dFinalScore += dDiff * dDiff;
+                v4Accum += dDiff * v4Jac;
+                double *p = &v10Triangle[0];
+                *p++ += v4Jac[0] * v4Jac[0];
+                *p++ += v4Jac[1] * v4Jac[0];
+                *p++ += v4Jac[1] * v4Jac[1];
+                *p++ += v4Jac[2] * v4Jac[0];
+                *p++ += v4Jac[2] * v4Jac[1];
+                *p++ += v4Jac[2] * v4Jac[2];
+                *p++ += v4Jac[0];
+                *p++ += v4Jac[1];
+                *p++ += v4Jac[2];
+                *p++ += 1.0;
+            } while (ir.next(irSize));
+            Matrix<4> m4;
+            int v = 0;
+            for (int j = 0; j < 4; j++)
+                for (int i = 0; i <= j; i++)
+                    m4[j][i] = m4[i][j] = v10Triangle[v++];
+            Cholesky<4> chol(m4);
+            Vector<4> v4Update = chol.backsub(v4Accum);
+            SE2<> se2Update;
+            se2Update.get_translation() = -v4Update.slice<0,2>();
+            se2Update.get_rotation() = SO2<>::exp(-v4Update[2]);
+            se2CtoC = se2CtoC * se2Update;
+            dMeanOffset -= v4Update[3];
+        }
+        return std::make_pair(se2CtoC, dFinalScore);
+    }
+
+    const float *TemplateData() const { return mimTemplate.data(); }
+
+private:
+    CVD::Image<Vector<2> > mimImageJacs;
+};
+
+// Two frames of a textured scene, the second turned and shifted in the image
+class SmallBlurryImageTest : public testing::Test {
+protected:
+    SmallBlurryImageTest() {
+        Render(SE2<>(), kfTarget);
+        Render(SE2<>(SO2<>::exp(0.06), makeVector(3.0, -2.0)), kfCurrent);
+    }
+
+    static double Texture(double x, double y) {
+        return 128 + 50*sin(0.3*x)*cos(0.4*y) + 30*sin(0.7*x + 0.2*y) + 20*cos(0.9*y - 0.5*x);
+    }
+
+    // Level 3 of a 640x480 frame, about its centre
+    static void Render(const SE2<> &se2Motion, KeyFrame &kf) {
+        CVD::ImageRef irSize(80, 60);
+        kf.aLevels[3].im.resize(irSize);
+        CVD::ImageRef ir;
+        do {
+            Vector<2> v2 = se2Motion * (vec(ir) - makeVector(40.0, 30.0));
+            kf.aLevels[3].im[ir] = (CVD::byte) Texture(v2[0], v2[1]);
+        } while (ir.next(irSize));
+    }
+
+    KeyFrame kfTarget, kfCurrent;
+};
+
+TEST_F(SmallBlurryImageTest, matchesReference)
+{
+    ReferenceSBI target(kfTarget), current(kfCurrent);
+    target.MakeReferenceJacs();
+    std::pair<SE2<>, double> fused = current.IteratePosRelToTarget(target, 6);
+    std::pair<SE2<>, double> reference = current.ReferenceIterate(target, 6);
+
+    Vector<3> v3Diff = (fused.first * reference.first.inverse()).ln();
+    EXPECT_NEAR(0.0, v3Diff[0], 1e-3);
+    EXPECT_NEAR(0.0, v3Diff[1], 1e-3);
+    EXPECT_NEAR(0.0, v3Diff[2], 1e-4);
+    EXPECT_NEAR(reference.second, fused.second, 1e-3 * reference.second + 1e-3);
+}
+
+TEST_F(SmallBlurryImageTest, alignsFrames)
+{
+    ReferenceSBI target(kfTarget), current(kfCurrent);
+    target.MakeJacs();
+    double dStartScore = current.IteratePosRelToTarget(target, 1).second;
+    std::pair<SE2<>, double> result = current.IteratePosRelToTarget(target, 10);
+    EXPECT_LT(result.second, 0.1 * dStartScore);
+    // At half the size of level 3, the turn is seen as it is
+    EXPECT_NEAR(0.06, std::fabs(result.first.get_rotation().ln()), 0.01);
+}
+
+TEST_F(SmallBlurryImageTest, reusesBuffers)
+{
+    ReferenceSBI sbi(kfTarget);
+    const float *pTemplate = sbi.TemplateData();
+    sbi.MakeFromKF(kfCurrent, 0.75);
+    EXPECT_EQ(pTemplate, sbi.TemplateData());
+}
+
+// Not a pass/fail test: prints the time of an alignment of 6 iterations
+TEST_F(SmallBlurryImageTest, DISABLED_benchmark)
+{
+    ReferenceSBI target(kfTarget), current(kfCurrent);
+    target.MakeReferenceJacs();
+    const int nRuns = 2000;
+    double dScore = 0.0;
+
+    Stopwatch watch;
+    for (int r = 0; r < nRuns; r++)
+        dScore += current.ReferenceIterate(target, 6).second;
+    double dReference = watch.Seconds() / nRuns;
+
+    watch.Restart();
+    for (int r = 0; r < nRuns; r++)
+        dScore += current.IteratePosRelToTarget(target, 6).second;
+    double dFused = watch.Seconds() / nRuns;
+
+    EXPECT_GT(dScore, 0.0);
+    std::cout << "SBI alignment: reference " << dReference * 1e6 << " us, fused "
+              << dFused * 1e6 << " us" << std::endl;
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <vector>
+#include <iostream>
+#include <TooN/TooN.h>
+#include <TooN/Cholesky.h>
+
+#include <ptam/SparseBlockCholesky.h>
+
+#include "Stopwatch.h"
+
+using namespace ptam;
+
+// Reduced camera systems as the bundle adjuster sees them: every keyframe
+// shares points with the few keyframes before it, plus the odd loop closure.
+class SparseBlockCholeskyTest : public testing::Test {
+protected:
+    SparseBlockCholeskyTest() { srand(42); }
+
+    static double Random() { return rand()/(RAND_MAX+1.0) - 0.5; }
+
+    void MakePattern(int nBlocks, std::vector<std::pair<int, int> > &pattern) {
+        pattern.clear();
+        for (int j = 0; j < nBlocks; j++)
+            for (int k = std::max(0, j-4); k < j; k++)
+                pattern.push_back(std::make_pair(j, k));
+        for (int j = 10; j < nBlocks; j += 25)
+            pattern.push_back(std::make_pair(j, rand() % (j-5)));
+    }
+
+    // Fills solver and dense with the same random, diagonally dominant matrix
+    void Fill(int nBlocks, const std::vector<std::pair<int, int> > &pattern,
+              SparseBlockCholesky &solver, TooN::Matrix<> *dense) {
+        solver.Clear();
+        if (dense)
+            *dense = TooN::Zeros;
+        for (unsigned int i = 0; i < pattern.size(); i++) {
+            int j = pattern[i].first, k = pattern[i].second;
+            bool transposed;
+            TooN::Matrix<6> &block = *solver.Block(j, k, transposed);
+            for (int r = 0; r < 6; r++)
+                for (int c = 0; c < 6; c++) {
+                    double v = Random();
+                    if (transposed)
+                        block[c][r] += v;
+                    else
+                        block[r][c] += v;
+                    if (dense) {
+                        (*dense)[j*6+r][k*6+c] += v;
+                        (*dense)[k*6+c][j*6+r] += v;
+                    }
+                }
+        }
+        for (int j = 0; j < nBlocks; j++) {
+            TooN::Matrix<6> &block = *solver.DiagonalBlock(j);
+            for (int r = 0; r < 6; r++)
+                for (int c = 0; c <= r; c++) {
+                    double v = (r == c) ? 60.0 : Random();
+                    block[r][c] = block[c][r] = v;
+                    if (dense)
+                        (*dense)[j*6+r][j*6+c] = (*dense)[j*6+c][j*6+r] = v;
+                }
+        }
+    }
+};
+
+TEST_F(SparseBlockCholeskyTest, matchesDenseSolve)
+{
+    const int nBlocks = 60;
+    std::vector<std::pair<int, int> > pattern;
+    MakePattern(nBlocks, pattern);
+
+    SparseBlockCholesky solver;
+    solver.Analyse(nBlocks, pattern);
+    TooN::Matrix<> dense(nBlocks*6, nBlocks*6);
+    Fill(nBlocks, pattern, solver, &dense);
+
+    TooN::Vector<> b(nBlocks*6);
+    for (int i = 0; i < b.size(); i++)
+        b[i] = Random();
+
+    ASSERT_TRUE(solver.Factorise());
+    TooN::Vector<> x = solver.Solve(b);
+    TooN::Vector<> expected = TooN::Cholesky<>(dense).backsub(b);
+    for (int i = 0; i < b.size(); i++)
+        EXPECT_NEAR(expected[i], x[i], 1e-9);
+}
+
+TEST_F(SparseBlockCholeskyTest, notPositiveDefinite)
+{
+    std::vector<std::pair<int, int> > pattern;
+    pattern.push_back(std::make_pair(1, 0));
+    SparseBlockCholesky solver;
+    solver.Analyse(2, pattern);
+    *solver.DiagonalBlock(0) = TooN::Identity;
+    *solver.DiagonalBlock(1) = -1.0 * TooN::Identity;
+    EXPECT_FALSE(solver.Factorise());
+}
+
+// Not a pass/fail test: prints how the sparse solve scales with the number
+// of keyframes, next to the dense solve used before (while that is bearable).
+TEST_F(SparseBlockCholeskyTest, DISABLED_benchmark)
+{
+    const int sizes[] = {10, 30, 100, 300, 1000};
+    for (unsigned int n = 0; n < sizeof(sizes)/sizeof(sizes[0]); n++) {
+        const int nBlocks = sizes[n];
+        std::vector<std::pair<int, int> > pattern;
+        MakePattern(nBlocks, pattern);
+
+        SparseBlockCholesky solver;
+        Stopwatch watch;
+        solver.Analyse(nBlocks, pattern);
+        double analyseTime = watch.Seconds();
+
+        const bool withDense = nBlocks <= 300;
+        TooN::Matrix<> dense(withDense ? nBlocks*6 : 0, withDense ? nBlocks*6 : 0);
+        Fill(nBlocks, pattern, solver, withDense ? &dense : NULL);
+        TooN::Vector<> b(nBlocks*6);
+        for (int i = 0; i < b.size(); i++)
+            b[i] = Random();
+
+        watch.Restart();
+        ASSERT_TRUE(solver.Factorise());
+        TooN::Vector<> x = solver.Solve(b);
+        double sparseTime = watch.Seconds();
+
+        std::cout << nBlocks << " keyframes: analyse " << 1e3*analyseTime
+                  << " ms, sparse solve " << 1e3*sparseTime << " ms ("
+                  << solver.NumBlocks() << " blocks)";
+        if (withDense) {
+            watch.Restart();
+            TooN::Vector<> expected = TooN::Cholesky<>(dense).backsub(b);
+            std::cout << ", dense solve " << 1e3*watch.Seconds() << " ms";
+        }
+        std::cout << std::endl;
+    }
+}
+
+int main(int argc, char **argv){
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
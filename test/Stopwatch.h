@@ -0,0 +1,22 @@
+// -*- c++ -*-
+//
+// Stopwatch - wall-clock timing for the benchmarks among the tests. These
+// only print, so they are all named DISABLED_ and stay out of a normal run.
+
+#ifndef __STOPWATCH_H
+#define __STOPWATCH_H
+#include <cvd/timer.h>
+
+class Stopwatch
+{
+public:
+  Stopwatch() : mdStart(CVD::timer.get_time()) {}
+
+  void Restart() { mdStart = CVD::timer.get_time(); }
+  double Seconds() const { return CVD::timer.get_time() - mdStart; }   // Since construction or Restart()
+
+private:
+  double mdStart;
+};
+
+#endif